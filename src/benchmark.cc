@@ -0,0 +1,31 @@
+#include "benchmark.hh"
+
+#include "clock.hh"
+#include "file.hh"
+#include "ranges.hh"
+#include "string_utils.hh"
+#include "vector.hh"
+
+namespace Kakoune
+{
+
+Benchmark* Benchmark::list = nullptr;
+
+void Benchmark::run_all_benchmarks()
+{
+    // the intrusive list is built in reverse registration order
+    Vector<const Benchmark*> benchmarks;
+    for (const Benchmark* bench = list; bench; bench = bench->next)
+        benchmarks.push_back(bench);
+
+    for (auto& bench : benchmarks | reverse())
+    {
+        const auto start = Clock::now();
+        bench->func();
+        const auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+            Clock::now() - start);
+        write(1, format("{}: {} us\n", bench->name, (size_t)elapsed.count()));
+    }
+}
+
+}
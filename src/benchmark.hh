@@ -0,0 +1,26 @@
+#ifndef benchmark_hh_INCLUDED
+#define benchmark_hh_INCLUDED
+
+namespace Kakoune
+{
+
+// Microbenchmarks living next to the code they measure, registered the
+// same way as UnitTest blocks; `kak -bench` (or `make bench`) runs them
+// in registration order and prints one timing line each. Workloads are
+// fixed so the output can be diffed between commits.
+struct Benchmark
+{
+    Benchmark(const char* name, void (*func)())
+        : name{name}, func{func}, next{list} { list = this; }
+
+    const char* name;
+    void (*func)();
+    const Benchmark* next;
+
+    static void run_all_benchmarks();
+    static Benchmark* list;
+};
+
+}
+
+#endif // benchmark_hh_INCLUDED
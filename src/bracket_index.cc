@@ -0,0 +1,172 @@
+#include "bracket_index.hh"
+
+#include "line_modification.hh"
+#include "unit_tests.hh"
+#include "value.hh"
+
+namespace Kakoune
+{
+
+static bool is_bracket(char c)
+{
+    return c == '(' or c == ')' or c == '{' or c == '}' or
+           c == '[' or c == ']' or c == '<' or c == '>';
+}
+
+bool BracketIndex::is_indexed(char c)
+{
+    return is_bracket(c);
+}
+
+BracketIndex::BracketIndex(const Buffer& buffer)
+    : m_buffer{&buffer}
+{
+    rebuild();
+}
+
+BracketIndex& BracketIndex::get(const Buffer& buffer)
+{
+    static const ValueId id = get_free_value_id();
+    Value& value = buffer.values()[id];
+    if (not value)
+        value = Value(BracketIndex{buffer});
+    return value.as<BracketIndex>();
+}
+
+void BracketIndex::index_line(LineCount line, EntryList& entries) const
+{
+    const StringView content = (*m_buffer)[line];
+    for (ByteCount byte = 0, len = content.length(); byte < len; ++byte)
+        if (is_bracket(content[byte]))
+            entries.push_back({{line, byte}, content[byte]});
+}
+
+void BracketIndex::rebuild()
+{
+    auto& buffer = *m_buffer;
+    m_entries.clear();
+    for (auto line = 0_line, end = buffer.line_count(); line < end; ++line)
+        index_line(line, m_entries);
+    m_timestamp = buffer.timestamp();
+}
+
+void BracketIndex::update()
+{
+    auto& buffer = *m_buffer;
+    if (buffer.timestamp() == m_timestamp)
+        return;
+
+    auto modifs = compute_line_modifications(buffer, m_timestamp);
+    m_timestamp = buffer.timestamp();
+    if (modifs.empty())
+        return;
+
+    // rescanning everything is cheaper than splicing once most of the
+    // buffer changed
+    size_t touched = 0;
+    for (auto& modif : modifs)
+        touched += (size_t)(int)std::max(modif.num_removed, modif.num_added);
+    if (touched * 2 >= (size_t)(int)buffer.line_count())
+        return rebuild();
+
+    // splice the entry list: entries on removed lines are dropped,
+    // added lines are rescanned, and surviving entries only have their
+    // line shifted, so the list stays sorted
+    EntryList new_entries;
+    new_entries.reserve(m_entries.size());
+    auto it = m_entries.begin();
+    const auto end = m_entries.end();
+    LineCount diff = 0;
+    for (auto& modif : modifs)
+    {
+        for (; it != end and it->coord.line < modif.old_line; ++it)
+            new_entries.push_back({{it->coord.line + diff, it->coord.column},
+                                   it->bracket});
+        while (it != end and it->coord.line < modif.old_line + modif.num_removed)
+            ++it;
+        for (auto line = 0_line; line < modif.num_added; ++line)
+            index_line(modif.new_line + line, new_entries);
+        diff = modif.diff();
+    }
+    for (; it != end; ++it)
+        new_entries.push_back({{it->coord.line + diff, it->coord.column},
+                               it->bracket});
+    m_entries = std::move(new_entries);
+}
+
+Optional<BufferCoord> BracketIndex::find_closing(BufferCoord pos, char opening,
+                                                 char closing, int level) const
+{
+    auto it = std::lower_bound(m_entries.begin(), m_entries.end(), pos,
+                               [](const Entry& entry, const BufferCoord& coord)
+                               { return entry.coord < coord; });
+    if (it != m_entries.end() and it->coord == pos and it->bracket == opening)
+        ++it; // the pair's own opening bracket
+    for (; it != m_entries.end(); ++it)
+    {
+        if (it->bracket == opening)
+            ++level;
+        else if (it->bracket == closing)
+        {
+            if (level == 0)
+                return it->coord;
+            --level;
+        }
+    }
+    return {};
+}
+
+Optional<BufferCoord> BracketIndex::find_opening(BufferCoord pos, char opening,
+                                                 char closing, int level) const
+{
+    auto it = std::upper_bound(m_entries.begin(), m_entries.end(), pos,
+                               [](const BufferCoord& coord, const Entry& entry)
+                               { return coord < entry.coord; });
+    if (it != m_entries.begin() and (it-1)->coord == pos and
+        (it-1)->bracket == closing)
+        --it; // the pair's own closing bracket
+    while (it != m_entries.begin())
+    {
+        --it;
+        if (it->bracket == closing)
+            ++level;
+        else if (it->bracket == opening)
+        {
+            if (level == 0)
+                return it->coord;
+            --level;
+        }
+    }
+    return {};
+}
+
+UnitTest test_bracket_index{[]()
+{
+    Buffer buffer("test", Buffer::Flags::None,
+                  "foo(bar(baz), qux[1])\n"
+                  "{\n"
+                  "    (nested (parens))\n"
+                  "}\n");
+    BracketIndex index(buffer);
+
+    kak_assert(*index.find_closing({0, 3}, '(', ')', 0) == BufferCoord{0, 20});
+    kak_assert(*index.find_closing({0, 7}, '(', ')', 0) == BufferCoord{0, 11});
+    kak_assert(*index.find_opening({0, 20}, '(', ')', 0) == BufferCoord{0, 3});
+    kak_assert(*index.find_closing({1, 0}, '{', '}', 0) == BufferCoord{3, 0});
+    kak_assert(not index.find_opening({0, 0}, '(', ')', 0));
+
+    // a position not on a bracket finds the surrounding pair
+    kak_assert(*index.find_opening({2, 10}, '(', ')', 0) == BufferCoord{2, 4});
+    kak_assert(*index.find_closing({2, 10}, '(', ')', 0) == BufferCoord{2, 20});
+    // a level skips that many enclosing pairs
+    kak_assert(*index.find_opening({2, 15}, '(', ')', 1) == BufferCoord{2, 4});
+
+    // small modifications take the incremental path
+    buffer.insert({0, 0}, "()\n");
+    index.update();
+    kak_assert(*index.find_closing({0, 0}, '(', ')', 0) == BufferCoord{0, 1});
+    kak_assert(*index.find_closing({1, 3}, '(', ')', 0) == BufferCoord{1, 20});
+    kak_assert(*index.find_opening({3, 10}, '(', ')', 0) == BufferCoord{3, 4});
+}};
+
+}
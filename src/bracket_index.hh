@@ -0,0 +1,64 @@
+#ifndef bracket_index_hh_INCLUDED
+#define bracket_index_hh_INCLUDED
+
+#include "buffer.hh"
+#include "optional.hh"
+#include "vector.hh"
+
+namespace Kakoune
+{
+
+// Per buffer sorted list of the positions of the matching pair brackets
+// ((){}[]<>), kept in sync incrementally from the buffer change history.
+// Matching queries binary search their starting position and then only
+// step over bracket entries, instead of rescanning every character
+// between a bracket and its match as the object selections and the
+// show_matching highlighter used to.
+class BracketIndex
+{
+public:
+    explicit BracketIndex(const Buffer& buffer);
+    BracketIndex(BracketIndex&&) = default;
+    BracketIndex& operator=(BracketIndex&&) = default;
+
+    // the index of the given buffer, built on first access
+    static BracketIndex& get(const Buffer& buffer);
+
+    // bring the index in sync with the buffer content
+    void update();
+
+    // whether the given character belongs to an indexed pair
+    static bool is_indexed(char c);
+
+    // position of the closing bracket matching at the given level when
+    // walking forward from pos; pos itself participates unless it holds
+    // the opening bracket, which is skipped as the pair being matched.
+    // level mirrors the init_level parameter of the selectors.cc scans:
+    // that many extra unmatched closings get skipped.
+    Optional<BufferCoord> find_closing(BufferCoord pos, char opening,
+                                       char closing, int level) const;
+
+    // backward counterpart of find_closing, skipping pos when it holds
+    // the closing bracket
+    Optional<BufferCoord> find_opening(BufferCoord pos, char opening,
+                                       char closing, int level) const;
+
+private:
+    struct Entry
+    {
+        BufferCoord coord;
+        char bracket;
+    };
+    using EntryList = Vector<Entry, MemoryDomain::BracketIndex>;
+
+    void rebuild();
+    void index_line(LineCount line, EntryList& entries) const;
+
+    SafePtr<const Buffer> m_buffer;
+    size_t m_timestamp;
+    EntryList m_entries;
+};
+
+}
+
+#endif // bracket_index_hh_INCLUDED
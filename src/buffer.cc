@@ -1,12 +1,15 @@
 #include "buffer.hh"
 
 #include "assert.hh"
+#include "benchmark.hh"
 #include "buffer_manager.hh"
 #include "buffer_utils.hh"
+#include "changes.hh"
 #include "client.hh"
 #include "context.hh"
 #include "diff.hh"
 #include "file.hh"
+#include "file_watcher.hh"
 #include "flags.hh"
 #include "option_types.hh"
 #include "ranges.hh"
@@ -16,6 +19,12 @@
 #include "window.hh"
 
 #include <algorithm>
+#include <cstring>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
 
 namespace Kakoune
 {
@@ -27,7 +36,62 @@ struct ParsedLines
     EolFormat eolformat = EolFormat::Lf;
 };
 
-static ParsedLines parse_lines(StringView data)
+struct EolScan
+{
+    std::vector<const char*> eols;
+    bool has_crlf = false;
+    bool has_lf = false;
+};
+
+// scan content for end of lines, splitting the work accross threads for
+// big enough data; workers only read the data and collect eol positions,
+// all allocations of line storage stay on the main thread.
+static EolScan scan_eols(StringView data)
+{
+    auto scan_range = [&data](const char* begin, const char* end, EolScan& res) {
+        for (auto it = begin;
+             (it = static_cast<const char*>(memchr(it, '\n', end - it))); ++it)
+        {
+            ((it != data.begin() and *(it-1) == '\r') ? res.has_crlf : res.has_lf) = true;
+            res.eols.push_back(it);
+        }
+    };
+
+    constexpr ByteCount parallel_threshold = 8 * 1024 * 1024;
+    const size_t max_threads = std::thread::hardware_concurrency();
+    if (data.length() < parallel_threshold or max_threads <= 1)
+    {
+        EolScan res;
+        scan_range(data.begin(), data.end(), res);
+        return res;
+    }
+
+    const size_t num_chunks = std::min(max_threads, (size_t)16);
+    const size_t chunk_size = ((int)data.length() + num_chunks - 1) / num_chunks;
+    std::vector<EolScan> partial(num_chunks);
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < num_chunks; ++i)
+    {
+        const char* begin = data.begin() + i * chunk_size;
+        const char* end = std::min(begin + chunk_size, data.end());
+        threads.emplace_back([=, &partial]{ scan_range(begin, end, partial[i]); });
+    }
+    for (auto& thread : threads)
+        thread.join();
+
+    EolScan res;
+    res.eols.reserve(accumulate(partial, (size_t)0, [](size_t sum, const EolScan& scan)
+                                { return sum + scan.eols.size(); }));
+    for (auto& scan : partial)
+    {
+        res.eols.insert(res.eols.end(), scan.eols.begin(), scan.eols.end());
+        res.has_crlf = res.has_crlf or scan.has_crlf;
+        res.has_lf = res.has_lf or scan.has_lf;
+    }
+    return res;
+}
+
+static ParsedLines parse_lines(StringView data, RefCountable* data_owner = nullptr)
 {
     ParsedLines res;
     const char* pos = data.begin();
@@ -37,21 +101,60 @@ static ParsedLines parse_lines(StringView data)
         pos = data.begin() + 3;
     }
 
-    bool has_crlf = false, has_lf = false;
-    for (auto it = pos; it != data.end(); ++it)
+    // scan for newlines and detect the eol format with memchr (which the
+    // libc vectorizes), so that the lines vector can be sized upfront and
+    // line splitting does not rescan the data. Deciding the format from a
+    // bounded head sample instead would save nothing here: every newline
+    // position is needed anyway to split the lines and the format flags
+    // are byproducts of that scan; worse, '\r' stripping is only correct
+    // when the whole file agrees, so a sampled crlf decision would mangle
+    // lines of a file whose tail turns out to use bare line feeds.
+    auto scan = scan_eols({pos, data.end()});
+    const bool crlf = scan.has_crlf and not scan.has_lf;
+    res.eolformat = crlf ? EolFormat::Crlf : EolFormat::Lf;
+
+    res.lines.reserve(scan.eols.size() + 1);
+
+    // Identical lines share a single StringData; machine generated files
+    // tend to be highly repetitive, and deduplicating cuts their storage
+    // to one pointer per duplicate line. Keys reference the source data,
+    // which outlives this local table.
+    HashMap<StringView, StringData*, MemoryDomain::BufferContent> dedup;
+    auto dedup_line = [&dedup](StringView content, auto&& create) -> StringDataPtr
     {
-        if (*it == '\n')
-            ((it != pos and *(it-1) == '\r') ? has_crlf : has_lf) = true;
+        auto it = dedup.find(content);
+        if (it != dedup.end())
+            return StringDataPtr{it->value};
+        StringDataPtr line = create();
+        dedup.insert({content, line.get()});
+        return line;
+    };
+
+    if (data_owner and not crlf)
+    {
+        // reference slices of the owned data (a mapped file) directly
+        // instead of copying each line into its own allocation
+        RefPtr<RefCountable> owner{data_owner};
+        for (auto eol : scan.eols)
+        {
+            res.lines.emplace_back(dedup_line({pos, eol}, [&]
+                { return StringData::create_external({pos, eol + 1}, owner); }));
+            pos = eol + 1;
+        }
+        if (pos != data.end()) // data does not end with an eol, we need to add one
+            res.lines.emplace_back(StringData::create({{pos, data.end()}, "\n"}));
+        return res;
     }
-    const bool crlf = has_crlf and not has_lf;
-    res.eolformat = crlf ? EolFormat::Crlf : EolFormat::Lf;
 
-    while (pos < data.end())
+    for (auto eol : scan.eols)
     {
-        const char* eol = std::find(pos, data.end(), '\n');
-        res.lines.emplace_back(StringData::create({{pos, eol - (crlf and eol != data.end() ? 1 : 0)}, "\n"}));
+        StringView content{pos, eol - (crlf ? 1 : 0)};
+        res.lines.emplace_back(dedup_line(content, [&]
+            { return StringData::create({content, "\n"}); }));
         pos = eol + 1;
     }
+    if (pos != data.end())
+        res.lines.emplace_back(StringData::create({{pos, data.end()}, "\n"}));
 
     return res;
 }
@@ -67,7 +170,7 @@ Buffer::HistoryNode::HistoryNode(size_t id, HistoryNode* parent)
 {}
 
 Buffer::Buffer(String name, Flags flags, StringView data,
-               timespec fs_timestamp)
+               timespec fs_timestamp, RefCountable* data_owner)
     : Scope{GlobalScope::instance()},
       m_name{(flags & Flags::File) ? real_path(parse_filename(name)) : std::move(name)},
       m_display_name{(flags & Flags::File) ? compact_path(m_name) : m_name},
@@ -76,7 +179,7 @@ Buffer::Buffer(String name, Flags flags, StringView data,
       m_last_save_history_cursor{&m_history},
       m_fs_timestamp{fs_timestamp.tv_sec, fs_timestamp.tv_nsec}
 {
-    ParsedLines parsed_lines = parse_lines(data);
+    ParsedLines parsed_lines = parse_lines(data, data_owner);
 
     if (parsed_lines.lines.empty())
         parsed_lines.lines.emplace_back(StringData::create({"\n"}));
@@ -86,7 +189,7 @@ Buffer::Buffer(String name, Flags flags, StringView data,
         kak_assert(not (line->length == 0) and
                    line->data()[line->length-1] == '\n');
     #endif
-    static_cast<BufferLines&>(m_lines) = std::move(parsed_lines.lines);
+    m_lines = std::move(parsed_lines.lines);
 
     m_changes.push_back({ Change::Insert, {0,0}, line_count() });
 
@@ -107,6 +210,9 @@ void Buffer::on_registered()
 
     options().register_watcher(*this);
 
+    if (FileWatcher::has_instance())
+        FileWatcher::instance().watch(*this);
+
     run_hook_in_own_context("BufCreate", m_name);
 
     if (m_flags & Flags::File)
@@ -130,11 +236,18 @@ void Buffer::on_unregistered()
         return;
 
     options().unregister_watcher(*this);
+
+    if (FileWatcher::has_instance())
+        FileWatcher::instance().unwatch(*this);
+
+    close_journal(true); // closing cleanly, nothing left to recover
+
     run_hook_in_own_context("BufClose", m_name);
 }
 
 Buffer::~Buffer()
 {
+    close_journal(false);
     m_values.clear();
 }
 
@@ -143,16 +256,20 @@ bool Buffer::set_name(String name)
     Buffer* other = BufferManager::instance().get_buffer_ifp(name);
     if (other == nullptr or other == this)
     {
+        const String old_name = std::move(m_name);
         if (m_flags & Flags::File)
         {
             m_name = real_path(name);
             m_display_name = compact_path(m_name);
+            if (FileWatcher::has_instance())
+                FileWatcher::instance().watch(*this);
         }
         else
         {
             m_name = std::move(name);
             m_display_name = m_name;
         }
+        BufferManager::instance().on_buffer_renamed(*this, old_name);
         return true;
     }
     return false;
@@ -187,11 +304,12 @@ BufferCoord Buffer::offset_coord(BufferCoord coord, CharCount offset, ColumnCoun
 
 BufferCoordAndTarget Buffer::offset_coord(BufferCoordAndTarget coord, LineCount offset, ColumnCount tabstop, bool avoid_eol)
 {
+    // the target carries the cursor display column across successive
+    // vertical moves; resolving it clamps against the new line in the
+    // same walk, so no full width scan of long lines is needed
     const auto column = coord.target == -1 ? get_column(*this, tabstop, coord) : coord.target;
     const auto line = Kakoune::clamp(coord.line + offset, 0_line, line_count()-1);
-    const auto max_column = get_column(*this, tabstop, {line, m_lines[line].length()-1});
-    const auto final_column = std::max(0_col, std::min(column, max_column - (avoid_eol ? 1 : 0)));
-    return {line, get_byte_to_column(*this, tabstop, {line, final_column}), column};
+    return {line, get_byte_to_column_clamped(*this, tabstop, {line, column}, avoid_eol), column};
 }
 
 String Buffer::string(BufferCoord begin, BufferCoord end) const
@@ -226,9 +344,9 @@ struct Buffer::Modification
     }
 };
 
-void Buffer::reload(StringView data, timespec fs_timestamp)
+void Buffer::reload(StringView data, timespec fs_timestamp, RefCountable* data_owner)
 {
-    ParsedLines parsed_lines = parse_lines(data);
+    ParsedLines parsed_lines = parse_lines(data, data_owner);
 
     if (parsed_lines.lines.empty())
         parsed_lines.lines.emplace_back(StringData::create({"\n"}));
@@ -243,19 +361,38 @@ void Buffer::reload(StringView data, timespec fs_timestamp)
         m_history_cursor = &m_history;
         m_last_save_history_cursor = &m_history;
         m_history = HistoryNode{m_next_history_id++, nullptr};
+        m_history_size = 0;
 
         m_changes.push_back({ Change::Erase, {0,0}, line_count() });
-        static_cast<BufferLines&>(m_lines) = std::move(parsed_lines.lines);
+        m_lines = std::move(parsed_lines.lines);
         m_changes.push_back({ Change::Insert, {0,0}, line_count() });
     }
     else
     {
-        auto diff = find_diff(m_lines.begin(), m_lines.size(),
-                              parsed_lines.lines.begin(), parsed_lines.lines.size(),
-                              [](const StringDataPtr& lhs, const StringDataPtr& rhs)
-                              { return lhs->strview() == rhs->strview(); });
-
-        auto it = m_lines.begin();
+        auto equal_lines = [](const StringDataPtr& lhs, const StringDataPtr& rhs)
+                           { return lhs == rhs or lhs->strview() == rhs->strview(); };
+
+        // Trim the common prefix and suffix first so that reloading a file
+        // that only changed locally (say a log that got appended to) diffs
+        // the changed window instead of the full content, as find_diff
+        // allocates vectors proportional to the diffed size.
+        const int old_count = (int)m_lines.size();
+        const int new_count = (int)parsed_lines.lines.size();
+        int prefix = 0;
+        while (prefix < old_count and prefix < new_count and
+               equal_lines(m_lines.get_storage(prefix), parsed_lines.lines[prefix]))
+            ++prefix;
+        int suffix = 0;
+        while (suffix < old_count - prefix and suffix < new_count - prefix and
+               equal_lines(m_lines.get_storage(old_count - 1 - suffix),
+                           parsed_lines.lines[new_count - 1 - suffix]))
+            ++suffix;
+
+        auto diff = find_diff(m_lines.begin() + prefix, old_count - prefix - suffix,
+                              parsed_lines.lines.begin() + prefix, new_count - prefix - suffix,
+                              equal_lines);
+
+        auto it = m_lines.begin() + prefix;
         for (auto& d : diff)
         {
             if (d.mode == Diff::Keep)
@@ -267,10 +404,11 @@ void Buffer::reload(StringView data, timespec fs_timestamp)
                 for (LineCount line = 0; line < d.len; ++line)
                     m_current_undo_group.push_back({
                         Modification::Insert, cur_line + line,
-                        parsed_lines.lines[(int)(d.posB + line)]});
+                        parsed_lines.lines[(int)(prefix + d.posB + line)]});
 
                 m_changes.push_back({ Change::Insert, cur_line, cur_line + d.len });
-                m_lines.insert(it, &parsed_lines.lines[d.posB], &parsed_lines.lines[d.posB + d.len]);
+                m_lines.insert(it, &parsed_lines.lines[prefix + d.posB],
+                               &parsed_lines.lines[prefix + d.posB + d.len]);
                 it = m_lines.begin() + (int)(cur_line + d.len);
             }
             else if (d.mode == Diff::Remove)
@@ -294,6 +432,138 @@ void Buffer::reload(StringView data, timespec fs_timestamp)
 
     m_last_save_history_cursor = m_history_cursor;
     m_fs_timestamp = fs_timestamp;
+
+    journal_checkpoint(); // the loaded content is the new base
+}
+
+// the coordinate one past content inserted at coord
+static BufferCoord advance_by(BufferCoord coord, StringView content)
+{
+    LineCount lines = 0;
+    ByteCount last_eol = -1;
+    for (ByteCount i = 0; i < content.length(); ++i)
+    {
+        if (content[i] == '\n')
+        {
+            ++lines;
+            last_eol = i;
+        }
+    }
+    if (lines == 0)
+        return {coord.line, coord.column + content.length()};
+    return {coord.line + lines, content.length() - last_eol - 1};
+}
+
+// Typing inserts one Modification per cursor for every key, so a long
+// insert session retains myriads of single character records. Coalesce
+// each cursor's contiguous run of insertions into one Modification.
+// Coalesced runs are emitted in reverse position order with coordinates
+// relative to the segment start; applied in that order they insert the
+// same content as the chronological records did, as an insertion cannot
+// move text located before it.
+void Buffer::coalesce_inserts(UndoGroup& undo_group)
+{
+    struct Chunk
+    {
+        BufferCoord begin; // in the buffer state at the segment start
+        BufferCoord end;   // as of the round that last extended the chunk
+        StringDataPtr first;
+        String content;
+    };
+    Vector<Chunk, MemoryDomain::BufferMeta> chunks;
+    // chunks extended during the previous and the current round of cursor
+    // insertions; a round ends when the insertion position goes backward
+    Vector<size_t, MemoryDomain::BufferMeta> last_round, current_round;
+    size_t round_pos = 0;
+    ForwardChangesTracker tracker;
+
+    UndoGroup coalesced;
+    auto flush = [&] {
+        for (auto& chunk : chunks | reverse())
+            coalesced.push_back({Modification::Insert, chunk.begin,
+                                 chunk.first ? std::move(chunk.first)
+                                             : StringData::create({chunk.content})});
+        chunks.clear();
+        last_round.clear();
+        current_round.clear();
+        round_pos = 0;
+        tracker = ForwardChangesTracker{};
+    };
+    auto extend = [&](size_t index, StringView content, BufferCoord end) {
+        auto& chunk = chunks[index];
+        if (chunk.first)
+        {
+            chunk.content = chunk.first->strview().str();
+            chunk.first = {};
+        }
+        chunk.content += content;
+        chunk.end = end;
+    };
+
+    for (auto& record : undo_group)
+    {
+        const StringView content = record.content->strview();
+        // records bigger than this are mostly pastes whose content is
+        // already shared, concatenating would duplicate it
+        if (record.type != Modification::Insert or content.length() > 32)
+        {
+            flush();
+            coalesced.push_back(std::move(record));
+            continue;
+        }
+
+        const BufferCoord end = advance_by(record.coord, content);
+        if (not current_round.empty() and
+            record.coord == chunks[current_round.back()].end)
+        {   // contiguously extends the last extended chunk
+            extend(current_round.back(), content, end);
+            tracker.update({Change::Insert, record.coord, end});
+            continue;
+        }
+        if (not current_round.empty() and
+            record.coord < chunks[current_round.back()].end)
+        {   // the position went backward: a new round of insertions begins
+            last_round = std::move(current_round);
+            current_round.clear();
+            round_pos = 0;
+            tracker = ForwardChangesTracker{};
+        }
+        // does this continue the matching cursor's chunk from the previous
+        // round, accounting for the shift this round's insertions caused?
+        auto matches = [&] {
+            for (; round_pos < last_round.size(); ++round_pos)
+            {
+                auto chunk_end = tracker.get_new_coord(chunks[last_round[round_pos]].end);
+                if (chunk_end >= record.coord)
+                    return chunk_end == record.coord;
+            }
+            return false;
+        };
+        if (matches())
+        {
+            extend(last_round[round_pos], content, end);
+            tracker.update({Change::Insert, record.coord, end});
+            current_round.push_back(last_round[round_pos]);
+            ++round_pos;
+        }
+        else if (last_round.empty()) // first round of the segment, new chunk
+        {
+            chunks.push_back({tracker.get_old_coord(record.coord), end,
+                              std::move(record.content), {}});
+            tracker.update({Change::Insert, record.coord, end});
+            current_round.push_back(chunks.size() - 1);
+        }
+        else // an unrelated insertion, do not coalesce across it
+        {
+            flush();
+            chunks.push_back({record.coord, end, std::move(record.content), {}});
+            tracker.update({Change::Insert, record.coord, end});
+            current_round.push_back(0);
+        }
+    }
+    flush();
+
+    undo_group = std::move(coalesced);
 }
 
 void Buffer::commit_undo_group()
@@ -304,6 +574,8 @@ void Buffer::commit_undo_group()
     if (m_current_undo_group.empty())
         return;
 
+    coalesce_inserts(m_current_undo_group);
+
     auto* node = new HistoryNode{m_next_history_id++, m_history_cursor.get()};
     node->undo_group = std::move(m_current_undo_group);
     m_current_undo_group.clear();
@@ -311,6 +583,66 @@ void Buffer::commit_undo_group()
     m_history_cursor->childs.emplace_back(node);
     m_history_cursor->redo_child = node;
     m_history_cursor = node;
+
+    m_history_size += history_node_size(*node);
+    trim_history();
+}
+
+size_t Buffer::history_node_size(const HistoryNode& node)
+{
+    return accumulate(node.undo_group, sizeof(HistoryNode),
+                      [](size_t size, const Modification& modification)
+                      { return size + sizeof(Modification) + modification.content->length; });
+}
+
+void Buffer::trim_history()
+{
+    const size_t limit = (size_t)std::max(0, options()["max_history_size"].get<int>());
+    if (limit == 0)
+        return;
+
+    static void (*forget_subtree)(Buffer&, HistoryNode*) =
+    [](Buffer& buffer, HistoryNode* node) {
+        for (auto& child : node->childs)
+            forget_subtree(buffer, child.get());
+        buffer.m_history_size -= history_node_size(*node);
+        if (buffer.m_last_save_history_cursor.get() == node)
+            buffer.m_last_save_history_cursor = nullptr;
+    };
+
+    while (m_history_size > limit and m_history_cursor.get() != &m_history)
+    {
+        // the root child on the path to the current cursor becomes the new
+        // history baseline; its siblings, along with its own undo data, are
+        // the oldest reachable history and get evicted
+        HistoryNode* keep = m_history_cursor.get();
+        while (keep->parent.get() != &m_history)
+            keep = keep->parent.get();
+
+        auto it = find_if(m_history.childs,
+                          [keep](auto& child) { return child.get() == keep; });
+        kak_assert(it != m_history.childs.end());
+        auto keep_ptr = std::move(*it);
+
+        for (auto& child : m_history.childs)
+        {
+            if (child)
+                forget_subtree(*this, child.get());
+        }
+        m_history.childs.clear();
+
+        m_history_size -= history_node_size(*keep);
+        m_history.id = keep->id;
+        m_history.timepoint = keep->timepoint;
+        m_history.redo_child = keep->redo_child;
+        for (auto& child : keep->childs)
+            child->parent = &m_history;
+        if (m_history_cursor.get() == keep)
+            m_history_cursor = &m_history;
+        if (m_last_save_history_cursor.get() == keep)
+            m_last_save_history_cursor = &m_history;
+        m_history.childs = std::move(keep->childs);
+    }
 }
 
 bool Buffer::undo(size_t count) noexcept
@@ -490,6 +822,8 @@ BufferCoord Buffer::do_insert(BufferCoord pos, StringView content)
                             : BufferCoord{ last_line, m_lines[last_line].length() - suffix.length() };
 
     m_changes.push_back({ Change::Insert, pos, end });
+    if (m_journal_fd != -1)
+        journal_record(Change::Insert, pos, {}, content);
     return pos;
 }
 
@@ -518,6 +852,8 @@ BufferCoord Buffer::do_erase(BufferCoord begin, BufferCoord end)
     }
 
     m_changes.push_back({ Change::Erase, begin, end });
+    if (m_journal_fd != -1)
+        journal_record(Change::Erase, begin, end, {});
     return next;
 }
 
@@ -546,22 +882,26 @@ void Buffer::apply_modification(const Modification& modification)
 
 BufferCoord Buffer::insert(BufferCoord pos, StringView content)
 {
-    kak_assert(is_valid(pos));
     if (content.empty())
         return pos;
+    return insert(pos, intern(content));
+}
 
-    StringDataPtr real_content;
-    if (is_end(pos) and content.back() != '\n')
-        real_content = intern(content + "\n");
-    else
-        real_content = intern(content);
+BufferCoord Buffer::insert(BufferCoord pos, StringDataPtr content)
+{
+    kak_assert(is_valid(pos));
+    if (content->length == 0)
+        return pos;
+
+    if (is_end(pos) and content->strview().back() != '\n')
+        content = intern(content->strview() + "\n");
 
     // for undo and redo purpose it is better to use one past last line rather
     // than one past last char coord.
     auto coord = is_end(pos) ? line_count() : pos;
     if (not (m_flags & Flags::NoUndo))
-        m_current_undo_group.push_back({Modification::Insert, coord, real_content});
-    return do_insert(pos, real_content->strview());
+        m_current_undo_group.push_back({Modification::Insert, coord, content});
+    return do_insert(pos, content->strview());
 }
 
 BufferCoord Buffer::erase(BufferCoord begin, BufferCoord end)
@@ -593,6 +933,15 @@ BufferCoord Buffer::replace(BufferCoord begin, BufferCoord end, StringView conte
     return insert(pos, content);
 }
 
+BufferCoord Buffer::replace(BufferCoord begin, BufferCoord end, StringDataPtr content)
+{
+    if (is_end(end) and content->length != 0 and content->strview().back() == '\n')
+        return replace(begin, end, content->strview());
+
+    auto pos = erase(begin, end);
+    return insert(pos, std::move(content));
+}
+
 bool Buffer::is_modified() const
 {
     return m_flags & Flags::File and
@@ -608,10 +957,199 @@ void Buffer::notify_saved()
     m_flags &= ~Flags::New;
     m_last_save_history_cursor = m_history_cursor;
     m_fs_timestamp = get_fs_timestamp(m_name);
+
+    // rearm the watch, the save might have created the file
+    if (FileWatcher::has_instance())
+        FileWatcher::instance().watch(*this);
+
+    journal_checkpoint(); // the file now matches the buffer
+}
+
+namespace
+{
+
+struct JournalHeader
+{
+    char magic[8];
+    timespec fs_timestamp;
+};
+constexpr char journal_magic[8] = {'K','A','K','J','R','N','L','1'};
+
+struct JournalRecord
+{
+    uint32_t type; // Change::Type
+    uint32_t begin_line, begin_column;
+    uint32_t end_line, end_column;
+    uint32_t length; // of the content following the record, for inserts
+};
+
+}
+
+String Buffer::journal_path() const
+{
+    StringView dir, file;
+    std::tie(dir, file) = split_path(m_name);
+    return format("{}.{}.kak.journal", dir, file);
+}
+
+void Buffer::init_journal()
+{
+    kak_assert(m_journal_fd == -1 and (m_flags & Flags::File));
+    m_journal_fd = open(journal_path().c_str(), O_RDWR | O_CREAT, 0600);
+    if (m_journal_fd == -1)
+        return;
+
+    JournalHeader header;
+    if (::read(m_journal_fd, &header, sizeof(header)) == sizeof(header) and
+        memcmp(header.magic, journal_magic, sizeof(journal_magic)) == 0 and
+        m_fs_timestamp != InvalidTime and header.fs_timestamp == m_fs_timestamp)
+    {
+        // the journal was written against the very content we just loaded;
+        // a previous session crashed before saving, replay its edits
+        const int fd = m_journal_fd;
+        m_journal_fd = -1; // do not journal the replayed modifications
+        const bool replayed = replay_journal(fd);
+        m_journal_fd = fd;
+        if (replayed)
+            return;
+    }
+    journal_checkpoint();
+}
+
+bool Buffer::replay_journal(int fd)
+{
+    bool applied = false;
+    off_t good = lseek(fd, 0, SEEK_CUR);
+    JournalRecord record;
+    while (::read(fd, &record, sizeof(record)) == sizeof(record))
+    {
+        if (record.type == Change::Insert and record.length > 0)
+        {
+            String content;
+            content.force_size((int)record.length);
+            if (::read(fd, content.data(), record.length) != (ssize_t)record.length)
+                break;
+            const BufferCoord pos{(int)record.begin_line, (int)record.begin_column};
+            if (not is_valid(pos))
+                break;
+            insert(pos, content);
+        }
+        else if (record.type == Change::Erase)
+        {
+            const BufferCoord begin{(int)record.begin_line, (int)record.begin_column};
+            const BufferCoord end{(int)record.end_line, (int)record.end_column};
+            if (not is_valid(begin) or not is_valid(end) or end < begin)
+                break;
+            erase(begin, end);
+        }
+        else // unknown or truncated record, ignore the rest
+            break;
+
+        applied = true;
+        good = lseek(fd, 0, SEEK_CUR);
+    }
+
+    if (applied)
+    {
+        commit_undo_group();
+        // drop whatever follows the last valid record so that further
+        // journaling appends to a consistent journal
+        ftruncate(fd, good);
+    }
+    lseek(fd, good, SEEK_SET);
+    return applied;
+}
+
+void Buffer::journal_checkpoint()
+{
+    if (m_journal_fd == -1)
+        return;
+
+    JournalHeader header{};
+    memcpy(header.magic, journal_magic, sizeof(journal_magic));
+    header.fs_timestamp = m_fs_timestamp;
+    if (ftruncate(m_journal_fd, 0) < 0 or
+        lseek(m_journal_fd, 0, SEEK_SET) < 0 or
+        ::write(m_journal_fd, &header, sizeof(header)) != sizeof(header))
+        close_journal(false); // stop journaling rather than journal garbage
+}
+
+void Buffer::journal_record(Change::Type type, BufferCoord begin, BufferCoord end,
+                            StringView content)
+{
+    const JournalRecord record{(uint32_t)type,
+                               (uint32_t)(int)begin.line, (uint32_t)(int)begin.column,
+                               (uint32_t)(int)end.line, (uint32_t)(int)end.column,
+                               (uint32_t)(int)content.length()};
+    iovec iov[2] = {{(void*)&record, sizeof(record)},
+                    {(void*)content.data(), (size_t)(int)content.length()}};
+    if (::writev(m_journal_fd, iov, content.empty() ? 1 : 2) < 0)
+        close_journal(false);
+}
+
+void Buffer::close_journal(bool remove)
+{
+    if (m_journal_fd == -1)
+        return;
+
+    close(m_journal_fd);
+    m_journal_fd = -1;
+    if (remove)
+        unlink(journal_path().c_str());
+}
+
+void Buffer::validate_offset_index(LineCount line) const
+{
+    auto& index = m_offset_index;
+    for (auto& change : changes_since(index.timestamp))
+        index.valid = std::min(index.valid, (size_t)(int)change.begin.line + 1);
+    index.timestamp = timestamp();
+
+    if (index.valid == 0)
+    {
+        if (index.offsets.empty())
+            index.offsets.push_back(0);
+        index.offsets[0] = 0;
+        index.valid = 1;
+    }
+
+    if (index.offsets.size() <= (size_t)(int)line)
+        index.offsets.resize((size_t)(int)line_count() + 1);
+
+    for (size_t i = index.valid; i <= (size_t)(int)line; ++i)
+        index.offsets[i] = index.offsets[i-1] + (int)m_lines[LineCount{(int)i} - 1].length();
+    index.valid = std::max(index.valid, (size_t)(int)line + 1);
+}
+
+ByteCount Buffer::coord_to_offset(BufferCoord coord) const
+{
+    kak_assert(is_valid(coord));
+    validate_offset_index(coord.line);
+    return ByteCount{(int)m_offset_index.offsets[(int)coord.line]} + coord.column;
+}
+
+BufferCoord Buffer::offset_to_coord(ByteCount offset) const
+{
+    if (offset < 0)
+        return {0, 0};
+
+    validate_offset_index(line_count());
+    auto& offsets = m_offset_index.offsets;
+    if ((size_t)(int)offset >= offsets[(int)line_count()])
+        return end_coord();
+
+    auto it = std::upper_bound(offsets.begin(), offsets.begin() + (int)line_count() + 1,
+                               (size_t)(int)offset);
+    const LineCount line{(int)(it - offsets.begin()) - 1};
+    return {line, offset - ByteCount{(int)offsets[(int)line]}};
 }
 
 BufferCoord Buffer::advance(BufferCoord coord, ByteCount count) const
 {
+    // far jumps are cheaper through the offset index than line by line
+    if (count > 1024 or count < -1024)
+        return offset_to_coord(coord_to_offset(coord) + count);
+
     if (count > 0)
     {
         auto line = coord.line;
@@ -684,6 +1222,13 @@ void Buffer::on_option_changed(const Option& option)
         else
             m_flags &= ~Flags::ReadOnly;
     }
+    else if (option.name() == "backupjournal" and (m_flags & Flags::File))
+    {
+        if (option.get<bool>() and m_journal_fd == -1)
+            init_journal();
+        else if (not option.get<bool>())
+            close_journal(true);
+    }
     run_hook_in_own_context("BufSetOption",
                             format("{}={}", option.name(), option.get_as_string()));
 }
@@ -742,6 +1287,18 @@ UnitTest test_parse_line{[]
         kak_assert(lines.lines[2]->strview() == "baz\n");
     }
 
+    {
+        // a single bare line feed, however late, forces the lf format;
+        // the '\r' then stays part of the content instead of being
+        // stripped from lines that do not carry one
+        auto lines = parse_lines("foo\r\nbar\r\nbaz\n");
+        kak_assert(lines.eolformat == EolFormat::Lf);
+        kak_assert(lines.lines.size() == 3);
+        kak_assert(lines.lines[0]->strview() == "foo\r\n");
+        kak_assert(lines.lines[1]->strview() == "bar\r\n");
+        kak_assert(lines.lines[2]->strview() == "baz\n");
+    }
+
     {
         auto lines = parse_lines("\xEF\xBB\xBF" "foo\nbar\r\nbaz");
         kak_assert(lines.eolformat == EolFormat::Lf);
@@ -752,6 +1309,26 @@ UnitTest test_parse_line{[]
         kak_assert(lines.lines[2]->strview() == "baz\n");
     }
 
+    {
+        struct Owner : RefCountable { String content = "foo\nbar\nbaz"; };
+        RefPtr<Owner> owner{new Owner{}};
+        auto lines = parse_lines(owner->content, owner.get());
+        kak_assert(lines.lines.size() == 3);
+        kak_assert(lines.lines[0]->strview() == "foo\n");
+        kak_assert(lines.lines[0]->data() == owner->content.data());
+        kak_assert(lines.lines[1]->strview() == "bar\n");
+        // last line has no eol, it cannot reference the data and gets copied
+        kak_assert(lines.lines[2]->strview() == "baz\n");
+        kak_assert(owner->refcount == 3);
+    }
+
+    {
+        auto lines = parse_lines("dup\nuniq\ndup\n");
+        kak_assert(lines.lines.size() == 3);
+        kak_assert(lines.lines[0] == lines.lines[2]); // identical lines are shared
+        kak_assert(lines.lines[0] != lines.lines[1]);
+    }
+
     {
         auto lines = parse_lines("foo\r\nbar\r\nbaz\r\n");
         kak_assert(lines.eolformat == EolFormat::Crlf);
@@ -763,6 +1340,24 @@ UnitTest test_parse_line{[]
     }
 }};
 
+UnitTest test_gap_buffer{[]
+{
+    GapBuffer<int, MemoryDomain::Undefined> gb;
+    for (int i = 0; i < 16; ++i)
+        gb.push_back(i);
+    kak_assert(gb.size() == 16 and gb[0] == 0 and gb[15] == 15);
+
+    const int to_insert[] = { 100, 101, 102 };
+    auto it = gb.insert(gb.begin() + 4, std::begin(to_insert), std::end(to_insert));
+    kak_assert(gb.size() == 19 and *it == 100 and gb[3] == 3 and gb[6] == 102 and gb[7] == 4);
+
+    it = gb.erase(gb.begin() + 2, gb.begin() + 8);
+    kak_assert(gb.size() == 13 and *it == 5 and gb[1] == 1 and gb[2] == 5);
+
+    gb.erase(gb.begin(), gb.end());
+    kak_assert(gb.empty());
+}};
+
 UnitTest test_buffer{[]()
 {
     Buffer empty_buffer("empty", Buffer::Flags::None, {});
@@ -808,6 +1403,42 @@ UnitTest test_buffer{[]()
     kak_assert(buffer.string(buffer.advance(buffer.end_coord(), -6), buffer.end_coord()) == StringView{"mutch\n"});
 }};
 
+UnitTest test_history_trim{[]
+{
+    Buffer buffer("test", Buffer::Flags::None, "allo\n");
+    buffer.options().get_local_option("max_history_size").set<int>(1);
+
+    buffer.insert({0,0}, "tchou\n");
+    buffer.commit_undo_group();
+    buffer.insert({0,0}, "kanaky\n");
+    buffer.commit_undo_group();
+
+    // with such a tiny budget everything older than the current state
+    // got evicted, undo has nothing left to go back to
+    kak_assert(not buffer.undo());
+    kak_assert(buffer[0_line] == "kanaky\n");
+    kak_assert(buffer[1_line] == "tchou\n");
+    kak_assert(buffer.is_modified() == false); // non file buffer
+}};
+
+UnitTest test_offset_index{[]
+{
+    Buffer buffer("test", Buffer::Flags::None, "allo ?\nmais que fais la police\n hein ?\n youpi\n");
+    kak_assert(buffer.coord_to_offset({0,0}) == 0);
+    kak_assert(buffer.coord_to_offset({1,0}) == 7);
+    kak_assert(buffer.offset_to_coord(7) == BufferCoord{1,0});
+    kak_assert(buffer.offset_to_coord(6) == BufferCoord{0,6});
+    kak_assert(buffer.distance({0,0}, buffer.end_coord()) == 46);
+
+    buffer.insert({0,0}, "foo\n");
+    kak_assert(buffer.coord_to_offset({1,0}) == 4);
+    kak_assert(buffer.offset_to_coord(11) == BufferCoord{2,0});
+    kak_assert(buffer.offset_to_coord(-1) == BufferCoord{0,0});
+    kak_assert(buffer.offset_to_coord(9999) == buffer.end_coord());
+    kak_assert(buffer.distance({0,0}, buffer.end_coord()) == 50);
+    kak_assert(buffer.advance({0,0}, 50) == buffer.end_coord());
+}};
+
 UnitTest test_undo{[]()
 {
     Buffer buffer("test", Buffer::Flags::None, "allo ?\nmais que fais la police\n hein ?\n youpi\n");
@@ -850,4 +1481,63 @@ UnitTest test_undo{[]()
     kak_assert(buffer[4_line] == " youpi\n");
 }};
 
+UnitTest test_undo_coalescing{[]()
+{
+    // two cursors typing, one single character record per cursor per key
+    Buffer buffer("test", Buffer::Flags::None, "abc def\n");
+    buffer.insert({0, 0}, "x");
+    buffer.insert({0, 5}, "x");
+    buffer.insert({0, 1}, "y");
+    buffer.insert({0, 7}, "y");
+    buffer.commit_undo_group();
+    kak_assert(buffer[0_line] == "xyabc xydef\n");
+    buffer.undo();
+    kak_assert(buffer[0_line] == "abc def\n");
+    buffer.redo();
+    kak_assert(buffer[0_line] == "xyabc xydef\n");
+    buffer.undo();
+
+    // an erase in the middle of a typing run splits the coalesced records
+    buffer.insert({0, 3}, "12");
+    buffer.erase({0, 4}, {0, 5});
+    buffer.insert({0, 4}, "3\n4");
+    buffer.commit_undo_group();
+    kak_assert(buffer[0_line] == "abc13\n");
+    kak_assert(buffer[1_line] == "4 def\n");
+    buffer.undo();
+    kak_assert((int)buffer.line_count() == 1);
+    kak_assert(buffer[0_line] == "abc def\n");
+    buffer.redo();
+    kak_assert(buffer[0_line] == "abc13\n");
+    kak_assert(buffer[1_line] == "4 def\n");
+}};
+
+UnitTest test_reload{[]()
+{
+    Buffer buffer("test", Buffer::Flags::None, "some\ncontent\nwe\nhave\n");
+    buffer.reload("some\ncontent\nwe\nhave\nappended\n");
+    kak_assert((int)buffer.line_count() == 5);
+    kak_assert(buffer[4_line] == "appended\n");
+
+    buffer.reload("some\nother content\nwe\nhave\nappended\n");
+    kak_assert((int)buffer.line_count() == 5);
+    kak_assert(buffer[1_line] == "other content\n");
+    kak_assert(buffer[4_line] == "appended\n");
+
+    kak_assert(buffer.undo());
+    kak_assert(buffer.undo());
+    kak_assert(buffer.string({0,0}, buffer.end_coord()) == "some\ncontent\nwe\nhave\n");
+}};
+
+
+Benchmark bench_buffer{"buffer insert/erase", []()
+{
+    Buffer buffer("bench", Buffer::Flags::None, "\n");
+    for (int i = 0; i < 20000; ++i)
+        buffer.insert(buffer.end_coord(),
+                      "a line of perfectly average length for a benchmark\n");
+    for (int i = 0; i < 10000; ++i)
+        buffer.erase({0, 0}, {1, 0});
+}};
+
 }
@@ -4,6 +4,7 @@
 #include "clock.hh"
 #include "coord.hh"
 #include "enum.hh"
+#include "gap_buffer.hh"
 #include "safe_ptr.hh"
 #include "scope.hh"
 #include "shared_string.hh"
@@ -87,11 +88,18 @@ public:
 
     const BufferCoord& coord() const noexcept { return m_coord; }
 
+    // the current line only holds printable single column ascii, see
+    // StringData::Metrics; lets character steps collapse to byte steps
+    bool ascii_line() const noexcept { return m_line_ascii; }
+
 private:
+    void update_line_ascii() noexcept;
+
     SafePtr<const Buffer> m_buffer;
     BufferCoord m_coord;
     LineCount m_line_count;
     StringView m_line;
+    bool m_line_ascii = false;
 };
 
 using BufferLines = Vector<StringDataPtr, MemoryDomain::BufferContent>;
@@ -118,7 +126,8 @@ public:
     friend constexpr bool with_bit_ops(Meta::Type<Flags>) { return true; }
 
     Buffer(String name, Flags flags, StringView data = {},
-           timespec fs_timestamp = InvalidTime);
+           timespec fs_timestamp = InvalidTime,
+           RefCountable* data_owner = nullptr);
     Buffer(const Buffer&) = delete;
     Buffer& operator= (const Buffer&) = delete;
     ~Buffer();
@@ -130,8 +139,10 @@ public:
     void update_display_name();
 
     BufferCoord insert(BufferCoord pos, StringView content);
+    BufferCoord insert(BufferCoord pos, StringDataPtr content);
     BufferCoord erase(BufferCoord begin, BufferCoord end);
     BufferCoord replace(BufferCoord begin, BufferCoord end, StringView content);
+    BufferCoord replace(BufferCoord begin, BufferCoord end, StringDataPtr content);
 
     size_t         timestamp() const;
     timespec       fs_timestamp() const;
@@ -148,6 +159,8 @@ public:
     StringView     substr(BufferCoord begin, BufferCoord end) const;
 
     const char&    byte_at(BufferCoord c) const;
+    ByteCount      coord_to_offset(BufferCoord coord) const;
+    BufferCoord    offset_to_coord(ByteCount offset) const;
     ByteCount      distance(BufferCoord begin, BufferCoord end) const;
     BufferCoord    advance(BufferCoord coord, ByteCount count) const;
     BufferCoord    next(BufferCoord coord) const;
@@ -158,6 +171,7 @@ public:
 
     BufferCoord    back_coord() const;
     BufferCoord    end_coord() const;
+    BufferCoord    line_end_coord(LineCount line) const;
 
     bool           is_valid(BufferCoord c) const;
     bool           is_end(BufferCoord c) const;
@@ -198,7 +212,8 @@ public:
     void run_hook_in_own_context(StringView hook_name, StringView param,
                                  String client_name = {});
 
-    void reload(StringView data, timespec fs_timestamp = InvalidTime);
+    void reload(StringView data, timespec fs_timestamp = InvalidTime,
+                RefCountable* data_owner = nullptr);
 
     void check_invariant() const;
 
@@ -228,22 +243,26 @@ private:
     void apply_modification(const Modification& modification);
     void revert_modification(const Modification& modification);
 
-    struct LineList : BufferLines
+    // Lines are kept in a GapBuffer so that successive edits on close-by
+    // lines do not shift the whole tail of the buffer each time.
+    struct LineList : GapBuffer<StringDataPtr, MemoryDomain::BufferContent>
     {
+        using GapBuffer::operator=;
+
         [[gnu::always_inline]]
         StringDataPtr& get_storage(LineCount line)
-        { return BufferLines::operator[]((int)line); }
+        { return GapBuffer::operator[]((int)line); }
 
         [[gnu::always_inline]]
         const StringDataPtr& get_storage(LineCount line) const
-        { return BufferLines::operator[]((int)line); }
+        { return GapBuffer::operator[]((int)line); }
 
         [[gnu::always_inline]]
         StringView operator[](LineCount line) const
         { return get_storage(line)->strview(); }
 
-        StringView front() const { return BufferLines::front()->strview(); }
-        StringView back() const { return BufferLines::back()->strview(); }
+        StringView front() const { return get_storage(0)->strview(); }
+        StringView back() const { return get_storage(LineCount{(int)size()} - 1)->strview(); }
     };
     LineList m_lines;
 
@@ -253,6 +272,8 @@ private:
 
     using UndoGroup = Vector<Modification, MemoryDomain::BufferMeta>;
 
+    static void coalesce_inserts(UndoGroup& undo_group);
+
    struct HistoryNode : SafeCountable, UseMemoryDomain<MemoryDomain::BufferMeta>
     {
         HistoryNode(size_t id, HistoryNode* parent);
@@ -265,11 +286,27 @@ private:
         TimePoint timepoint;
     };
 
+    // Append only modification journal written next to the file when the
+    // backupjournal option is set, replayed on the next open after a crash.
+    // Cost is proportional to edits, unlike full backup rewrites.
+    String journal_path() const;
+    void init_journal();
+    void close_journal(bool remove);
+    bool replay_journal(int fd);
+    void journal_checkpoint();
+    void journal_record(Change::Type type, BufferCoord begin, BufferCoord end,
+                        StringView content);
+    int m_journal_fd = -1;
+
     size_t                m_next_history_id = 0;
     HistoryNode           m_history;
     SafePtr<HistoryNode>  m_history_cursor;
     SafePtr<HistoryNode>  m_last_save_history_cursor;
     UndoGroup             m_current_undo_group;
+    size_t                m_history_size = 0;
+
+    static size_t history_node_size(const HistoryNode& node);
+    void trim_history();
 
     void move_to(HistoryNode* history_node) noexcept;
 
@@ -277,6 +314,19 @@ private:
 
     Vector<Change, MemoryDomain::BufferMeta> m_changes;
 
+    // Lazily maintained byte offsets of line starts; entries up to valid
+    // are meaningful, the valid prefix is truncated according to m_changes
+    // on use and extended on demand, making coordinate/offset conversions
+    // cheap on read heavy workloads.
+    struct OffsetIndex
+    {
+        Vector<size_t, MemoryDomain::BufferMeta> offsets;
+        size_t valid = 0;
+        size_t timestamp = 0;
+    };
+    mutable OffsetIndex m_offset_index;
+    void validate_offset_index(LineCount line) const;
+
     timespec m_fs_timestamp;
 
     // Values are just data holding by the buffer, they are not part of its
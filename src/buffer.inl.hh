@@ -2,6 +2,7 @@
 #define buffer_inl_h_INCLUDED
 
 #include "assert.hh"
+#include "utf8.hh"
 
 namespace Kakoune
 {
@@ -34,6 +35,9 @@ inline ByteCount Buffer::distance(BufferCoord begin, BufferCoord end) const
     if (begin.line == end.line)
         return end.column - begin.column;
 
+    if (end.line - begin.line > 8) // long spans go through the offset index
+        return coord_to_offset(end) - coord_to_offset(begin);
+
     ByteCount res = m_lines[begin.line].length() - begin.column;
     for (LineCount l = begin.line+1; l < end.line; ++l)
         res += m_lines[l].length();
@@ -98,10 +102,24 @@ inline BufferCoord Buffer::end_coord() const
     return line_count();
 }
 
+inline BufferCoord Buffer::line_end_coord(LineCount line) const
+{
+    return { line, m_lines[line].length() - 1 };
+}
+
 inline BufferIterator::BufferIterator(const Buffer& buffer, BufferCoord coord) noexcept
     : m_buffer{&buffer}, m_coord{coord},
       m_line_count{buffer.line_count()},
-      m_line{coord.line < buffer.line_count() ? (*m_buffer)[coord.line] : StringView{}} {}
+      m_line{coord.line < buffer.line_count() ? (*m_buffer)[coord.line] : StringView{}}
+{
+    update_line_ascii();
+}
+
+inline void BufferIterator::update_line_ascii() noexcept
+{
+    m_line_ascii = m_coord.line < m_line_count and
+                   m_buffer->line_storage(m_coord.line)->metrics().ascii;
+}
 
 inline bool BufferIterator::operator==(const BufferIterator& iterator) const noexcept
 {
@@ -169,6 +187,7 @@ inline BufferIterator& BufferIterator::operator+=(ByteCount size)
 {
     m_coord = m_buffer->advance(m_coord, size);
     m_line = (*m_buffer)[m_coord.line];
+    update_line_ascii();
     return *this;
 }
 
@@ -176,6 +195,7 @@ inline BufferIterator& BufferIterator::operator-=(ByteCount size)
 {
     m_coord = m_buffer->advance(m_coord, -size);
     m_line = (*m_buffer)[m_coord.line];
+    update_line_ascii();
     return *this;
 }
 
@@ -186,6 +206,7 @@ inline BufferIterator& BufferIterator::operator++()
         m_line = (++m_coord.line < m_line_count) ?
             (*m_buffer)[m_coord.line] : StringView{};
         m_coord.column = 0;
+        update_line_ascii();
     }
     return *this;
 }
@@ -196,6 +217,7 @@ inline BufferIterator& BufferIterator::operator--()
     {
         m_line = (*m_buffer)[--m_coord.line];
         m_coord.column = m_line.length() - 1;
+        update_line_ascii();
     }
     else
        --m_coord.column;
@@ -216,5 +238,28 @@ inline BufferIterator BufferIterator::operator--(int)
     return save;
 }
 
+// ascii fast paths for the utf8 character stepping templates, found
+// through argument dependent lookup; on a pure ascii line every byte
+// starts a character so the continuation byte scan can be skipped
+inline void to_next(BufferIterator& it, const BufferIterator& end) noexcept
+{
+    if (it != end)
+        ++it;
+    if (it.ascii_line())
+        return;
+    while (it != end and not utf8::is_character_start(*it))
+        ++it;
+}
+
+inline void to_previous(BufferIterator& it, const BufferIterator& begin) noexcept
+{
+    if (it != begin)
+        --it;
+    if (it.ascii_line())
+        return;
+    while (it != begin and not utf8::is_character_start(*it))
+        --it;
+}
+
 }
 #endif // buffer_inl_h_INCLUDED
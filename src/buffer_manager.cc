@@ -13,9 +13,12 @@ namespace Kakoune
 
 BufferManager::~BufferManager()
 {
+    finish_pending_writes();
+
     // Move buffers to m_buffer_trash to avoid running BufClose
     // hook while clearing m_buffers
     m_buffer_trash = std::move(m_buffers);
+    m_buffer_index.clear();
 
     for (auto& buffer : m_buffer_trash)
         buffer->on_unregistered();
@@ -25,19 +28,18 @@ BufferManager::~BufferManager()
 }
 
 Buffer* BufferManager::create_buffer(String name, Buffer::Flags flags,
-                                     StringView data, timespec fs_timestamp)
+                                     StringView data, timespec fs_timestamp,
+                                     RefCountable* data_owner)
 {
     auto path = real_path(parse_filename(name));
-    for (auto& buf : m_buffers)
-    {
-        if (buf->name() == name or
-            (buf->flags() & Buffer::Flags::File and buf->name() == path))
-            throw runtime_error{"buffer name is already in use"};
-    }
+    if (find_buffer(name, path))
+        throw runtime_error{"buffer name is already in use"};
 
     m_buffers.emplace(m_buffers.begin(),
-                      new Buffer{std::move(name), flags, data, fs_timestamp});
+                      new Buffer{std::move(name), flags, data, fs_timestamp, data_owner});
     auto& buffer = *m_buffers.front();
+    // index before running hooks, they may resolve the buffer by name
+    m_buffer_index.insert({buffer.name(), &buffer});
     buffer.on_registered();
 
     if (contains(m_buffer_trash, &buffer))
@@ -54,6 +56,7 @@ void BufferManager::delete_buffer(Buffer& buffer)
 
     m_buffer_trash.emplace_back(std::move(*it));
     m_buffers.erase(it);
+    m_buffer_index.remove(buffer.name());
 
     ClientManager::instance().ensure_no_client_uses_buffer(buffer);
 
@@ -62,14 +65,35 @@ void BufferManager::delete_buffer(Buffer& buffer)
 
 Buffer* BufferManager::get_buffer_ifp(StringView name)
 {
+    // a direct name hit saves canonicalizing the query
+    auto it = m_buffer_index.find(name);
+    if (it != m_buffer_index.end())
+        return it->value;
+
     auto path = real_path(parse_filename(name));
-    for (auto& buf : m_buffers)
+    return find_buffer(name, path);
+}
+
+Buffer* BufferManager::find_buffer(StringView name, StringView path) const
+{
+    auto it = m_buffer_index.find(name);
+    if (it == m_buffer_index.end())
     {
-        if (buf->name() == name or
-            (buf->flags() & Buffer::Flags::File and buf->name() == path))
-            return buf.get();
+        it = m_buffer_index.find(path);
+        if (it == m_buffer_index.end() or
+            not (it->value->flags() & Buffer::Flags::File))
+            return nullptr;
     }
-    return nullptr;
+    return it->value;
+}
+
+void BufferManager::on_buffer_renamed(Buffer& buffer, StringView old_name)
+{
+    auto it = m_buffer_index.find(old_name);
+    if (it == m_buffer_index.end() or it->value != &buffer)
+        return; // not registered (in the trash already)
+    m_buffer_index.remove(old_name);
+    m_buffer_index.insert({buffer.name(), &buffer});
 }
 
 Buffer& BufferManager::get_buffer(StringView name)
@@ -108,6 +132,7 @@ void BufferManager::clear_buffer_trash()
         ClientManager::instance().ensure_no_client_uses_buffer(*buffer);
         ClientManager::instance().clear_window_trash();
 
+        finish_pending_writes(buffer.get());
         buffer.reset();
     }
 
@@ -2,6 +2,7 @@
 #define buffer_manager_hh_INCLUDED
 
 #include "buffer.hh"
+#include "hash_map.hh"
 #include "vector.hh"
 
 #include <memory>
@@ -19,7 +20,8 @@ public:
 
     Buffer* create_buffer(String name, Buffer::Flags flags,
                           StringView data = {},
-                          timespec fs_timestamp = InvalidTime);
+                          timespec fs_timestamp = InvalidTime,
+                          RefCountable* data_owner = nullptr);
 
     void delete_buffer(Buffer& buffer);
 
@@ -36,7 +38,16 @@ public:
 
     void clear_buffer_trash();
 private:
+    friend class Buffer;
+    void on_buffer_renamed(Buffer& buffer, StringView old_name);
+
+    Buffer* find_buffer(StringView name, StringView path) const;
+
     BufferList m_buffers;
+    // name -> buffer index, maintained on create/rename/delete; file
+    // buffer names are canonical real paths, so once a query is
+    // canonicalized this also resolves path lookups
+    HashMap<String, Buffer*, MemoryDomain::BufferMeta> m_buffer_index;
     BufferList m_buffer_trash;
 };
 
@@ -18,6 +18,9 @@ ColumnCount get_column(const Buffer& buffer,
                        ColumnCount tabstop, BufferCoord coord)
 {
     auto line = buffer[coord.line];
+    // on plain ascii lines display columns and byte offsets coincide
+    if (buffer.line_storage(coord.line)->metrics().ascii)
+        return std::min(std::max(0, (int)coord.column), (int)line.length());
     auto col = 0_col;
     for (auto it = line.begin();
          it != line.end() and coord.column > (int)(it - line.begin()); )
@@ -36,6 +39,8 @@ ColumnCount get_column(const Buffer& buffer,
 ByteCount get_byte_to_column(const Buffer& buffer, ColumnCount tabstop, DisplayCoord coord)
 {
     auto line = buffer[coord.line];
+    if (buffer.line_storage(coord.line)->metrics().ascii)
+        return std::min(std::max(0, (int)coord.column), (int)line.length());
     auto col = 0_col;
     auto it = line.begin();
     while (it != line.end() and coord.column > col)
@@ -59,11 +64,58 @@ ByteCount get_byte_to_column(const Buffer& buffer, ColumnCount tabstop, DisplayC
     return (int)(it - line.begin());
 }
 
+// As get_byte_to_column, but clamp into the line content during the same
+// walk instead of scanning the full line up front to know its width, so
+// resolving a cached cursor column costs at most min(column, width);
+// avoid_eol keeps the result off the end of line character.
+ByteCount get_byte_to_column_clamped(const Buffer& buffer, ColumnCount tabstop,
+                                     DisplayCoord coord, bool avoid_eol)
+{
+    auto line = buffer[coord.line];
+    if (buffer.line_storage(coord.line)->metrics().ascii)
+        return std::max(0, std::min((int)coord.column,
+                                    (int)line.length() - (avoid_eol ? 2 : 1)));
+    auto col = 0_col;
+    auto it = line.begin();
+    const char* const content_end = line.end() - 1; // lines end with '\n'
+    auto prev = it;
+    while (it != content_end and col < coord.column)
+    {
+        prev = it;
+        if (*it == '\t')
+        {
+            col = (col / tabstop + 1) * tabstop;
+            if (col > coord.column) // the target column was in the tab
+                return (int)(it - line.begin());
+            ++it;
+        }
+        else
+        {
+            auto next = it;
+            col += codepoint_width(utf8::read_codepoint(next, line.end()));
+            if (col > coord.column) // the target column was in the char
+                return (int)(it - line.begin());
+            it = next;
+        }
+    }
+    // past the content with the cursor kept off the end of line
+    // character: back up onto the last character
+    if (avoid_eol and it == content_end and it != line.begin())
+        return (int)(prev - line.begin());
+    return (int)(it - line.begin());
+}
+
+// Above this size, buffer lines reference the mapped file directly instead
+// of copying its content; the mapping then stays alive (and the memory
+// shared with the page cache) as long as some lines still reference it.
+static constexpr off_t direct_mapping_threshold = 1024 * 1024;
+
 Buffer* open_file_buffer(StringView filename, Buffer::Flags flags)
 {
-    MappedFile file_data{parse_filename(filename)};
+    RefPtr<MappedFile> file_data{new MappedFile{parse_filename(filename)}};
     return BufferManager::instance().create_buffer(
-        filename.str(), Buffer::Flags::File | flags, file_data, file_data.st.st_mtim);
+        filename.str(), Buffer::Flags::File | flags, *file_data, file_data->st.st_mtim,
+        file_data->st.st_size > direct_mapping_threshold ? file_data.get() : nullptr);
 }
 
 Buffer* open_or_create_file_buffer(StringView filename, Buffer::Flags flags)
@@ -72,9 +124,10 @@ Buffer* open_or_create_file_buffer(StringView filename, Buffer::Flags flags)
     auto path = parse_filename(filename);
     if (file_exists(path))
     {
-        MappedFile file_data{path};
+        RefPtr<MappedFile> file_data{new MappedFile{path}};
         return buffer_manager.create_buffer(filename.str(), Buffer::Flags::File | flags,
-                                            file_data, file_data.st.st_mtim);
+                                            *file_data, file_data->st.st_mtim,
+                                            file_data->st.st_size > direct_mapping_threshold ? file_data.get() : nullptr);
     }
     return buffer_manager.create_buffer(
         filename.str(), Buffer::Flags::File | Buffer::Flags::New,
@@ -84,8 +137,9 @@ Buffer* open_or_create_file_buffer(StringView filename, Buffer::Flags flags)
 void reload_file_buffer(Buffer& buffer)
 {
     kak_assert(buffer.flags() & Buffer::Flags::File);
-    MappedFile file_data{buffer.name()};
-    buffer.reload(file_data, file_data.st.st_mtim);
+    RefPtr<MappedFile> file_data{new MappedFile{buffer.name()}};
+    buffer.reload(*file_data, file_data->st.st_mtim,
+                  file_data->st.st_size > direct_mapping_threshold ? file_data.get() : nullptr);
 }
 
 Buffer* create_fifo_buffer(String name, int fd, Buffer::Flags flags, bool scroll)
@@ -122,39 +176,56 @@ Buffer* create_fifo_buffer(String name, int fd, Buffer::Flags flags, bool scroll
 
         kak_assert(buffer->flags() & Buffer::Flags::Fifo);
 
-        constexpr size_t buffer_size = 2048;
-        // if we read data slower than it arrives in the fifo, limiting the
-        // iteration number allows us to go back go back to the event loop and
-        // handle other events sources (such as input)
-        size_t loops = 16;
-        char data[buffer_size];
+        // drain the fifo and coalesce everything that arrived into a single
+        // insert, so that fast writers cost one change record, hook run and
+        // highlight invalidation per event loop iteration instead of one
+        // per small chunk. The accumulated data is capped so that we still
+        // go back to the event loop and handle other event sources (such
+        // as input) against a writer outpacing us.
+        constexpr ByteCount read_size = 65536;
+        constexpr ByteCount max_data = 4 * 1024 * 1024;
+        String data;
+        bool closed = false;
         const int fifo = watcher.fd();
         do
         {
-            const ssize_t count = ::read(fifo, data, buffer_size);
+            const ByteCount cur = data.length();
+            data.reserve(cur + read_size); // force_size alone would not keep the content on growth
+            data.force_size(cur + read_size);
+            const ssize_t count = ::read(fifo, data.data() + (int)cur, (size_t)(int)read_size);
+            data.force_size(cur + (count > 0 ? ByteCount{(int)count} : 0));
             if (count <= 0)
             {
-                buffer->values().erase(fifo_watcher_id); // will delete this
-                return;
+                closed = true;
+                break;
             }
+        }
+        while (data.length() < max_data and fd_readable(fifo));
 
+        if (not data.empty())
+        {
             auto pos = buffer->back_coord();
             const bool prevent_scrolling = pos == BufferCoord{0,0} and not scroll;
             if (prevent_scrolling)
                 pos = buffer->next(pos);
 
-            buffer->insert(pos, StringView(data, data+count));
+            buffer->insert(pos, data);
 
             if (prevent_scrolling)
             {
                 buffer->erase({0,0}, buffer->next({0,0}));
                 // in the other case, the buffer will have automatically
                 // inserted a \n to guarantee its invariant.
-                if (data[count-1] == '\n')
+                if (data.back() == '\n')
                     buffer->insert(buffer->end_coord(), "\n");
             }
         }
-        while (--loops and fd_readable(fifo));
+
+        if (closed)
+        {
+            buffer->values().erase(fifo_watcher_id); // will delete this
+            return;
+        }
 
         buffer->run_hook_in_own_context("BufReadFifo", buffer->name());
     }), std::move(watcher_deleter));
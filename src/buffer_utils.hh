@@ -25,6 +25,11 @@ inline BufferCoord replace(Buffer& buffer, const Selection& range, StringView co
     return buffer.replace(range.min(), buffer.char_next(range.max()), content);
 }
 
+inline BufferCoord replace(Buffer& buffer, const Selection& range, StringDataPtr content)
+{
+    return buffer.replace(range.min(), buffer.char_next(range.max()), std::move(content));
+}
+
 inline CharCount char_length(const Buffer& buffer, const Selection& range)
 {
     return utf8::distance(buffer.iterator_at(range.min()),
@@ -75,6 +80,9 @@ ColumnCount get_column(const Buffer& buffer,
 ByteCount get_byte_to_column(const Buffer& buffer, ColumnCount tabstop,
                              DisplayCoord coord);
 
+ByteCount get_byte_to_column_clamped(const Buffer& buffer, ColumnCount tabstop,
+                                     DisplayCoord coord, bool avoid_eol);
+
 Buffer* create_fifo_buffer(String name, int fd, Buffer::Flags flags, bool scroll = false);
 Buffer* open_file_buffer(StringView filename,
                          Buffer::Flags flags = Buffer::Flags::None);
@@ -1,6 +1,7 @@
 #include "client.hh"
 
 #include "face_registry.hh"
+#include "trace.hh"
 #include "context.hh"
 #include "buffer_manager.hh"
 #include "buffer_utils.hh"
@@ -10,7 +11,9 @@
 #include "client_manager.hh"
 #include "command_manager.hh"
 #include "event_manager.hh"
+#include "file_watcher.hh"
 #include "user_interface.hh"
+#include "utf8.hh"
 #include "window.hh"
 #include "hash_map.hh"
 
@@ -33,7 +36,8 @@ Client::Client(std::unique_ptr<UserInterface>&& ui,
       m_on_exit{std::move(on_exit)},
       m_input_handler{std::move(selections), Context::Flags::None,
                       std::move(name)},
-      m_env_vars(std::move(env_vars))
+      m_env_vars(std::move(env_vars)),
+      m_redraw_timer{TimePoint::max(), [this](Timer&) { redraw_ifn(); }}
 {
     m_window->set_client(this);
 
@@ -47,6 +51,13 @@ Client::Client(std::unique_ptr<UserInterface>&& ui,
     m_ui->set_on_key([this](Key key) {
         if (key == ctrl('c'))
             killpg(getpgrp(), SIGINT);
+        // mouse drags report one motion event per terminal cell crossed,
+        // but only the latest position matters; replace the previous one
+        // so a whole burst costs a single selection update and redraw
+        else if ((bool)(key.modifiers & Key::Modifiers::MousePos) and
+                 not m_pending_keys.empty() and
+                 m_pending_keys.back().modifiers == key.modifiers)
+            m_pending_keys.back() = key;
         else
             m_pending_keys.push_back(key);
     });
@@ -66,13 +77,51 @@ Client::~Client()
                                               context().selections());
 }
 
+static bool is_pasted_key(Key key)
+{
+    if (key == Key::Return or key == Key::Tab)
+        return true;
+    return key.modifiers == Key::Modifiers::None and key.key > 31 and
+           (key.key < 0xD800 or key.key > 0xDFFF); // avoid named keys
+}
+
 bool Client::process_pending_inputs()
 {
     const bool debug_keys = (bool)(context().options()["debug"].get<DebugFlags>() & DebugFlags::Keys);
     // steal keys as we might receive new keys while handling them.
     Vector<Key, MemoryDomain::Client> keys = std::move(m_pending_keys);
-    for (auto& key : keys)
+
+    // more plain text than anybody types within a single event loop
+    // iteration has to be a paste flood
+    constexpr size_t min_paste_run = 64;
+    for (size_t i = 0; i < keys.size(); )
     {
+        size_t run = i;
+        while (run < keys.size() and is_pasted_key(keys[run]))
+            ++run;
+        if (run - i >= min_paste_run)
+        {
+            String content;
+            for (size_t j = i; j < run; ++j)
+                utf8::dump(std::back_inserter(content), *keys[j].codepoint());
+            i = run;
+            try
+            {
+                if (debug_keys)
+                    write_to_debug_buffer(format("Client '{}' got {} pasted bytes",
+                                                 context().name(), (int)content.length()));
+                m_input_handler.paste(content);
+            }
+            catch (Kakoune::runtime_error& error)
+            {
+                write_to_debug_buffer(format("Error: {}", error.what()));
+                context().print_status({ fix_atom_text(error.what().str()), get_face("Error") });
+                context().hooks().run_hook("RuntimeError", error.what(), context());
+            }
+            continue;
+        }
+
+        auto& key = keys[i++];
         try
         {
             if (debug_keys)
@@ -100,7 +149,12 @@ bool Client::process_pending_inputs()
             context().hooks().run_hook("RuntimeError", error.what(), context());
         }
     }
-    return not keys.empty();
+    if (not keys.empty())
+    {
+        m_immediate_redraw = true;
+        return true;
+    }
+    return false;
 }
 
 void Client::print_status(DisplayLine status_line, bool immediate)
@@ -129,7 +183,7 @@ String generate_context_info(const Context& context)
     if (context.buffer().is_modified())
         s += "[+]";
     if (context.client().input_handler().is_recording())
-        s += format("[recording ({})]", context.client().input_handler().recording_reg());
+        format_to(s, "[recording ({})]", context.client().input_handler().recording_reg());
     if (context.buffer().flags() & Buffer::Flags::New)
         s += "[new file]";
     if (context.hooks_disabled())
@@ -147,11 +201,29 @@ DisplayLine Client::generate_mode_line() const
     try
     {
         const String& modelinefmt = context().options()["modelinefmt"].get<String>();
-        HashMap<String, DisplayLine> atoms{{ "mode_info", context().client().input_handler().mode_line() },
-                                           { "context_info", {generate_context_info(context()), get_face("Information")}}};
+        DisplayLine mode_info = context().client().input_handler().mode_line();
+        String context_info = generate_context_info(context());
+
+        // Expanding modelinefmt can be expensive (a %sh{} block forks a
+        // shell); only redo it when one of its inputs changed since the
+        // line was last generated.
+        const auto& buffer = context().buffer();
+        const auto cursor = context().selections().main().cursor();
+        size_t key = hash_values(modelinefmt, buffer.display_name(),
+                                 buffer.timestamp(), buffer.flags(),
+                                 (size_t)(int)cursor.line, (size_t)(int)cursor.column,
+                                 context().selections().size(), context_info);
+        for (auto& atom : mode_info.atoms())
+            key = combine_hash(key, hash_value(atom.content()));
+        if (key != 0 and key == m_mode_line_cache.key)
+            return m_mode_line_cache.line;
+
+        HashMap<String, DisplayLine> atoms{{ "mode_info", std::move(mode_info) },
+                                           { "context_info", {std::move(context_info), get_face("Information")}}};
         auto expanded = expand(modelinefmt, context(), ShellContext{},
                                [](String s) { return escape(s, '{', '\\'); });
         modeline = parse_display_line(expanded, atoms);
+        m_mode_line_cache = { key, modeline };
     }
     catch (runtime_error& err)
     {
@@ -199,6 +271,15 @@ static bool is_inline(InfoStyle style)
 
 void Client::redraw_ifn()
 {
+    // Commands can pump the event loop in the middle of their execution
+    // (waiting on a shell for instance); defer drawing until the
+    // outermost command returns so a command loop costs a single final
+    // redraw. The force-redraw command and <c-l> opt out.
+    if (not m_redraw_forced and CommandManager::has_instance() and
+        CommandManager::instance().is_executing())
+        return;
+    m_redraw_forced = false;
+
     Window& window = context().window();
     if (window.needs_redraw(context()))
         m_ui_pending |= Draw;
@@ -213,9 +294,58 @@ void Client::redraw_ifn()
     if (m_ui_pending == 0)
         return;
 
+    // When updates come faster than redraw_interval (a streaming fifo
+    // buffer, a busy shell filter...) coalesce them into one frame drawn
+    // when the timer fires; interactive input always gets its frame now.
+    const auto interval = std::chrono::milliseconds{
+        context().options()["redraw_interval"].get<int>()};
+    const auto now = Clock::now();
+    if (not m_immediate_redraw and now < m_last_redraw + interval)
+    {
+        m_redraw_timer.set_next_date(m_last_redraw + interval);
+        return;
+    }
+    m_immediate_redraw = false;
+    m_last_redraw = now;
+
+    TraceScope trace{"redraw", context().name()};
+
+    static const FaceRef default_face_ref{"Default"};
+    static const FaceRef padding_face_ref{"BufferPadding"};
+    static const FaceRef menu_fg_face_ref{"MenuForeground"};
+    static const FaceRef menu_bg_face_ref{"MenuBackground"};
+    static const FaceRef info_face_ref{"Information"};
+    static const FaceRef status_face_ref{"StatusLine"};
+
     if (m_ui_pending & Draw)
-        m_ui->draw(window.update_display_buffer(context()),
-                   get_face("Default"), get_face("BufferPadding"));
+    {
+        auto& display_buffer = window.update_display_buffer(context());
+        const Face default_face = get_face(default_face_ref);
+
+        // beyond this many cells painting and transmitting a full frame
+        // blows the input latency budget, so the cursor vicinity goes
+        // out first in a small partial frame the ui shows right away;
+        // the full frame follows and fills in the rest
+        constexpr int progressive_cells = 30000;
+        constexpr LineCount vicinity = 10;
+        auto& lines = display_buffer.lines();
+        const auto dim = window.dimensions();
+        if ((int)dim.line * (int)dim.column >= progressive_cells and
+            not lines.empty())
+        {
+            const auto cursor = context().selections().main().cursor();
+            const LineCount last_line{(int)lines.size() - 1};
+            const LineCount cursor_row =
+                window.display_position(cursor).value_or(DisplayCoord{}).line;
+            const LineCount first = clamp(cursor_row - vicinity, 0_line, last_line);
+            const LineCount last = clamp(cursor_row + vicinity, 0_line, last_line);
+            m_ui->draw_partial({&lines[(int)first], &lines[(int)last + 1]},
+                               first, default_face);
+            m_ui->refresh(false);
+        }
+
+        m_ui->draw(display_buffer, default_face, get_face(padding_face_ref));
+    }
 
     const bool update_menu_anchor = (m_ui_pending & Draw) and not (m_ui_pending & MenuHide) and
                                     not m_menu.items.empty() and m_menu.style == MenuStyle::Inline;
@@ -230,7 +360,7 @@ void Client::redraw_ifn()
 
     if (m_ui_pending & MenuShow and m_menu.ui_anchor)
         m_ui->menu_show(m_menu.items, *m_menu.ui_anchor,
-                        get_face("MenuForeground"), get_face("MenuBackground"),
+                        get_face(menu_fg_face_ref), get_face(menu_bg_face_ref),
                         m_menu.style);
     if (m_ui_pending & MenuSelect and m_menu.ui_anchor)
         m_ui->menu_select(m_menu.selected);
@@ -250,22 +380,24 @@ void Client::redraw_ifn()
 
     if (m_ui_pending & InfoShow and m_info.ui_anchor)
         m_ui->info_show(m_info.title, m_info.content, *m_info.ui_anchor,
-                        get_face("Information"), m_info.style);
+                        get_face(info_face_ref), m_info.style);
     if (m_ui_pending & InfoHide)
         m_ui->info_hide();
 
     if (m_ui_pending & StatusLine)
-        m_ui->draw_status(m_status_line, m_mode_line, get_face("StatusLine"));
+        m_ui->draw_status(m_status_line, m_mode_line, get_face(status_face_ref));
 
     auto cursor = m_input_handler.get_cursor_info();
     m_ui->set_cursor(cursor.first, cursor.second);
 
-    m_ui->refresh(m_ui_pending | Refresh);
+    m_ui->refresh(m_ui_pending & Refresh);
     m_ui_pending = 0;
 }
 
 void Client::force_redraw()
 {
+    m_redraw_forced = true;
+    m_mode_line_cache.key = 0;
     m_ui_pending |= Refresh | Draw | StatusLine |
         (m_menu.items.empty() ? MenuHide : MenuShow | MenuSelect) |
         (m_info.content.empty() ? InfoHide : InfoShow);
@@ -326,6 +458,10 @@ void Client::check_if_buffer_needs_reloading()
     if (not (buffer.flags() & Buffer::Flags::File) or reload == Autoreload::No)
         return;
 
+    if (FileWatcher::has_instance() and
+        not FileWatcher::instance().maybe_modified(buffer))
+        return;
+
     const String& filename = buffer.name();
     timespec ts = get_fs_timestamp(filename);
     if (ts == InvalidTime or ts == buffer.fs_timestamp())
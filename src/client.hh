@@ -3,6 +3,7 @@
 
 #include "display_buffer.hh"
 #include "env_vars.hh"
+#include "event_manager.hh"
 #include "input_handler.hh"
 #include "safe_ptr.hh"
 #include "utils.hh"
@@ -96,6 +97,13 @@ private:
     DisplayLine m_status_line;
     DisplayLine m_mode_line;
 
+    struct ModeLineCache
+    {
+        size_t key = 0;
+        DisplayLine line;
+    };
+    mutable ModeLineCache m_mode_line_cache;
+
     enum PendingUI : int
     {
         MenuShow   = 1 << 0,
@@ -129,6 +137,11 @@ private:
 
     Vector<Key, MemoryDomain::Client> m_pending_keys;
 
+    Timer m_redraw_timer;
+    TimePoint m_last_redraw;
+    bool m_immediate_redraw = false;
+    bool m_redraw_forced = false;
+
     bool m_buffer_reload_dialog_opened = false;
 
     SafePtr<Buffer> m_last_buffer;
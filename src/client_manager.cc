@@ -50,6 +50,7 @@ Client* ClientManager::create_client(std::unique_ptr<UserInterface>&& ui, int pi
                                 std::move(env_vars), generate_name(),
                                 std::move(on_exit)};
     m_clients.emplace_back(client);
+    ++m_created_count;
 
     if (init_coord)
     {
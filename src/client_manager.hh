@@ -26,6 +26,7 @@ public:
 
     bool   empty() const { return m_clients.empty(); }
     size_t count() const { return m_clients.size(); }
+    size_t created_count() const { return m_created_count; }
 
     void clear();
 
@@ -58,6 +59,7 @@ private:
 
     ClientList m_clients;
     ClientList m_client_trash;
+    size_t m_created_count = 0;
     Vector<WindowAndSelections, MemoryDomain::Client> m_free_windows;
     Vector<std::unique_ptr<Window>, MemoryDomain::Client> m_window_trash;
 };
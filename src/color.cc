@@ -1,6 +1,7 @@
 #include "color.hh"
 
 #include "exception.hh"
+#include "hash_map.hh"
 #include "ranges.hh"
 #include "string_utils.hh"
 
@@ -26,7 +27,7 @@ bool is_color_name(StringView color)
     return contains(color_names, color);
 }
 
-Color str_to_color(StringView color)
+static Color parse_color(StringView color)
 {
     auto it = find_if(color_names, [&](const char* c){ return color == c; });
     if (it != std::end(color_names))
@@ -52,6 +53,24 @@ Color str_to_color(StringView color)
     return Color::Default;
 }
 
+Color str_to_color(StringView color)
+{
+    // themes and inline face specs parse the same few color strings over
+    // and over, remember the results; parse failures keep throwing and
+    // are never cached
+    static HashMap<String, Color, MemoryDomain::Faces> cache;
+    auto it = cache.find(color);
+    if (it != cache.end())
+        return it->value;
+
+    const Color res = parse_color(color);
+    constexpr size_t max_cached = 512;
+    if (cache.size() >= max_cached) // inline colors can be generated
+        cache.clear();
+    cache.insert({color.str(), res});
+    return res;
+}
+
 String to_string(Color color)
 {
     if (color.color == Color::RGB)
@@ -4,14 +4,26 @@
 #include "assert.hh"
 #include "buffer_utils.hh"
 #include "context.hh"
+#include "file.hh"
 #include "flags.hh"
 #include "optional.hh"
 #include "ranges.hh"
 #include "register_manager.hh"
 #include "shell_manager.hh"
+#include "trace.hh"
 #include "utils.hh"
 
 #include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__APPLE__)
+#define st_mtim st_mtimespec
+#endif
 
 namespace Kakoune
 {
@@ -252,8 +264,14 @@ Token parse_percent_token(Reader& reader)
     }
 }
 
-String expand_token(const Token& token, const Context& context,
-                    const ShellContext& shell_context)
+void expand_unprocessed(String& res, StringView str, const Context& context,
+                        const ShellContext& shell_context);
+
+// append the token expansion directly to res, so that expanding a
+// command body streams into a single buffer instead of building a
+// String temporary per token
+void expand_token(const Token& token, const Context& context,
+                  const ShellContext& shell_context, String& res)
 {
     auto& content = token.content;
     switch (token.type)
@@ -264,47 +282,60 @@ String expand_token(const Token& token, const Context& context,
             content, context, {}, ShellManager::Flags::WaitForStdout,
             shell_context).first;
 
-        int trailing_eol_count = 0;
-        for (auto c : str | reverse())
-        {
-            if (c != '\n')
-                break;
-            ++trailing_eol_count;
-        }
-        str.resize(str.length() - trailing_eol_count, 0);
-        return str;
-
+        StringView trimmed = str;
+        while (not trimmed.empty() and trimmed.back() == '\n')
+            trimmed = trimmed.substr(0_byte, trimmed.length() - 1);
+        res += trimmed;
+        return;
     }
     case Token::Type::RegisterExpand:
-        return context.main_sel_register_value(content).str();
+        res += context.main_sel_register_value(content);
+        return;
     case Token::Type::OptionExpand:
-        return context.options()[content].get_as_string();
+        res += context.options()[content].get_as_string();
+        return;
     case Token::Type::ValExpand:
     {
         auto it = shell_context.env_vars.find(content);
         if (it != shell_context.env_vars.end())
-            return it->value;
-        return ShellManager::instance().get_val(content, context);
+            res += it->value;
+        else
+            res += ShellManager::instance().get_val(content, context);
+        return;
     }
     case Token::Type::ArgExpand:
     {
         auto& params = shell_context.params;
         if (content == '@')
-            return join(params, ' ');
+        {
+            res += join(params, ' ');
+            return;
+        }
 
         const int arg = str_to_int(content)-1;
         if (arg < 0)
             throw runtime_error("invalid argument index");
-        return arg < params.size() ? params[arg] : String{};
+        if (arg < params.size())
+            res += params[arg];
+        return;
     }
     case Token::Type::RawEval:
-        return expand(content, context, shell_context);
+        expand_unprocessed(res, content, context, shell_context);
+        return;
     case Token::Type::Raw:
     case Token::Type::RawQuoted:
-        return content;
+        res += content;
+        return;
     default: kak_assert(false);
     }
-    return {};
+}
+
+String expand_token(const Token& token, const Context& context,
+                    const ShellContext& shell_context)
+{
+    String res;
+    expand_token(token, context, shell_context, res);
+    return res;
 }
 
 }
@@ -360,13 +391,169 @@ TokenList parse(StringView line)
     return result;
 }
 
-template<typename Postprocess>
-String expand_impl(StringView str, const Context& context,
-                   const ShellContext& shell_context,
-                   Postprocess postprocess)
+template TokenList parse<true>(StringView line);
+template TokenList parse<false>(StringView line);
+
+namespace
+{
+
+constexpr char script_cache_magic[4] = { 'k', 'a', 'k', 'c' };
+constexpr uint32_t script_cache_version = 1;
+
+struct ScriptCacheHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint64_t mtime_sec;
+    uint64_t mtime_nsec;
+    uint32_t token_count;
+};
+
+String script_cache_path(StringView path)
+{
+    String dir;
+    if (const char* cache_home = getenv("XDG_CACHE_HOME"))
+        dir = format("{}/kak", cache_home);
+    else if (const char* home = getenv("HOME"))
+        dir = format("{}/.cache/kak", home);
+    else
+        return {};
+    return format("{}/{}.program", dir, hex(hash_value(path)));
+}
+
+template<typename T>
+bool read_raw(FILE* file, T& val)
+{
+    return fread(&val, sizeof(T), 1, file) == 1;
+}
+
+template<typename T>
+bool write_raw(FILE* file, const T& val)
+{
+    return fwrite(&val, sizeof(T), 1, file) == 1;
+}
+
+bool read_string(FILE* file, String& str)
+{
+    uint32_t length;
+    if (not read_raw(file, length) or length > 1024 * 1024)
+        return false;
+    str.resize((int)length, 0);
+    return length == 0 or
+           fread(&str[0_byte], 1, length, file) == length;
+}
+
+bool write_string(FILE* file, StringView str)
+{
+    const uint32_t length = (uint32_t)(int)str.length();
+    return write_raw(file, length) and
+           (length == 0 or fwrite(str.data(), 1, length, file) == length);
+}
+
+bool load_cached_script(StringView cache_path, StringView path,
+                        const timespec& mtime, TokenList& tokens)
+{
+    FILE* file = fopen(cache_path.zstr(), "rb");
+    if (not file)
+        return false;
+    auto close_file = on_scope_end([=] { fclose(file); });
+
+    ScriptCacheHeader header;
+    if (not read_raw(file, header) or
+        memcmp(header.magic, script_cache_magic, sizeof(header.magic)) != 0 or
+        header.version != script_cache_version or
+        header.mtime_sec != (uint64_t)mtime.tv_sec or
+        header.mtime_nsec != (uint64_t)mtime.tv_nsec)
+        return false;
+
+    // guard against two paths hashing to the same cache file
+    String cached_for;
+    if (not read_string(file, cached_for) or cached_for != path)
+        return false;
+
+    tokens.reserve(header.token_count);
+    for (uint32_t i = 0; i < header.token_count; ++i)
+    {
+        uint8_t type;
+        int32_t begin, end, line, column;
+        String content;
+        if (not read_raw(file, type) or
+            type > (uint8_t)Token::Type::CommandSeparator or
+            not read_raw(file, begin) or not read_raw(file, end) or
+            not read_raw(file, line) or not read_raw(file, column) or
+            not read_string(file, content))
+        {
+            tokens.clear();
+            return false;
+        }
+        tokens.push_back({(Token::Type)type, begin, end,
+                          {line, column}, std::move(content)});
+    }
+    return true;
+}
+
+void store_cached_script(StringView cache_path, StringView path,
+                         const timespec& mtime, const TokenList& tokens)
+{
+    try
+    {
+        make_directory(split_path(cache_path).first, 0755);
+    }
+    catch (runtime_error&)
+    {
+        return;
+    }
+
+    // write to a temporary file then rename, so that concurrent kakoune
+    // processes never see a partially written cache
+    String temp_path = format("{}.{}", cache_path, getpid());
+    FILE* file = fopen(temp_path.c_str(), "wb");
+    if (not file)
+        return;
+
+    ScriptCacheHeader header;
+    memcpy(header.magic, script_cache_magic, sizeof(header.magic));
+    header.version = script_cache_version;
+    header.mtime_sec = (uint64_t)mtime.tv_sec;
+    header.mtime_nsec = (uint64_t)mtime.tv_nsec;
+    header.token_count = (uint32_t)tokens.size();
+
+    bool ok = write_raw(file, header) and write_string(file, path);
+    for (auto it = tokens.begin(); ok and it != tokens.end(); ++it)
+        ok = write_raw(file, (uint8_t)it->type) and
+             write_raw(file, (int32_t)(int)it->begin) and
+             write_raw(file, (int32_t)(int)it->end) and
+             write_raw(file, (int32_t)(int)it->coord.line) and
+             write_raw(file, (int32_t)(int)it->coord.column) and
+             write_string(file, it->content);
+
+    if (fclose(file) != 0 or not ok or
+        rename(temp_path.c_str(), cache_path.zstr()) != 0)
+        unlink(temp_path.c_str());
+}
+
+}
+
+TokenList parse_file(StringView path)
+{
+    struct stat st;
+    const String cache_path = script_cache_path(path);
+    if (cache_path.empty() or stat(path.zstr(), &st) != 0)
+        return parse<true>(read_file(path, true));
+
+    TokenList tokens;
+    if (load_cached_script(cache_path, path, st.st_mtim, tokens))
+        return tokens;
+
+    tokens = parse<true>(read_file(path, true));
+    store_cached_script(cache_path, path, st.st_mtim, tokens);
+    return tokens;
+}
+
+template<typename AppendToken>
+void expand_impl(String& res, StringView str, AppendToken&& append_token)
 {
     Reader reader{str};
-    String res;
     auto beg = 0_byte;
     while (reader)
     {
@@ -384,29 +571,62 @@ String expand_impl(StringView str, const Context& context,
         else if (c == '%')
         {
             res += reader.substr_from(beg);
-            res += postprocess(expand_token(parse_percent_token<true>(reader),
-                                            context, shell_context));
+            append_token(res, parse_percent_token<true>(reader));
             beg = (++reader).pos;
         }
         else
             ++reader;
     }
     res += reader.substr_from(beg);
-    return res;
+}
+
+namespace
+{
+
+bool has_expansion_marker(StringView str)
+{
+    return find_if(str, [](char c) { return c == '%' or c == '\\'; }) != str.end();
+}
+
+void expand_unprocessed(String& res, StringView str, const Context& context,
+                        const ShellContext& shell_context)
+{
+    expand_impl(res, str, [&](String& out, const Token& token) {
+        expand_token(token, context, shell_context, out); });
+}
+
 }
 
 String expand(StringView str, const Context& context,
               const ShellContext& shell_context)
 {
-    return expand_impl(str, context, shell_context, [](String s){ return s; });
+    if (not has_expansion_marker(str))
+        return str.str();
+
+    String res;
+    expand_unprocessed(res, str, context, shell_context);
+    return res;
 }
 
 String expand(StringView str, const Context& context,
               const ShellContext& shell_context,
               const std::function<String (String)>& postprocess)
 {
-    return expand_impl(str, context, shell_context,
-                       [&](String s) { return postprocess(std::move(s)); });
+    String res;
+    expand_impl(res, str, [&](String& out, const Token& token) {
+        out += postprocess(expand_token(token, context, shell_context)); });
+    return res;
+}
+
+StringView expand_to(String& buffer, StringView str, const Context& context,
+                     const ShellContext& shell_context)
+{
+    if (not has_expansion_marker(str))
+        return str;
+
+    buffer.clear();
+    expand_unprocessed(buffer, str, context, shell_context);
+    return buffer;
 }
 
 struct command_not_found : runtime_error
@@ -444,7 +664,8 @@ void CommandManager::execute_single_command(CommandParameters params,
     if (command_it == m_commands.end())
         throw command_not_found(params[0]);
 
-    const DebugFlags debug_flags = context.options()["debug"].get<DebugFlags>();
+    static const TypedOptionId<DebugFlags> debug_id{"debug"};
+    const DebugFlags debug_flags = context.options().get(debug_id);
     if (debug_flags & DebugFlags::Commands)
     {
         String repr_parameters;
@@ -456,6 +677,7 @@ void CommandManager::execute_single_command(CommandParameters params,
 
     try
     {
+        TraceScope trace{"command", params[0]};
         ParametersParser parameter_parser(param_view,
                                           command_it->value.param_desc);
         command_it->value.command(parameter_parser, context, shell_context);
@@ -470,42 +692,71 @@ void CommandManager::execute_single_command(CommandParameters params,
 void CommandManager::execute(StringView command_line,
                              Context& context, const ShellContext& shell_context)
 {
-    TokenList tokens = parse<true>(command_line);
+    execute(parse<true>(command_line), context, shell_context);
+}
+
+void CommandManager::execute(const TokenList& tokens,
+                             Context& context, const ShellContext& shell_context)
+{
     if (tokens.empty())
         return;
-    // Tokens are going to be read as a stack
-    std::reverse(tokens.begin(), tokens.end());
 
     DisplayCoord command_coord;
+    // the argument strings are reused from one command of the line to the
+    // next so that their heap buffers survive; command heavy scripts spend
+    // most of their time reallocating them otherwise
     Vector<String> params;
-    while (not tokens.empty())
+    size_t param_count = 0;
+    auto next_param = [&]() -> String& {
+        if (param_count == params.size())
+            params.emplace_back();
+        auto& param = params[param_count++];
+        param.clear();
+        return param;
+    };
+    TokenList expanded; // stack of tokens produced by shell expansion
+    size_t pos = 0;
+    while (pos != tokens.size() or not expanded.empty())
     {
-        Token token = std::move(tokens.back());
-        tokens.pop_back();
-        if (params.empty())
-            command_coord = token.coord;
+        Token storage;
+        const Token* token;
+        if (not expanded.empty())
+        {
+            storage = std::move(expanded.back());
+            expanded.pop_back();
+            token = &storage;
+        }
+        else
+            token = &tokens[pos++];
 
-        if (token.type == Token::Type::CommandSeparator)
+        if (param_count == 0)
+            command_coord = token->coord;
+
+        if (token->type == Token::Type::CommandSeparator)
         {
-            execute_single_command(params, context, shell_context, command_coord);
-            params.clear();
+            execute_single_command({params.data(), params.data() + param_count},
+                                   context, shell_context, command_coord);
+            param_count = 0;
         }
         // Shell expand are retokenized
-        else if (token.type == Token::Type::ShellExpand)
+        else if (token->type == Token::Type::ShellExpand)
         {
-            auto new_tokens = parse<true>(expand_token(token, context,
+            auto new_tokens = parse<true>(expand_token(*token, context,
                                                        shell_context));
-            tokens.insert(tokens.end(),
-                          std::make_move_iterator(new_tokens.rbegin()),
-                          std::make_move_iterator(new_tokens.rend()));
+            expanded.insert(expanded.end(),
+                            std::make_move_iterator(new_tokens.rbegin()),
+                            std::make_move_iterator(new_tokens.rend()));
+        }
+        else if (token->type == Token::Type::ArgExpand and token->content == '@')
+        {
+            for (auto& shell_param : shell_context.params)
+                next_param() += shell_param;
         }
-        else if (token.type == Token::Type::ArgExpand and token.content == '@')
-            params.insert(params.end(), shell_context.params.begin(),
-                          shell_context.params.end());
         else
-            params.push_back(expand_token(token, context, shell_context));
+            expand_token(*token, context, shell_context, next_param());
     }
-    execute_single_command(params, context, shell_context, command_coord);
+    execute_single_command({params.data(), params.data() + param_count},
+                           context, shell_context, command_coord);
 }
 
 Optional<CommandInfo> CommandManager::command_info(const Context& context, StringView command_line) const
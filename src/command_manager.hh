@@ -4,6 +4,7 @@
 #include "coord.hh"
 #include "completion.hh"
 #include "array_view.hh"
+#include "inline_vector.hh"
 #include "shell_manager.hh"
 #include "parameters_parser.hh"
 #include "string.hh"
@@ -61,17 +62,29 @@ struct Token
     String content;
 };
 
-using TokenList = Vector<Token>;
+// most command lines parse to a handful of tokens, keep them inline
+using TokenList = InlineVector<Token, 4>;
 
 template<bool throw_on_unterminated>
 TokenList parse(StringView line);
 
+// parse the script file at the given path, keeping a binary cache of
+// the resulting token list so that rc files are only re-tokenized when
+// they change; any cache problem silently falls back to parsing.
+TokenList parse_file(StringView path);
+
 class CommandManager : public Singleton<CommandManager>
 {
 public:
     void execute(StringView command_line, Context& context,
                  const ShellContext& shell_context = ShellContext{});
 
+    // execute an already parsed command line; parsing once with
+    // parse<true> and keeping the token list allows callers that run
+    // the same commands repeatedly, as hooks do, to skip the parser.
+    void execute(const TokenList& tokens, Context& context,
+                 const ShellContext& shell_context = ShellContext{});
+
     Completions complete(const Context& context, CompletionFlags flags,
                          StringView command_line, ByteCount cursor_pos);
 
@@ -84,6 +97,9 @@ public:
 
     bool command_defined(StringView command_name) const;
 
+    // clients defer drawing while commands execute, see Client::redraw_ifn
+    bool is_executing() const { return m_command_depth != 0; }
+
     void register_command(String command_name, Command command,
                           String docstring,
                           ParameterDesc param_desc,
@@ -126,6 +142,13 @@ String expand(StringView str, const Context& context,
               const ShellContext& shell_context,
               const std::function<String (String)>& postprocess);
 
+// expand str into the caller provided buffer, which is cleared first;
+// reusing the same buffer across calls amortizes its allocation. When
+// str contains no expansion marker it is returned unchanged and the
+// buffer is left untouched.
+StringView expand_to(String& buffer, StringView str, const Context& context,
+                     const ShellContext& shell_context = ShellContext{});
+
 }
 
 #endif // command_manager_hh_INCLUDED
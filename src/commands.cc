@@ -18,12 +18,14 @@
 #include "option_manager.hh"
 #include "option_types.hh"
 #include "parameters_parser.hh"
+#include "project_search.hh"
 #include "ranges.hh"
 #include "ranked_match.hh"
 #include "regex.hh"
 #include "register_manager.hh"
 #include "remote.hh"
 #include "shell_manager.hh"
+#include "trace.hh"
 #include "string.hh"
 #include "user_interface.hh"
 #include "window.hh"
@@ -317,17 +319,28 @@ void write_buffer(const ParametersParser& parser, Context& context, const ShellC
     auto filename = parser.positional_count() == 0 ?
                     buffer.name() : parse_filename(parser[0]);
 
+    const bool sync = (bool)parser.get_switch("sync");
     context.hooks().run_hook("BufWritePre", filename, context);
-    write_buffer_to_file(buffer, filename, force);
-    context.hooks().run_hook("BufWritePost", filename, context);
+    // big buffers get written from a worker thread so that clients do not
+    // freeze for the duration; BufWritePost then runs on completion
+    if (force or not write_buffer_to_file_async(buffer, filename, sync))
+    {
+        write_buffer_to_file(buffer, filename, force, sync);
+        context.hooks().run_hook("BufWritePost", filename, context);
+    }
 }
 
+const ParameterDesc write_params{
+    { { "sync", { false, "force the synchronization of the file onto the filesystem" } } },
+    ParameterDesc::Flags::None, 0, 1
+};
+
 const CommandDesc write_cmd = {
     "write",
     "w",
     "write [filename]: write the current buffer to its file "
     "or to [filename] if specified",
-    single_optional_param,
+    write_params,
     CommandFlags::None,
     CommandHelper{},
     filename_completer,
@@ -339,14 +352,48 @@ const CommandDesc force_write_cmd = {
     "w!",
     "write [filename]: write the current buffer to its file "
     "or to [filename] if specified, even when the file is write protected",
-    single_optional_param,
+    write_params,
     CommandFlags::None,
     CommandHelper{},
     filename_completer,
     write_buffer<true>,
 };
 
-void write_all_buffers(Context& context)
+const CommandDesc write_snapshot_cmd = {
+    "write-snapshot",
+    nullptr,
+    "write-snapshot <filename>: stream a snapshot of the current buffer "
+    "content to the given file or fifo in the background, without copying "
+    "the buffer content, marking the buffer saved or running write hooks",
+    single_param,
+    CommandFlags::None,
+    CommandHelper{},
+    filename_completer,
+    [](const ParametersParser& parser, Context& context, const ShellContext&)
+    {
+        write_buffer_snapshot(context.buffer(), parse_filename(parser[0]));
+    }
+};
+
+const CommandDesc write_changes_cmd = {
+    "write-changes",
+    nullptr,
+    "write-changes <timestamp> <filename>: write the buffer modifications "
+    "since <timestamp> to the given file or fifo in the background, as "
+    "line granular records an external tool can apply incrementally; the "
+    "first output line holds the timestamp to pass on the next call",
+    ParameterDesc{ {}, ParameterDesc::Flags::None, 2, 2 },
+    CommandFlags::None,
+    CommandHelper{},
+    CommandCompleter{},
+    [](const ParametersParser& parser, Context& context, const ShellContext&)
+    {
+        write_buffer_changes(context.buffer(), (size_t)std::max(0, str_to_int(parser[0])),
+                             parse_filename(parser[1]));
+    }
+};
+
+void write_all_buffers(Context& context, bool sync = false)
 {
     // Copy buffer list because hooks might be creating/deleting buffers
     Vector<SafePtr<Buffer>> buffers;
@@ -359,7 +406,7 @@ void write_all_buffers(Context& context)
             and !(buffer->flags() & Buffer::Flags::ReadOnly))
         {
             buffer->run_hook_in_own_context("BufWritePre", buffer->name(), context.name());
-            write_buffer_to_file(*buffer, buffer->name());
+            write_buffer_to_file(*buffer, buffer->name(), false, sync);
             buffer->run_hook_in_own_context("BufWritePost", buffer->name(), context.name());
         }
     }
@@ -369,15 +416,21 @@ const CommandDesc write_all_cmd = {
     "write-all",
     "wa",
     "write all buffers that are associated to a file",
-    no_params,
+    ParameterDesc{
+        { { "sync", { false, "force the synchronization of the files onto the filesystem" } } },
+        ParameterDesc::Flags::None, 0, 0
+    },
     CommandFlags::None,
     CommandHelper{},
     CommandCompleter{},
-    [](const ParametersParser&, Context& context, const ShellContext&){ write_all_buffers(context); }
+    [](const ParametersParser& parser, Context& context, const ShellContext&)
+    { write_all_buffers(context, (bool)parser.get_switch("sync")); }
 };
 
 static void ensure_all_buffers_are_saved()
 {
+    finish_pending_writes();
+
     auto is_modified = [](const std::unique_ptr<Buffer>& buf) {
         return (buf->flags() & Buffer::Flags::File) and buf->is_modified();
     };
@@ -772,7 +825,8 @@ static constexpr auto hooks = {
     "BufWritePre", "BufOpenFifo", "BufCloseFifo", "BufReadFifo", "BufSetOption",
     "InsertBegin", "InsertChar", "InsertDelete", "InsertEnd", "InsertIdle", "InsertKey",
     "InsertMove", "InsertCompletionHide", "InsertCompletionShow",
-    "KakBegin", "KakEnd", "FocusIn", "FocusOut", "RuntimeError", "PromptIdle",
+    "KakBegin", "KakEnd", "FocusIn", "FocusOut", "MemoryPressure",
+    "RuntimeError", "PromptIdle",
     "NormalBegin", "NormalEnd", "NormalIdle", "NormalKey", "RawKey",
     "WinClose", "WinCreate", "WinDisplay", "WinResize", "WinSetOption",
 };
@@ -960,34 +1014,64 @@ void define_command(const ParametersParser& parser, Context& context, const Shel
     else if (auto shell_cmd_opt = parser.get_switch("shell-candidates"))
     {
         String shell_cmd = shell_cmd_opt->str();
-        Vector<std::pair<String, UsedLetters>, MemoryDomain::Completion> candidates;
-        int token = -1;
-        completer = [shell_cmd, candidates, token](
+        struct ShellCandidates
+        {
+            Vector<std::pair<String, UsedLetters>, MemoryDomain::Completion> list;
+            int token = -1;
+            bool gathering = false;
+        };
+        auto candidates = std::make_shared<ShellCandidates>();
+        completer = [shell_cmd, candidates](
             const Context& context, CompletionFlags flags, CommandParameters params,
-            size_t token_to_complete, ByteCount pos_in_token) mutable
+            size_t token_to_complete, ByteCount pos_in_token)
         {
             if (flags & CompletionFlags::Start)
-                token = -1;
+                candidates->token = -1;
 
-            if (token != token_to_complete)
+            if (candidates->token != token_to_complete)
             {
                 ShellContext shell_context{
                     params,
                     { { "token_to_complete", to_string(token_to_complete) } }
                 };
-                String output = ShellManager::instance().eval(shell_cmd, context, {},
-                                                              ShellManager::Flags::WaitForStdout,
-                                                              shell_context).first;
-                candidates.clear();
-                for (auto c : output | split<StringView>('\n'))
-                    candidates.emplace_back(c.str(), used_letters(c));
-                token = token_to_complete;
+
+                auto fill = [candidates](StringView output, int token) {
+                    candidates->list.clear();
+                    for (auto c : output | split<StringView>('\n'))
+                        candidates->list.emplace_back(c.str(), used_letters(c));
+                    candidates->token = token;
+                };
+
+                // on automatic refresh, gather the candidates in the
+                // background; the shell command might be slow and the
+                // prompt has to keep echoing keys while it runs
+                if (flags & CompletionFlags::Fast)
+                {
+                    if (not candidates->gathering)
+                    {
+                        candidates->gathering = true;
+                        ShellManager::instance().spawn_async(shell_cmd, context, shell_context,
+                            [candidates, fill, token_to_complete, client_name = context.name()]
+                            (String output, int) {
+                                candidates->gathering = false;
+                                fill(output, token_to_complete);
+                                if (Client* client = ClientManager::instance().get_client_ifp(client_name))
+                                    client->input_handler().refresh_completions();
+                            });
+                    }
+                    return Completions{ 0_byte, pos_in_token };
+                }
+
+                fill(ShellManager::instance().eval(shell_cmd, context, {},
+                                                   ShellManager::Flags::WaitForStdout,
+                                                   shell_context).first,
+                     token_to_complete);
             }
 
             StringView query = params[token_to_complete].substr(0, pos_in_token);
             UsedLetters query_letters = used_letters(query);
             Vector<RankedMatch> matches;
-            for (const auto& candidate : candidates)
+            for (const auto& candidate : candidates->list)
             {
                 if (RankedMatch match{candidate.first, candidate.second, query, query_letters})
                     matches.push_back(match);
@@ -1112,6 +1196,45 @@ const CommandDesc echo_cmd = {
     }
 };
 
+const CommandDesc shell_async_cmd = {
+    "shell-async",
+    nullptr,
+    "shell-async <command> <callback>: run <command> in a shell without waiting\n"
+    "for it; once it finishes, <callback> is executed with the command standard\n"
+    "output as %arg{1} and its exit status as %arg{2}",
+    ParameterDesc{{}, ParameterDesc::Flags::None, 2, 2},
+    CommandFlags::None,
+    CommandHelper{},
+    CommandCompleter{},
+    [](const ParametersParser& parser, Context& context, const ShellContext& shell_context)
+    {
+        ShellManager::instance().spawn_async(parser[0], context, shell_context,
+            [callback = parser[1], client_name = context.name()]
+            (String output, int status) {
+                Vector<String> params{std::move(output), to_string(status)};
+                try
+                {
+                    // run in the context of the requesting client if it
+                    // still exists
+                    if (Client* client = ClientManager::instance().get_client_ifp(client_name))
+                        CommandManager::instance().execute(callback, client->context(),
+                                                           { params, {} });
+                    else
+                    {
+                        Context empty_context{Context::EmptyContextFlag{}};
+                        CommandManager::instance().execute(callback, empty_context,
+                                                           { params, {} });
+                    }
+                }
+                catch (runtime_error& error)
+                {
+                    write_to_debug_buffer(format("error in shell-async callback: {}",
+                                                 error.what()));
+                }
+            });
+    }
+};
+
 KeymapMode parse_keymap_mode(const String& str)
 {
     if (prefix_match("normal", str)) return KeymapMode::Normal;
@@ -1173,7 +1296,20 @@ const CommandDesc debug_cmd = {
             {
                 size_t count = domain_allocated_bytes[domain];
                 total += count;
-                write_to_debug_buffer(format("  {}: {}", domain_name((MemoryDomain)domain), count));
+                write_to_debug_buffer(format("  {}: {} (peak {}, {} allocations)",
+                                             domain_name((MemoryDomain)domain), count,
+                                             (size_t)domain_peak_bytes[domain],
+                                             (size_t)domain_allocation_count[domain]));
+                static constexpr const char* bucket_names[memory_histogram_buckets] =
+                    { "16", "64", "256", "1K", "4K", "16K", "64K", ">64K" };
+                String histogram;
+                for (int bucket = 0; bucket < memory_histogram_buckets; ++bucket)
+                {
+                    if (size_t n = domain_size_histogram[domain][bucket])
+                        histogram += format(" {}:{}", bucket_names[bucket], n);
+                }
+                if (not histogram.empty())
+                    write_to_debug_buffer(format("    sizes:{}", histogram));
             }
             write_to_debug_buffer(format("  Total: {}", total));
             #if defined(__GLIBC__) || defined(__CYGWIN__)
@@ -1225,10 +1361,9 @@ const CommandDesc source_cmd = {
     [](const ParametersParser& parser, Context& context, const ShellContext&)
     {
         String path = real_path(parse_filename(parser[0]));
-        String file_content = read_file(path, true);
         try
         {
-            CommandManager::instance().execute(file_content, context,
+            CommandManager::instance().execute(parse_file(path), context,
                                                {{}, {{"source", path}}});
         }
         catch (Kakoune::runtime_error& err)
@@ -1265,7 +1400,8 @@ const CommandDesc set_option_cmd = {
     "<scope> can be global, buffer, window, or current which refers to the narrowest "
     "scope the option is set in",
     ParameterDesc{
-        { { "add", { false, "add to option rather than replacing it" } } },
+        { { "add", { false, "add to option rather than replacing it" } },
+          { "remove", { false, "remove from option rather than replacing it" } } },
         ParameterDesc::Flags::SwitchesOnlyAtStart, 3, 3
     },
     CommandFlags::None,
@@ -1274,7 +1410,8 @@ const CommandDesc set_option_cmd = {
        CommandParameters params, size_t token_to_complete,
        ByteCount pos_in_token) -> Completions
     {
-        const bool add = params.size() > 1 and params[0] == "-add";
+        const bool add = params.size() > 1 and
+                         (params[0] == "-add" or params[0] == "-remove");
         const int start = add ? 1 : 0;
 
         static constexpr auto scopes = { "global", "buffer", "window", "current" };
@@ -1297,9 +1434,14 @@ const CommandDesc set_option_cmd = {
     },
     [](const ParametersParser& parser, Context& context, const ShellContext&)
     {
+        if (parser.get_switch("add") and parser.get_switch("remove"))
+            throw runtime_error{"-add and -remove are mutually exclusive"};
+
         Option& opt = get_options(parser[0], context, parser[1]).get_local_option(parser[1]);
         if (parser.get_switch("add"))
             opt.add_from_string(parser[2]);
+        else if (parser.get_switch("remove"))
+            opt.remove_from_string(parser[2]);
         else
             opt.set_from_string(parser[2]);
     }
@@ -1707,6 +1849,7 @@ const CommandDesc exec_string_cmd = {
             }
 
             ScopedEdition edition(context);
+            ScopedSetBool replaying(context.input_handler().replaying());
             for (auto& key : keys)
                 context.input_handler().handle_key(key);
         });
@@ -2018,6 +2161,24 @@ const CommandDesc set_face_cmd = {
     }
 };
 
+const CommandDesc force_redraw_cmd = {
+    "force-redraw",
+    nullptr,
+    "force-redraw: redraw the client immediately, opting out of the\n"
+    "redraw deferral done while commands execute",
+    no_params,
+    CommandFlags::None,
+    CommandHelper{},
+    CommandCompleter{},
+    [](const ParametersParser&, Context& context, const ShellContext&)
+    {
+        if (not context.has_client())
+            return;
+        context.client().force_redraw();
+        context.client().redraw_ifn();
+    }
+};
+
 const CommandDesc rename_client_cmd = {
     "rename-client",
     "nc",
@@ -2038,14 +2199,33 @@ const CommandDesc rename_client_cmd = {
 const CommandDesc set_register_cmd = {
     "set-register",
     "reg",
-    "set-register <name> <value>: set register <name> to <value>",
-    ParameterDesc{{}, ParameterDesc::Flags::SwitchesAsPositional, 2, 2},
+    "set-register <name> <values>...: set register <name> to <values>",
+    ParameterDesc{{}, ParameterDesc::Flags::SwitchesAsPositional, 1},
     CommandFlags::None,
     CommandHelper{},
     CommandCompleter{},
     [](const ParametersParser& parser, Context& context, const ShellContext&)
     {
-        RegisterManager::instance()[parser[0]].set(context, {parser[1]});
+        Vector<String> values;
+        for (size_t i = 1; i < parser.positional_count(); ++i)
+            values.push_back(parser[i]);
+        RegisterManager::instance()[parser[0]].set(context, values);
+    }
+};
+
+const CommandDesc restore_register_cmd = {
+    "restore-register",
+    nullptr,
+    "restore-register <name>: discard the current value of register <name> "
+    "and bring back the value it had before its last assignment",
+    single_param,
+    CommandFlags::None,
+    CommandHelper{},
+    CommandCompleter{},
+    [](const ParametersParser& parser, Context& context, const ShellContext&)
+    {
+        if (not RegisterManager::instance()[parser[0]].restore(context))
+            throw runtime_error(format("register '{}' has no history", parser[0]));
     }
 };
 
@@ -2090,6 +2270,45 @@ const CommandDesc change_directory_cmd = {
     }
 };
 
+const CommandDesc search_project_cmd = {
+    "search-project",
+    nullptr,
+    "search-project <pattern> [<directory>]: search the files under <directory> "
+    "(the current directory if unspecified) for <pattern> with the built-in "
+    "regex engine, streaming matches into the *grep* buffer",
+    ParameterDesc{{}, ParameterDesc::Flags::None, 1, 2},
+    CommandFlags::None,
+    CommandHelper{},
+    make_completer(
+         [](const Context&, CompletionFlags, const String&, ByteCount) -> Completions
+         { return {}; },
+         [](const Context& context, CompletionFlags flags,
+            const String& prefix, ByteCount cursor_pos) -> Completions {
+             return { 0_byte, cursor_pos,
+                      complete_filename(prefix,
+                                        context.options()["ignored_files"].get<Regex>(),
+                                        cursor_pos, FilenameFlags::OnlyDirectories) };
+        }),
+    [](const ParametersParser& parser, Context& context, const ShellContext&)
+    {
+        String root = parser.positional_count() == 2 ?
+            parse_filename(parser[1]) : "."_str;
+        while (root.length() > 1 and root.back() == '/')
+            root.resize(root.length() - 1, 0);
+
+        const int fd = spawn_project_search(parser[0], std::move(root));
+        Buffer* buffer = create_fifo_buffer("*grep*", fd, Buffer::Flags::None, true);
+
+        if (buffer != &context.buffer())
+        {
+            context.push_jump();
+            context.change_buffer(*buffer);
+        }
+        // reuse the filetype=grep highlighting and jump bindings
+        buffer->options().get_local_option("filetype").set<String>("grep");
+    }
+};
+
 const CommandDesc rename_session_cmd = {
     "rename-session",
     nullptr,
@@ -2105,6 +2324,134 @@ const CommandDesc rename_session_cmd = {
     }
 };
 
+const CommandDesc session_save_cmd = {
+    "session-save",
+    nullptr,
+    "session-save [<filename>]: write a script restoring the current session\n"
+    "\n"
+    "The script records the working directory, the global options, the user\n"
+    "modifiable registers and the edited files along with the selections\n"
+    "displayed in clients. Sourcing it in a fresh server (kak -e 'source\n"
+    "<filename>') rebuilds the session, buffer content being read back from\n"
+    "disk as the files get opened. <filename> defaults to a per session file\n"
+    "in the kakoune temporary directory.",
+    single_optional_param,
+    CommandFlags::None,
+    CommandHelper{},
+    filename_completer,
+    [](const ParametersParser& parser, Context& context, const ShellContext&)
+    {
+        auto quoted = [](StringView str) {
+            return format("'{}'", escape(str, "'", '\\'));
+        };
+
+        String script;
+
+        char cwd[1024];
+        if (::getcwd(cwd, 1024))
+            script += format("cd {}\n", quoted(cwd));
+
+        for (auto& option : GlobalScope::instance().options().flatten_options())
+        {
+            if (not (option->flags() & OptionFlags::Hidden))
+                script += format("set-option global {} {}\n", option->name(),
+                                 quoted(option->get_as_string()));
+        }
+
+        for (auto c : StringView{"abcdefghijklmnopqrstuvwxyz/\"|^@:"})
+        {
+            auto values = RegisterManager::instance()[c].get(context);
+            if (values.empty() or (values.size() == 1 and values[0].empty()))
+                continue;
+
+            script += format("set-register {}", quoted({&c, 1}));
+            for (auto& value : values)
+                script += format(" {}", quoted(value));
+            script += "\n";
+        }
+
+        auto& client_manager = ClientManager::instance();
+        auto& buffer_manager = BufferManager::instance();
+        // most recently used buffers come first, emit them last so that
+        // the restored buffer list ends up in the same order
+        for (auto it = buffer_manager.end(); it != buffer_manager.begin(); )
+        {
+            auto& buffer = *--it;
+            if (not (buffer->flags() & Buffer::Flags::File) or
+                buffer->flags() & Buffer::Flags::Debug)
+                continue;
+
+            const Client* client = nullptr;
+            for (auto& c : client_manager)
+            {
+                if (&c->context().buffer() == buffer.get())
+                    client = c.get();
+            }
+
+            if (client)
+            {
+                auto cursor = client->context().selections().main().cursor();
+                script += format("edit -existing {} {} {}\n",
+                                 quoted(buffer->name()),
+                                 cursor.line + 1, cursor.column + 1);
+                // the file might have changed on disk since, do not fail
+                // restoring the other buffers for stale selections.
+                script += "try %{ select " +
+                          selection_list_to_string(client->context().selections()) +
+                          " }\n";
+            }
+            else
+                script += format("edit -existing {}\n", quoted(buffer->name()));
+        }
+
+        if (context.has_buffer() and context.buffer().flags() & Buffer::Flags::File)
+            script += format("buffer {}\n", quoted(context.buffer().name()));
+
+        auto filename = parser.positional_count() > 0 ?
+            parse_filename(parser[0]) :
+            format("{}/kakoune/{}.session", tmpdir(), Server::instance().session());
+
+        int fd = open(filename.c_str(), O_CREAT | O_WRONLY | O_TRUNC, 0644);
+        if (fd < 0)
+            throw runtime_error(format("unable to open '{}'", filename));
+        auto close_fd = on_scope_end([fd]{ close(fd); });
+        write(fd, script);
+
+        context.print_status({ format("session saved to '{}'", filename),
+                               get_face("Information") });
+    }
+};
+
+const CommandDesc trace_start_cmd = {
+    "trace-start",
+    nullptr,
+    "trace-start <filename>: start recording a chrome trace of hook runs, "
+    "highlighter passes, command executions and redraws into <filename>, "
+    "loadable in chrome://tracing",
+    single_param,
+    CommandFlags::None,
+    CommandHelper{},
+    filename_completer,
+    [](const ParametersParser& parser, Context&, const ShellContext&)
+    {
+        trace_start(parse_filename(parser[0]));
+    }
+};
+
+const CommandDesc trace_stop_cmd = {
+    "trace-stop",
+    nullptr,
+    "trace-stop: stop recording the chrome trace and finalize the file",
+    no_params,
+    CommandFlags::None,
+    CommandHelper{},
+    CommandCompleter{},
+    [](const ParametersParser&, Context&, const ShellContext&)
+    {
+        trace_stop();
+    }
+};
+
 const CommandDesc fail_cmd = {
     "fail",
     nullptr,
@@ -2137,6 +2484,8 @@ void register_commands()
     register_command(force_edit_cmd);
     register_command(write_cmd);
     register_command(force_write_cmd);
+    register_command(write_snapshot_cmd);
+    register_command(write_changes_cmd);
     register_command(write_all_cmd);
     register_command(write_all_quit_cmd);
     register_command(kill_cmd);
@@ -2159,6 +2508,7 @@ void register_commands()
     register_command(alias_cmd);
     register_command(unalias_cmd);
     register_command(echo_cmd);
+    register_command(shell_async_cmd);
     register_command(debug_cmd);
     register_command(source_cmd);
     register_command(set_option_cmd);
@@ -2175,12 +2525,18 @@ void register_commands()
     register_command(info_cmd);
     register_command(try_catch_cmd);
     register_command(set_face_cmd);
+    register_command(force_redraw_cmd);
     register_command(rename_client_cmd);
     register_command(set_register_cmd);
+    register_command(restore_register_cmd);
     register_command(select_cmd);
     register_command(change_directory_cmd);
+    register_command(search_project_cmd);
     register_command(rename_session_cmd);
+    register_command(session_save_cmd);
     register_command(fail_cmd);
+    register_command(trace_start_cmd);
+    register_command(trace_stop_cmd);
 }
 
 }
@@ -4,6 +4,7 @@
 #include "client.hh"
 #include "face_registry.hh"
 #include "register_manager.hh"
+#include "scope.hh"
 #include "window.hh"
 
 namespace Kakoune
@@ -84,6 +85,44 @@ void JumpList::push(SelectionList jump)
                       end(m_jumps));
     m_jumps.push_back(jump);
     m_current = m_jumps.size();
+    trim();
+}
+
+void JumpList::trim()
+{
+    static const TypedOptionId<int> depth_id{"jump_list_depth"};
+    static const TypedOptionId<int> size_id{"jump_list_size"};
+    auto& options = GlobalScope::instance().options();
+    const size_t depth = (size_t)std::max(0, options.get(depth_id));
+    const size_t byte_budget = (size_t)std::max(0, options.get(size_id));
+
+    auto drop_oldest = [this] {
+        m_jumps.erase(m_jumps.begin());
+        if (m_current > 0)
+            --m_current;
+    };
+
+    while (m_jumps.size() > depth)
+        drop_oldest();
+    while (m_jumps.size() > 1 and content_bytes() > byte_budget)
+        drop_oldest();
+}
+
+size_t JumpList::content_bytes() const
+{
+    // the snapshots are copy-on-write and may share their selection
+    // storage, only count each storage once
+    size_t bytes = 0;
+    Vector<const void*, MemoryDomain::Selections> seen;
+    for (auto& jump : m_jumps)
+    {
+        const void* data = &jump[0];
+        if (contains(seen, data))
+            continue;
+        seen.push_back(data);
+        bytes += jump.size() * sizeof(Selection);
+    }
+    return bytes;
 }
 
 const SelectionList& JumpList::forward(Context& context)
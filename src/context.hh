@@ -32,6 +32,9 @@ struct JumpList
     friend bool operator!=(const JumpList& lhs, const JumpList& rhs) { return not (lhs == rhs); }
 
 private:
+    void trim();
+    size_t content_bytes() const;
+
     using Contents = Vector<SelectionList, MemoryDomain::Selections>;
     Contents m_jumps;
     size_t m_current = 0;
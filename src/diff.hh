@@ -20,8 +20,8 @@ struct Snake
     enum Op { Add, Del, RevAdd, RevDel } op;
 };
 
-template<typename Iterator, typename Equal>
-Snake find_end_snake_of_further_reaching_dpath(Iterator a, int N, Iterator b, int M,
+template<typename IteratorA, typename IteratorB, typename Equal>
+Snake find_end_snake_of_further_reaching_dpath(IteratorA a, int N, IteratorB b, int M,
                                                const int* V, const int D, const int k, Equal eq)
 {
     const bool add = k == -D or (k != D and V[k-1] < V[k+1]);
@@ -41,15 +41,16 @@ Snake find_end_snake_of_further_reaching_dpath(Iterator a, int N, Iterator b, in
     return { x, y, u, v, add ? Snake::Add : Snake::Del };
 }
 
-template<typename Iterator, typename Equal>
-Snake find_middle_snake(Iterator a, int N, Iterator b, int M,
+template<typename IteratorA, typename IteratorB, typename Equal>
+Snake find_middle_snake(IteratorA a, int N, IteratorB b, int M,
                         int* V1, int* V2, int cost_limit, Equal eq)
 {
     const int delta = N - M;
     V1[1] = 0;
     V2[1] = 0;
 
-    std::reverse_iterator<Iterator> ra{a + N}, rb{b + M};
+    std::reverse_iterator<IteratorA> ra{a + N};
+    std::reverse_iterator<IteratorB> rb{b + M};
     const int max_D = std::min((M + N + 1) / 2 + 1, cost_limit);
     for (int D = 0; D < max_D; ++D)
     {
@@ -117,9 +118,9 @@ inline void append_diff(Vector<Diff>& diffs, Diff diff)
         diffs.push_back(diff);
 }
 
-template<typename Iterator, typename Equal>
-void find_diff_rec(Iterator a, int begA, int endA,
-                   Iterator b, int begB, int endB,
+template<typename IteratorA, typename IteratorB, typename Equal>
+void find_diff_rec(IteratorA a, int begA, int endA,
+                   IteratorB b, int begB, int endB,
                    int* V1, int* V2, int cost_limit,
                    Equal eq, Vector<Diff>& diffs)
 {
@@ -168,8 +169,8 @@ void find_diff_rec(Iterator a, int begA, int endA,
     append_diff(diffs, {Diff::Keep, suffix_len, 0});
 }
 
-template<typename Iterator, typename Equal = std::equal_to<>>
-Vector<Diff> find_diff(Iterator a, int N, Iterator b, int M, Equal eq = Equal{})
+template<typename IteratorA, typename IteratorB, typename Equal = std::equal_to<>>
+Vector<Diff> find_diff(IteratorA a, int N, IteratorB b, int M, Equal eq = Equal{})
 {
     const int max = 2 * (N + M) + 1;
     Vector<int> data(2*max);
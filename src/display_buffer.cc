@@ -44,8 +44,17 @@ ColumnCount DisplayAtom::length() const
     switch (m_type)
     {
         case Range:
+        {
+            // an atom spanning its whole line is the common case, the
+            // line storage caches that width
+            auto& storage = m_buffer->line_storage(m_range.begin.line);
+            if (m_range.begin.column == 0 and
+                ((m_range.end.line == m_range.begin.line + 1 and m_range.end.column == 0) or
+                 (m_range.end.line == m_range.begin.line and m_range.end.column == storage->length)))
+                return storage->metrics().column_length;
             return utf8::column_distance(get_iterator(*m_buffer, m_range.begin),
                                          get_iterator(*m_buffer, m_range.end));
+        }
         case Text:
         case ReplacedRange:
             return m_text.column_length();
@@ -120,6 +129,26 @@ DisplayLine::iterator DisplayLine::insert(iterator it, DisplayAtom atom)
     return m_atoms.insert(it, std::move(atom));
 }
 
+void DisplayLine::reset(DisplayAtom atom)
+{
+    m_atoms.clear();
+    m_range = { { INT_MAX, INT_MAX }, { INT_MIN, INT_MIN } };
+    push_back(std::move(atom));
+}
+
+DisplayLine::iterator DisplayLine::insert(iterator it, std::initializer_list<DisplayAtom> atoms)
+{
+    for (auto& atom : atoms)
+    {
+        if (atom.has_buffer_range())
+        {
+            m_range.begin  = std::min(m_range.begin, atom.begin());
+            m_range.end = std::max(m_range.end, atom.end());
+        }
+    }
+    return m_atoms.insert(it, atoms.begin(), atoms.end());
+}
+
 void DisplayLine::push_back(DisplayAtom atom)
 {
     if (atom.has_buffer_range())
@@ -137,6 +166,12 @@ DisplayLine::iterator DisplayLine::erase(iterator beg, iterator end)
     return res;
 }
 
+void DisplayLine::swap_atoms(AtomList& atoms)
+{
+    std::swap(m_atoms, atoms);
+    compute_range();
+}
+
 void DisplayLine::optimize()
 {
     if (m_atoms.empty())
@@ -4,6 +4,7 @@
 #include "face.hh"
 #include "hash.hh"
 #include "coord.hh"
+#include "inline_vector.hh"
 #include "string.hh"
 #include "vector.hh"
 #include "hash_map.hh"
@@ -93,7 +94,8 @@ private:
     String m_text;
 };
 
-using AtomList = Vector<DisplayAtom, MemoryDomain::Display>;
+// most lines hold very few atoms, keep that many inline
+using AtomList = InlineVector<DisplayAtom, 4, MemoryDomain::Display>;
 
 class DisplayLine : public UseMemoryDomain<MemoryDomain::Display>
 {
@@ -118,6 +120,10 @@ public:
     ColumnCount length() const;
     const BufferRange& range() const { return m_range; }
 
+    // Reinitialize the line with the given atom, keeping the
+    // already allocated atom storage around
+    void reset(DisplayAtom atom);
+
     // Split atom pointed by it at buffer coord pos,
     // returns an iterator to the first atom
     iterator split(iterator it, BufferCoord pos);
@@ -127,9 +133,15 @@ public:
     iterator split(iterator it, ColumnCount pos);
 
     iterator insert(iterator it, DisplayAtom atom);
+    iterator insert(iterator it, std::initializer_list<DisplayAtom> atoms);
     iterator erase(iterator beg, iterator end);
     void     push_back(DisplayAtom atom);
 
+    // Replace the atom list wholesale, swapping the given list storage
+    // in; lets highlighters rebuild a line in a single pass instead of
+    // splitting atoms in place
+    void     swap_atoms(AtomList& atoms);
+
     // remove first_col from the begining of the line, and make sure
     // the line is less that col_count character
     void trim(ColumnCount first_col, ColumnCount col_count);
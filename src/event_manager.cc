@@ -1,22 +1,31 @@
 #include "event_manager.hh"
 
+#include "exception.hh"
 #include "flags.hh"
 #include "ranges.hh"
+#include "string_utils.hh"
 
+#include <cerrno>
+#include <cstring>
 #include <unistd.h>
 
+#ifdef KAK_USE_EPOLL
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#endif
+
 namespace Kakoune
 {
 
 FDWatcher::FDWatcher(int fd, FdEvents events, Callback callback)
     : m_fd{fd}, m_events{events}, m_callback{std::move(callback)}
 {
-    EventManager::instance().m_fd_watchers.push_back(this);
+    EventManager::instance().register_watcher(*this);
 }
 
 FDWatcher::~FDWatcher()
 {
-    unordered_erase(EventManager::instance().m_fd_watchers, this);
+    EventManager::instance().unregister_watcher(*this);
 }
 
 void FDWatcher::run(FdEvents events, EventMode mode)
@@ -28,22 +37,51 @@ void FDWatcher::close_fd()
 {
     if (m_fd != -1)
     {
-        close(m_fd);
+        close(m_fd); // also removes the fd from the epoll set
         m_fd = -1;
+        m_registered_events = FdEvents::None;
     }
 }
 
+void FDWatcher::disable()
+{
+    if (m_fd != -1 and EventManager::has_instance())
+        EventManager::instance().unregister_fd(*this);
+    m_fd = -1;
+}
+
 Timer::Timer(TimePoint date, Callback callback, EventMode mode)
     : m_date{date}, m_callback{std::move(callback)}, m_mode(mode)
 {
     if (m_callback and EventManager::has_instance())
+    {
         EventManager::instance().m_timers.push_back(this);
+        if (m_date != TimePoint::max())
+            EventManager::instance().schedule_timer(*this);
+    }
 }
 
 Timer::~Timer()
 {
     if (m_callback and EventManager::has_instance())
-        unordered_erase(EventManager::instance().m_timers, this);
+    {
+        auto& event_manager = EventManager::instance();
+        unordered_erase(event_manager.m_timers, this);
+        // entries cannot cheaply be removed from the heap, disown them so
+        // they get dropped when they surface
+        for (auto& entry : event_manager.m_timer_heap)
+        {
+            if (entry.timer == this)
+                entry.timer = nullptr;
+        }
+    }
+}
+
+void Timer::set_next_date(TimePoint date)
+{
+    m_date = date;
+    if (m_callback and date != TimePoint::max() and EventManager::has_instance())
+        EventManager::instance().schedule_timer(*this);
 }
 
 void Timer::run(EventMode mode)
@@ -55,18 +93,323 @@ void Timer::run(EventMode mode)
         m_callback(*this);
     }
     else // try again a little later
-        m_date = Clock::now() + std::chrono::milliseconds{10};
+        set_next_date(Clock::now() + std::chrono::milliseconds{10});
 }
 
+// node of the posted completion stack, allocated by the posting thread
+// and freed by the main thread once the function ran
+struct EventManager::PostedFunc : UseMemoryDomain<MemoryDomain::Events>
+{
+    PostedFunc(std::function<void()> f) : func{std::move(f)} {}
+
+    std::function<void()> func;
+    PostedFunc* next = nullptr;
+};
+
 EventManager::EventManager()
 {
     FD_ZERO(&m_forced_fd);
+#ifdef KAK_USE_EPOLL
+    m_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (m_epoll_fd == -1)
+        throw runtime_error(format("unable to create epoll instance: {}", strerror(errno)));
+    m_wakeup_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (m_wakeup_fd == -1)
+        throw runtime_error(format("unable to create eventfd: {}", strerror(errno)));
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.fd = m_wakeup_fd;
+    epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, m_wakeup_fd, &ev);
+#else
+    if (::pipe(m_wakeup_fds) != 0)
+        throw runtime_error(format("unable to create wake up pipe: {}", strerror(errno)));
+#endif
 }
 
 EventManager::~EventManager()
 {
     kak_assert(m_fd_watchers.empty());
     kak_assert(m_timers.empty());
+    // completions posted after the last drain are dropped, anything that
+    // mattered was waited upon before tearing the event loop down
+    for (PostedFunc* node = m_posted.exchange(nullptr); node != nullptr; )
+    {
+        PostedFunc* next = node->next;
+        delete node;
+        node = next;
+    }
+#ifdef KAK_USE_EPOLL
+    close(m_wakeup_fd);
+    close(m_epoll_fd);
+#else
+    close(m_wakeup_fds[0]);
+    close(m_wakeup_fds[1]);
+#endif
+}
+
+void EventManager::post(std::function<void()> func)
+{
+    auto* node = new PostedFunc{std::move(func)};
+    PostedFunc* head = m_posted.load(std::memory_order_relaxed);
+    do
+    {
+        node->next = head;
+    } while (not m_posted.compare_exchange_weak(head, node,
+                                                std::memory_order_release,
+                                                std::memory_order_relaxed));
+    if (head == nullptr) // the stack was empty, the main loop needs a wake up
+    {
+#ifdef KAK_USE_EPOLL
+        const uint64_t one = 1;
+        (void)::write(m_wakeup_fd, &one, sizeof one);
+#else
+        const char c = 0;
+        (void)::write(m_wakeup_fds[1], &c, 1);
+#endif
+    }
+}
+
+void EventManager::drain_posted()
+{
+    PostedFunc* node = m_posted.exchange(nullptr, std::memory_order_acquire);
+    if (node == nullptr)
+        return;
+    // the stack pops newest first, reverse it back into submission order
+    PostedFunc* head = nullptr;
+    while (node != nullptr)
+    {
+        PostedFunc* next = node->next;
+        node->next = head;
+        head = node;
+        node = next;
+    }
+    while (head != nullptr)
+    {
+        std::unique_ptr<PostedFunc> cur{head};
+        head = head->next;
+        cur->func();
+    }
+}
+
+bool EventManager::later_date(const TimerEntry& lhs, const TimerEntry& rhs)
+{
+    return lhs.date > rhs.date;
+}
+
+void EventManager::schedule_timer(Timer& timer)
+{
+    m_timer_heap.push_back({timer.next_date(), &timer});
+    std::push_heap(m_timer_heap.begin(), m_timer_heap.end(), later_date);
+}
+
+TimePoint EventManager::next_timer_date()
+{
+    // drop disowned entries and the ones a reschedule superseded
+    while (not m_timer_heap.empty())
+    {
+        const auto& top = m_timer_heap.front();
+        if (top.timer != nullptr and top.timer->next_date() == top.date)
+            return top.date;
+        std::pop_heap(m_timer_heap.begin(), m_timer_heap.end(), later_date);
+        m_timer_heap.pop_back();
+    }
+    return TimePoint::max();
+}
+
+void EventManager::run_due_timers(EventMode mode)
+{
+    const TimePoint now = Clock::now();
+    Vector<Timer*, MemoryDomain::Events> due;
+    while (not m_timer_heap.empty())
+    {
+        const TimerEntry top = m_timer_heap.front();
+        const bool stale = top.timer == nullptr or
+                           top.timer->next_date() != top.date;
+        if (not stale and top.date > now)
+            break;
+        std::pop_heap(m_timer_heap.begin(), m_timer_heap.end(), later_date);
+        m_timer_heap.pop_back();
+        if (not stale)
+            due.push_back(top.timer);
+    }
+    // a timer callback may destroy or reschedule any other due timer,
+    // re-validate against the registry before each run
+    for (auto* timer : due)
+    {
+        if (contains(m_timers, timer) and timer->next_date() <= now)
+            timer->run(mode);
+    }
+}
+
+#ifdef KAK_USE_EPOLL
+
+static uint32_t to_epoll_events(FdEvents events)
+{
+    return (events & FdEvents::Read   ? (uint32_t)EPOLLIN  : 0) |
+           (events & FdEvents::Write  ? (uint32_t)EPOLLOUT : 0) |
+           (events & FdEvents::Except ? (uint32_t)EPOLLPRI : 0);
+}
+
+void EventManager::register_watcher(FDWatcher& watcher)
+{
+    m_fd_watchers.push_back(&watcher);
+    const int fd = watcher.fd();
+    if (fd == -1)
+        return;
+
+    epoll_event ev{};
+    ev.events = to_epoll_events(watcher.events());
+    ev.data.fd = fd;
+    if (epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, fd, &ev) == 0)
+        watcher.m_registered_events = watcher.events();
+    else if (errno == EPERM)
+    {
+        m_always_ready.push_back(&watcher);
+        watcher.m_registered_events = watcher.events();
+    }
+}
+
+void EventManager::unregister_fd(FDWatcher& watcher)
+{
+    const int fd = watcher.fd();
+    epoll_ctl(m_epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+    watcher.m_registered_events = FdEvents::None;
+    auto it = find(m_always_ready, &watcher);
+    if (it != m_always_ready.end())
+        m_always_ready.erase(it);
+
+    // a fd can be watched by two watchers for a short while, as when a
+    // client socket is handed over from the server accepter to its
+    // RemoteUI; give the registration to the remaining watcher.
+    auto other = find_if(m_fd_watchers, [&](FDWatcher* w) {
+        return w != &watcher and w->fd() == fd; });
+    if (other != m_fd_watchers.end())
+    {
+        epoll_event ev{};
+        ev.events = to_epoll_events((*other)->events());
+        ev.data.fd = fd;
+        if (epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, fd, &ev) == 0)
+            (*other)->m_registered_events = (*other)->events();
+    }
+}
+
+void EventManager::unregister_watcher(FDWatcher& watcher)
+{
+    if (watcher.fd() != -1)
+        unregister_fd(watcher);
+    unordered_erase(m_fd_watchers, &watcher);
+}
+
+void EventManager::handle_next_events(EventMode mode, sigset_t* sigmask)
+{
+    // masks are mutated directly through FDWatcher::events(), re-sync the
+    // persistent registrations that changed since the last iteration
+    for (auto& watcher : m_fd_watchers)
+    {
+        const int fd = watcher->fd();
+        if (fd == -1 or watcher->m_registered_events == watcher->events())
+            continue;
+        epoll_event ev{};
+        ev.events = to_epoll_events(watcher->events());
+        ev.data.fd = fd;
+        if (epoll_ctl(m_epoll_fd, EPOLL_CTL_MOD, fd, &ev) == 0 or errno == EPERM)
+            watcher->m_registered_events = watcher->events();
+    }
+
+    int timeout = -1;
+    const auto next_date = next_timer_date();
+    if (not m_always_ready.empty())
+        timeout = 0;
+    else if (next_date != TimePoint::max())
+    {
+        using namespace std::chrono;
+        auto msecs = duration_cast<milliseconds>(next_date - Clock::now()) + m_timer_coalescing;
+        timeout = (int)std::max<long long>(0, msecs.count());
+    }
+
+    constexpr int max_events = 64;
+    epoll_event events[max_events];
+    const int res = epoll_pwait(m_epoll_fd, events, max_events, timeout, sigmask);
+
+    // copy forced fds *after* the wait, so that signal handlers can write
+    // to m_forced_fd, interrupt the wait, and directly be serviced.
+    const bool has_forced = m_has_forced != 0;
+    fd_set forced;
+    FD_ZERO(&forced);
+    if (has_forced)
+    {
+        forced = m_forced_fd;
+        FD_ZERO(&m_forced_fd);
+        m_has_forced = 0;
+    }
+
+    for (int i = 0; res > 0 and i < res; ++i)
+    {
+        const int fd = events[i].data.fd;
+        if (fd == m_wakeup_fd)
+        {
+            uint64_t count;
+            (void)::read(m_wakeup_fd, &count, sizeof count);
+            continue;
+        }
+        auto ev = (events[i].events & EPOLLIN  ? FdEvents::Read   : FdEvents::None) |
+                  (events[i].events & EPOLLOUT ? FdEvents::Write  : FdEvents::None) |
+                  (events[i].events & EPOLLPRI ? FdEvents::Except : FdEvents::None);
+        if (has_forced and fd < FD_SETSIZE and FD_ISSET(fd, &forced))
+        {
+            ev |= FdEvents::Read;
+            FD_CLR(fd, &forced);
+        }
+
+        auto it = find_if(m_fd_watchers,
+                          [fd](const FDWatcher* w){ return w->fd() == fd; });
+        if (it == m_fd_watchers.end())
+            continue;
+        if (events[i].events & (EPOLLERR | EPOLLHUP)) // wake the watcher so it notices the condition
+            ev |= (*it)->events();
+        if (ev != FdEvents::None)
+            (*it)->run(ev, mode);
+    }
+
+    if (has_forced)
+    {
+        for (int fd = 0; fd < FD_SETSIZE; ++fd)
+        {
+            if (not FD_ISSET(fd, &forced))
+                continue;
+            auto it = find_if(m_fd_watchers,
+                              [fd](const FDWatcher* w){ return w->fd() == fd; });
+            if (it != m_fd_watchers.end())
+                (*it)->run(FdEvents::Read, mode);
+        }
+    }
+
+    auto always_ready = m_always_ready; // copy in case it gets mutated
+    for (auto& watcher : always_ready)
+    {
+        if (contains(m_always_ready, watcher) and watcher->fd() != -1 and
+            watcher->events() != FdEvents::None)
+            watcher->run(watcher->events(), mode);
+    }
+
+    drain_posted();
+    run_due_timers(mode);
+}
+
+#else
+
+void EventManager::register_watcher(FDWatcher& watcher)
+{
+    m_fd_watchers.push_back(&watcher);
+}
+
+void EventManager::unregister_fd(FDWatcher&)
+{
+}
+
+void EventManager::unregister_watcher(FDWatcher& watcher)
+{
+    unordered_erase(m_fd_watchers, &watcher);
 }
 
 void EventManager::handle_next_events(EventMode mode, sigset_t* sigmask)
@@ -89,24 +432,19 @@ void EventManager::handle_next_events(EventMode mode, sigset_t* sigmask)
                 FD_SET(fd, &efds);
         }
     }
+    max_fd = std::max(m_wakeup_fds[0], max_fd);
+    FD_SET(m_wakeup_fds[0], &rfds);
 
     bool with_timeout = false;
     timespec ts{};
-    if (not m_timers.empty())
+    const auto next_date = next_timer_date();
+    if (next_date != TimePoint::max())
     {
-        auto next_date = (*std::min_element(
-            m_timers.begin(), m_timers.end(), [](Timer* lhs, Timer* rhs) {
-                return lhs->next_date() < rhs->next_date();
-        }))->next_date();
-
-        if (next_date != TimePoint::max())
-        {
-            with_timeout = true;
-            using namespace std::chrono; using ns = std::chrono::nanoseconds;
-            auto nsecs = std::max(ns(0), duration_cast<ns>(next_date - Clock::now()));
-            auto secs = duration_cast<seconds>(nsecs);
-            ts = timespec{ (time_t)secs.count(), (long)(nsecs - secs).count() };
-        }
+        with_timeout = true;
+        using namespace std::chrono; using ns = std::chrono::nanoseconds;
+        auto nsecs = std::max(ns(0), duration_cast<ns>(next_date + m_timer_coalescing - Clock::now()));
+        auto secs = duration_cast<seconds>(nsecs);
+        ts = timespec{ (time_t)secs.count(), (long)(nsecs - secs).count() };
     }
     int res = pselect(max_fd + 1, &rfds, &wfds, &efds,
                       with_timeout ? &ts : nullptr, sigmask);
@@ -116,6 +454,13 @@ void EventManager::handle_next_events(EventMode mode, sigset_t* sigmask)
     fd_set forced = m_forced_fd;
     FD_ZERO(&m_forced_fd);
 
+    if (res > 0 and FD_ISSET(m_wakeup_fds[0], &rfds))
+    {
+        char c;
+        (void)::read(m_wakeup_fds[0], &c, 1);
+        FD_CLR(m_wakeup_fds[0], &rfds);
+    }
+
     for (int fd = 0; fd < max_fd + 1; ++fd)
     {
         auto events =  FD_ISSET(fd, &forced) ? FdEvents::Read : FdEvents::None;
@@ -133,18 +478,18 @@ void EventManager::handle_next_events(EventMode mode, sigset_t* sigmask)
         }
     }
 
-    TimePoint now = Clock::now();
-    auto timers = m_timers; // copy timers in case m_timers gets mutated
-    for (auto& timer : timers)
-    {
-        if (contains(m_timers, timer) and timer->next_date() <= now)
-            timer->run(mode);
-    }
+    drain_posted();
+    run_due_timers(mode);
 }
 
+#endif
+
 void EventManager::force_signal(int fd)
 {
     FD_SET(fd, &m_forced_fd);
+#ifdef KAK_USE_EPOLL
+    m_has_forced = 1;
+#endif
 }
 
 SignalHandler set_signal_handler(int signum, SignalHandler handler)
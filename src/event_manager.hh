@@ -6,11 +6,19 @@
 #include "utils.hh"
 #include "vector.hh"
 
+#include <atomic>
 #include <functional>
 
 #include <sys/select.h>
 #include <csignal>
 
+// On Linux file descriptors are registered persistently in an epoll
+// instance instead of rebuilding fd_sets for pselect on each iteration.
+// Define KAK_NO_EPOLL to fall back to the pselect implementation.
+#if defined(__linux__) and not defined(KAK_NO_EPOLL)
+#define KAK_USE_EPOLL
+#endif
+
 namespace Kakoune
 {
 
@@ -46,11 +54,16 @@ public:
     void run(FdEvents events, EventMode mode);
 
     void close_fd();
-    void disable() { m_fd = -1; }
+    void disable();
 
 private:
+    friend class EventManager;
+
     int      m_fd;
     FdEvents m_events;
+    // events the backend was last told about, used to re-sync persistent
+    // registrations after the mask was mutated through events()
+    FdEvents m_registered_events = FdEvents::None;
     Callback m_callback;
 };
 
@@ -66,7 +79,7 @@ public:
     ~Timer();
 
     TimePoint next_date() const { return m_date; }
-    void      set_next_date(TimePoint date) { m_date = date; }
+    void      set_next_date(TimePoint date);
     void run(EventMode mode);
 
 private:
@@ -92,12 +105,56 @@ public:
     // on next handle_next_events call.
     void force_signal(int fd);
 
+    // timers becoming ready within this window of the chosen wake up date
+    // are serviced together, trading a little timer latency for fewer
+    // wake ups
+    void set_timer_coalescing(std::chrono::milliseconds window) { m_timer_coalescing = window; }
+
+    // run func on the main thread during the next handle_next_events
+    // call; safe to call from worker threads. Only the first completion
+    // posted since the last drain wakes the loop up, so a burst of
+    // completions costs a single wake up.
+    void post(std::function<void()> func);
+
 private:
     friend class FDWatcher;
     friend class Timer;
+
+    void register_watcher(FDWatcher& watcher);
+    void unregister_watcher(FDWatcher& watcher);
+    void unregister_fd(FDWatcher& watcher);
+
+    void schedule_timer(Timer& timer);
+    TimePoint next_timer_date();
+    void run_due_timers(EventMode mode);
+
     Vector<FDWatcher*, MemoryDomain::Events> m_fd_watchers;
     Vector<Timer*, MemoryDomain::Events>     m_timers;
+
+    // min heap on date; entries are append only and dropped lazily once
+    // they no longer match their timer, so rescheduling a timer is
+    // O(log n) instead of a heap wide search
+    struct TimerEntry { TimePoint date; Timer* timer; };
+    static bool later_date(const TimerEntry& lhs, const TimerEntry& rhs);
+    Vector<TimerEntry, MemoryDomain::Events> m_timer_heap;
+    std::chrono::milliseconds m_timer_coalescing{1};
+
+    // completions posted from worker threads, a lock free multi producer
+    // stack the main thread drains each iteration
+    struct PostedFunc;
+    void drain_posted();
+    std::atomic<PostedFunc*> m_posted{nullptr};
+
     fd_set m_forced_fd;
+#ifdef KAK_USE_EPOLL
+    int m_epoll_fd = -1;
+    int m_wakeup_fd = -1; // eventfd signalled when completions get posted
+    // fds epoll refuses to poll (regular files), always ready as with pselect
+    Vector<FDWatcher*, MemoryDomain::Events> m_always_ready;
+    volatile sig_atomic_t m_has_forced = 0;
+#else
+    int m_wakeup_fds[2] = {-1, -1}; // self pipe standing in for the eventfd
+#endif
 
     TimePoint m_last;
 };
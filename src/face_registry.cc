@@ -73,14 +73,30 @@ String to_string(Face face)
 
 Face FaceRegistry::operator[](const String& facedesc)
 {
+    auto cached = m_cache.find(facedesc);
+    if (cached != m_cache.end())
+        return cached->value;
+
     auto it = m_aliases.find(facedesc);
-    while (it != m_aliases.end())
-    {
-        if (it->value.alias.empty())
-            return it->value.face;
+    while (it != m_aliases.end() and not it->value.alias.empty())
         it = m_aliases.find(it->value.alias);
+
+    // parse_face throws on invalid descriptions, only cache resolutions
+    const Face res = it != m_aliases.end() ? it->value.face
+                                           : parse_face(facedesc);
+    m_cache.insert({facedesc, res});
+    return res;
+}
+
+Face FaceRegistry::operator[](const FaceRef& face)
+{
+    if (face.m_version != m_version)
+    {
+        face.m_face = face.m_facedesc.empty() ? Face{}
+                                              : (*this)[face.m_facedesc];
+        face.m_version = m_version;
     }
-    return parse_face(facedesc);
+    return face.m_face;
 }
 
 void FaceRegistry::register_alias(const String& name, const String& facedesc,
@@ -97,6 +113,9 @@ void FaceRegistry::register_alias(const String& name, const String& facedesc,
     if (name == facedesc)
         throw runtime_error(format("cannot alias face '{}' to itself", name));
 
+    m_cache.clear(); // cached resolutions may go through this alias
+    ++m_version;
+
     FaceOrAlias& alias = m_aliases[name];
     auto it = m_aliases.find(facedesc);
     if (it != m_aliases.end())
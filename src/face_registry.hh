@@ -9,12 +9,33 @@
 namespace Kakoune
 {
 
+// Face reference holding a cached resolution of its description,
+// revalidated only when the registry changes. Rendering code resolves
+// the same descriptions on every frame; with a FaceRef the steady state
+// is a version check instead of a hash lookup.
+class FaceRef
+{
+public:
+    FaceRef() = default;
+    FaceRef(String facedesc) : m_facedesc{std::move(facedesc)} {}
+
+    const String& facedesc() const { return m_facedesc; }
+
+private:
+    friend class FaceRegistry;
+
+    String m_facedesc;
+    mutable Face m_face{};
+    mutable size_t m_version = 0;
+};
+
 class FaceRegistry : public Singleton<FaceRegistry>
 {
 public:
     FaceRegistry();
 
     Face operator[](const String& facedesc);
+    Face operator[](const FaceRef& face);
     void register_alias(const String& name, const String& facedesc,
                         bool override = false);
 
@@ -32,6 +53,12 @@ public:
 
 private:
     AliasMap m_aliases;
+    // resolution cache, highlighters look the same descriptions up on
+    // every frame; invalidated whenever an alias changes
+    HashMap<String, Face, MemoryDomain::Faces> m_cache;
+    // bumped whenever an alias changes, FaceRef caches are revalidated
+    // against it
+    size_t m_version = 1;
 };
 
 inline Face get_face(const String& facedesc)
@@ -41,6 +68,13 @@ inline Face get_face(const String& facedesc)
     return Face{};
 }
 
+inline Face get_face(const FaceRef& face)
+{
+    if (FaceRegistry::has_instance())
+        return FaceRegistry::instance()[face];
+    return Face{};
+}
+
 String to_string(Face face);
 
 }
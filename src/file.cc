@@ -2,14 +2,19 @@
 
 #include "assert.hh"
 #include "buffer.hh"
+#include "buffer_utils.hh"
+#include "event_manager.hh"
 #include "exception.hh"
 #include "flags.hh"
+#include "line_modification.hh"
+#include "ranges.hh"
 #include "ranked_match.hh"
 #include "regex.hh"
 #include "string.hh"
 #include "unicode.hh"
 
 #include <cerrno>
+#include <thread>
 #include <cstring>
 #include <sys/mman.h>
 #include <fcntl.h>
@@ -17,6 +22,11 @@
 #include <dirent.h>
 #include <cstdlib>
 #include <sys/select.h>
+#include <sys/uio.h>
+
+#if defined(__linux__)
+#include <sys/inotify.h>
+#endif
 
 #if defined(__FreeBSD__)
 #include <sys/sysctl.h>
@@ -25,6 +35,7 @@
 #if defined(__APPLE__)
 #include <mach-o/dyld.h>
 #define st_mtim st_mtimespec
+#define fdatasync fsync
 #endif
 
 #if defined(__HAIKU__)
@@ -233,57 +244,374 @@ void write(int fd, StringView data)
     }
 }
 
-void write_buffer_to_fd(Buffer& buffer, int fd)
+// Batches lines into large vectored writes instead of issuing one (or
+// two, for eol conversion) syscall per line. Returns 0 or the errno of
+// the first failed syscall; this also runs on the asynchronous write
+// worker thread where exceptions (and the Strings they would carry)
+// cannot be used.
+template<typename GetLine>
+static int do_write_lines(int fd, LineCount line_count, StringView eoldata,
+                          bool bom, GetLine&& get_line) noexcept
 {
-    auto eolformat = buffer.options()["eolformat"].get<EolFormat>();
-    StringView eoldata;
-    if (eolformat == EolFormat::Crlf)
-        eoldata = "\r\n";
-    else
-        eoldata = "\n";
-
-    if (buffer.options()["BOM"].get<ByteOrderMark>() == ByteOrderMark::Utf8)
-        if (::write(fd, "\xEF\xBB\xBF", 3) < 0)
-            throw runtime_error(format("unable to write data to the buffer (fd: {}; errno: {})", fd, ::strerror(errno)));
+    if (bom and ::write(fd, "\xEF\xBB\xBF", 3) < 0)
+        return errno;
+
+    constexpr int max_iov = 256; // modest stack footprint, well below IOV_MAX
+    iovec iov[max_iov];
+    int iov_count = 0;
+    int error = 0;
+    auto flush = [&]() -> bool {
+        for (int i = 0; i < iov_count; )
+        {
+            ssize_t res = ::writev(fd, iov + i, iov_count - i);
+            if (res < 0)
+            {
+                error = errno;
+                return false;
+            }
+            while (res > 0) // skip iovecs that got fully written
+            {
+                if ((size_t)res >= iov[i].iov_len)
+                {
+                    res -= iov[i].iov_len;
+                    ++i;
+                }
+                else // partial write, retry the remainder of this iovec
+                {
+                    iov[i].iov_base = (char*)iov[i].iov_base + res;
+                    iov[i].iov_len -= res;
+                    res = 0;
+                }
+            }
+        }
+        iov_count = 0;
+        return true;
+    };
 
-    for (LineCount i = 0; i < buffer.line_count(); ++i)
+    const bool crlf = eoldata.length() == 2;
+    for (LineCount i = 0; i < line_count; ++i)
     {
         // end of lines are written according to eolformat but always
         // stored as \n
-        StringView linedata = buffer[i];
-        write(fd, linedata.substr(0, linedata.length()-1));
-        write(fd, eoldata);
+        StringView linedata = get_line(i);
+        if (crlf)
+        {
+            iov[iov_count++] = { (void*)linedata.data(), (size_t)(int)(linedata.length() - 1) };
+            iov[iov_count++] = { (void*)eoldata.data(), (size_t)(int)eoldata.length() };
+        }
+        else
+            iov[iov_count++] = { (void*)linedata.data(), (size_t)(int)linedata.length() };
+
+        if (iov_count + 2 > max_iov and not flush())
+            return error;
     }
+    if (not flush())
+        return error;
+    return 0;
+}
+
+void write_buffer_to_fd(Buffer& buffer, int fd)
+{
+    const bool crlf = buffer.options()["eolformat"].get<EolFormat>() == EolFormat::Crlf;
+    const bool bom = buffer.options()["BOM"].get<ByteOrderMark>() == ByteOrderMark::Utf8;
+
+    if (int error = do_write_lines(fd, buffer.line_count(), crlf ? "\r\n" : "\n", bom,
+                                   [&buffer](LineCount i) { return buffer[i]; }))
+        throw file_access_error(fd, strerror(error));
 }
 
-void write_buffer_to_file(Buffer& buffer, StringView filename, bool force)
+namespace
 {
+
+constexpr ByteCount async_write_threshold = 4 * 1024 * 1024;
+
+// Saving goes through a temporary file in the target directory that gets
+// renamed over the destination once fully written: an interrupted or failed
+// write cannot destroy the previous content, and saving a buffer on top of
+// the very file that backs its memory mapped lines (see open_file_buffer)
+// cannot truncate that mapping while the lines are still being read from it.
+int open_temp_output(StringView target, bool force, char (&temp_path)[PATH_MAX])
+{
+    String path = real_path(target); // replace what a symlink points at
+    StringView dir, file;
+    std::tie(dir, file) = split_path(path);
+
     struct stat st;
-    auto zfilename = filename.zstr();
+    const bool exists = ::stat(path.c_str(), &st) == 0;
+    if (exists and not force and ::access(path.c_str(), W_OK) != 0)
+        throw file_access_error(target, strerror(errno));
+
+    if (dir.empty())
+        format_to(temp_path, ".{}.kak.XXXXXX", file);
+    else
+        format_to(temp_path, "{}/.{}.kak.XXXXXX", dir, file);
+
+    const int fd = mkstemp(temp_path);
+    if (fd < 0)
+        throw file_access_error(target, strerror(errno));
+
+    mode_t mode = 0644;
+    if (exists)
+    {
+        mode = st.st_mode;
+        // keep the file owned by its current owner when possible, the
+        // rename would otherwise silently reassign it to us
+        (void)::fchown(fd, st.st_uid, st.st_gid);
+    }
+    else
+    {
+        const mode_t mask = umask(0); umask(mask);
+        mode = 0666 & ~mask;
+    }
+    ::fchmod(fd, mode);
+    return fd;
+}
+
+void replace_with_temp(StringView target, const char* temp_path)
+{
+    if (::rename(temp_path, real_path(target).c_str()) < 0)
+    {
+        ::unlink(temp_path);
+        throw file_access_error(target, strerror(errno));
+    }
+}
+
+// An in flight asynchronous save. The snapshot owns references to the
+// immutable line storage; it is built and destroyed on the main thread
+// as StringData refcounts are not atomic, the worker only ever reads
+// through it.
+struct AsyncWrite : UseMemoryDomain<MemoryDomain::Events>
+{
+    SafePtr<Buffer> buffer;
+    String filename;
+    String temp_filename; // temporary file renamed over filename on success
+    BufferLines snapshot;
+    size_t timestamp; // buffer timestamp the snapshot was taken at
+    bool crlf;
+    bool bom;
+    bool sync;
+    int error = 0; // errno of the first failed syscall in the worker
+    // identifies this write in its posted completion, which may run
+    // after finish_pending_writes already reaped the entry
+    size_t id;
+    std::thread thread;
+};
+
+Vector<std::unique_ptr<AsyncWrite>, MemoryDomain::Events>& pending_writes()
+{
+    static Vector<std::unique_ptr<AsyncWrite>, MemoryDomain::Events> writes;
+    return writes;
+}
+
+void finalize_write(AsyncWrite& async)
+{
+    async.thread.join();
+
+    auto buffer = std::move(async.buffer);
+    auto filename = std::move(async.filename);
+    auto temp_filename = std::move(async.temp_filename);
+    const size_t timestamp = async.timestamp;
+    int error = async.error;
+
+    auto& writes = pending_writes();
+    writes.erase(find_if(writes, [&](auto& write) { return write.get() == &async; }));
 
-    if (force)
+    // snapshot writes go directly to their destination and have no
+    // temporary file to put in place
+    if (not temp_filename.empty())
     {
-        if (::stat(zfilename, &st) == 0)
+        if (error == 0 and ::rename(temp_filename.c_str(), real_path(filename).c_str()) < 0)
+            error = errno;
+        if (error != 0)
+            ::unlink(temp_filename.c_str());
+    }
+
+    if (error != 0)
+        write_to_debug_buffer(format("error writing '{}': {}", filename, strerror(error)));
+    else if (buffer)
+    {
+        // only mark the buffer saved if it was not modified while the
+        // snapshot was being written
+        if ((buffer->flags() & Buffer::Flags::File) and
+            buffer->timestamp() == timestamp and
+            real_path(filename) == real_path(buffer->name()))
+            buffer->notify_saved();
+        buffer->run_hook_in_own_context("BufWritePost", filename);
+    }
+}
+
+// Start the worker thread for an already filled AsyncWrite; a negative
+// fd makes the worker open filename itself, which for a fifo blocks (in
+// the worker) until a reader shows up.
+void start_async_write(std::unique_ptr<AsyncWrite> async, int fd)
+{
+    static size_t next_id = 0;
+    async->id = ++next_id;
+
+    AsyncWrite* ptr = async.get();
+    async->thread = std::thread([ptr, fd] {
+        int out_fd = fd;
+        if (out_fd < 0)
+            out_fd = ::open(ptr->filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (out_fd < 0)
+            ptr->error = errno;
+        else
         {
-            if (::chmod(zfilename, st.st_mode | S_IWUSR) < 0)
-                throw runtime_error("couldn't change file permissions");
+            ptr->error = do_write_lines(out_fd, LineCount{(int)ptr->snapshot.size()},
+                                        ptr->crlf ? "\r\n" : "\n", ptr->bom,
+                                        [ptr](LineCount i)
+                                        { return ptr->snapshot[(int)i]->strview(); });
+            if (ptr->error == 0 and ptr->sync and ::fdatasync(out_fd) < 0)
+                ptr->error = errno;
+            close(out_fd);
         }
+        // the completion looks the entry up by id as finish_pending_writes
+        // may have finalized it synchronously before the post gets drained
+        EventManager::instance().post([id = ptr->id] {
+            auto& writes = pending_writes();
+            auto it = find_if(writes, [id](auto& write) { return write->id == id; });
+            if (it != writes.end())
+                finalize_write(**it);
+        });
+    });
+
+    pending_writes().push_back(std::move(async));
+}
+
+}
+
+void finish_pending_writes(Buffer* buffer)
+{
+    auto& writes = pending_writes();
+    for (size_t i = 0; i < writes.size(); )
+    {
+        if (buffer and writes[i]->buffer.get() != buffer)
+            ++i;
         else
-            force = false;
+            finalize_write(*writes[i]); // removes the entry
     }
-    auto restore_mode = on_scope_end([&]{
-        if (force and ::chmod(zfilename, st.st_mode) < 0)
-            throw runtime_error("couldn't restore file permissions");
-    });
+}
 
-    int fd = open(zfilename, O_CREAT | O_WRONLY | O_TRUNC, 0644);
-    if (fd == -1)
-        throw file_access_error(filename, strerror(errno));
+bool write_buffer_to_file_async(Buffer& buffer, StringView filename, bool sync)
+{
+    if (not EventManager::has_instance() or
+        buffer.distance({0,0}, buffer.end_coord()) < async_write_threshold)
+        return false;
 
+    finish_pending_writes(&buffer); // serialize writes of the same buffer
+
+    char temp_path[PATH_MAX];
+    const int fd = open_temp_output(filename, false, temp_path);
+
+    auto async = std::make_unique<AsyncWrite>();
+    async->buffer = SafePtr<Buffer>{&buffer};
+    async->filename = filename.str();
+    async->temp_filename = temp_path;
+    async->snapshot.reserve((size_t)(int)buffer.line_count());
+    for (LineCount i = 0; i < buffer.line_count(); ++i)
+        async->snapshot.push_back(buffer.line_storage(i));
+    async->timestamp = buffer.timestamp();
+    async->crlf = buffer.options()["eolformat"].get<EolFormat>() == EolFormat::Crlf;
+    async->bom = buffer.options()["BOM"].get<ByteOrderMark>() == ByteOrderMark::Utf8;
+    async->sync = sync;
+
+    start_async_write(std::move(async), fd);
+    return true;
+}
+
+void write_buffer_snapshot(Buffer& buffer, StringView filename)
+{
+    const bool crlf = buffer.options()["eolformat"].get<EolFormat>() == EolFormat::Crlf;
+    const bool bom = buffer.options()["BOM"].get<ByteOrderMark>() == ByteOrderMark::Utf8;
+
+    // without an event loop there is nothing to post completion to,
+    // write synchronously
+    if (not EventManager::has_instance())
+    {
+        String path = filename.str();
+        const int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+            throw file_access_error(filename, strerror(errno));
+        auto guard = on_scope_end([&]{ close(fd); });
+        if (int error = do_write_lines(fd, buffer.line_count(), crlf ? "\r\n" : "\n", bom,
+                                       [&buffer](LineCount i) { return buffer[i]; }))
+            throw file_access_error(filename, strerror(error));
+        return;
+    }
+
+    auto async = std::make_unique<AsyncWrite>();
+    async->filename = filename.str();
+    async->snapshot.reserve((size_t)(int)buffer.line_count());
+    for (LineCount i = 0; i < buffer.line_count(); ++i)
+        async->snapshot.push_back(buffer.line_storage(i));
+    async->timestamp = buffer.timestamp();
+    async->crlf = crlf;
+    async->bom = bom;
+    async->sync = false;
+
+    start_async_write(std::move(async), -1);
+}
+
+void write_buffer_changes(Buffer& buffer, size_t timestamp, StringView filename)
+{
+    // records always use plain \n endings and no BOM whatever the buffer
+    // eolformat, they describe the buffer content, not the file on disk
+    BufferLines payload;
+    payload.push_back(StringData::create({format("timestamp {}\n", buffer.timestamp())}));
+    for (auto& modif : compute_line_modifications(buffer, timestamp))
     {
-        auto close_fd = on_scope_end([fd]{ close(fd); });
+        payload.push_back(StringData::create({format("{} {} {} {}\n",
+                                                     (int)modif.old_line + 1,
+                                                     (int)modif.new_line + 1,
+                                                     (int)modif.num_removed,
+                                                     (int)modif.num_added)}));
+        for (LineCount line = 0; line < modif.num_added; ++line)
+            payload.push_back(buffer.line_storage(modif.new_line + line));
+    }
+
+    // without an event loop there is nothing to post completion to,
+    // write synchronously
+    if (not EventManager::has_instance())
+    {
+        String path = filename.str();
+        const int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+            throw file_access_error(filename, strerror(errno));
+        auto guard = on_scope_end([&]{ close(fd); });
+        if (int error = do_write_lines(fd, LineCount{(int)payload.size()}, "\n", false,
+                                       [&payload](LineCount i) { return payload[(int)i]->strview(); }))
+            throw file_access_error(filename, strerror(error));
+        return;
+    }
+
+    auto async = std::make_unique<AsyncWrite>();
+    async->filename = filename.str();
+    async->snapshot = std::move(payload);
+    async->timestamp = buffer.timestamp();
+    async->crlf = false;
+    async->bom = false;
+    async->sync = false;
+
+    start_async_write(std::move(async), -1);
+}
+
+void write_buffer_to_file(Buffer& buffer, StringView filename, bool force, bool sync)
+{
+    finish_pending_writes(&buffer);
+
+    char temp_path[PATH_MAX];
+    const int fd = open_temp_output(filename, force, temp_path);
+
+    bool written = false;
+    {
+        auto guard = on_scope_end([&]{ close(fd); if (not written) ::unlink(temp_path); });
         write_buffer_to_fd(buffer, fd);
+        // a single sync at the end amortizes a lot better than O_SYNC
+        if (sync and ::fdatasync(fd) < 0)
+            throw file_access_error(filename, strerror(errno));
+        written = true;
     }
+    replace_with_temp(filename, temp_path);
 
     if ((buffer.flags() & Buffer::Flags::File) and
         real_path(filename) == real_path(buffer.name()))
@@ -362,41 +690,150 @@ void make_directory(StringView dir, mode_t mode)
     }
 }
 
-template<typename Filter>
-Vector<String> list_files(StringView dirname, Filter filter)
+struct DirectoryEntry
 {
-    char buffer[PATH_MAX+1];
-    format_to(buffer, "{}", dirname);
-    DIR* dir = opendir(dirname.empty() ? "./" : buffer);
+    String name;
+    mode_t mode;
+};
+using DirectoryListing = Vector<DirectoryEntry, MemoryDomain::Completion>;
+
+// Directory listings are cached between completion requests, as reading
+// and stating thousands of entries on every keypress is what makes
+// filename completion crawl on slow filesystems. On Linux an inotify
+// watch on each cached directory invalidates its listing as soon as the
+// directory changes; elsewhere, or when adding a watch fails, the
+// directory modification time is compared on each access instead.
+static const DirectoryListing& read_directory(StringView dirname)
+{
+    struct CachedListing
+    {
+        int wd = -1;
+        timespec mtim = InvalidTime;
+        bool valid = false;
+        DirectoryListing entries;
+    };
+    static HashMap<String, CachedListing, MemoryDomain::Completion> cache;
+
+#if defined(__linux__)
+    static const int inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotify_fd != -1)
+    {
+        char buf[4096];
+        ssize_t len;
+        while ((len = read(inotify_fd, buf, sizeof(buf))) > 0)
+        {
+            for (char* ptr = buf; ptr < buf + len; )
+            {
+                auto* event = reinterpret_cast<const inotify_event*>(ptr);
+                ptr += sizeof(inotify_event) + event->len;
+                for (auto& item : cache)
+                {
+                    if (item.value.wd != event->wd and
+                        not (event->mask & IN_Q_OVERFLOW))
+                        continue;
+                    item.value.valid = false;
+                    if (event->mask & (IN_IGNORED | IN_Q_OVERFLOW))
+                        item.value.wd = -1;
+                }
+            }
+        }
+    }
+#else
+    static constexpr int inotify_fd = -1;
+#endif
+
+    // relative paths depend on the current directory, which can change
+    char cwd[PATH_MAX];
+    String key = (dirname.empty() or dirname[0_byte] != '/') ?
+        format("{}/{}", getcwd(cwd, sizeof(cwd)) ? cwd : "", dirname) :
+        dirname.str();
+    while (key.length() > 1 and key.back() == '/')
+        key = key.substr(0, key.length() - 1).str();
+
+    auto it = cache.find(key);
+    if (it != cache.end() and it->value.valid)
+    {
+        if (it->value.wd != -1)
+            return it->value.entries;
+        // no watch on this directory, compare its modification time
+        struct stat st;
+        if (stat(key.c_str(), &st) == 0 and
+            memcmp(&st.st_mtim, &it->value.mtim, sizeof(timespec)) == 0)
+            return it->value.entries;
+    }
+
+    if (it == cache.end())
+    {
+        if (cache.size() >= 128)
+        {
+#if defined(__linux__)
+            for (auto& item : cache)
+            {
+                if (item.value.wd != -1)
+                    inotify_rm_watch(inotify_fd, item.value.wd);
+            }
+#endif
+            cache.clear();
+        }
+        cache.insert({key, {}});
+        it = cache.find(key);
+    }
+
+    auto& listing = it->value;
+    listing.valid = true;
+    listing.entries.clear();
+
+#if defined(__linux__)
+    if (inotify_fd != -1 and listing.wd == -1)
+        listing.wd = inotify_add_watch(inotify_fd, key.c_str(),
+                                       IN_CREATE | IN_DELETE | IN_MOVED_FROM |
+                                       IN_MOVED_TO | IN_CLOSE_WRITE |
+                                       IN_ATTRIB | IN_ONLYDIR);
+#endif
+
+    struct stat st;
+    listing.mtim = stat(key.c_str(), &st) == 0 ? st.st_mtim : InvalidTime;
+
+    DIR* dir = opendir(key.c_str());
     if (not dir)
-        return {};
+        return listing.entries;
 
     auto close_dir = on_scope_end([dir]{ closedir(dir); });
 
-    Vector<String> result;
+    char buffer[PATH_MAX+1];
     while (dirent* entry = readdir(dir))
     {
         StringView filename = entry->d_name;
         if (filename.empty())
             continue;
 
-        struct stat st;
-        auto fmt_str = (dirname.empty() or dirname.back() == '/') ? "{}{}" : "{}/{}";
-        format_to(buffer, fmt_str, dirname, filename);
-        if (stat(buffer, &st) != 0 or not filter(*entry, st))
+        format_to(buffer, key.back() == '/' ? "{}{}" : "{}/{}", key, filename);
+        if (stat(buffer, &st) != 0)
+            continue;
+
+        listing.entries.push_back({filename.str(), st.st_mode});
+    }
+    return listing.entries;
+}
+
+template<typename Filter>
+Vector<String> list_files(StringView dirname, Filter filter)
+{
+    Vector<String> result;
+    for (auto& entry : read_directory(dirname))
+    {
+        if (not filter(entry.name, entry.mode))
             continue;
 
-        if (S_ISDIR(st.st_mode))
-            filename = format_to(buffer, "{}/", filename);
-        result.push_back(filename.str());
+        result.push_back(S_ISDIR(entry.mode) ? entry.name + "/" : entry.name);
     }
     return result;
 }
 
 Vector<String> list_files(StringView directory)
 {
-    return list_files(directory, [](const dirent& entry, const struct stat&) {
-                          return StringView{entry.d_name}.substr(0_byte, 1_byte) != ".";
+    return list_files(directory, [](StringView name, mode_t) {
+                          return name.substr(0_byte, 1_byte) != ".";
                       });
 }
 
@@ -421,11 +858,10 @@ CandidateList complete_filename(StringView prefix, const Regex& ignored_regex,
         not regex_match(fileprefix.begin(), fileprefix.end(), ignored_regex);
     const bool only_dirs = (flags & FilenameFlags::OnlyDirectories);
 
-    auto filter = [&ignored_regex, check_ignored_regex, only_dirs](const dirent& entry, struct stat& st)
+    auto filter = [&ignored_regex, check_ignored_regex, only_dirs](StringView name, mode_t mode)
     {
-        StringView name{entry.d_name};
         return (not check_ignored_regex or not regex_match(name.begin(), name.end(), ignored_regex)) and
-               (not only_dirs or S_ISDIR(st.st_mode));
+               (not only_dirs or S_ISDIR(mode));
     };
     auto files = list_files(parsed_dirname, filter);
     Vector<RankedMatch> matches;
@@ -447,12 +883,12 @@ CandidateList complete_command(StringView prefix, ByteCount cursor_pos)
 
     if (not dirname.empty())
     {
-        auto filter = [&dirname](const dirent& entry, const struct stat& st)
+        auto filter = [](StringView, mode_t mode)
         {
-            bool executable = (st.st_mode & S_IXUSR)
-                            | (st.st_mode & S_IXGRP)
-                            | (st.st_mode & S_IXOTH);
-            return S_ISDIR(st.st_mode) or (S_ISREG(st.st_mode) and executable);
+            bool executable = (mode & S_IXUSR)
+                            | (mode & S_IXGRP)
+                            | (mode & S_IXOTH);
+            return S_ISDIR(mode) or (S_ISREG(mode) and executable);
         };
         auto files = list_files(dirname, filter);
         Vector<RankedMatch> matches;
@@ -486,11 +922,11 @@ CandidateList complete_command(StringView prefix, ByteCount cursor_pos)
         auto& cache = command_cache[dirname];
         if (memcmp(&cache.mtim, &st.st_mtim, sizeof(TimeSpec)) != 0)
         {
-            auto filter = [&dirname](const dirent& entry, const struct stat& st) {
-                bool executable = (st.st_mode & S_IXUSR)
-                                | (st.st_mode & S_IXGRP)
-                                | (st.st_mode & S_IXOTH);
-                return S_ISREG(st.st_mode) and executable;
+            auto filter = [](StringView, mode_t mode) {
+                bool executable = (mode & S_IXUSR)
+                                | (mode & S_IXGRP)
+                                | (mode & S_IXOTH);
+                return S_ISREG(mode) and executable;
             };
 
             cache.commands = list_files(dirname, filter);
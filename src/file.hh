@@ -3,6 +3,7 @@
 
 #include "array_view.hh"
 #include "meta.hh"
+#include "ref_ptr.hh"
 #include "units.hh"
 #include "vector.hh"
 
@@ -37,7 +38,9 @@ String read_fd(int fd, bool text = false);
 String read_file(StringView filename, bool text = false);
 void write(int fd, StringView data);
 
-struct MappedFile
+// RefCountable so that buffer lines can reference the mapped data directly
+// and keep the mapping alive until the last one dies
+struct MappedFile : RefCountable
 {
     MappedFile(StringView filename);
     ~MappedFile();
@@ -49,10 +52,40 @@ struct MappedFile
     struct stat st {};
 };
 
-void write_buffer_to_file(Buffer& buffer, StringView filename, bool force = false);
+void write_buffer_to_file(Buffer& buffer, StringView filename,
+                          bool force = false, bool sync = false);
 void write_buffer_to_fd(Buffer& buffer, int fd);
 void write_buffer_to_backup_file(Buffer& buffer);
 
+// Tries to write the buffer from a worker thread: the immutable line
+// storage is snapshotted and flushed without blocking the event loop,
+// with notify_saved and the BufWritePost hook deferred to completion.
+// Returns false when the write cannot or should not happen
+// asynchronously (small buffer, no event loop), without writing anything.
+bool write_buffer_to_file_async(Buffer& buffer, StringView filename,
+                                bool sync = false);
+
+// Streams a snapshot of the buffer content to the file or fifo at
+// filename from a worker thread. The snapshot pins the current line
+// storage, so the buffer content is never copied and later edits do not
+// affect what gets written; the buffer is not marked saved and no write
+// hooks run.
+void write_buffer_snapshot(Buffer& buffer, StringView filename);
+
+// Streams the buffer modifications since the given timestamp to the file
+// or fifo at filename from a worker thread, as line granular records an
+// external tool can apply to its copy of the old content. The output
+// starts with a "timestamp <n>" line giving the value to pass on the
+// next call, followed for each modification by a
+// "<old line> <new line> <removed count> <added count>" header (1 based
+// lines) and the added lines of text, pinned from the line storage
+// without copies.
+void write_buffer_changes(Buffer& buffer, size_t timestamp, StringView filename);
+
+// Completes in flight asynchronous writes of the given buffer, or of all
+// buffers when given nullptr.
+void finish_pending_writes(Buffer* buffer = nullptr);
+
 String find_file(StringView filename, ConstArrayView<String> paths);
 bool file_exists(StringView filename);
 
@@ -0,0 +1,113 @@
+#include "file_watcher.hh"
+
+#include "buffer.hh"
+#include "event_manager.hh"
+
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <sys/inotify.h>
+#endif
+
+namespace Kakoune
+{
+
+#if defined(__linux__)
+
+FileWatcher::FileWatcher()
+    : m_fd{inotify_init1(IN_NONBLOCK | IN_CLOEXEC)}
+{
+    if (m_fd != -1 and EventManager::has_instance())
+        m_fd_watcher.reset(new FDWatcher{m_fd, FdEvents::Read,
+            [this](FDWatcher&, FdEvents, EventMode) { read_events(); }});
+}
+
+FileWatcher::~FileWatcher()
+{
+    if (m_fd != -1)
+        close(m_fd);
+}
+
+void FileWatcher::watch(Buffer& buffer)
+{
+    if (m_fd == -1 or not (buffer.flags() & Buffer::Flags::File))
+        return;
+
+    unwatch(buffer);
+
+    const int wd = inotify_add_watch(m_fd, buffer.name().c_str(),
+                                     IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB |
+                                     IN_MOVE_SELF | IN_DELETE_SELF);
+    if (wd != -1)
+        m_watches.insert({&buffer, Watch{wd}});
+}
+
+void FileWatcher::unwatch(Buffer& buffer)
+{
+    const Buffer* key = &buffer;
+    auto it = m_watches.find(key);
+    if (it == m_watches.end())
+        return;
+
+    if (not it->value.stale)
+        inotify_rm_watch(m_fd, it->value.wd);
+    m_watches.remove(key);
+}
+
+bool FileWatcher::maybe_modified(const Buffer& buffer)
+{
+    read_events();
+
+    auto it = m_watches.find(&buffer);
+    if (it == m_watches.end())
+        return true;
+
+    if (it->value.stale) // rearm, the file might have been recreated
+    {
+        watch(const_cast<Buffer&>(buffer));
+        return true;
+    }
+
+    const bool modified = it->value.modified;
+    it->value.modified = false;
+    return modified;
+}
+
+void FileWatcher::read_events()
+{
+    if (m_fd == -1)
+        return;
+
+    char buf[4096];
+    ssize_t len;
+    while ((len = read(m_fd, buf, sizeof(buf))) > 0)
+    {
+        for (char* ptr = buf; ptr < buf + len; )
+        {
+            auto* event = reinterpret_cast<const inotify_event*>(ptr);
+            ptr += sizeof(inotify_event) + event->len;
+
+            auto it = find_if(m_watches, [&](auto& item)
+                              { return item.value.wd == event->wd; });
+            if (it == m_watches.end())
+                continue;
+
+            it->value.modified = true;
+            if (event->mask & (IN_MOVE_SELF | IN_DELETE_SELF | IN_IGNORED))
+                it->value.stale = true;
+        }
+    }
+}
+
+#else
+
+FileWatcher::FileWatcher() {}
+FileWatcher::~FileWatcher() {}
+void FileWatcher::watch(Buffer&) {}
+void FileWatcher::unwatch(Buffer&) {}
+bool FileWatcher::maybe_modified(const Buffer&) { return true; }
+void FileWatcher::read_events() {}
+
+#endif
+
+}
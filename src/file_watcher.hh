@@ -0,0 +1,51 @@
+#ifndef file_watcher_hh_INCLUDED
+#define file_watcher_hh_INCLUDED
+
+#include "hash_map.hh"
+#include "utils.hh"
+
+#include <memory>
+
+namespace Kakoune
+{
+
+class Buffer;
+class FDWatcher;
+
+// The FileWatcher tracks external modifications to the files backing
+// buffers using the native filesystem notification facility (inotify
+// on Linux), so that checking for external modifications does not need
+// to stat() buffer files on every idle cycle. On systems without such
+// a facility every file is always considered possibly modified, which
+// falls back to the timestamp comparison behaviour.
+class FileWatcher : public Singleton<FileWatcher>
+{
+public:
+    FileWatcher();
+    ~FileWatcher();
+
+    void watch(Buffer& buffer);
+    void unwatch(Buffer& buffer);
+
+    // Returns false only if we know the file backing this buffer was not
+    // touched since the last call, in which case stating it can be skipped.
+    bool maybe_modified(const Buffer& buffer);
+
+private:
+    void read_events();
+
+    struct Watch
+    {
+        int wd;
+        bool modified = false;
+        bool stale = false; // the watch was lost, file removed or renamed over
+    };
+
+    int m_fd = -1;
+    std::unique_ptr<FDWatcher> m_fd_watcher;
+    HashMap<const Buffer*, Watch, MemoryDomain::Events> m_watches;
+};
+
+}
+
+#endif // file_watcher_hh_INCLUDED
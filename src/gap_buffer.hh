@@ -0,0 +1,168 @@
+#ifndef gap_buffer_hh_INCLUDED
+#define gap_buffer_hh_INCLUDED
+
+#include "vector.hh"
+
+#include <algorithm>
+#include <iterator>
+
+namespace Kakoune
+{
+
+// A random access container keeping a gap of unused slots at the last
+// modification point, so that insertions and erases close to each other
+// are amortized O(1) instead of shifting the whole tail as Vector does.
+// Random access stays O(1), at the price of one branch per access.
+template<typename T, MemoryDomain domain = memory_domain(Meta::Type<T>{})>
+struct GapBuffer
+{
+    using value_type = T;
+
+    GapBuffer() = default;
+    GapBuffer(Vector<T, domain> storage)
+        : m_storage(std::move(storage)) {}
+
+    GapBuffer& operator=(Vector<T, domain> storage)
+    {
+        m_storage = std::move(storage);
+        m_gap_pos = m_gap_size = 0;
+        return *this;
+    }
+
+    template<bool constify>
+    struct IteratorImpl
+    {
+        using value_type = T;
+        using difference_type = ptrdiff_t;
+        using pointer = std::conditional_t<constify, const T*, T*>;
+        using reference = std::conditional_t<constify, const T&, T&>;
+        using iterator_category = std::random_access_iterator_tag;
+
+        using Container = std::conditional_t<constify, const GapBuffer, GapBuffer>;
+
+        IteratorImpl() = default;
+        IteratorImpl(Container& buffer, size_t index)
+            : m_buffer(&buffer), m_index(index) {}
+
+        reference operator*() const { return (*m_buffer)[m_index]; }
+        reference operator[](difference_type n) const { return (*m_buffer)[m_index + n]; }
+        pointer operator->() const { return &(*m_buffer)[m_index]; }
+
+        IteratorImpl& operator++() { ++m_index; return *this; }
+        IteratorImpl& operator--() { --m_index; return *this; }
+        IteratorImpl operator++(int) { auto copy = *this; ++m_index; return copy; }
+        IteratorImpl operator--(int) { auto copy = *this; --m_index; return copy; }
+
+        IteratorImpl& operator+=(difference_type n) { m_index += n; return *this; }
+        IteratorImpl& operator-=(difference_type n) { m_index -= n; return *this; }
+
+        IteratorImpl operator+(difference_type n) const { return {*m_buffer, m_index + n}; }
+        IteratorImpl operator-(difference_type n) const { return {*m_buffer, m_index - n}; }
+
+        difference_type operator-(const IteratorImpl& other) const
+        { return (difference_type)m_index - (difference_type)other.m_index; }
+
+        bool operator==(const IteratorImpl& other) const { return m_index == other.m_index; }
+        bool operator!=(const IteratorImpl& other) const { return m_index != other.m_index; }
+        bool operator<(const IteratorImpl& other) const { return m_index < other.m_index; }
+        bool operator<=(const IteratorImpl& other) const { return m_index <= other.m_index; }
+        bool operator>(const IteratorImpl& other) const { return m_index > other.m_index; }
+        bool operator>=(const IteratorImpl& other) const { return m_index >= other.m_index; }
+
+        size_t index() const { return m_index; }
+
+    private:
+        Container* m_buffer = nullptr;
+        size_t m_index = 0;
+    };
+
+    using iterator = IteratorImpl<false>;
+    using const_iterator = IteratorImpl<true>;
+
+    size_t size() const { return m_storage.size() - m_gap_size; }
+    bool empty() const { return size() == 0; }
+
+    T& operator[](size_t index)
+    { return m_storage[index < m_gap_pos ? index : index + m_gap_size]; }
+    const T& operator[](size_t index) const
+    { return m_storage[index < m_gap_pos ? index : index + m_gap_size]; }
+
+    iterator begin() { return {*this, 0}; }
+    iterator end() { return {*this, size()}; }
+    const_iterator begin() const { return {*this, 0}; }
+    const_iterator end() const { return {*this, size()}; }
+
+    void push_back(T value)
+    {
+        move_gap(size());
+        ensure_gap(1);
+        m_storage[m_gap_pos++] = std::move(value);
+        --m_gap_size;
+    }
+
+    template<typename... Args>
+    void emplace_back(Args&&... args) { push_back(T{std::forward<Args>(args)...}); }
+
+    template<typename InputIt>
+    iterator insert(iterator pos, InputIt first, InputIt last)
+    {
+        const size_t index = pos.index();
+        const size_t count = std::distance(first, last);
+        move_gap(index);
+        ensure_gap(count);
+        while (first != last)
+        {
+            m_storage[m_gap_pos++] = *first++;
+            --m_gap_size;
+        }
+        return {*this, index};
+    }
+
+    iterator erase(iterator first, iterator last)
+    {
+        const size_t index = first.index();
+        const size_t count = last.index() - index;
+        move_gap(index);
+        for (size_t i = 0; i < count; ++i)
+            m_storage[m_gap_pos + m_gap_size + i] = T{};
+        m_gap_size += count;
+        return {*this, index};
+    }
+
+private:
+    void move_gap(size_t pos)
+    {
+        if (m_gap_size == 0) // moving an empty gap would self-move elements
+        {
+            m_gap_pos = pos;
+            return;
+        }
+        if (pos < m_gap_pos)
+            std::move_backward(m_storage.begin() + pos,
+                               m_storage.begin() + m_gap_pos,
+                               m_storage.begin() + m_gap_pos + m_gap_size);
+        else if (pos > m_gap_pos)
+            std::move(m_storage.begin() + m_gap_pos + m_gap_size,
+                      m_storage.begin() + pos + m_gap_size,
+                      m_storage.begin() + m_gap_pos);
+        m_gap_pos = pos;
+    }
+
+    void ensure_gap(size_t count)
+    {
+        if (m_gap_size >= count)
+            return;
+        const size_t grow = std::max(count, size() / 8 + 8);
+        m_storage.insert(m_storage.begin() + m_gap_pos + m_gap_size,
+                         grow - m_gap_size, T{});
+        m_gap_size = grow;
+    }
+
+    Vector<T, domain> m_storage;
+    size_t m_gap_pos = 0;
+    size_t m_gap_size = 0;
+};
+
+}
+
+#endif // gap_buffer_hh_INCLUDED
@@ -6,63 +6,46 @@
 namespace Kakoune
 {
 
-[[gnu::always_inline]]
-static inline uint32_t rotl(uint32_t x, int8_t r)
-{
-    return (x << r) | (x >> (32 - r));
-}
-
-[[gnu::always_inline]]
-static inline uint32_t fmix(uint32_t h)
-{
-    h ^= h >> 16;
-    h *= 0x85ebca6b;
-    h ^= h >> 13;
-    h *= 0xc2b2ae35;
-    h ^= h >> 16;
-
-    return h;
-}
-
-// murmur3 hash, based on https://github.com/PeterScott/murmur3
+// murmur2 64 bit hash (MurmurHash64A), processing eight bytes per round
+// instead of the four of the previous 32 bit murmur3, which makes a
+// measurable difference on the long keys (file paths, words) dominating
+// map lookups
 size_t hash_data(const char* input, size_t len)
 {
-    const uint8_t* data = reinterpret_cast<const uint8_t*>(input);
-    uint32_t hash = 0x1235678;
-    constexpr uint32_t c1 = 0xcc9e2d51;
-    constexpr uint32_t c2 = 0x1b873593;
+    constexpr uint64_t mul = 0xc6a4a7935bd1e995ull;
+    constexpr int shift = 47;
 
-    const int nblocks = len / 4;
-    const uint8_t* blocks = data + nblocks*4;
+    const uint8_t* data = reinterpret_cast<const uint8_t*>(input);
+    const uint8_t* const blocks_end = data + (len & ~size_t{7});
+    uint64_t hash = 0x1235678 ^ (len * mul);
 
-    for (int i = -nblocks; i; ++i)
+    for (; data != blocks_end; data += 8)
     {
-        uint32_t key;
-        memcpy(&key, blocks + 4*i, 4);
-        key *= c1;
-        key = rotl(key, 15);
-        key *= c2;
+        uint64_t key;
+        memcpy(&key, data, 8);
+        key *= mul;
+        key ^= key >> shift;
+        key *= mul;
 
         hash ^= key;
-        hash = rotl(hash, 13);
-        hash = hash * 5 + 0xe6546b64;
+        hash *= mul;
     }
 
-    const uint8_t* tail = data + nblocks * 4;
-    uint32_t key = 0;
-    switch (len & 3)
+    switch (len & 7)
     {
-        case 3: key ^= tail[2] << 16; /* fallthrough */
-        case 2: key ^= tail[1] << 8;  /* fallthrough */
-        case 1: key ^= tail[0];
-                key *= c1;
-                key = rotl(key,15);
-                key *= c2;
-                hash ^= key;
+        case 7: hash ^= uint64_t{data[6]} << 48; /* fallthrough */
+        case 6: hash ^= uint64_t{data[5]} << 40; /* fallthrough */
+        case 5: hash ^= uint64_t{data[4]} << 32; /* fallthrough */
+        case 4: hash ^= uint64_t{data[3]} << 24; /* fallthrough */
+        case 3: hash ^= uint64_t{data[2]} << 16; /* fallthrough */
+        case 2: hash ^= uint64_t{data[1]} << 8;  /* fallthrough */
+        case 1: hash ^= uint64_t{data[0]};
+                hash *= mul;
     }
 
-    hash ^= len;
-    hash = fmix(hash);
+    hash ^= hash >> shift;
+    hash *= mul;
+    hash ^= hash >> shift;
 
     return hash;
 }
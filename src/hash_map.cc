@@ -4,6 +4,7 @@
 #include "string.hh"
 #include "buffer_utils.hh"
 #include "unit_tests.hh"
+#include "benchmark.hh"
 
 #include <random>
 #include <unordered_map>
@@ -133,4 +134,20 @@ void profile_hash_maps()
     }
 }
 
+
+Benchmark bench_hash_map{"hash map insert/find/erase", []()
+{
+    constexpr size_t count = 500000;
+    HashMap<size_t, size_t> map;
+    for (size_t i = 0; i < count; ++i)
+        map.insert({i * 7919, i});
+    size_t found = 0;
+    for (size_t i = 0; i < count; ++i)
+        found += map.find(i * 7919)->value;
+    for (size_t i = 0; i < count; i += 2)
+        map.unordered_remove(i * 7919);
+    volatile size_t sink = found + map.size();
+    (void)sink;
+}};
+
 }
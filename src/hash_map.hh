@@ -5,16 +5,23 @@
 #include "memory.hh"
 #include "vector.hh"
 
+#include <cstdint>
+
 namespace Kakoune
 {
 
 template<MemoryDomain domain>
 struct HashIndex
 {
+    // Entries are packed to 8 bytes so that a cache line holds twice as
+    // many of them; the truncated hash is only a probe filter, the key
+    // comparison in HashMap confirms actual matches. This assumes the
+    // index never grows past 2^32 slots, as compute_slot only ever uses
+    // the low bits.
     struct Entry
     {
-        size_t hash;
-        int index;
+        uint32_t hash;
+        int32_t index;
     };
 
     void resize(size_t new_size)
@@ -42,7 +49,7 @@ struct HashIndex
 
     void add(size_t hash, int index)
     {
-        Entry entry{hash, index};
+        Entry entry{(uint32_t)hash, index};
         while (true)
         {
             auto target_slot = compute_slot(entry.hash);
@@ -146,10 +153,14 @@ struct HashMap
             m_index.add(hash_value(m_items[i].key), i);
     }
 
-    Value& insert(Item item)
+    Value& insert(Item item) { return insert(std::move(item), hash_value(item.key)); }
+
+    // callers holding a precomputed (or cached) hash of the key can pass
+    // it to skip rehashing
+    Value& insert(Item item, size_t hash)
     {
         m_index.reserve(m_items.size()+1);
-        m_index.add(hash_value(item.key), (int)m_items.size());
+        m_index.add(hash, (int)m_items.size());
         m_items.push_back(std::move(item));
         return m_items.back().value;
     }
@@ -167,7 +178,7 @@ struct HashMap
             auto& entry = m_index[slot];
             if (entry.index == -1)
                 return -1;
-            if (entry.hash == hash and m_items[entry.index].key == key)
+            if (entry.hash == (uint32_t)hash and m_items[entry.index].key == key)
                 return entry.index;
         }
         return -1;
@@ -207,9 +218,11 @@ struct HashMap
     }
 
     template<typename KeyType, typename = EnableIfHashCompatible<KeyType>>
-    void unordered_remove(const KeyType& key)
+    void unordered_remove(const KeyType& key) { unordered_remove(key, hash_value(key)); }
+
+    template<typename KeyType, typename = EnableIfHashCompatible<KeyType>>
+    void unordered_remove(const KeyType& key, size_t hash)
     {
-        const auto hash = hash_value(key);
         int index = find_index(key, hash);
         if (index >= 0)
         {
@@ -247,7 +260,13 @@ struct HashMap
     template<typename KeyType, typename = EnableIfHashCompatible<KeyType>>
     iterator find(const KeyType& key)
     {
-        auto index = find_index(key);
+        return find(key, hash_value(key));
+    }
+
+    template<typename KeyType, typename = EnableIfHashCompatible<KeyType>>
+    iterator find(const KeyType& key, size_t hash)
+    {
+        auto index = find_index(key, hash);
         return index >= 0 ? begin() + index : end();
     }
 
@@ -257,6 +276,12 @@ struct HashMap
         return const_cast<HashMap*>(this)->find(key);
     }
 
+    template<typename KeyType, typename = EnableIfHashCompatible<KeyType>>
+    const_iterator find(const KeyType& key, size_t hash) const
+    {
+        return const_cast<HashMap*>(this)->find(key, hash);
+    }
+
     void clear() { m_items.clear(); m_index.clear(); }
 
     size_t size() const { return m_items.size(); }
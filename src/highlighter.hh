@@ -37,6 +37,16 @@ struct Highlighter;
 
 using HighlighterAndId = std::pair<String, std::unique_ptr<Highlighter>>;
 
+// Computations queued by the fetch phase of highlighting; they only read
+// the buffer and fill caches owned by the highlighter that queued them, so
+// tasks from different highlighters may run on concurrent threads.
+using HighlightTask = std::function<void()>;
+using HighlightTaskList = Vector<HighlightTask, MemoryDomain::Highlight>;
+
+// Run the queued fetch tasks, on worker threads when there are several and
+// hardware to spare.
+void run_highlight_tasks(HighlightTaskList& tasks);
+
 struct DisplaySetup
 {
     // Window position relative to the buffer origin
@@ -68,6 +78,13 @@ struct Highlighter
             do_compute_display_setup(context, pass, setup);
     }
 
+    void fetch(const Context& context, HighlightPass pass, BufferRange display_range,
+               BufferRange range, HighlightTaskList& tasks)
+    {
+        if (pass & m_passes)
+            do_fetch(context, pass, display_range, range, tasks);
+    }
+
     virtual bool has_children() const { return false; }
     virtual Highlighter& get_child(StringView path) { throw runtime_error("this highlighter do not hold children"); }
     virtual void add_child(HighlighterAndId&& hl) { throw runtime_error("this highlighter do not hold children"); }
@@ -79,6 +96,11 @@ struct Highlighter
 private:
     virtual void do_highlight(const Context& context, HighlightPass pass, DisplayBuffer& display_buffer, BufferRange range) = 0;
     virtual void do_compute_display_setup(const Context& context, HighlightPass pass, DisplaySetup& setup) {}
+    // First phase of highlighting, run before do_highlight: queue into tasks
+    // the computations that only depend on the buffer content, they may get
+    // run on worker threads. Called on the main thread, so cache bookkeeping
+    // belongs here and only the pure computation in the queued task.
+    virtual void do_fetch(const Context& context, HighlightPass pass, BufferRange display_range, BufferRange range, HighlightTaskList& tasks) {}
 
     const HighlightPass m_passes;
 };
@@ -2,15 +2,78 @@
 
 #include "ranges.hh"
 #include "string_utils.hh"
+#include "trace.hh"
+
+#include <atomic>
+#include <thread>
 
 namespace Kakoune
 {
 
+// Tasks from different highlighters are independent, so the fetch phase
+// costs the most expensive one instead of their sum.
+void run_highlight_tasks(HighlightTaskList& tasks)
+{
+    const size_t max_threads = std::thread::hardware_concurrency();
+    if (tasks.size() <= 1 or max_threads <= 1)
+    {
+        for (auto& task : tasks)
+            task();
+        return;
+    }
+
+    std::atomic<size_t> next{0};
+    std::vector<std::exception_ptr> errors{tasks.size()};
+    auto worker = [&] {
+        for (size_t i = next.fetch_add(1); i < tasks.size(); i = next.fetch_add(1))
+        {
+            try { tasks[i](); }
+            catch (...) { errors[i] = std::current_exception(); }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (size_t i = 0, count = std::min(tasks.size(), max_threads) - 1; i < count; ++i)
+        threads.emplace_back(worker);
+    worker();
+    for (auto& thread : threads)
+        thread.join();
+
+    for (auto& error : errors)
+        if (error)
+            std::rethrow_exception(error);
+}
+
 void HighlighterGroup::do_highlight(const Context& context, HighlightPass pass,
                                     DisplayBuffer& display_buffer, BufferRange range)
+{
+    HighlightTaskList tasks;
+    try
+    {
+        do_fetch(context, pass, display_buffer.range(), range, tasks);
+    }
+    catch (...)
+    {
+        // already queued tasks must run, highlighters rely on it to clear
+        // their pending state
+        try { run_highlight_tasks(tasks); } catch (...) {}
+        throw;
+    }
+    run_highlight_tasks(tasks);
+
+    for (auto& hl : m_highlighters)
+    {
+        TraceScope trace{"highlight", hl.key};
+        hl.value->highlight(context, pass, display_buffer, range);
+    }
+}
+
+void HighlighterGroup::do_fetch(const Context& context, HighlightPass pass,
+                                BufferRange display_range, BufferRange range,
+                                HighlightTaskList& tasks)
 {
     for (auto& hl : m_highlighters)
-       hl.value->highlight(context, pass, display_buffer, range);
+        hl.value->fetch(context, pass, display_range, range, tasks);
 }
 
 void HighlighterGroup::do_compute_display_setup(const Context& context, HighlightPass pass, DisplaySetup& setup)
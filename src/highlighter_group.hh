@@ -30,6 +30,7 @@ public:
 private:
     void do_highlight(const Context& context, HighlightPass pass, DisplayBuffer& display_buffer, BufferRange range) override;
     void do_compute_display_setup(const Context& context, HighlightPass pass, DisplaySetup& setup) override;
+    void do_fetch(const Context& context, HighlightPass pass, BufferRange display_range, BufferRange range, HighlightTaskList& tasks) override;
 
     using HighlighterMap = HashMap<String, std::unique_ptr<Highlighter>, MemoryDomain::Highlight>;
     HighlighterMap m_highlighters;
@@ -1,6 +1,7 @@
 #include "highlighters.hh"
 
 #include "assert.hh"
+#include "bracket_index.hh"
 #include "buffer_utils.hh"
 #include "changes.hh"
 #include "command_manager.hh"
@@ -25,6 +26,8 @@
 namespace Kakoune
 {
 
+static const TypedOptionId<int> tabstop_id{"tabstop"};
+
 template<typename Func>
 std::unique_ptr<Highlighter> make_highlighter(Func func, HighlightPass pass = HighlightPass::Colorize)
 {
@@ -69,7 +72,7 @@ void highlight_range(DisplayBuffer& display_buffer,
                 continue;
 
             if (not is_replaced and begin > atom_it->begin())
-                atom_it = ++line.split(atom_it, begin);
+                atom_it = line.split(atom_it, begin) + 1;
 
             if (not is_replaced and end < atom_it->end())
             {
@@ -83,6 +86,144 @@ void highlight_range(DisplayBuffer& display_buffer,
     }
 }
 
+struct RangeAndFace
+{
+    BufferCoord begin, end;
+    Face face;
+};
+
+// Batched version of highlight_range: sweep all the ranges over each
+// line in one pass that rebuilds the atom list into a scratch vector,
+// so a line crossed by many ranges stays linear in its atom count
+// instead of shifting the tail on every split. Overlapping faces merge
+// in the order the caller listed the ranges, matching what repeated
+// highlight_range calls would produce.
+void highlight_ranges(DisplayBuffer& display_buffer, bool skip_replaced,
+                      ConstArrayView<RangeAndFace> ranges)
+{
+    auto& display_range = display_buffer.range();
+
+    struct Entry
+    {
+        const RangeAndFace* range;
+        size_t order;
+    };
+    Vector<Entry, MemoryDomain::Highlight> sorted;
+    sorted.reserve(ranges.size());
+    for (size_t i = 0; i < ranges.size(); ++i)
+    {
+        auto& r = ranges[i];
+        // tolerate begin > end as that can be triggered by wrong encodings
+        if (r.begin >= r.end or r.end <= display_range.begin
+                             or r.begin >= display_range.end)
+            continue;
+        sorted.push_back({&r, i});
+    }
+    if (sorted.empty())
+        return;
+    std::sort(sorted.begin(), sorted.end(),
+              [](const Entry& lhs, const Entry& rhs) {
+                  return lhs.range->begin < rhs.range->begin or
+                         (lhs.range->begin == rhs.range->begin and
+                          lhs.order < rhs.order);
+              });
+
+    // ranges overlapping the current position, kept in submission order
+    // as merge_faces is not commutative
+    Vector<Entry, MemoryDomain::Highlight> active;
+    auto add_active = [&active](const Entry& entry) {
+        active.insert(std::upper_bound(active.begin(), active.end(), entry,
+                                       [](const Entry& lhs, const Entry& rhs) {
+                                           return lhs.order < rhs.order;
+                                       }),
+                      entry);
+    };
+    auto prune_active = [&active](BufferCoord pos) {
+        active.erase(std::remove_if(active.begin(), active.end(),
+                                    [pos](const Entry& e) {
+                                        return e.range->end <= pos;
+                                    }),
+                     active.end());
+    };
+
+    auto next = sorted.begin();
+    AtomList atoms;
+    for (auto& line : display_buffer.lines())
+    {
+        auto& line_range = line.range();
+        prune_active(line_range.begin);
+        if (active.empty() and
+            (next == sorted.end() or line_range.end <= next->range->begin))
+            continue;
+
+        atoms.clear();
+        for (auto& atom : line)
+        {
+            const bool is_replaced = atom.type() == DisplayAtom::ReplacedRange;
+            if (not atom.has_buffer_range() or (skip_replaced and is_replaced))
+            {
+                atoms.push_back(std::move(atom));
+                continue;
+            }
+
+            const BufferCoord atom_end = atom.end();
+            if (is_replaced)
+            {
+                // replaced atoms are never split, every overlapping
+                // range applies its face to the whole atom
+                prune_active(atom.begin());
+                while (next != sorted.end() and next->range->begin < atom_end)
+                {
+                    if (next->range->end > atom.begin())
+                        add_active(*next);
+                    ++next;
+                }
+                for (auto& entry : active)
+                    atom.face = merge_faces(atom.face, entry.range->face);
+                atoms.push_back(std::move(atom));
+                continue;
+            }
+
+            BufferCoord pos = atom.begin();
+            while (true)
+            {
+                prune_active(pos);
+                while (next != sorted.end() and next->range->begin <= pos)
+                {
+                    if (next->range->end > pos)
+                        add_active(*next);
+                    ++next;
+                }
+
+                BufferCoord boundary = atom_end;
+                for (auto& entry : active)
+                    boundary = std::min(boundary, entry.range->end);
+                if (next != sorted.end())
+                    boundary = std::min(boundary, next->range->begin);
+
+                if (pos == atom.begin() and boundary == atom_end)
+                {
+                    // atom untouched or covered whole, no split needed
+                    for (auto& entry : active)
+                        atom.face = merge_faces(atom.face, entry.range->face);
+                    atoms.push_back(std::move(atom));
+                    break;
+                }
+
+                DisplayAtom sub{atom.buffer(), pos, boundary};
+                sub.face = atom.face;
+                for (auto& entry : active)
+                    sub.face = merge_faces(sub.face, entry.range->face);
+                atoms.push_back(std::move(sub));
+                if (boundary == atom_end)
+                    break;
+                pos = boundary;
+            }
+        }
+        line.swap_atoms(atoms);
+    }
+}
+
 template<typename T>
 void replace_range(DisplayBuffer& display_buffer,
                    BufferCoord begin, BufferCoord end, T func)
@@ -108,7 +249,7 @@ void replace_range(DisplayBuffer& display_buffer,
             if (begin >= atom_it->begin())
             {
                 if (begin > atom_it->begin())
-                    atom_it = ++line.split(atom_it, begin);
+                    atom_it = line.split(atom_it, begin) + 1;
                 beg_idx = atom_it - line.begin();
             }
             if (end <= atom_it->end())
@@ -169,7 +310,7 @@ void apply_highlighter(const Context& context,
                         beg_idx = atom_it - line.begin();
                     else
                     {
-                        atom_it = ++line.split(atom_it, begin);
+                        atom_it = line.split(atom_it, begin) + 1;
                         beg_idx = atom_it - line.begin();
                         ++end_idx;
                     }
@@ -181,7 +322,7 @@ void apply_highlighter(const Context& context,
                         end_idx = atom_it - line.begin() + 1;
                     else
                     {
-                        atom_it = ++line.split(atom_it, end);
+                        atom_it = line.split(atom_it, end) + 1;
                         end_idx = atom_it - line.begin();
                     }
                 }
@@ -208,7 +349,7 @@ void apply_highlighter(const Context& context,
         auto& line = *(first_line + i);
         auto pos = insert_pos[i];
         for (auto& atom : region_lines[i])
-            pos = ++line.insert(pos, std::move(atom));
+            pos = line.insert(pos, std::move(atom)) + 1;
     }
     display_buffer.compute_range();
 }
@@ -228,11 +369,11 @@ static HighlighterAndId create_fill_highlighter(HighlighterParameters params)
     const String& facespec = params[0];
     get_face(facespec); // validate param
 
-    auto func = [=](const Context& context, HighlightPass pass,
-                    DisplayBuffer& display_buffer, BufferRange range)
+    auto func = [face=FaceRef{facespec}](const Context& context, HighlightPass pass,
+                                         DisplayBuffer& display_buffer, BufferRange range)
     {
         highlight_range(display_buffer, range.begin, range.end, true,
-                        apply_face(get_face(facespec)));
+                        apply_face(get_face(face)));
     };
     return {"fill_" + facespec, make_highlighter(std::move(func))};
 }
@@ -276,25 +417,23 @@ public:
         if (not overlaps(display_buffer.range(), range))
             return;
 
-        Vector<Face> faces(m_faces.size());
-        for (int f = 0; f < m_faces.size(); ++f)
-        {
-            if (not m_faces[f].second.empty())
-                faces[f] = get_face(m_faces[f].second);
-        }
+        Vector<Face> faces(m_face_refs.size());
+        for (int f = 0; f < m_face_refs.size(); ++f)
+            faces[f] = get_face(m_face_refs[f]);
 
-        auto& matches = get_matches(context.buffer(), display_buffer.range(), range);
+        auto matches = get_matches(context.buffer(), display_buffer.range(), range);
         kak_assert(matches.size() % m_faces.size() == 0);
+        Vector<RangeAndFace, MemoryDomain::Highlight> ranges;
+        ranges.reserve(matches.size());
         for (size_t m = 0; m < matches.size(); ++m)
         {
             auto& face = faces[m % faces.size()];
             if (face == Face{})
                 continue;
 
-            highlight_range(display_buffer,
-                            matches[m].begin, matches[m].end,
-                            true, apply_face(face));
+            ranges.push_back({matches[m].begin, matches[m].end, face});
         }
+        highlight_ranges(display_buffer, true, ranges);
     }
 
     void reset(Regex regex, FacesSpec faces)
@@ -336,27 +475,38 @@ private:
     {
         size_t m_timestamp = -1;
         size_t m_regex_version = -1;
-        struct RangeAndMatches { BufferRange range; MatchList matches; };
-        Vector<RangeAndMatches, MemoryDomain::Highlight> m_matches;
+        // flat list of match groups sorted by position, each match
+        // contributing m_faces.size() consecutive entries (capture 0
+        // first); viewport queries are a binary search plus linear emit
+        MatchList m_matches;
+        // sorted, disjoint buffer ranges the list covers
+        Vector<BufferRange, MemoryDomain::Highlight> m_ranges;
     };
     BufferSideCache<Cache> m_cache;
 
     Regex     m_regex;
     FacesSpec m_faces;
+    Vector<FaceRef, MemoryDomain::Highlight> m_face_refs;
 
     size_t m_regex_version = 0;
+    bool m_fetch_pending = false;
 
     void ensure_first_face_is_capture_0()
     {
-        if (m_faces.empty())
-            return;
+        if (not m_faces.empty())
+        {
+            std::sort(m_faces.begin(), m_faces.end(),
+                      [](const std::pair<size_t, String>& lhs,
+                         const std::pair<size_t, String>& rhs)
+                      { return lhs.first < rhs.first; });
+            if (m_faces[0].first != 0)
+                m_faces.emplace(m_faces.begin(), 0, String{});
+        }
 
-        std::sort(m_faces.begin(), m_faces.end(),
-                  [](const std::pair<size_t, String>& lhs,
-                     const std::pair<size_t, String>& rhs)
-                  { return lhs.first < rhs.first; });
-        if (m_faces[0].first != 0)
-            m_faces.emplace(m_faces.begin(), 0, String{});
+        // keep the cached references in sync for the per frame resolution
+        m_face_refs.clear();
+        for (auto& face : m_faces)
+            m_face_refs.push_back(FaceRef{face.second});
     }
 
     void add_matches(const Buffer& buffer, MatchList& matches,
@@ -381,71 +531,243 @@ private:
         }
     }
 
-    MatchList& get_matches(const Buffer& buffer, BufferRange display_range,
-                           BufferRange buffer_range)
+    // index of the first match group whose capture 0 begins at or after coord
+    static size_t first_group_after(const MatchList& matches, size_t stride,
+                                    BufferCoord coord)
     {
-        Cache& cache = m_cache.get(buffer);
+        size_t lo = 0, hi = matches.size() / stride;
+        while (lo < hi)
+        {
+            const size_t mid = (lo + hi) / 2;
+            if (matches[mid * stride].begin < coord)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        return lo;
+    }
+
+    // Shift the cached matches by the line modifications since the cache was
+    // filled and drop the covered ranges overlapping modified lines, so that
+    // an edit only invalidates the matches around it instead of the whole
+    // cache.
+    void update_cache(Cache& cache, const Buffer& buffer)
+    {
+        auto modifs = compute_line_modifications(buffer, cache.m_timestamp);
+        if (modifs.empty())
+            return;
+
+        auto damaged = [&](const BufferRange& range) {
+            for (auto& modif : modifs)
+            {
+                if (modif.old_line > range.end.line)
+                    break;
+                if (modif.old_line + modif.num_removed >= range.begin.line)
+                    return true;
+            }
+            return false;
+        };
+
+        const size_t stride = m_faces.size();
         auto& matches = cache.m_matches;
 
-        if (cache.m_regex_version != m_regex_version or
-            cache.m_timestamp != buffer.timestamp())
+        size_t elem_in = 0, elem_out = 0;
+        auto range_out = cache.m_ranges.begin();
+        for (auto& range : cache.m_ranges)
         {
-            matches.clear();
-            cache.m_timestamp = buffer.timestamp();
-            cache.m_regex_version = m_regex_version;
+            // every match group of a covered range begins within it
+            size_t range_end = elem_in;
+            while (range_end != matches.size() and
+                   matches[range_end].begin < range.end)
+                range_end += stride;
+
+            if (damaged(range))
+            {
+                // range dropped along with its matches, it will be
+                // recomputed on demand
+                elem_in = range_end;
+                continue;
+            }
+
+            auto modif_it = std::upper_bound(modifs.begin(), modifs.end(), range.begin.line,
+                                             [](const LineCount& l, const LineModification& c)
+                                             { return l < c.old_line; });
+            // no modification lies within the range, every line shifts
+            // by the same amount
+            const LineCount diff = modif_it != modifs.begin() ?
+                (modif_it-1)->diff() : 0;
+
+            BufferRange shifted = range;
+            shifted.begin.line += diff;
+            shifted.end.line += diff;
+            *range_out++ = shifted;
+
+            for (; elem_in != range_end; ++elem_in, ++elem_out)
+            {
+                auto m = matches[elem_in];
+                m.begin.line += diff;
+                m.end.line += diff;
+                matches[elem_out] = m;
+            }
         }
+        matches.erase(matches.begin() + elem_out, matches.end());
+        cache.m_ranges.erase(range_out, cache.m_ranges.end());
+    }
+
+    static BufferRange needed_range(BufferRange display_range, BufferRange buffer_range)
+    {
         const LineCount line_offset = 3;
-        BufferRange range{std::max<BufferCoord>(buffer_range.begin, display_range.begin.line - line_offset),
-                          std::min<BufferCoord>(buffer_range.end, display_range.end.line + line_offset)};
+        return {std::max<BufferCoord>(buffer_range.begin, display_range.begin.line - line_offset),
+                std::min<BufferCoord>(buffer_range.end, display_range.end.line + line_offset)};
+    }
 
-        auto it = std::upper_bound(matches.begin(), matches.end(), range,
-                                   [](const BufferRange& lhs, const Cache::RangeAndMatches& rhs)
-                                   { return lhs.begin < rhs.range.end; });
+    // Cache bookkeeping for the given ranges, returning the scan (if any)
+    // still needed to cover them as a task runnable on a worker thread. At
+    // most one task is pending at a time so that concurrent tasks never
+    // mutate the same cache, even when the same highlighter is referenced
+    // several times.
+    HighlightTask fetch_matches(const Buffer& buffer, BufferRange display_range,
+                                BufferRange buffer_range)
+    {
+        if (m_fetch_pending)
+            return {};
+
+        Cache& cache = m_cache.get(buffer);
+        auto& matches = cache.m_matches;
 
-        if (it == matches.end() or it->range.begin > range.end)
+        if (cache.m_regex_version != m_regex_version)
         {
-            it = matches.insert(it, Cache::RangeAndMatches{range, {}});
-            add_matches(buffer, it->matches, range);
+            matches.clear();
+            cache.m_ranges.clear();
+            cache.m_timestamp = buffer.timestamp();
+            cache.m_regex_version = m_regex_version;
         }
-        else if (it->matches.empty())
+        else if (cache.m_timestamp != buffer.timestamp())
         {
-            it->range = range;
-            add_matches(buffer, it->matches, range);
+            if (cache.m_timestamp == (size_t)-1)
+            {
+                matches.clear();
+                cache.m_ranges.clear();
+            }
+            else
+                update_cache(cache, buffer);
+            cache.m_timestamp = buffer.timestamp();
         }
-        else
-        {
-            // Here we extend the matches, that is not strictly valid,
-            // but may work nicely with every reasonable regex, and
-            // greatly reduces regex parsing. To change if we encounter
-            // regex that do not work great with that.
-            BufferRange& old_range = it->range;
-            MatchList& matches = it->matches;
+        const BufferRange range = needed_range(display_range, buffer_range);
+
+        auto it = std::lower_bound(cache.m_ranges.begin(), cache.m_ranges.end(), range.begin,
+                                   [](const BufferRange& lhs, const BufferCoord& rhs)
+                                   { return lhs.end < rhs; });
+        if (it != cache.m_ranges.end() and
+            it->begin <= range.begin and range.end <= it->end)
+            return {}; // the cache already covers the range
+
+        m_fetch_pending = true;
+        return [this, &buffer, cache = &cache, range] {
+            auto done = on_scope_end([this]{ m_fetch_pending = false; });
+            fill_range(*cache, buffer, range);
+        };
+    }
 
-            // Thanks to the ensure_first_face_is_capture_0 method, we know
-            // these point to the first/last matches capture 0.
-            auto first_end = matches.begin()->end;
-            auto last_end = (matches.end() - m_faces.size())->end;
+    // Scan the parts of range the cache does not cover yet and merge the
+    // results in, keeping the match list sorted and the covered ranges
+    // disjoint. Runs on a worker thread.
+    void fill_range(Cache& cache, const Buffer& buffer, BufferRange range)
+    {
+        auto& matches = cache.m_matches;
+        auto& ranges = cache.m_ranges;
+        const size_t stride = m_faces.size();
+
+        // covered ranges overlapping or touching the needed one get merged
+        // with it, so scrolling extends coverage instead of fragmenting it
+        auto first = std::lower_bound(ranges.begin(), ranges.end(), range.begin,
+                                      [](const BufferRange& lhs, const BufferCoord& rhs)
+                                      { return lhs.end < rhs; });
+        auto last = std::upper_bound(first, ranges.end(), range.end,
+                                     [](const BufferCoord& lhs, const BufferRange& rhs)
+                                     { return lhs < rhs.begin; });
+
+        BufferRange merged = range;
+        if (first != last)
+        {
+            merged.begin = std::min(merged.begin, first->begin);
+            merged.end = std::max(merged.end, (last-1)->end);
+        }
 
-            // add regex matches from new begin to old first match end
-            if (range.begin < old_range.begin)
-            {
-                old_range.begin = range.begin;
-                MatchList new_matches;
-                add_matches(buffer, new_matches, {range.begin, first_end});
-                matches.erase(matches.begin(), matches.begin() + m_faces.size());
-
-                std::copy(std::make_move_iterator(new_matches.begin()),
-                          std::make_move_iterator(new_matches.end()),
-                          std::inserter(matches, matches.begin()));
-            }
-            // add regex matches from old last match begin to new end
-            if (old_range.end < range.end)
+        MatchList rebuilt;
+        rebuilt.reserve(matches.size());
+        size_t group = first_group_after(matches, stride, merged.begin);
+        rebuilt.insert(rebuilt.end(), matches.begin(),
+                       matches.begin() + group * stride);
+
+        // Here we scan only the gaps between kept matches, that is not
+        // strictly valid, but may work nicely with every reasonable regex,
+        // and greatly reduces regex parsing. To change if we encounter
+        // regex that do not work great with that.
+        BufferCoord cur = merged.begin;
+        for (auto it = first; it != last; ++it)
+        {
+            const size_t range_last = first_group_after(matches, stride, it->end);
+            if (cur < it->begin)
             {
-                old_range.end = range.end;
-                add_matches(buffer, matches, {last_end, range.end});
+                // a match may straddle the gap boundary; when the covered
+                // range has matches, rescan up to the end of its first one
+                // and replace it
+                const bool has_matches = range_last != group;
+                add_matches(buffer, rebuilt,
+                            {cur, has_matches ? matches[group * stride].end
+                                              : it->end});
+                if (has_matches)
+                    ++group;
             }
+            rebuilt.insert(rebuilt.end(), matches.begin() + group * stride,
+                           matches.begin() + range_last * stride);
+            group = range_last;
+            cur = std::max(cur, it->end);
+        }
+        if (cur < merged.end)
+        {
+            // restart the scan at the end of the last known match, a match
+            // may straddle the covered end
+            BufferCoord scan_begin = cur;
+            if (rebuilt.size() >= stride)
+                scan_begin = std::max(merged.begin,
+                                      std::min(cur, (rebuilt.end() - stride)->end));
+            add_matches(buffer, rebuilt, {scan_begin, merged.end});
         }
-        return it->matches;
+        rebuilt.insert(rebuilt.end(), matches.begin() + group * stride,
+                       matches.end());
+
+        matches = std::move(rebuilt);
+        auto ins = ranges.erase(first, last);
+        ranges.insert(ins, merged);
+    }
+
+    void do_fetch(const Context& context, HighlightPass, BufferRange display_range,
+                  BufferRange range, HighlightTaskList& tasks) override
+    {
+        if (auto task = fetch_matches(context.buffer(), display_range, range))
+            tasks.push_back(std::move(task));
+    }
+
+    ConstArrayView<BufferRange> get_matches(const Buffer& buffer, BufferRange display_range,
+                                            BufferRange buffer_range)
+    {
+        // when the fetch phase did not run beforehand, compute synchronously
+        if (auto task = fetch_matches(buffer, display_range, buffer_range))
+            task();
+
+        auto& matches = m_cache.get(buffer).m_matches;
+        const size_t stride = m_faces.size();
+        const BufferRange range = needed_range(display_range, buffer_range);
+
+        // a single binary search, then walk back over the matches
+        // straddling the top of the range
+        size_t first = first_group_after(matches, stride, range.begin);
+        while (first != 0 and matches[(first-1) * stride].end > range.begin)
+            --first;
+        const size_t last = first_group_after(matches, stride, range.end);
+        return {matches.data() + first * stride, matches.data() + last * stride};
     }
 };
 
@@ -474,6 +796,22 @@ public:
             m_highlighter.highlight(context, pass, display_buffer, range);
     }
 
+    void do_fetch(const Context& context, HighlightPass pass, BufferRange display_range,
+                  BufferRange range, HighlightTaskList& tasks) override
+    {
+        Regex regex = m_regex_getter(context);
+        FacesSpec face = m_face_getter(context);
+        if (regex != m_last_regex or face != m_last_face)
+        {
+            m_last_regex = std::move(regex);
+            m_last_face = face;
+            if (not m_last_regex.empty())
+                m_highlighter.reset(m_last_regex, m_last_face);
+        }
+        if (not m_last_regex.empty() and not m_last_face.empty())
+            m_highlighter.fetch(context, pass, display_range, range, tasks);
+    }
+
 private:
     Regex       m_last_regex;
     RegexGetter m_regex_getter;
@@ -548,12 +886,13 @@ HighlighterAndId create_line_highlighter(HighlighterParameters params)
 
     get_face(facespec); // validate facespec
 
-    auto func = [=](const Context& context, HighlightPass, DisplayBuffer& display_buffer, BufferRange)
+    auto func = [=, faceref=FaceRef{facespec},
+                 expansion_buffer=String{}](const Context& context, HighlightPass, DisplayBuffer& display_buffer, BufferRange) mutable
     {
         LineCount line = -1;
         try
         {
-            line = str_to_int_ifp(expand(line_expr, context)).value_or(0) - 1;
+            line = str_to_int_ifp(expand_to(expansion_buffer, line_expr, context)).value_or(0) - 1;
         }
         catch (runtime_error& err)
         {
@@ -570,7 +909,7 @@ HighlighterAndId create_line_highlighter(HighlighterParameters params)
         if (it == display_buffer.lines().end())
             return;
 
-        auto face = get_face(facespec);
+        auto face = get_face(faceref);
         ColumnCount column = 0;
         for (auto& atom : *it)
         {
@@ -599,12 +938,13 @@ HighlighterAndId create_column_highlighter(HighlighterParameters params)
 
     get_face(facespec); // validate facespec
 
-    auto func = [=](const Context& context, HighlightPass, DisplayBuffer& display_buffer, BufferRange)
+    auto func = [=, faceref=FaceRef{facespec},
+                 expansion_buffer=String{}](const Context& context, HighlightPass, DisplayBuffer& display_buffer, BufferRange) mutable
     {
         ColumnCount column = -1;
         try
         {
-            column = str_to_int_ifp(expand(col_expr, context)).value_or(0) - 1;
+            column = str_to_int_ifp(expand_to(expansion_buffer, col_expr, context)).value_or(0) - 1;
         }
         catch (runtime_error& err)
         {
@@ -615,7 +955,7 @@ HighlighterAndId create_column_highlighter(HighlighterParameters params)
         if (column < 0)
             return;
 
-        auto face = get_face(facespec);
+        auto face = get_face(faceref);
         auto win_column = context.window().position().column;
         for (auto& line : display_buffer.lines())
         {
@@ -631,7 +971,7 @@ HighlighterAndId create_column_highlighter(HighlighterParameters params)
                 if (target_col < atom_len)
                 {
                     if (target_col > 0)
-                        atom_it = ++line.split(atom_it, target_col);
+                        atom_it = line.split(atom_it, target_col) + 1;
                     if (atom_it->length() > 1)
                         atom_it = line.split(atom_it, 1_col);
                     atom_it->face = merge_faces(atom_it->face, face);
@@ -666,20 +1006,24 @@ struct WrapHighlighter : Highlighter
 
         const Buffer& buffer = context.buffer();
         const auto& cursor = context.selections().main().cursor();
-        const int tabstop = context.options()["tabstop"].get<int>();
+        const int tabstop = context.options().get(tabstop_id);
         const LineCount win_height = context.window().dimensions().line;
+        Cache& cache = update_cache(buffer, wrap_column, tabstop);
         for (auto it = display_buffer.lines().begin();
              it != display_buffer.lines().end(); ++it)
         {
             const LineCount buf_line = it->range().begin.line;
-            const ByteCount line_length = buffer[buf_line].length();
 
-            auto coord = next_split_coord(buffer, wrap_column, tabstop, buf_line);
-            if (buffer.is_valid(coord) and not buffer.is_end(coord))
+            auto& splits = line_splits(buffer, wrap_column, tabstop, cache, buf_line);
+            if (not splits.empty() and
+                buffer.is_valid({buf_line, splits[0]}) and
+                not buffer.is_end({buf_line, splits[0]}))
             {
+                size_t split = 0;
                 for (auto atom_it = it->begin();
-                     coord.column != line_length and atom_it != it->end(); )
+                     split != splits.size() and atom_it != it->end(); )
                 {
+                    const BufferCoord coord{buf_line, splits[split]};
                     if (!atom_it->has_buffer_range() or
                         coord < atom_it->begin() or coord >= atom_it->end())
                     {
@@ -690,7 +1034,7 @@ struct WrapHighlighter : Highlighter
                     auto& line = *it;
 
                     if (coord > atom_it->begin())
-                        atom_it = ++line.split(atom_it, coord);
+                        atom_it = line.split(atom_it, coord) + 1;
 
                     DisplayLine new_line{ AtomList{ atom_it, line.end() } };
                     line.erase(atom_it, line.end());
@@ -710,7 +1054,7 @@ struct WrapHighlighter : Highlighter
                     }
                     it = display_buffer.lines().insert(it+1, new_line);
 
-                    coord = next_split_coord(buffer, wrap_column, tabstop, coord);
+                    ++split;
                     atom_it = it->begin();
                 }
             }
@@ -725,20 +1069,12 @@ struct WrapHighlighter : Highlighter
 
         const Buffer& buffer = context.buffer();
         const auto& cursor = context.selections().main().cursor();
-        const int tabstop = context.options()["tabstop"].get<int>();
+        const int tabstop = context.options().get(tabstop_id);
+        Cache& cache = update_cache(buffer, wrap_column, tabstop);
 
         auto line_wrap_count = [&](LineCount line) {
-            LineCount count = 0;
-            BufferCoord coord{line};
-            const ByteCount line_length = buffer[line].length();
-            while (true)
-            {
-                coord = next_split_coord(buffer, wrap_column, tabstop, coord);
-                if (coord.column == line_length)
-                    break;
-                ++count;
-            }
-            return count;
+            return LineCount{(int)line_splits(buffer, wrap_column, tabstop,
+                                              cache, line).size()};
         };
 
         // Disable horizontal scrolling when using a WrapHighlighter
@@ -764,10 +1100,13 @@ struct WrapHighlighter : Highlighter
             // Place the cursor correctly after its line gets wrapped
             else if (win_line == setup.cursor_pos.line)
             {
+                auto& splits = line_splits(buffer, wrap_column, tabstop, cache, buf_line);
+                const ByteCount line_length = buffer[buf_line].length();
                 BufferCoord coord{buf_line};
-                while (true)
+                for (size_t split = 0; true; ++split)
                 {
-                    auto split_coord = next_split_coord(buffer, wrap_column, tabstop, coord);
+                    const BufferCoord split_coord{buf_line, split < splits.size() ?
+                                                  splits[split] : line_length};
                     if (split_coord.column > cursor.column)
                     {
                         setup.cursor_pos.column = get_column(buffer, tabstop, cursor) - get_column(buffer, tabstop, coord);
@@ -823,6 +1162,101 @@ struct WrapHighlighter : Highlighter
         return split_coord;
     };
 
+    struct Cache
+    {
+        struct Line
+        {
+            bool computed = false;
+            Vector<ByteCount, MemoryDomain::Highlight> splits;
+        };
+
+        size_t timestamp = 0;
+        ColumnCount wrap_column = -1;
+        int tabstop = 0;
+        Vector<Line, MemoryDomain::Highlight> lines;
+    };
+    using CacheList = Vector<Cache, MemoryDomain::Highlight>;
+
+    // split points only depend on the wrap column and tabstop, so each
+    // combination in use gets its own cache; clients viewing the buffer
+    // at different widths then keep their lazily computed splits instead
+    // of invalidating each other every frame
+    static constexpr size_t max_cached_widths = 4;
+
+    Cache& update_cache(const Buffer& buffer, ColumnCount wrap_column, int tabstop)
+    {
+        CacheList& caches = m_cache.get(buffer);
+        auto it = find_if(caches, [&](const Cache& cache) {
+            return cache.wrap_column == wrap_column and cache.tabstop == tabstop;
+        });
+        if (it == caches.end())
+        {
+            if (caches.size() >= max_cached_widths) // least recently used goes
+                caches.pop_back();
+            Cache cache;
+            cache.wrap_column = wrap_column;
+            cache.tabstop = tabstop;
+            cache.timestamp = buffer.timestamp();
+            cache.lines.resize((int)buffer.line_count());
+            caches.insert(caches.begin(), std::move(cache));
+            return caches.front();
+        }
+        std::rotate(caches.begin(), it, it + 1); // most recently used first
+        Cache& cache = caches.front();
+        if (cache.timestamp == buffer.timestamp())
+            return cache;
+
+        auto modifs = compute_line_modifications(buffer, cache.timestamp);
+        cache.timestamp = buffer.timestamp();
+
+        // splice the still valid lines over, edited ones get recomputed lazily
+        Vector<Cache::Line, MemoryDomain::Highlight> new_lines;
+        new_lines.reserve((int)buffer.line_count());
+        auto old_line = 0_line;
+        for (auto& modif : modifs)
+        {
+            while (old_line < modif.old_line)
+                new_lines.push_back(std::move(cache.lines[(int)old_line++]));
+            kak_assert((int)new_lines.size() == (int)modif.new_line);
+            old_line += modif.num_removed;
+            new_lines.resize(new_lines.size() + (int)modif.num_added);
+        }
+        while (old_line != cache.lines.size())
+            new_lines.push_back(std::move(cache.lines[(int)old_line++]));
+        kak_assert((int)new_lines.size() == (int)buffer.line_count());
+        cache.lines = std::move(new_lines);
+        return cache;
+    }
+
+    const Vector<ByteCount, MemoryDomain::Highlight>&
+    line_splits(const Buffer& buffer, ColumnCount wrap_column, int tabstop,
+                Cache& cache, LineCount buf_line)
+    {
+        auto& line = cache.lines[(int)buf_line];
+        if (not line.computed)
+        {
+            // most lines fit; the cached line metrics tell without
+            // scanning for split points
+            auto& metrics = buffer.line_storage(buf_line)->metrics();
+            if (metrics.ascii and metrics.column_length <= wrap_column)
+            {
+                line.computed = true;
+                return line.splits;
+            }
+            const ByteCount line_length = buffer[buf_line].length();
+            BufferCoord coord{buf_line};
+            while (true)
+            {
+                coord = next_split_coord(buffer, wrap_column, tabstop, coord);
+                if (coord.column == line_length)
+                    break;
+                line.splits.push_back(coord.column);
+            }
+            line.computed = true;
+        }
+        return line.splits;
+    }
+
     static HighlighterAndId create(HighlighterParameters params)
     {
         static const ParameterDesc param_desc{
@@ -841,6 +1275,7 @@ struct WrapHighlighter : Highlighter
 
     const bool m_word_wrap;
     const ColumnCount m_max_width;
+    BufferSideCache<CacheList> m_cache;
 };
 
 struct TabulationHighlighter : Highlighter
@@ -850,7 +1285,7 @@ struct TabulationHighlighter : Highlighter
     void do_highlight(const Context& context, HighlightPass,
                       DisplayBuffer& display_buffer, BufferRange) override
     {
-        const ColumnCount tabstop = context.options()["tabstop"].get<int>();
+        const ColumnCount tabstop = context.options().get(tabstop_id);
         auto& buffer = context.buffer();
         auto win_column = context.window().position().column;
         for (auto& line : display_buffer.lines())
@@ -867,7 +1302,7 @@ struct TabulationHighlighter : Highlighter
                     if (*it == '\t')
                     {
                         if (it != begin)
-                            atom_it = ++line.split(atom_it, it.coord());
+                            atom_it = line.split(atom_it, it.coord()) + 1;
                         if (it+1 != end)
                             atom_it = line.split(atom_it, (it+1).coord());
 
@@ -890,7 +1325,7 @@ struct TabulationHighlighter : Highlighter
         if (buffer.byte_at(cursor) != '\t')
             return;
 
-        const ColumnCount tabstop = context.options()["tabstop"].get<int>();
+        const ColumnCount tabstop = context.options().get(tabstop_id);
         const ColumnCount column = get_column(buffer, tabstop, cursor);
         const ColumnCount width = tabstop - (column % tabstop);
         const ColumnCount win_end = setup.window_pos.column + setup.window_range.column;
@@ -905,8 +1340,9 @@ void show_whitespaces(const Context& context, HighlightPass, DisplayBuffer& disp
                       StringView tab, StringView tabpad,
                       StringView spc, StringView lf, StringView nbsp)
 {
-    const int tabstop = context.options()["tabstop"].get<int>();
-    auto whitespaceface = get_face("Whitespace");
+    const int tabstop = context.options().get(tabstop_id);
+    static const FaceRef whitespace_face_ref{"Whitespace"};
+    auto whitespaceface = get_face(whitespace_face_ref);
     auto& buffer = context.buffer();
     auto win_column = context.window().position().column;
     for (auto& line : display_buffer.lines())
@@ -925,7 +1361,7 @@ void show_whitespaces(const Context& context, HighlightPass, DisplayBuffer& disp
                 if (cp == '\t' or cp == ' ' or cp == '\n' or cp == 0xA0)
                 {
                     if (coord != begin.coord())
-                        atom_it = ++line.split(atom_it, coord);
+                        atom_it = line.split(atom_it, coord) + 1;
                     if (it != end)
                         atom_it = line.split(atom_it, it.coord());
 
@@ -1007,15 +1443,21 @@ struct LineNumbersHighlighter : Highlighter
 private:
     void do_highlight(const Context& context, HighlightPass, DisplayBuffer& display_buffer, BufferRange) override
     {
-        const Face face = get_face("LineNumbers");
-        const Face face_wrapped = get_face("LineNumbersWrapped");
-        const Face face_absolute = get_face("LineNumberCursor");
+        static const FaceRef numbers_face_ref{"LineNumbers"};
+        static const FaceRef wrapped_face_ref{"LineNumbersWrapped"};
+        static const FaceRef cursor_face_ref{"LineNumberCursor"};
+        const Face face = get_face(numbers_face_ref);
+        const Face face_wrapped = get_face(wrapped_face_ref);
+        const Face face_absolute = get_face(cursor_face_ref);
         int digit_count = compute_digit_count(context);
 
         char format[16];
         format_to(format, "%{}d", digit_count);
         const int main_line = (int)context.selections().main().cursor().line + 1;
         int last_line = -1;
+        // gutter strings are small enough to stay inline in String, so the
+        // only cost of pushing them is the insertion itself, done in one go
+        const DisplayAtom separator{m_separator, face};
         for (auto& line : display_buffer.lines())
         {
             const int current_line = (int)line.range().begin.line + 1;
@@ -1026,8 +1468,7 @@ private:
             snprintf(buffer, 16, format, std::abs(line_to_format));
             const auto atom_face = last_line == current_line ? face_wrapped :
                 ((m_hl_cursor_line and is_cursor_line) ? face_absolute : face);
-            line.insert(line.begin(), {buffer, atom_face});
-            line.insert(line.begin() + 1, {m_separator, face});
+            line.insert(line.begin(), {{buffer, atom_face}, separator});
 
             last_line = current_line;
         }
@@ -1056,11 +1497,14 @@ private:
 
 void show_matching_char(const Context& context, HighlightPass, DisplayBuffer& display_buffer, BufferRange)
 {
-    const Face face = get_face("MatchingChar");
+    static const FaceRef matching_face_ref{"MatchingChar"};
+    const Face face = get_face(matching_face_ref);
     using CodepointPair = std::pair<Codepoint, Codepoint>;
     static const CodepointPair matching_chars[] = { { '(', ')' }, { '{', '}' }, { '[', ']' }, { '<', '>' } };
     const auto range = display_buffer.range();
     const auto& buffer = context.buffer();
+    auto& index = BracketIndex::get(buffer);
+    index.update();
     for (auto& sel : context.selections())
     {
         auto pos = sel.cursor();
@@ -1069,40 +1513,21 @@ void show_matching_char(const Context& context, HighlightPass, DisplayBuffer& di
         auto c = buffer.byte_at(pos);
         for (auto& pair : matching_chars)
         {
-            int level = 1;
             if (c == pair.first)
             {
-                for (auto it = get_iterator(buffer, pos)+1,
-                         end = get_iterator(buffer, range.end); it != end; ++it)
-                {
-                    char c = *it;
-                    if (c == pair.first)
-                        ++level;
-                    else if (c == pair.second and --level == 0)
-                    {
-                        highlight_range(display_buffer, it.coord(), (it+1).coord(), false,
-                                        apply_face(face));
-                        break;
-                    }
-                }
+                auto match = index.find_closing(pos, (char)pair.first,
+                                                (char)pair.second, 0);
+                if (match and *match < range.end)
+                    highlight_range(display_buffer, *match, buffer.char_next(*match),
+                                    false, apply_face(face));
             }
             else if (c == pair.second and pos > range.begin)
             {
-                for (auto it = get_iterator(buffer, pos)-1,
-                         end = get_iterator(buffer, range.begin); true; --it)
-                {
-                    char c = *it;
-                    if (c == pair.second)
-                        ++level;
-                    else if (c == pair.first and --level == 0)
-                    {
-                        highlight_range(display_buffer, it.coord(), (it+1).coord(), false,
-                                        apply_face(face));
-                        break;
-                    }
-                    if (it == end)
-                        break;
-                }
+                auto match = index.find_opening(pos, (char)pair.first,
+                                                (char)pair.second, 0);
+                if (match and *match >= range.begin)
+                    highlight_range(display_buffer, *match, buffer.char_next(*match),
+                                    false, apply_face(face));
             }
         }
     }
@@ -1116,12 +1541,18 @@ HighlighterAndId create_matching_char_highlighter(HighlighterParameters params)
 void highlight_selections(const Context& context, HighlightPass, DisplayBuffer& display_buffer, BufferRange)
 {
     const auto& buffer = context.buffer();
-    const Face primary_face = get_face("PrimarySelection");
-    const Face secondary_face = get_face("SecondarySelection");
-    const Face primary_cursor_face = get_face("PrimaryCursor");
-    const Face secondary_cursor_face = get_face("SecondaryCursor");
+    static const FaceRef primary_face_ref{"PrimarySelection"};
+    static const FaceRef secondary_face_ref{"SecondarySelection"};
+    static const FaceRef primary_cursor_face_ref{"PrimaryCursor"};
+    static const FaceRef secondary_cursor_face_ref{"SecondaryCursor"};
+    const Face primary_face = get_face(primary_face_ref);
+    const Face secondary_face = get_face(secondary_face_ref);
+    const Face primary_cursor_face = get_face(primary_cursor_face_ref);
+    const Face secondary_cursor_face = get_face(secondary_cursor_face_ref);
 
     const auto& selections = context.selections();
+    Vector<RangeAndFace, MemoryDomain::Highlight> ranges;
+    ranges.reserve(selections.size() * 2);
     for (size_t i = 0; i < selections.size(); ++i)
     {
         auto& sel = selections[i];
@@ -1130,22 +1561,23 @@ void highlight_selections(const Context& context, HighlightPass, DisplayBuffer&
         BufferCoord end   = forward ? (BufferCoord)sel.cursor() : buffer.char_next(sel.anchor());
 
         const bool primary = (i == selections.main_index());
-        highlight_range(display_buffer, begin, end, false,
-                        apply_face(primary ? primary_face : secondary_face));
+        ranges.push_back({begin, end, primary ? primary_face : secondary_face});
     }
     for (size_t i = 0; i < selections.size(); ++i)
     {
         auto& sel = selections[i];
         const bool primary = (i == selections.main_index());
-        highlight_range(display_buffer, sel.cursor(), buffer.char_next(sel.cursor()), false,
-                        apply_face(primary ? primary_cursor_face : secondary_cursor_face));
+        ranges.push_back({sel.cursor(), buffer.char_next(sel.cursor()),
+                          primary ? primary_cursor_face : secondary_cursor_face});
     }
+    highlight_ranges(display_buffer, false, ranges);
 }
 
 void expand_unprintable(const Context& context, HighlightPass, DisplayBuffer& display_buffer, BufferRange)
 {
     auto& buffer = context.buffer();
-    auto error = get_face("Error");
+    static const FaceRef error_face_ref{"Error"};
+    auto error = get_face(error_face_ref);
     for (auto& line : display_buffer.lines())
     {
         for (auto atom_it = line.begin(); atom_it != line.end(); ++atom_it)
@@ -1160,7 +1592,7 @@ void expand_unprintable(const Context& context, HighlightPass, DisplayBuffer& di
                     if (cp != '\n' and not iswprint((wchar_t)cp))
                     {
                         if (coord != atom_it->begin())
-                            atom_it = ++line.split(atom_it, coord);
+                            atom_it = line.split(atom_it, coord) + 1;
                         if (it.coord() < atom_it->end())
                             atom_it = line.split(atom_it, it.coord());
 
@@ -1176,14 +1608,20 @@ void expand_unprintable(const Context& context, HighlightPass, DisplayBuffer& di
 
 static void update_line_specs_ifn(const Buffer& buffer, LineAndSpecList& line_flags)
 {
+    auto& lines = line_flags.list;
+    auto cmp = [](const LineAndSpec& lhs, const LineAndSpec& rhs)
+               { return std::get<0>(lhs) < std::get<0>(rhs); };
+
     if (line_flags.prefix == buffer.timestamp())
+    {
+        // a freshly set option comes in any order, highlighters rely on
+        // sorted lines to binary search the displayed interval
+        if (not std::is_sorted(lines.begin(), lines.end(), cmp))
+            std::sort(lines.begin(), lines.end(), cmp);
         return;
+    }
 
-    auto& lines = line_flags.list;
-
-    std::sort(lines.begin(), lines.end(),
-              [](const LineAndSpec& lhs, const LineAndSpec& rhs)
-              { return std::get<0>(lhs) < std::get<0>(rhs); });
+    std::sort(lines.begin(), lines.end(), cmp);
 
     auto modifs = compute_line_modifications(buffer, line_flags.prefix);
     auto ins_pos = lines.begin();
@@ -1270,10 +1708,10 @@ private:
         for (auto& line : display_buffer.lines())
         {
             int line_num = (int)line.range().begin.line + 1;
-            auto it = find_if(lines,
-                              [&](const LineAndSpec& l)
-                              { return std::get<0>(l) == line_num; });
-            if (it == lines.end())
+            auto it = std::lower_bound(lines.begin(), lines.end(), line_num,
+                                       [](const LineAndSpec& l, int line_num)
+                                       { return (int)std::get<0>(l) < line_num; });
+            if (it == lines.end() or (int)std::get<0>(*it) != line_num)
                 line.insert(line.begin(), empty);
             else
             {
@@ -1311,7 +1749,7 @@ private:
     }
 
     String m_option_name;
-    String m_default_face;
+    FaceRef m_default_face;
 };
 
 String option_to_string(InclusiveBufferRange range)
@@ -1350,27 +1788,35 @@ BufferCoord& get_last(RangeAndString& r) { return std::get<0>(r).last; }
 
 static void update_ranges_ifn(const Buffer& buffer, RangeAndStringList& range_and_faces)
 {
-    if (range_and_faces.prefix == buffer.timestamp())
-        return;
-
-    auto changes = buffer.changes_since(range_and_faces.prefix);
-    for (auto change_it = changes.begin(); change_it != changes.end(); )
+    if (range_and_faces.prefix != buffer.timestamp())
     {
-        auto forward_end = forward_sorted_until(change_it, changes.end());
-        auto backward_end = backward_sorted_until(change_it, changes.end());
-
-        if (forward_end >= backward_end)
+        auto changes = buffer.changes_since(range_and_faces.prefix);
+        for (auto change_it = changes.begin(); change_it != changes.end(); )
         {
-            update_forward({ change_it, forward_end }, range_and_faces.list);
-            change_it = forward_end;
-        }
-        else
-        {
-            update_backward({ change_it, backward_end }, range_and_faces.list);
-            change_it = backward_end;
+            auto forward_end = forward_sorted_until(change_it, changes.end());
+            auto backward_end = backward_sorted_until(change_it, changes.end());
+
+            if (forward_end >= backward_end)
+            {
+                update_forward({ change_it, forward_end }, range_and_faces.list);
+                change_it = forward_end;
+            }
+            else
+            {
+                update_backward({ change_it, backward_end }, range_and_faces.list);
+                change_it = backward_end;
+            }
         }
+        range_and_faces.prefix = buffer.timestamp();
     }
-    range_and_faces.prefix = buffer.timestamp();
+
+    // keep the list sorted by range start so highlighters can cheaply
+    // restrict themselves to the displayed interval
+    auto cmp = [](const RangeAndString& lhs, const RangeAndString& rhs)
+               { return std::get<0>(lhs).first < std::get<0>(rhs).first; };
+    if (not std::is_sorted(range_and_faces.list.begin(),
+                           range_and_faces.list.end(), cmp))
+        std::sort(range_and_faces.list.begin(), range_and_faces.list.end(), cmp);
 }
 
 void option_update(RangeAndStringList& opt, const Context& context)
@@ -1403,18 +1849,25 @@ private:
         auto& range_and_faces = context.options()[m_option_name].get_mutable<RangeAndStringList>();
         update_ranges_ifn(buffer, range_and_faces);
 
+        auto& display_range = display_buffer.range();
+        Vector<RangeAndFace, MemoryDomain::Highlight> ranges;
         for (auto& range : range_and_faces.list)
         {
+            auto& r = std::get<0>(range);
+            if (r.first >= display_range.end)
+                break; // sorted by range start, nothing else is displayed
+            if (r.last < display_range.begin)
+                continue;
             try
             {
-                auto& r = std::get<0>(range);
                 if (buffer.is_valid(r.first) and buffer.is_valid(r.last))
-                    highlight_range(display_buffer, r.first, buffer.char_next(r.last), true,
-                                    apply_face(get_face(std::get<1>(range))));
+                    ranges.push_back({r.first, buffer.char_next(r.last),
+                                      get_face(std::get<1>(range))});
             }
             catch (runtime_error&)
             {}
         }
+        highlight_ranges(display_buffer, true, ranges);
     }
 
     const String m_option_name;
@@ -1445,11 +1898,16 @@ private:
         auto& range_and_faces = context.options()[m_option_name].get_mutable<RangeAndStringList>();
         update_ranges_ifn(buffer, range_and_faces);
 
+        auto& display_range = display_buffer.range();
         for (auto& range : range_and_faces.list)
         {
+            auto& r = std::get<0>(range);
+            if (r.first >= display_range.end)
+                break; // sorted by range start, nothing else is displayed
+            if (r.last < display_range.begin)
+                continue;
             try
             {
-                auto& r = std::get<0>(range);
                 if (buffer.is_valid(r.first) and buffer.is_valid(r.last))
                 {
                     auto replacement = parse_display_line(std::get<1>(range));
@@ -1457,7 +1915,7 @@ private:
                                   [&](DisplayLine& line, int beg_idx, int end_idx){
                                       auto it = line.erase(line.begin() + beg_idx, line.begin() + end_idx);
                                       for (auto& atom : replacement)
-                                          it = ++line.insert(it, std::move(atom));
+                                          it = line.insert(it, std::move(atom)) + 1;
                                   });
                 }
             }
@@ -1529,6 +1987,17 @@ private:
         {}
     }
 
+    void do_fetch(const Context& context, HighlightPass pass, BufferRange display_range,
+                  BufferRange range, HighlightTaskList& tasks) override
+    {
+        try
+        {
+            DefinedHighlighters::instance().get_child(m_name).fetch(context, pass, display_range, range, tasks);
+        }
+        catch (child_not_found&)
+        {}
+    }
+
     void do_compute_display_setup(const Context& context, HighlightPass pass, DisplaySetup& setup) override
     {
         try
@@ -1554,11 +2023,18 @@ struct RegexMatch
 };
 using RegexMatchList = Vector<RegexMatch, MemoryDomain::Highlight>;
 
-void find_matches(const Buffer& buffer, RegexMatchList& matches, const Regex& regex, bool capture)
+// one flag per buffer line, lines flagged false are known to contain no
+// match and do not need to be scanned.
+using LineFlags = Vector<bool, MemoryDomain::Highlight>;
+
+void find_matches(const Buffer& buffer, RegexMatchList& matches, const Regex& regex,
+                  bool capture, const LineFlags* relevant)
 {
     capture = capture and regex.mark_count() > 0;
     for (auto line = 0_line, end = buffer.line_count(); line < end; ++line)
     {
+        if (relevant and not (*relevant)[(int)line])
+            continue;
         auto l = buffer[line];
         for (RegexIterator<const char*> it{l.begin(), l.end(), regex}, end{}; it != end; ++it)
         {
@@ -1572,7 +2048,8 @@ void find_matches(const Buffer& buffer, RegexMatchList& matches, const Regex& re
 }
 
 void update_matches(const Buffer& buffer, ConstArrayView<LineModification> modifs,
-                    RegexMatchList& matches, const Regex& regex, bool capture)
+                    RegexMatchList& matches, const Regex& regex, bool capture,
+                    const LineFlags* relevant)
 {
     // remove out of date matches and update line for others
     auto ins_pos = matches.begin();
@@ -1609,6 +2086,8 @@ void update_matches(const Buffer& buffer, ConstArrayView<LineModification> modif
     {
         for (auto line = modif.new_line; line < modif.new_line + modif.num_added; ++line)
         {
+            if (relevant and not (*relevant)[(int)line])
+                continue;
             auto l = buffer[line];
             for (RegexIterator<const char*> it{l.begin(), l.end(), regex}, end{}; it != end; ++it)
             {
@@ -1686,24 +2165,24 @@ struct RegionDesc
     Regex m_recurse;
     bool  m_match_capture;
 
-    RegionMatches find_matches(const Buffer& buffer) const
+    RegionMatches find_matches(const Buffer& buffer, const LineFlags* relevant) const
     {
         RegionMatches res;
-        Kakoune::find_matches(buffer, res.begin_matches, m_begin, m_match_capture);
-        Kakoune::find_matches(buffer, res.end_matches, m_end, m_match_capture);
+        Kakoune::find_matches(buffer, res.begin_matches, m_begin, m_match_capture, relevant);
+        Kakoune::find_matches(buffer, res.end_matches, m_end, m_match_capture, relevant);
         if (not m_recurse.empty())
-            Kakoune::find_matches(buffer, res.recurse_matches, m_recurse, m_match_capture);
+            Kakoune::find_matches(buffer, res.recurse_matches, m_recurse, m_match_capture, relevant);
         return res;
     }
 
     void update_matches(const Buffer& buffer,
                         ConstArrayView<LineModification> modifs,
-                        RegionMatches& matches) const
+                        RegionMatches& matches, const LineFlags* relevant) const
     {
-        Kakoune::update_matches(buffer, modifs, matches.begin_matches, m_begin, m_match_capture);
-        Kakoune::update_matches(buffer, modifs, matches.end_matches, m_end, m_match_capture);
+        Kakoune::update_matches(buffer, modifs, matches.begin_matches, m_begin, m_match_capture, relevant);
+        Kakoune::update_matches(buffer, modifs, matches.end_matches, m_end, m_match_capture, relevant);
         if (not m_recurse.empty())
-            Kakoune::update_matches(buffer, modifs, matches.recurse_matches, m_recurse, m_match_capture);
+            Kakoune::update_matches(buffer, modifs, matches.recurse_matches, m_recurse, m_match_capture, relevant);
     }
 };
 
@@ -1728,6 +2207,31 @@ public:
         }
         if (not m_default_group.empty())
             m_groups.insert({m_default_group, HighlighterGroup{HighlightPass::Colorize}});
+
+        // When every delimiter is supported by the internal regex engine
+        // their alternation is as well, and a line the alternation does not
+        // match cannot contain any delimiter: one scan per line then
+        // replaces one scan per delimiter on the (usually vast) majority
+        // of lines. Regexes the internal engine rejects may contain
+        // backreferences, which alternating would renumber, so the
+        // combined scan is not attempted for those.
+        auto supported = [](const Regex& re) { return re.empty() or re.impl(); };
+        bool can_combine = true;
+        String combined;
+        for (auto& region : m_regions)
+        {
+            for (const Regex* re : { &region.m_begin, &region.m_end, &region.m_recurse })
+            {
+                if (re->empty())
+                    continue;
+                can_combine = can_combine and supported(*re);
+                combined += combined.empty() ? "(?:" : "|(?:";
+                combined += re->str();
+                combined += ")";
+            }
+        }
+        if (can_combine) // no nosubs, it would mask the internal engine
+            m_delimiters = Regex{combined, Regex::optimize};
     }
 
     void do_highlight(const Context& context, HighlightPass pass, DisplayBuffer& display_buffer, BufferRange range) override
@@ -1773,6 +2277,56 @@ public:
                               default_group_it->value);
     }
 
+    void do_fetch(const Context& context, HighlightPass pass, BufferRange display_range,
+                  BufferRange range, HighlightTaskList& tasks) override
+    {
+        const auto& buffer = context.buffer();
+        if (auto task = fetch_regions(buffer))
+        {
+            // the per region children can only fetch once the updated
+            // region list is known, they will scan synchronously this time
+            tasks.push_back(std::move(task));
+            return;
+        }
+
+        auto& regions = get_regions_for_range(buffer, range);
+        auto begin = std::lower_bound(regions.begin(), regions.end(), display_range.begin,
+                                      [](const Region& r, BufferCoord c) { return r.end < c; });
+        auto end = std::lower_bound(begin, regions.end(), display_range.end,
+                                    [](const Region& r, BufferCoord c) { return r.begin < c; });
+        auto correct = [&](BufferCoord c) -> BufferCoord {
+            if (not buffer.is_end(c) and buffer[c.line].length() == c.column)
+                return {c.line+1, 0};
+            return c;
+        };
+        auto child_fetch = [&](BufferCoord begin, BufferCoord end, HighlighterGroup& group) {
+            const BufferRange child_range{begin, end};
+            const BufferRange child_display{std::max(display_range.begin, begin),
+                                            std::min(display_range.end, end)};
+            group.fetch(context, pass, child_display, child_range, tasks);
+        };
+
+        auto default_group_it = m_groups.find(m_default_group);
+        const bool apply_default = default_group_it != m_groups.end();
+
+        auto last_begin = (begin == regions.begin()) ?
+                             BufferCoord{0,0} : (begin-1)->end;
+        for (; begin != end; ++begin)
+        {
+            if (apply_default and last_begin < begin->begin)
+                child_fetch(correct(last_begin), correct(begin->begin),
+                            default_group_it->value);
+
+            auto it = m_groups.find(begin->group);
+            if (it == m_groups.end())
+                continue;
+            child_fetch(correct(begin->begin), correct(begin->end), it->value);
+            last_begin = begin->end;
+        }
+        if (apply_default and last_begin < display_range.end)
+            child_fetch(correct(last_begin), range.end, default_group_it->value);
+    }
+
     bool has_children() const override { return true; }
 
     Highlighter& get_child(StringView path) override
@@ -1837,6 +2391,8 @@ private:
     const RegionDescList m_regions;
     const String m_default_group;
     HashMap<String, HighlighterGroup, MemoryDomain::Highlight> m_groups;
+    Regex m_delimiters; // alternation of every delimiter, empty if unbuildable
+    bool m_fetch_pending = false;
 
     struct Region
     {
@@ -1850,12 +2406,48 @@ private:
     {
         size_t timestamp = 0;
         Vector<RegionMatches, MemoryDomain::Highlight> matches;
+        RegionList full_regions; // whole buffer range, updated incrementally
         HashMap<BufferRange, RegionList, MemoryDomain::Highlight> regions;
     };
     BufferSideCache<Cache> m_cache;
 
     using RegionAndMatch = std::pair<size_t, RegexMatchList::const_iterator>;
 
+    // flag the lines the combined delimiter regex matches, the others
+    // cannot contain any begin/end/recurse match and get skipped by the
+    // individual scans. Returns an empty list when no combined regex
+    // could be built.
+    LineFlags relevant_lines(const Buffer& buffer) const
+    {
+        LineFlags flags;
+        if (m_delimiters.empty())
+            return flags;
+        flags.reserve((size_t)(int)buffer.line_count());
+        for (auto line = 0_line, end = buffer.line_count(); line < end; ++line)
+        {
+            auto l = buffer[line];
+            flags.push_back(regex_search(l.begin(), l.end(), m_delimiters));
+        }
+        return flags;
+    }
+
+    LineFlags relevant_lines(const Buffer& buffer, ConstArrayView<LineModification> modifs) const
+    {
+        LineFlags flags;
+        if (m_delimiters.empty())
+            return flags;
+        flags.resize((size_t)(int)buffer.line_count(), false);
+        for (auto& modif : modifs)
+        {
+            for (auto line = modif.new_line; line < modif.new_line + modif.num_added; ++line)
+            {
+                auto l = buffer[line];
+                flags[(int)line] = regex_search(l.begin(), l.end(), m_delimiters);
+            }
+        }
+        return flags;
+    }
+
     // find the begin closest to pos in all matches
     RegionAndMatch find_next_begin(const Cache& cache, BufferCoord pos) const
     {
@@ -1872,35 +2464,17 @@ private:
         return res;
     }
 
-    const RegionList& get_regions_for_range(const Buffer& buffer, BufferRange range)
-    {
-        Cache& cache = m_cache.get(buffer);
-        const size_t buf_timestamp = buffer.timestamp();
-        if (cache.timestamp != buf_timestamp)
-        {
-            if (cache.timestamp == 0)
-            {
-                cache.matches.resize(m_regions.size());
-                for (size_t i = 0; i < m_regions.size(); ++i)
-                    cache.matches[i] = m_regions[i].find_matches(buffer);
-            }
-            else
-            {
-                auto modifs = compute_line_modifications(buffer, cache.timestamp);
-                for (size_t i = 0; i < m_regions.size(); ++i)
-                    m_regions[i].update_matches(buffer, modifs, cache.matches[i]);
-            }
-
-            cache.regions.clear();
-        }
-
-        auto it = cache.regions.find(range);
-        if (it != cache.regions.end())
-            return it->value;
-
-        RegionList& regions = cache.regions[range];
-
-        for (auto begin = find_next_begin(cache, range.begin),
+    // Build the region list for range by walking the delimiter matches from
+    // pos, appending to regions. When reconverge regions are given (already
+    // at their current coordinates, all beginning after the last modified
+    // line) and the walk produces one of them, the following ones only
+    // depend on matches the modification did not touch and get spliced
+    // instead of recomputed.
+    void add_regions(const Cache& cache, RegionList& regions, BufferCoord pos,
+                     BufferRange range, ConstArrayView<Region> reconverge) const
+    {
+        size_t next = 0;
+        for (auto begin = find_next_begin(cache, pos),
                   end = RegionAndMatch{ 0, cache.matches[0].begin_matches.end() };
              begin != end; )
         {
@@ -1923,6 +2497,20 @@ private:
                 regions.push_back({ beg_it->begin_coord(),
                                    end_it->end_coord(),
                                    region.m_name });
+
+                while (next != reconverge.size() and
+                       reconverge[next].begin < regions.back().begin)
+                    ++next;
+                if (next != reconverge.size() and
+                    reconverge[next].begin == regions.back().begin and
+                    reconverge[next].end == regions.back().end and
+                    reconverge[next].group == regions.back().group)
+                {
+                    for (++next; next != reconverge.size(); ++next)
+                        regions.push_back(reconverge[next]);
+                    return;
+                }
+
                 auto end_coord = end_it->end_coord();
 
                 // With empty begin and end matches (for example if the regexes
@@ -1937,7 +2525,112 @@ private:
                 begin = find_next_begin(cache, end_coord);
             }
         }
-        cache.timestamp = buf_timestamp;
+    }
+
+    // Reuse the previous whole buffer region list across a modification:
+    // regions ending before the first modified line are still valid, the
+    // walk restarts after them and stops as soon as it reconverges on the
+    // old regions beginning after the last modified line (shifted to their
+    // new position) instead of continuing to the end of the buffer.
+    void update_full_regions(Cache& cache, BufferRange range,
+                             ConstArrayView<LineModification> modifs) const
+    {
+        if (modifs.empty())
+            return;
+
+        RegionList old_regions = std::move(cache.full_regions);
+        cache.full_regions.clear();
+
+        const LineCount first_modified = modifs.front().new_line;
+        auto it = old_regions.begin();
+        for (; it != old_regions.end() and it->end.line < first_modified; ++it)
+            cache.full_regions.push_back(*it);
+        // a zero width region would be found again from its own end
+        while (not cache.full_regions.empty() and
+               cache.full_regions.back().begin == cache.full_regions.back().end)
+            cache.full_regions.pop_back();
+
+        const LineCount first_unchanged = modifs.back().old_line + modifs.back().num_removed;
+        const LineCount diff = modifs.back().diff();
+        RegionList reconverge;
+        for (; it != old_regions.end(); ++it)
+        {
+            if (it->begin.line >= first_unchanged)
+                reconverge.push_back({ {it->begin.line + diff, it->begin.column},
+                                       {it->end.line + diff, it->end.column},
+                                       it->group });
+        }
+
+        const BufferCoord pos = cache.full_regions.empty() ?
+            range.begin : cache.full_regions.back().end;
+        add_regions(cache, cache.full_regions, pos, range, reconverge);
+    }
+
+    // Cache bookkeeping, returning the scan (if any) still needed to bring
+    // the region list up to date as a task runnable on a worker thread. At
+    // most one task is pending at a time so that concurrent tasks never
+    // share the cache, even when the highlighter is referenced several
+    // times.
+    HighlightTask fetch_regions(const Buffer& buffer)
+    {
+        if (m_fetch_pending)
+            return {};
+
+        Cache& cache = m_cache.get(buffer);
+        const size_t buf_timestamp = buffer.timestamp();
+        if (cache.timestamp == buf_timestamp)
+            return {};
+
+        m_fetch_pending = true;
+        return [this, &buffer, &cache, buf_timestamp] {
+            auto done = on_scope_end([this]{ m_fetch_pending = false; });
+            const BufferRange full_range{{0,0}, buffer.end_coord()};
+            if (cache.timestamp == 0)
+            {
+                const LineFlags relevant = relevant_lines(buffer);
+                const auto* filter = m_delimiters.empty() ? nullptr : &relevant;
+                cache.matches.resize(m_regions.size());
+                for (size_t i = 0; i < m_regions.size(); ++i)
+                    cache.matches[i] = m_regions[i].find_matches(buffer, filter);
+
+                cache.full_regions.clear();
+                add_regions(cache, cache.full_regions, full_range.begin, full_range, {});
+            }
+            else
+            {
+                auto modifs = compute_line_modifications(buffer, cache.timestamp);
+                const LineFlags relevant = relevant_lines(buffer, modifs);
+                const auto* filter = m_delimiters.empty() ? nullptr : &relevant;
+                for (size_t i = 0; i < m_regions.size(); ++i)
+                    m_regions[i].update_matches(buffer, modifs, cache.matches[i], filter);
+
+                update_full_regions(cache, full_range, modifs);
+            }
+
+            cache.regions.clear();
+            cache.timestamp = buf_timestamp;
+        };
+    }
+
+    const RegionList& get_regions_for_range(const Buffer& buffer, BufferRange range)
+    {
+        // when the fetch phase did not run beforehand, compute synchronously
+        if (auto task = fetch_regions(buffer))
+            task();
+
+        Cache& cache = m_cache.get(buffer);
+        const BufferRange full_range{{0,0}, buffer.end_coord()};
+        if (range == full_range)
+            return cache.full_regions;
+
+        // nested regions highlighters get handed sub ranges depending on the
+        // parents regions, those are just rebuilt whenever the buffer changes
+        auto it = cache.regions.find(range);
+        if (it != cache.regions.end())
+            return it->value;
+
+        RegionList& regions = cache.regions[range];
+        add_regions(cache, regions, range.begin, range, {});
         return regions;
     }
 };
@@ -1,6 +1,8 @@
 #include "hook_manager.hh"
 
 #include "buffer_utils.hh"
+#include "client.hh"
+#include "client_manager.hh"
 #include "clock.hh"
 #include "command_manager.hh"
 #include "context.hh"
@@ -9,15 +11,37 @@
 #include "option.hh"
 #include "ranges.hh"
 #include "regex.hh"
+#include "trace.hh"
 
 namespace Kakoune
 {
 
+static const TypedOptionId<DebugFlags> debug_id{"debug"};
+static const TypedOptionId<Regex> disabled_hooks_id{"disabled_hooks"};
+
 struct HookManager::Hook
 {
+    // filters are classified once at declaration so that dispatch can
+    // skip the regex engine for the common catch-all and literal ones
+    enum class Filter : char { MatchAll, Literal, Dynamic };
+
     String group;
     Regex filter;
     String commands;
+    Filter filter_kind;
+    // commands parsed once on first run, so that hooks triggered on
+    // every keystroke do not pay for tokenization each time
+    Optional<TokenList> parsed;
+
+    static Filter classify_filter(StringView pattern)
+    {
+        if (pattern == ".*")
+            return Filter::MatchAll;
+        if (std::any_of(pattern.begin(), pattern.end(),
+                        [](char c) { return contains(R"(\^$.|?*+()[]{})"_sv, c); }))
+            return Filter::Dynamic;
+        return Filter::Literal;
+    }
 };
 
 HookManager::HookManager() : m_parent(nullptr) {}
@@ -27,7 +51,9 @@ HookManager::~HookManager() = default;
 void HookManager::add_hook(StringView hook_name, String group, Regex filter, String commands)
 {
     auto& hooks = m_hooks[hook_name];
-    hooks.emplace_back(new Hook{std::move(group), std::move(filter), std::move(commands)});
+    auto filter_kind = Hook::classify_filter(filter.str());
+    hooks.emplace_back(new Hook{std::move(group), std::move(filter),
+                                std::move(commands), filter_kind});
 }
 
 void HookManager::remove_hooks(StringView group)
@@ -61,14 +87,103 @@ CandidateList HookManager::complete_hook_group(StringView prefix, ByteCount pos_
     return res;
 }
 
+// frame length and the share of it hooks may consume before further
+// triggers of the coalescible class get deferred to the next frame
+static constexpr std::chrono::milliseconds hook_frame{100};
+static constexpr std::chrono::milliseconds hook_budget{50};
+
+// idle-style hooks only report a lull in activity; when they trigger
+// faster than they run, executing the latest instance is as good as
+// executing every one of them
+static bool is_coalescible(StringView hook_name)
+{
+    return hook_name.length() > 4 and
+           hook_name.substr(hook_name.length() - 4) == "Idle";
+}
+
 void HookManager::run_hook(StringView hook_name,
                            StringView param, Context& context) const
 {
     if (context.hooks_disabled())
         return;
 
+    auto* root = this;
+    while (root->m_parent)
+        root = root->m_parent.get();
+
+    const auto now = Clock::now();
+    if (now - root->m_frame_start >= hook_frame)
+    {
+        root->m_frame_start = now;
+        root->m_frame_spent = {};
+    }
+
+    // the budget cannot preempt a hook that already runs, it only keeps
+    // the deferrable class from starting once the frame is spent, so
+    // worst case input latency is bounded by the slowest single hook
+    // instead of the whole plugin load
+    if (root->m_frame_spent >= hook_budget and
+        is_coalescible(hook_name) and context.has_client() and
+        EventManager::has_instance())
+    {
+        root->defer_hook(hook_name, param, context.name());
+        return;
+    }
+
+    const bool outermost = m_running_hooks.empty();
+    run_hook_impl(hook_name, param, context);
+    if (outermost)
+        root->m_frame_spent += Clock::now() - now;
+}
+
+void HookManager::defer_hook(StringView hook_name, StringView param,
+                             StringView client) const
+{
+    kak_assert(not m_parent);
+    auto it = find_if(m_deferred, [&](const DeferredHook& hook) {
+        return hook.hook_name == hook_name and hook.client == client;
+    });
+    if (it != m_deferred.end())
+        it->param = param.str();
+    else
+        m_deferred.push_back({hook_name.str(), param.str(), client.str()});
+
+    if (not m_flush_timer)
+        m_flush_timer.emplace(m_frame_start + hook_frame, [this](Timer&) {
+            flush_deferred_hooks();
+        });
+    else if (m_flush_timer->next_date() == TimePoint::max())
+        m_flush_timer->set_next_date(m_frame_start + hook_frame);
+}
+
+void HookManager::flush_deferred_hooks() const
+{
+    if (not ClientManager::has_instance())
+    {
+        m_deferred.clear();
+        return;
+    }
+
+    // open a fresh frame so the flush does not immediately defer again
+    m_frame_start = Clock::now();
+    m_frame_spent = {};
+
+    auto deferred = std::move(m_deferred);
+    m_deferred.clear();
+    for (auto& hook : deferred)
+    {
+        // clients may be gone by now, their pending hooks go with them
+        if (Client* client = ClientManager::instance().get_client_ifp(hook.client))
+            client->context().hooks().run_hook(hook.hook_name, hook.param,
+                                               client->context());
+    }
+}
+
+void HookManager::run_hook_impl(StringView hook_name,
+                                StringView param, Context& context) const
+{
     if (m_parent)
-        m_parent->run_hook(hook_name, param, context);
+        m_parent->run_hook_impl(hook_name, param, context);
 
     auto hook_list = m_hooks.find(hook_name);
     if (hook_list == m_hooks.end())
@@ -88,21 +203,35 @@ void HookManager::run_hook(StringView hook_name,
             m_hooks_trash.clear();
     });
 
-    const DebugFlags debug_flags = context.options()["debug"].get<DebugFlags>();
+    const DebugFlags debug_flags = context.options().get(debug_id);
     const bool profile = debug_flags & DebugFlags::Profile;
     auto start_time = profile ? Clock::now() : TimePoint{};
 
-    auto& disabled_hooks = context.options()["disabled_hooks"].get<Regex>();
+    auto& disabled_hooks = context.options().get(disabled_hooks_id);
 
     struct ToRun { Hook* hook; MatchResults<const char*> captures; };
     Vector<ToRun> hooks_to_run; // The m_hooks_trash vector ensure hooks wont die during this method
     for (auto& hook : hook_list->value)
     {
+        if (not (hook->group.empty() or disabled_hooks.empty() or
+                 not regex_match(hook->group.begin(), hook->group.end(), disabled_hooks)))
+            continue;
+
         MatchResults<const char*> captures;
-        if ((hook->group.empty() or disabled_hooks.empty() or
-             not regex_match(hook->group.begin(), hook->group.end(), disabled_hooks))
-            and regex_match(param.begin(), param.end(), captures, hook->filter))
-            hooks_to_run.push_back({ hook.get(), std::move(captures) });
+        bool matched = false;
+        switch (hook->filter_kind)
+        {
+        case Hook::Filter::MatchAll: matched = true; break;
+        case Hook::Filter::Literal:  matched = (param == hook->filter.str()); break;
+        case Hook::Filter::Dynamic:
+            matched = regex_match(param.begin(), param.end(), captures, hook->filter);
+            break;
+        }
+        if (not matched)
+            continue;
+        if (captures.size() == 0) // emulate the whole match capture
+            captures = MatchResults<const char*>{{ { param.begin(), param.end(), true } }};
+        hooks_to_run.push_back({ hook.get(), std::move(captures) });
     }
 
     bool hook_error = false;
@@ -115,12 +244,17 @@ void HookManager::run_hook(StringView hook_name,
 
             ScopedSetBool disable_history{context.history_disabled()};
 
+            TraceScope trace{"hook", tracing_enabled ?
+                             format("{}({})/{}", hook_name, param, to_run.hook->group) : StringView{}};
+
             EnvVarMap env_vars{ {"hook_param", param.str()} };
             for (size_t i = 0; i < to_run.captures.size(); ++i)
                 env_vars.insert({format("hook_param_capture_{}", i),
                                  {to_run.captures[i].first, to_run.captures[i].second}});
 
-            CommandManager::instance().execute(to_run.hook->commands, context,
+            if (not to_run.hook->parsed)
+                to_run.hook->parsed = parse<true>(to_run.hook->commands);
+            CommandManager::instance().execute(*to_run.hook->parsed, context,
                                                { {}, std::move(env_vars) });
         }
         catch (runtime_error& err)
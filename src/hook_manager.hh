@@ -1,10 +1,15 @@
 #ifndef hook_manager_hh_INCLUDED
 #define hook_manager_hh_INCLUDED
 
+#include "clock.hh"
+#include "event_manager.hh"
 #include "hash_map.hh"
 #include "completion.hh"
+#include "optional.hh"
 #include "safe_ptr.hh"
 
+#include <memory>
+
 namespace Kakoune
 {
 
@@ -30,11 +35,32 @@ private:
 
     struct Hook;
 
+    void run_hook_impl(StringView hook_name, StringView param,
+                       Context& context) const;
+    void defer_hook(StringView hook_name, StringView param,
+                    StringView client) const;
+    void flush_deferred_hooks() const;
+
     SafePtr<HookManager> m_parent;
     HashMap<String, Vector<std::unique_ptr<Hook>, MemoryDomain::Hooks>, MemoryDomain::Hooks> m_hooks;
 
     mutable Vector<std::pair<StringView, StringView>, MemoryDomain::Hooks> m_running_hooks;
     mutable Vector<std::unique_ptr<Hook>, MemoryDomain::Hooks> m_hooks_trash;
+
+    // execution governor state, only used by the root manager: idle-style
+    // hooks that trigger once the frame budget is spent wait here,
+    // coalesced to their latest instance per hook and client, until the
+    // flush timer fires
+    struct DeferredHook
+    {
+        String hook_name;
+        String param;
+        String client;
+    };
+    mutable Vector<DeferredHook, MemoryDomain::Hooks> m_deferred;
+    mutable TimePoint m_frame_start{};
+    mutable Clock::duration m_frame_spent{};
+    mutable Optional<Timer> m_flush_timer;
 };
 
 }
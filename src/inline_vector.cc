@@ -0,0 +1,42 @@
+#include "inline_vector.hh"
+
+#include "string.hh"
+#include "unit_tests.hh"
+
+namespace Kakoune
+{
+
+UnitTest test_inline_vector{[] {
+    // stays inline below the threshold, spills beyond it
+    InlineVector<String, 2> vec;
+    vec.push_back("foo");
+    vec.push_back("bar");
+    kak_assert(vec.capacity() == 2);
+    vec.push_back("baz");
+    kak_assert(vec.capacity() > 2);
+    kak_assert(vec.size() == 3);
+    kak_assert(vec[0] == "foo" and vec[1] == "bar" and vec[2] == "baz");
+
+    // move steals the spilled allocation
+    InlineVector<String, 2> moved{std::move(vec)};
+    kak_assert(moved.size() == 3 and vec.empty());
+    kak_assert(moved[2] == "baz");
+
+    // move of an inline vector moves element-wise
+    InlineVector<String, 2> small{"a"};
+    InlineVector<String, 2> small_moved{std::move(small)};
+    kak_assert(small_moved.size() == 1 and small_moved[0] == "a");
+
+    // insertion and erasure in the middle, across the spill point
+    InlineVector<int, 4> ints{1, 2, 3, 4};
+    ints.insert(ints.begin() + 2, 10);
+    kak_assert((ints == InlineVector<int, 4>{1, 2, 10, 3, 4}));
+    ints.erase(ints.begin() + 1, ints.begin() + 3);
+    kak_assert((ints == InlineVector<int, 4>{1, 3, 4}));
+
+    InlineVector<int, 2> copy{ints.begin(), ints.end()};
+    copy = copy;
+    kak_assert((copy == ints));
+}};
+
+}
@@ -0,0 +1,260 @@
+#ifndef inline_vector_hh_INCLUDED
+#define inline_vector_hh_INCLUDED
+
+#include "array_view.hh"
+#include "memory.hh"
+
+#include <algorithm>
+#include <initializer_list>
+#include <iterator>
+#include <new>
+
+namespace Kakoune
+{
+
+// A contiguous vector with in-object storage for its first N elements,
+// spilling to the domain allocator beyond that. Lists that are almost
+// always tiny (display atoms, capture groups, command tokens) pay a
+// malloc per instance with Vector; with inline storage they only
+// allocate in the rare case they outgrow N.
+template<typename T, size_t N, MemoryDomain domain = memory_domain(Meta::Type<T>{})>
+class InlineVector
+{
+public:
+    using value_type = T;
+    using iterator = T*;
+    using const_iterator = const T*;
+    using reverse_iterator = std::reverse_iterator<iterator>;
+    using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+
+    InlineVector() = default;
+
+    InlineVector(std::initializer_list<T> list)
+    {
+        insert(end(), list.begin(), list.end());
+    }
+
+    template<typename Iterator>
+    InlineVector(Iterator first, Iterator last)
+    {
+        insert(end(), first, last);
+    }
+
+    InlineVector(const InlineVector& other)
+    {
+        insert(end(), other.begin(), other.end());
+    }
+
+    InlineVector(InlineVector&& other) noexcept
+    {
+        steal(other);
+    }
+
+    ~InlineVector()
+    {
+        release();
+    }
+
+    InlineVector& operator=(const InlineVector& other)
+    {
+        if (this != &other)
+        {
+            clear();
+            insert(end(), other.begin(), other.end());
+        }
+        return *this;
+    }
+
+    InlineVector& operator=(InlineVector&& other) noexcept
+    {
+        if (this != &other)
+        {
+            release();
+            steal(other);
+        }
+        return *this;
+    }
+
+    iterator begin() { return m_data; }
+    iterator end() { return m_data + m_size; }
+    const_iterator begin() const { return m_data; }
+    const_iterator end() const { return m_data + m_size; }
+
+    reverse_iterator rbegin() { return reverse_iterator{end()}; }
+    reverse_iterator rend() { return reverse_iterator{begin()}; }
+    const_reverse_iterator rbegin() const { return const_reverse_iterator{end()}; }
+    const_reverse_iterator rend() const { return const_reverse_iterator{begin()}; }
+
+    T* data() { return m_data; }
+    const T* data() const { return m_data; }
+
+    size_t size() const { return m_size; }
+    size_t capacity() const { return m_capacity; }
+    bool empty() const { return m_size == 0; }
+
+    T& operator[](size_t i) { return m_data[i]; }
+    const T& operator[](size_t i) const { return m_data[i]; }
+
+    T& front() { return m_data[0]; }
+    const T& front() const { return m_data[0]; }
+    T& back() { return m_data[m_size-1]; }
+    const T& back() const { return m_data[m_size-1]; }
+
+    operator ArrayView<T>() { return {m_data, m_size}; }
+    operator ArrayView<const T>() const { return {m_data, m_size}; }
+
+    void reserve(size_t new_capacity)
+    {
+        if (new_capacity <= m_capacity)
+            return;
+        new_capacity = std::max(new_capacity, m_capacity * 2);
+        T* new_data = Allocator<T, domain>{}.allocate(new_capacity);
+        for (size_t i = 0; i < m_size; ++i)
+        {
+            new (new_data + i) T(std::move(m_data[i]));
+            m_data[i].~T();
+        }
+        if (spilled())
+            Allocator<T, domain>{}.deallocate(m_data, m_capacity);
+        m_data = new_data;
+        m_capacity = new_capacity;
+    }
+
+    template<typename... Args>
+    T& emplace_back(Args&&... args)
+    {
+        reserve(m_size + 1);
+        new (m_data + m_size) T(std::forward<Args>(args)...);
+        return m_data[m_size++];
+    }
+
+    void push_back(const T& value) { emplace_back(value); }
+    void push_back(T&& value) { emplace_back(std::move(value)); }
+
+    void pop_back()
+    {
+        m_data[--m_size].~T();
+    }
+
+    void clear()
+    {
+        while (m_size != 0)
+            pop_back();
+    }
+
+    void resize(size_t new_size)
+    {
+        reserve(new_size);
+        while (m_size > new_size)
+            pop_back();
+        while (m_size < new_size)
+            emplace_back();
+    }
+
+    iterator insert(const_iterator pos, T value)
+    {
+        return insert(pos, std::make_move_iterator(&value),
+                      std::make_move_iterator(&value + 1));
+    }
+
+    template<typename Iterator>
+    iterator insert(const_iterator pos, Iterator first, Iterator last)
+    {
+        const size_t index = pos - begin();
+        const size_t count = std::distance(first, last);
+        if (count == 0)
+            return begin() + index;
+        reserve(m_size + count);
+        // shift the tail towards the end, into raw storage where needed
+        for (size_t i = m_size; i > index; --i)
+        {
+            const size_t src = i - 1, dst = src + count;
+            if (dst >= m_size)
+                new (m_data + dst) T(std::move(m_data[src]));
+            else
+                m_data[dst] = std::move(m_data[src]);
+        }
+        size_t dst = index;
+        for (auto it = first; it != last; ++it, ++dst)
+        {
+            if (dst < m_size)
+                m_data[dst] = *it;
+            else
+                new (m_data + dst) T(*it);
+        }
+        m_size += count;
+        return begin() + index;
+    }
+
+    iterator erase(const_iterator first, const_iterator last)
+    {
+        iterator out = begin() + (first - begin());
+        iterator in = begin() + (last - begin());
+        iterator new_end = std::move(in, end(), out);
+        while (end() != new_end)
+            pop_back();
+        return out;
+    }
+
+    iterator erase(const_iterator pos)
+    {
+        return erase(pos, pos + 1);
+    }
+
+    template<size_t otherN, MemoryDomain otherDomain>
+    bool operator==(const InlineVector<T, otherN, otherDomain>& other) const
+    {
+        return m_size == other.size() and
+               std::equal(begin(), end(), other.begin());
+    }
+
+    template<size_t otherN, MemoryDomain otherDomain>
+    bool operator!=(const InlineVector<T, otherN, otherDomain>& other) const
+    {
+        return not (*this == other);
+    }
+
+private:
+    T* inline_data() { return reinterpret_cast<T*>(m_storage); }
+    bool spilled() const { return m_data != reinterpret_cast<const T*>(m_storage); }
+
+    void release()
+    {
+        clear();
+        if (spilled())
+            Allocator<T, domain>{}.deallocate(m_data, m_capacity);
+        m_data = inline_data();
+        m_capacity = N;
+    }
+
+    // take other's allocation if it spilled, move its elements into our
+    // inline storage otherwise; other is left empty either way
+    void steal(InlineVector& other) noexcept
+    {
+        if (other.spilled())
+        {
+            m_data = other.m_data;
+            m_size = other.m_size;
+            m_capacity = other.m_capacity;
+            other.m_data = other.inline_data();
+            other.m_size = 0;
+            other.m_capacity = N;
+        }
+        else
+        {
+            for (size_t i = 0; i < other.m_size; ++i)
+                new (m_data + i) T(std::move(other.m_data[i]));
+            m_size = other.m_size;
+            other.clear();
+        }
+    }
+
+    T* m_data = inline_data();
+    size_t m_size = 0;
+    size_t m_capacity = N;
+    alignas(T) char m_storage[N * sizeof(T)];
+};
+
+}
+
+#endif // inline_vector_hh_INCLUDED
@@ -19,6 +19,10 @@
 namespace Kakoune
 {
 
+static const TypedOptionId<int> tabstop_id{"tabstop"};
+static const TypedOptionId<int> idle_timeout_id{"idle_timeout"};
+static const TypedOptionId<int> fs_check_timeout_id{"fs_check_timeout"};
+
 class InputMode : public RefCountable
 {
 public:
@@ -49,6 +53,17 @@ public:
     using Insertion = InputHandler::Insertion;
     Insertion& last_insert() { return m_input_handler.m_last_insert; }
 
+    virtual void paste(StringView content)
+    {
+        for (auto it = content.begin(), end = content.end(); it != end; )
+        {
+            const Codepoint cp = utf8::read_codepoint(it, end);
+            m_input_handler.handle_key(cp == '\n' ? Key{Key::Return} : Key{cp});
+        }
+    }
+
+    virtual void refresh_completions() {}
+
 protected:
     virtual void on_key(Key key) = 0;
 
@@ -70,12 +85,12 @@ namespace InputModes
 
 std::chrono::milliseconds get_idle_timeout(const Context& context)
 {
-    return std::chrono::milliseconds{context.options()["idle_timeout"].get<int>()};
+    return std::chrono::milliseconds{context.options().get(idle_timeout_id)};
 }
 
 std::chrono::milliseconds get_fs_check_timeout(const Context& context)
 {
-    return std::chrono::milliseconds{context.options()["fs_check_timeout"].get<int>()};
+    return std::chrono::milliseconds{context.options().get(fs_check_timeout_id)};
 }
 
 struct MouseHandler
@@ -285,7 +300,8 @@ public:
             if (it != keymap.end() and it->key == key)
             {
                 auto autoinfo = context().options()["autoinfo"].get<AutoInfo>();
-                if (autoinfo & AutoInfo::Normal and context().has_client())
+                if (autoinfo & AutoInfo::Normal and context().has_client() and
+                    not context().input_handler().replaying())
                     context().client().info_show(key_to_str(key), it->value.docstring.str(),
                                                  {}, InfoStyle::Prompt);
 
@@ -903,6 +919,13 @@ public:
         return { CursorMode::Prompt, coord };
     }
 
+    void refresh_completions() override
+    {
+        m_refresh_completion_pending = true;
+        if (enabled() and not (context().flags() & Context::Flags::Transient))
+            m_idle_timer.set_next_date(Clock::now());
+    }
+
 private:
     void refresh_completions(CompletionFlags flags)
     {
@@ -1253,6 +1276,24 @@ public:
             m_idle_timer.set_next_date(Clock::now() + get_idle_timeout(context()));
     }
 
+    void paste(StringView content) override
+    {
+        // keep the keys around for repeat-last-insert, but apply the
+        // content as a single edit and a single undo group; running the
+        // per-key pipeline on each character makes large pastes crawl
+        for (auto it = content.begin(), end = content.end(); it != end; )
+        {
+            const Codepoint cp = utf8::read_codepoint(it, end);
+            last_insert().keys.push_back(cp == '\n' ? Key{Key::Return} : Key{cp});
+        }
+
+        String str{content};
+        context().selections().insert(str, InsertMode::InsertCursor);
+
+        if (enabled() and not (context().flags() & Context::Flags::Transient))
+            m_idle_timer.set_next_date(Clock::now() + get_idle_timeout(context()));
+    }
+
     DisplayLine mode_line() const override
     {
         auto num_sel = context().selections().size();
@@ -1269,7 +1310,7 @@ private:
     void move(Type offset)
     {
         auto& selections = context().selections();
-        const ColumnCount tabstop = context().options()["tabstop"].get<int>();
+        const ColumnCount tabstop = context().options().get(tabstop_id);
         for (auto& sel : selections)
         {
             auto cursor = context().buffer().offset_coord(sel.cursor(), offset, tabstop, false);
@@ -1436,6 +1477,7 @@ void InputHandler::repeat_last_insert()
     swap(keys, m_last_insert.keys);
     ScopedSetBool disable_hooks(context().hooks_disabled(),
                                 m_last_insert.disable_hooks);
+    ScopedSetBool replaying(m_replaying);
     // context.last_insert will be refilled by the new Insert
     // this is very inefficient.
     push_mode(new InputModes::Insert(*this, m_last_insert.mode, m_last_insert.count));
@@ -1540,6 +1582,32 @@ void InputHandler::handle_key(Key key)
     }
 }
 
+void InputHandler::paste(StringView content)
+{
+    if (content.empty())
+        return;
+
+    const bool was_recording = is_recording();
+    ++m_handle_key_level;
+    auto dec = on_scope_end([this]{ --m_handle_key_level; });
+
+    current_mode().paste(content);
+
+    if (was_recording and is_recording() and m_handle_key_level == m_recording_level)
+    {
+        for (auto it = content.begin(), end = content.end(); it != end; )
+        {
+            const Codepoint cp = utf8::read_codepoint(it, end);
+            m_recorded_keys += key_to_str(cp == '\n' ? Key{Key::Return} : Key{cp});
+        }
+    }
+}
+
+void InputHandler::refresh_completions()
+{
+    current_mode().refresh_completions();
+}
+
 void InputHandler::start_recording(char reg)
 {
     kak_assert(m_recording_reg == 0);
@@ -1578,7 +1646,7 @@ std::pair<CursorMode, DisplayCoord> InputHandler::get_cursor_info() const
 bool show_auto_info_ifn(StringView title, StringView info, AutoInfo mask, const Context& context)
 {
     if (not (context.options()["autoinfo"].get<AutoInfo>() & mask) or
-        not context.has_client())
+        not context.has_client() or context.input_handler().replaying())
         return false;
 
     context.client().info_show(title.str(), info.str(), {}, InfoStyle::Prompt);
@@ -80,6 +80,21 @@ public:
     // process the given key
     void handle_key(Key key);
 
+    // process a whole block of pasted text at once; insert mode applies
+    // it as a single edit instead of running the per-key pipeline on
+    // every character, other modes fall back to per-key handling
+    void paste(StringView content);
+
+    // ask the current mode to refresh its completions, used when
+    // candidates were gathered asynchronously and became available
+    void refresh_completions();
+
+    // set while keys are replayed mechanically (macro replay, exec,
+    // insert repeat); per-key feedback like autoinfo boxes would be
+    // overwritten before anybody sees them and is skipped
+    NestedBool& replaying() { return m_replaying; }
+    const NestedBool& replaying() const { return m_replaying; }
+
     void start_recording(char reg);
     bool is_recording() const;
     void stop_recording();
@@ -124,6 +139,8 @@ private:
     int    m_recording_level = -1;
 
     int    m_handle_key_level = 0;
+
+    NestedBool m_replaying;
 };
 
 enum class AutoInfo
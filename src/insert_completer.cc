@@ -152,12 +152,16 @@ InsertCompletion complete_word(const SelectionList& sels, const OptionManager& o
 
     if (other_buffers)
     {
+        // bring the other word dbs in sync, then rank the global index
+        // once instead of scanning each buffer's words separately
         for (const auto& buf : BufferManager::instance())
         {
             if (buf.get() == &buffer or buf->flags() & Buffer::Flags::Debug)
                 continue;
-            add_matches(*buf);
+            get_word_db(*buf).update_db();
         }
+        for (auto& m : GlobalWordDB::instance().find_matching(prefix, &buffer))
+            matches.push_back({ m.match, m.buffer });
     }
 
     using StaticWords = Vector<String, MemoryDomain::Options>;
@@ -412,6 +416,7 @@ void InsertCompleter::select(int offset, Vector<Key>& keystrokes)
     if (m_context.has_client())
     {
         m_context.client().menu_select(m_current_candidate);
+        m_menu_selected = m_current_candidate;
         if (not candidate.docstring.empty())
             m_context.client().info_show(candidate.completion, candidate.docstring,
                                          {}, InfoStyle::MenuDoc);
@@ -432,16 +437,24 @@ void InsertCompleter::update()
     if (m_explicit_completer and try_complete(m_explicit_completer))
         return;
 
-    reset();
-    setup_ifn();
+    // drop the current completions but leave the menu up; if a completer
+    // still applies, menu_show can then compare the refiltered entries
+    // with what is displayed and skip republishing an unchanged menu
+    m_explicit_completer = nullptr;
+    m_completions = InsertCompletion{};
+    if (not setup_ifn())
+        reset();
 }
 
 void InsertCompleter::reset()
 {
-    if (m_explicit_completer or m_completions.is_valid())
+    if (m_explicit_completer or m_completions.is_valid() or m_menu_shown)
     {
         m_explicit_completer = nullptr;
         m_completions = InsertCompletion{};
+        m_menu_entries.clear();
+        m_menu_selected = -1;
+        m_menu_shown = false;
         if (m_context.has_client())
         {
             m_context.client().menu_hide();
@@ -493,6 +506,30 @@ void InsertCompleter::menu_show()
     for (auto& candidate : m_completions.candidates)
         menu_entries.push_back(candidate.menu_entry);
 
+    // refiltering as the user types often keeps the very same ranked
+    // entries; sending them again to the client is a full round-trip of
+    // the candidate list for no visible change
+    auto same_entry = [](const DisplayLine& lhs, const DisplayLine& rhs) {
+        return lhs.atoms() == rhs.atoms();
+    };
+    if (m_menu_shown and m_completions.begin == m_menu_anchor and
+        menu_entries.size() == m_menu_entries.size() and
+        std::equal(menu_entries.begin(), menu_entries.end(),
+                   m_menu_entries.begin(), same_entry))
+    {
+        if (m_current_candidate != m_menu_selected)
+        {
+            m_context.client().menu_select(m_current_candidate);
+            m_menu_selected = m_current_candidate;
+        }
+        return;
+    }
+
+    m_menu_entries = menu_entries;
+    m_menu_anchor = m_completions.begin;
+    m_menu_selected = m_current_candidate;
+    m_menu_shown = true;
+
     m_context.client().menu_show(std::move(menu_entries), m_completions.begin,
                                  MenuStyle::Inline);
     m_context.client().menu_select(m_current_candidate);
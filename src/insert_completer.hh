@@ -103,6 +103,13 @@ private:
     InsertCompletion m_completions;
     int              m_current_candidate = -1;
 
+    // menu as last published to the client, so that refiltering can
+    // skip the round-trip when the entries did not change
+    Vector<DisplayLine> m_menu_entries;
+    BufferCoord      m_menu_anchor;
+    int              m_menu_selected = -1;
+    bool             m_menu_shown = false;
+
     using CompleteFunc = InsertCompletion (const SelectionList& sels, const OptionManager& options);
     CompleteFunc* m_explicit_completer = nullptr;
 };
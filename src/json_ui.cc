@@ -17,28 +17,36 @@
 namespace Kakoune
 {
 
+// Serialization appends to a caller provided buffer so that a whole
+// request can be built with a single, reusable allocation instead of
+// one temporary String per value.
+
 template<typename T>
-String to_json(ArrayView<const T> array)
+void to_json(String& res, ArrayView<const T> array)
 {
-    String res;
+    res += '[';
+    bool first = true;
     for (auto& elem : array)
     {
-        if (not res.empty())
+        if (not first)
             res += ", ";
-        res += to_json(elem);
+        first = false;
+        to_json(res, elem);
     }
-    return "[" + res + "]";
+    res += ']';
 }
 
 template<typename T, MemoryDomain D>
-String to_json(const Vector<T, D>& vec) { return to_json(ArrayView<const T>{vec}); }
+void to_json(String& res, const Vector<T, D>& vec) { to_json(res, ArrayView<const T>{vec}); }
+
+template<typename T, size_t N, MemoryDomain D>
+void to_json(String& res, const InlineVector<T, N, D>& vec) { to_json(res, ArrayView<const T>(vec)); }
 
-String to_json(int i) { return to_string(i); }
-String to_json(bool b) { return b ? "true" : "false"; }
-String to_json(StringView str)
+void to_json(String& res, int i) { res += to_string(i); }
+void to_json(String& res, bool b) { res += b ? "true" : "false"; }
+void to_json(String& res, StringView str)
 {
-    String res;
-    res.reserve(str.length() + 4);
+    res.reserve(res.length() + str.length() + 4);
     res += '"';
     for (auto it = str.begin(), end = str.end(); it != end; )
     {
@@ -58,24 +66,24 @@ String to_json(StringView str)
         it = next+1;
     }
     res += '"';
-    return res;
 }
 
-String to_json(Color color)
+void to_json(String& res, Color color)
 {
     if (color.color == Kakoune::Color::RGB)
     {
         char buffer[10];
         sprintf(buffer, R"("#%02x%02x%02x")", color.r, color.g, color.b);
-        return buffer;
+        res += buffer;
+        return;
     }
-    return to_json(to_string(color));
+    to_json(res, to_string(color));
 }
 
-String to_json(Attribute attributes)
+void to_json(String& res, Attribute attributes)
 {
     struct Attr { Attribute attr; StringView name; }
-    attrs[] { 
+    attrs[] {
         { Attribute::Exclusive, "exclusive" },
         { Attribute::Underline, "underline" },
         { Attribute::Reverse, "reverse" },
@@ -85,87 +93,114 @@ String to_json(Attribute attributes)
         { Attribute::Italic, "italic" },
     };
 
-    return "[" + join(attrs |
-                      filter([=](const Attr& a) { return attributes & a.attr; }) |
-                      transform([](const Attr& a) { return to_json(a.name); }),
-                      ',', false) + "]";
+    res += '[';
+    bool first = true;
+    for (auto& attr : attrs)
+    {
+        if (not (attributes & attr.attr))
+            continue;
+        if (not first)
+            res += ',';
+        first = false;
+        to_json(res, attr.name);
+    }
+    res += ']';
 }
 
-String to_json(Face face)
+void to_json(String& res, Face face)
 {
-    return format(R"(\{ "fg": {}, "bg": {}, "attributes": {} })",
-                  to_json(face.fg), to_json(face.bg), to_json(face.attributes));
+    res += R"({ "fg": )";
+    to_json(res, face.fg);
+    res += R"(, "bg": )";
+    to_json(res, face.bg);
+    res += R"(, "attributes": )";
+    to_json(res, face.attributes);
+    res += " }";
 }
 
-String to_json(const DisplayAtom& atom)
+void to_json(String& res, const DisplayAtom& atom)
 {
-    return format(R"(\{ "face": {}, "contents": {} })", to_json(atom.face), to_json(atom.content()));
+    res += R"({ "face": )";
+    to_json(res, atom.face);
+    res += R"(, "contents": )";
+    to_json(res, atom.content());
+    res += " }";
 }
 
-String to_json(const DisplayLine& line)
+void to_json(String& res, const DisplayLine& line)
 {
-    return to_json(line.atoms());
+    to_json(res, line.atoms());
 }
 
-String to_json(DisplayCoord coord)
+void to_json(String& res, DisplayCoord coord)
 {
-    return format(R"(\{ "line": {}, "column": {} })", coord.line, coord.column);
+    format_to(res, R"(\{ "line": {}, "column": {} })", coord.line, coord.column);
 }
 
-String to_json(MenuStyle style)
+void to_json(String& res, MenuStyle style)
 {
     switch (style)
     {
-        case MenuStyle::Prompt: return R"("prompt")";
-        case MenuStyle::Inline: return R"("inline")";
+        case MenuStyle::Prompt: res += R"("prompt")"; return;
+        case MenuStyle::Inline: res += R"("inline")"; return;
     }
-    return "";
 }
 
-String to_json(InfoStyle style)
+void to_json(String& res, InfoStyle style)
 {
     switch (style)
     {
-        case InfoStyle::Prompt: return R"("prompt")";
-        case InfoStyle::Inline: return R"("inline")";
-        case InfoStyle::InlineAbove: return R"("inlineAbove")";
-        case InfoStyle::InlineBelow: return R"("inlineBelow")";
-        case InfoStyle::MenuDoc: return R"("menuDoc")";
-        case InfoStyle::Modal: return R"("modal")";
+        case InfoStyle::Prompt: res += R"("prompt")"; return;
+        case InfoStyle::Inline: res += R"("inline")"; return;
+        case InfoStyle::InlineAbove: res += R"("inlineAbove")"; return;
+        case InfoStyle::InlineBelow: res += R"("inlineBelow")"; return;
+        case InfoStyle::MenuDoc: res += R"("menuDoc")"; return;
+        case InfoStyle::Modal: res += R"("modal")"; return;
     }
-    return "";
 }
 
-String to_json(CursorMode mode)
+void to_json(String& res, CursorMode mode)
 {
     switch (mode)
     {
-        case CursorMode::Prompt: return R"("prompt")";
-        case CursorMode::Buffer: return R"("buffer")";
+        case CursorMode::Prompt: res += R"("prompt")"; return;
+        case CursorMode::Buffer: res += R"("buffer")"; return;
     }
-    return "";
 }
 
-String concat()
+void concat(String&)
 {
-    return "";
 }
 
 template<typename First, typename... Args>
-String concat(First&& first, Args&&... args)
+void concat(String& res, First&& first, Args&&... args)
 {
+    to_json(res, first);
     if (sizeof...(Args) != 0)
-        return to_json(first) + ", " + concat(args...);
-    return to_json(first);
+        res += ", ";
+    concat(res, args...);
 }
 
-template<typename... Args>
-void rpc_call(StringView method, Args&&... args)
+void rpc_call_begin(String& buffer, StringView method)
+{
+    buffer.clear();
+    buffer += R"({ "jsonrpc": "2.0", "method": ")";
+    buffer += method;
+    buffer += R"(", "params": [)";
+}
+
+void rpc_call_end(String& buffer)
 {
-    auto q = format(R"(\{ "jsonrpc": "2.0", "method": "{}", "params": [{}] }{})",
-                    method, concat(std::forward<Args>(args)...), "\n");
+    buffer += "] }\n";
+    write(1, buffer);
+}
 
-    write(1, q);
+template<typename... Args>
+void rpc_call(String& buffer, StringView method, Args&&... args)
+{
+    rpc_call_begin(buffer, method);
+    concat(buffer, std::forward<Args>(args)...);
+    rpc_call_end(buffer);
 }
 
 JsonUI::JsonUI()
@@ -180,14 +215,57 @@ JsonUI::JsonUI()
 void JsonUI::draw(const DisplayBuffer& display_buffer,
                   const Face& default_face, const Face& padding_face)
 {
-    rpc_call("draw", display_buffer.lines(), default_face, padding_face);
+    auto& lines = display_buffer.lines();
+    if (m_draw_delta and lines.size() == m_sent_lines.size())
+    {
+        // Send only [index, line] pairs for lines that changed since the
+        // previous draw; the frontend patches them into its copy.
+        rpc_call_begin(m_send_buffer, "draw_delta");
+        m_send_buffer += '[';
+        bool first = true;
+        for (int i = 0; i < (int)lines.size(); ++i)
+        {
+            if (lines[i].atoms() == m_sent_lines[i].atoms())
+                continue;
+            if (not first)
+                m_send_buffer += ", ";
+            first = false;
+            m_send_buffer += '[';
+            to_json(m_send_buffer, i);
+            m_send_buffer += ", ";
+            to_json(m_send_buffer, lines[i]);
+            m_send_buffer += ']';
+            m_sent_lines[i] = lines[i];
+        }
+        m_send_buffer += "], ";
+        concat(m_send_buffer, default_face, padding_face);
+        rpc_call_end(m_send_buffer);
+        return;
+    }
+
+    rpc_call(m_send_buffer, "draw", lines, default_face, padding_face);
+    if (m_draw_delta)
+        m_sent_lines.assign(lines.begin(), lines.end());
+}
+
+void JsonUI::draw_partial(ConstArrayView<DisplayLine> lines,
+                          LineCount first_row,
+                          const Face& default_face)
+{
+    rpc_call(m_send_buffer, "draw_partial", lines, (int)first_row, default_face);
+    if (m_draw_delta and
+        (int)m_sent_lines.size() >= (int)first_row + (int)lines.size())
+    {
+        for (int i = 0; i < (int)lines.size(); ++i)
+            m_sent_lines[(int)first_row + i] = lines[i];
+    }
 }
 
 void JsonUI::draw_status(const DisplayLine& status_line,
                          const DisplayLine& mode_line,
                          const Face& default_face)
 {
-    rpc_call("draw_status", status_line, mode_line, default_face);
+    rpc_call(m_send_buffer, "draw_status", status_line, mode_line, default_face);
 }
 
 
@@ -195,39 +273,39 @@ void JsonUI::menu_show(ConstArrayView<DisplayLine> items,
                        DisplayCoord anchor, Face fg, Face bg,
                        MenuStyle style)
 {
-    rpc_call("menu_show", items, anchor, fg, bg, style);
+    rpc_call(m_send_buffer, "menu_show", items, anchor, fg, bg, style);
 }
 
 void JsonUI::menu_select(int selected)
 {
-    rpc_call("menu_select", selected);
+    rpc_call(m_send_buffer, "menu_select", selected);
 }
 
 void JsonUI::menu_hide()
 {
-    rpc_call("menu_hide");
+    rpc_call(m_send_buffer, "menu_hide");
 }
 
 void JsonUI::info_show(StringView title, StringView content,
                        DisplayCoord anchor, Face face,
                        InfoStyle style)
 {
-    rpc_call("info_show", title, content, anchor, face, style);
+    rpc_call(m_send_buffer, "info_show", title, content, anchor, face, style);
 }
 
 void JsonUI::info_hide()
 {
-    rpc_call("info_hide");
+    rpc_call(m_send_buffer, "info_hide");
 }
 
 void JsonUI::set_cursor(CursorMode mode, DisplayCoord coord)
 {
-    rpc_call("set_cursor", mode, coord);
+    rpc_call(m_send_buffer, "set_cursor", mode, coord);
 }
 
 void JsonUI::refresh(bool force)
 {
-    rpc_call("refresh", force);
+    rpc_call(m_send_buffer, "refresh", force);
 }
 
 void JsonUI::set_ui_options(const Options& options)
@@ -358,45 +436,304 @@ parse_json(const char* pos, const char* end)
 std::tuple<Value, const char*>
 parse_json(StringView json) { return parse_json(json.begin(), json.end()); }
 
-void JsonUI::eval_json(const Value& json)
+namespace
 {
-    if (not json.is_a<JsonObject>())
-        throw runtime_error("json request is not an object");
 
-    const JsonObject& object = json.as<JsonObject>();
-    auto json_it = object.find("jsonrpc"_sv);
-    if (json_it == object.end() or json_it->value.as<String>() != "2.0")
-        throw runtime_error("invalid json rpc request");
+// In place scanner over the receive buffer; the requests frontends send
+// at high frequency (keys, resize) are flat objects of strings and ints,
+// reading them directly as views avoids building a Value tree and a
+// String per token. Running out of input is not an error, the rest of
+// the request may arrive with the next read.
+struct JsonScanner
+{
+    const char* pos;
+    const char* end;
+    bool incomplete = false;
 
-    auto method_it = object.find("method"_sv);
-    if (method_it == object.end())
-        throw runtime_error("invalid json rpc request (method missing)");
-    StringView method = method_it->value.as<String>();
+    bool skip_blanks()
+    {
+        if (not skip_while(pos, end, is_blank))
+            incomplete = true;
+        return not incomplete;
+    }
+
+    bool match(char expected)
+    {
+        if (not skip_blanks())
+            return false;
+        if (*pos != expected)
+            throw runtime_error(format("expected '{}'", expected));
+        ++pos;
+        return true;
+    }
+
+    bool peek_match(char expected)
+    {
+        if (not skip_blanks())
+            return false;
+        if (*pos != expected)
+            return false;
+        ++pos;
+        return true;
+    }
+
+    // strings without escapes are returned as a view into the buffer,
+    // escaped ones get unescaped into storage, which the caller must
+    // keep alive as long as the result
+    bool read_string(StringView& res, String& storage)
+    {
+        if (not match('"'))
+            return false;
+        const char* start = pos;
+        bool escaped = false;
+        bool copied = false;
+        for (; pos != end; ++pos)
+        {
+            if (escaped)
+            {
+                escaped = false;
+                storage += StringView{start, pos};
+                storage.back() = *pos;
+                start = pos + 1;
+                continue;
+            }
+            if (*pos == '\\')
+            {
+                escaped = true;
+                copied = true;
+            }
+            else if (*pos == '"')
+            {
+                if (copied)
+                {
+                    storage += StringView{start, pos};
+                    res = storage;
+                }
+                else
+                    res = StringView{start, pos};
+                ++pos;
+                return true;
+            }
+        }
+        incomplete = true;
+        return false;
+    }
 
-    auto params_it = object.find("params"_sv);
-    if (params_it == object.end())
+    bool read_int(int& res)
+    {
+        if (not skip_blanks())
+            return false;
+        const char* start = pos;
+        skip_while(pos, end, is_digit);
+        if (pos == end) // more digits may still arrive
+        {
+            incomplete = true;
+            return false;
+        }
+        if (start == pos)
+            throw runtime_error("expected a number");
+        res = str_to_int({start, pos});
+        return true;
+    }
+
+    // skip any json value without interpreting it
+    bool skip_value()
+    {
+        if (not skip_blanks())
+            return false;
+        if (is_digit(*pos))
+        {
+            int dummy;
+            return read_int(dummy);
+        }
+        if (*pos == '"')
+        {
+            StringView dummy;
+            String storage;
+            return read_string(dummy, storage);
+        }
+        if (*pos == 't' or *pos == 'f')
+        {
+            const StringView expected = *pos == 't' ? "true" : "false";
+            if (end - pos < expected.length())
+            {
+                incomplete = true;
+                return false;
+            }
+            if (StringView{pos, pos + (int)expected.length()} != expected)
+                throw runtime_error("Could not parse json");
+            pos += (int)expected.length();
+            return true;
+        }
+        if (*pos == '[' or *pos == '{')
+        {
+            const char close = *pos == '[' ? ']' : '}';
+            const bool object = *pos == '{';
+            ++pos;
+            if (peek_match(close))
+                return true;
+            if (incomplete)
+                return false;
+            while (true)
+            {
+                if (not skip_value())
+                    return false;
+                if (object and (not match(':') or not skip_value()))
+                    return false;
+                if (not skip_blanks())
+                    return false;
+                if (*pos == ',')
+                    ++pos;
+                else if (*pos == close)
+                {
+                    ++pos;
+                    return true;
+                }
+                else
+                    throw runtime_error(format("unable to parse, expected ',' or '{}'", close));
+            }
+        }
+        throw runtime_error("Could not parse json");
+    }
+};
+
+}
+
+// Handle one rpc request directly from the receive buffer, returning
+// the position after it, or nullptr when the request is not complete
+// yet. Known methods only carry flat string/int params, so no Value
+// tree is ever built for them.
+const char* JsonUI::process_request(StringView request)
+{
+    JsonScanner scanner{request.begin(), request.end()};
+    if (not scanner.match('{'))
+        return nullptr;
+
+    bool jsonrpc = false;
+    bool has_method = false;
+    StringView method;
+    String method_storage;
+    const char* params_begin = nullptr;
+    const char* params_end = nullptr;
+
+    if (not scanner.peek_match('}'))
+    {
+        if (scanner.incomplete)
+            return nullptr;
+        while (true)
+        {
+            StringView name;
+            String name_storage;
+            if (not scanner.read_string(name, name_storage) or
+                not scanner.match(':'))
+                return nullptr;
+
+            if (name == "jsonrpc")
+            {
+                StringView version;
+                String version_storage;
+                if (not scanner.read_string(version, version_storage))
+                    return nullptr;
+                jsonrpc = version == "2.0";
+            }
+            else if (name == "method")
+            {
+                if (not scanner.read_string(method, method_storage))
+                    return nullptr;
+                has_method = true;
+            }
+            else if (name == "params")
+            {
+                if (not scanner.skip_blanks())
+                    return nullptr;
+                params_begin = scanner.pos;
+                if (not scanner.skip_value())
+                    return nullptr;
+                params_end = scanner.pos;
+            }
+            else if (not scanner.skip_value())
+                return nullptr;
+
+            if (not scanner.skip_blanks())
+                return nullptr;
+            if (*scanner.pos == ',')
+                ++scanner.pos;
+            else if (*scanner.pos == '}')
+            {
+                ++scanner.pos;
+                break;
+            }
+            else
+                throw runtime_error("unable to parse object, expected ',' or '}'");
+        }
+    }
+
+    if (not jsonrpc)
+        throw runtime_error("invalid json rpc request");
+    if (not has_method)
+        throw runtime_error("invalid json rpc request (method missing)");
+    if (not params_begin)
         throw runtime_error("invalid json rpc request (params missing)");
-    const JsonArray& params = params_it->value.as<JsonArray>();
+
+    // the recorded params span is complete, re-scan it for the method
+    // specific parameters, still in place
+    JsonScanner params{params_begin, params_end};
+    if (not params.match('['))
+        return nullptr;
 
     if (method == "keys")
     {
-        for (auto& key_val : params)
+        String storage;
+        if (not params.peek_match(']')) while (true)
         {
-            for (auto& key : parse_keys(key_val.as<String>()))
+            StringView key_str;
+            storage.clear();
+            if (not params.read_string(key_str, storage))
+                return nullptr;
+            for (auto& key : parse_keys(key_str))
                 m_on_key(key);
+            if (params.peek_match(','))
+                continue;
+            if (params.peek_match(']'))
+                break;
+            throw runtime_error("unable to parse array, expected ',' or ']'");
         }
     }
     else if (method == "resize")
     {
-        if (params.size() != 2)
+        int line = 0, column = 0;
+        if (not params.read_int(line) or not params.match(',') or
+            not params.read_int(column) or not params.match(']'))
             throw runtime_error("resize expects 2 parameters");
 
-        DisplayCoord dim{params[0].as<int>(), params[1].as<int>()};
+        DisplayCoord dim{line, column};
         m_dimensions = dim;
         m_on_key(resize(dim));
     }
+    else if (method == "set_protocol")
+    {
+        String storage;
+        if (not params.peek_match(']')) while (true)
+        {
+            StringView feature;
+            storage.clear();
+            if (not params.read_string(feature, storage))
+                return nullptr;
+            if (feature == "draw_delta")
+                m_draw_delta = true;
+            else
+                throw runtime_error(format("unknown protocol feature: {}", feature));
+            if (params.peek_match(','))
+                continue;
+            if (params.peek_match(']'))
+                break;
+            throw runtime_error("unable to parse array, expected ',' or ']'");
+        }
+    }
     else
         throw runtime_error("unknown method");
+
+    return scanner.pos;
 }
 
 void JsonUI::parse_requests(EventMode mode)
@@ -420,10 +757,7 @@ void JsonUI::parse_requests(EventMode mode)
         const char* pos = nullptr;
         try
         {
-            Value json;
-            std::tie(json, pos) = parse_json(m_requests);
-            if (json)
-                eval_json(json);
+            pos = process_request(m_requests);
         }
         catch (runtime_error& error)
         {
@@ -2,6 +2,7 @@
 #define json_ui_hh_INCLUDED
 
 #include "user_interface.hh"
+#include "display_buffer.hh"
 #include "event_manager.hh"
 #include "coord.hh"
 #include "string.hh"
@@ -23,6 +24,10 @@ public:
               const Face& default_face,
               const Face& buffer_padding) override;
 
+    void draw_partial(ConstArrayView<DisplayLine> lines,
+                      LineCount first_row,
+                      const Face& default_face) override;
+
     void draw_status(const DisplayLine& status_line,
                      const DisplayLine& mode_line,
                      const Face& default_face) override;
@@ -48,13 +53,16 @@ public:
 
 private:
     void parse_requests(EventMode mode);
-    void eval_json(const Value& value);
+    const char* process_request(StringView request);
 
     FDWatcher m_stdin_watcher;
     OnKeyCallback m_on_key;
     Vector<Key, MemoryDomain::Client> m_pending_keys;
     DisplayCoord m_dimensions;
     String m_requests;
+    String m_send_buffer;
+    bool m_draw_delta = false;
+    DisplayBuffer::LineList m_sent_lines;
 };
 
 }
@@ -8,32 +8,55 @@
 namespace Kakoune
 {
 
+size_t KeymapManager::ms_mapping_epoch = 0;
+
 void KeymapManager::map_key(Key key, KeymapMode mode,
                             KeyList mapping, String docstring)
 {
     m_mapping[KeyAndMode{key, mode}] = {std::move(mapping), std::move(docstring)};
+    ++ms_mapping_epoch;
 }
 
 void KeymapManager::unmap_key(Key key, KeymapMode mode)
 {
     m_mapping.remove(KeyAndMode{key, mode});
+    ++ms_mapping_epoch;
 }
 
+const KeymapManager::KeyMapInfo*
+KeymapManager::resolve(Key key, KeymapMode mode) const
+{
+    if (m_resolved_epoch != ms_mapping_epoch)
+    {
+        m_resolved.clear();
+        m_resolved_epoch = ms_mapping_epoch;
+    }
+    auto cached = m_resolved.find(KeyAndMode{key, mode});
+    if (cached != m_resolved.end())
+        return cached->value;
+
+    const KeyMapInfo* info = nullptr;
+    auto it = m_mapping.find(KeyAndMode{key, mode});
+    if (it != m_mapping.end())
+        info = &it->value;
+    else if (m_parent)
+        info = m_parent->resolve(key, mode);
+
+    m_resolved.insert({KeyAndMode{key, mode}, info});
+    return info;
+}
 
 bool KeymapManager::is_mapped(Key key, KeymapMode mode) const
 {
-    return m_mapping.find(KeyAndMode{key, mode}) != m_mapping.end() or
-           (m_parent and m_parent->is_mapped(key, mode));
+    return resolve(key, mode) != nullptr;
 }
 
 const KeymapManager::KeyMapInfo&
 KeymapManager::get_mapping(Key key, KeymapMode mode) const
 {
-    auto it = m_mapping.find(KeyAndMode{key, mode});
-    if (it != m_mapping.end())
-        return it->value;
-    kak_assert(m_parent);
-    return m_parent->get_mapping(key, mode);
+    auto* info = resolve(key, mode);
+    kak_assert(info);
+    return *info;
 }
 
 KeymapManager::KeyList KeymapManager::get_mapped_keys(KeymapMode mode) const
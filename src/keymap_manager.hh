@@ -49,9 +49,19 @@ private:
     // the only one allowed to construct a root map manager
     friend class Scope;
 
-    KeymapManager* m_parent;
     using KeyAndMode = std::pair<Key, KeymapMode>;
+    const KeyMapInfo* resolve(Key key, KeymapMode mode) const;
+
+    KeymapManager* m_parent;
     HashMap<KeyAndMode, KeyMapInfo, MemoryDomain::Mapping> m_mapping;
+    // flattened (key, mode) -> mapping cache, including negative
+    // entries as most keystrokes are not mapped at all; key dispatch is
+    // then a single hash probe instead of one per scope. Any mapping
+    // change anywhere invalidates every cache through a process wide
+    // epoch, mappings change far too rarely for finer grain to pay off.
+    mutable HashMap<KeyAndMode, const KeyMapInfo*, MemoryDomain::Mapping> m_resolved;
+    mutable size_t m_resolved_epoch = 0;
+    static size_t ms_mapping_epoch;
 };
 
 }
@@ -1,6 +1,7 @@
 #include "assert.hh"
 #include "backtrace.hh"
 #include "buffer.hh"
+#include "benchmark.hh"
 #include "buffer_manager.hh"
 #include "buffer_utils.hh"
 #include "client_manager.hh"
@@ -10,6 +11,7 @@
 #include "event_manager.hh"
 #include "face_registry.hh"
 #include "file.hh"
+#include "file_watcher.hh"
 #include "highlighters.hh"
 #include "insert_completer.hh"
 #include "json_ui.hh"
@@ -31,6 +33,7 @@
 #include <locale>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/wait.h>
 #include <unistd.h>
 #include <pwd.h>
 
@@ -107,6 +110,10 @@ void register_env_vars()
             "selections", false,
             [](StringView name, const Context& context)
             { return join(context.selections_content(), ':'); }
+        }, {
+            "selections_fifo", false,
+            [](StringView name, const Context& context)
+            { return create_selections_fifo(context.selections()); }
         }, {
             "runtime", false,
             [](StringView name, const Context& context)
@@ -177,6 +184,34 @@ void register_env_vars()
             "selections_desc", false,
             [](StringView name, const Context& context)
             { return selection_list_to_string(context.selections()); }
+        }, {
+            "mem_", true,
+            [](StringView name, const Context& context) -> String
+            {
+                auto stat = name.substr(4_byte);
+                const bool peak = prefix_match(stat, "peak_");
+                if (peak)
+                    stat = stat.substr(5_byte);
+                auto& counters = peak ? domain_peak_bytes : domain_allocated_bytes;
+                if (stat == "total")
+                {
+                    size_t total = 0;
+                    for (int domain = 0; domain < (int)MemoryDomain::Count; ++domain)
+                        total += counters[domain];
+                    return to_string(total);
+                }
+                auto iequal = [](StringView lhs, StringView rhs) {
+                    return lhs.length() == rhs.length() and
+                           std::equal(lhs.begin(), lhs.end(), rhs.begin(),
+                                      [](char a, char b) { return to_lower(a) == to_lower(b); });
+                };
+                for (int domain = 0; domain < (int)MemoryDomain::Count; ++domain)
+                {
+                    if (iequal(stat, domain_name((MemoryDomain)domain)))
+                        return to_string((size_t)counters[domain]);
+                }
+                throw runtime_error{format("no such memory domain: '{}'", stat)};
+            }
         }, {
             "window_width", false,
             [](StringView name, const Context& context) -> String
@@ -198,7 +233,7 @@ void register_registers()
     RegisterManager& register_manager = RegisterManager::instance();
 
     for (auto c : "abcdefghijklmnopqrstuvwxyz/\"|^@:")
-        register_manager.add_register(c, std::make_unique<StaticRegister>());
+        register_manager.add_register(c, std::make_unique<HistoryRegister>());
 
     using StringList = Vector<String, MemoryDomain::Registers>;
 
@@ -269,6 +304,18 @@ static void check_timeout(const int& timeout)
         throw runtime_error{"the minimum acceptable timeout is 50 milliseconds"};
 }
 
+static void check_redraw_interval(const int& interval)
+{
+    if (interval < 0)
+        throw runtime_error{"redraw interval should be positive"};
+}
+
+static void check_timer_resolution(const int& resolution)
+{
+    if (resolution < 1)
+        throw runtime_error{"timer resolution should be at least 1 millisecond"};
+}
+
 static void check_extra_word_chars(const Vector<Codepoint, MemoryDomain::Options>& extra_chars)
 {
     if (contains_that(extra_chars, is_blank))
@@ -305,6 +352,29 @@ void register_options()
     reg.declare_option("disabled_hooks",
                       "patterns to disable hooks whose group is matched",
                       Regex{});
+    reg.declare_option("max_history_size",
+                       "amount of memory in bytes a buffer undo history may use "
+                       "before its oldest undo groups get evicted, 0 means unlimited",
+                       100 * 1024 * 1024);
+    reg.declare_option("register_history_depth",
+                       "number of previous values a register keeps",
+                       8);
+    reg.declare_option("register_history_size",
+                       "amount of memory in bytes all register histories "
+                       "together may use before the least recently used "
+                       "registers drop their oldest values",
+                       4 * 1024 * 1024);
+    reg.declare_option("jump_list_depth",
+                       "number of jumps a client jump list keeps",
+                       100);
+    reg.declare_option("jump_list_size",
+                       "amount of memory in bytes a client jump list may use "
+                       "before its oldest jumps get evicted",
+                       4 * 1024 * 1024);
+    reg.declare_option("backupjournal",
+                       "maintain an append only journal of buffer modifications "
+                       "next to the file, replayed on the next open after a crash",
+                       false);
     reg.declare_option("filetype", "buffer filetype", ""_str);
     reg.declare_option("path", "path to consider when trying to find a file",
                    Vector<String, MemoryDomain::Options>({ "./", "/usr/include" }));
@@ -323,6 +393,14 @@ void register_options()
     reg.declare_option<int, check_timeout>(
         "fs_check_timeout", "timeout, in milliseconds, between file system buffer modification checks",
         500);
+    reg.declare_option<int, check_redraw_interval>(
+        "redraw_interval", "minimum time, in milliseconds, between two redraws of the same client",
+        16);
+    reg.declare_option<int, check_timer_resolution>(
+        "timer_resolution", "window, in milliseconds, within which timers becoming "
+        "ready are serviced together; larger values mean fewer wake ups at the "
+        "cost of timer precision",
+        1);
     reg.declare_option("ui_options",
                        "colon separated list of <key>=<value> options that are "
                        "passed to and interpreted by the user interface\n"
@@ -346,6 +424,43 @@ void register_options()
         "extra_word_chars",
         "Additional characters to be considered as words for insert completion",
         {});
+    reg.declare_option("memory_pressure_limits",
+                       "memory domain to allocated byte limit map, crossing "
+                       "a limit triggers the MemoryPressure hook",
+                       HashMap<String, int, MemoryDomain::Options>{});
+}
+
+// compare the per domain allocation counters against the configured
+// limits and run the MemoryPressure hook on upward crossings, so that
+// scripts get a chance to drop caches before the OOM killer visits
+void check_memory_pressure(GlobalScope& global_scope)
+{
+    static const TypedOptionId<HashMap<String, int, MemoryDomain::Options>> limits_id{"memory_pressure_limits"};
+    auto& limits = global_scope.options().get(limits_id);
+    if (limits.empty())
+        return;
+
+    static bool above[(size_t)MemoryDomain::Count] = {};
+    for (int domain = 0; domain < (int)MemoryDomain::Count; ++domain)
+    {
+        auto it = limits.find(StringView{domain_name((MemoryDomain)domain)});
+        if (it == limits.end())
+            continue;
+        const size_t allocated = domain_allocated_bytes[domain];
+        if (allocated > (size_t)std::max(0, it->value))
+        {
+            if (not above[domain])
+            {
+                above[domain] = true;
+                Context empty_context{Context::EmptyContextFlag{}};
+                global_scope.hooks().run_hook("MemoryPressure",
+                                              format("{} {}", it->key, allocated),
+                                              empty_context);
+            }
+        }
+        else
+            above[domain] = false;
+    }
 }
 
 static Client* local_client = nullptr;
@@ -384,6 +499,7 @@ std::unique_ptr<UserInterface> make_ui(UIType ui_type)
         void info_hide() override {}
 
         void draw(const DisplayBuffer&, const Face&, const Face&) override {}
+        void draw_partial(ConstArrayView<DisplayLine>, LineCount, const Face&) override {}
         void draw_status(const DisplayLine&, const DisplayLine&, const Face&) override {}
         DisplayCoord dimensions() override { return {24,80}; }
         void set_cursor(CursorMode, DisplayCoord) override {}
@@ -524,12 +640,13 @@ enum class ServerFlags
     Daemon      = 1 << 1,
     ReadOnly    = 1 << 2,
     StartupInfo = 1 << 3,
+    Template    = 1 << 4,
 };
 constexpr bool with_bit_ops(Meta::Type<ServerFlags>) { return true; }
 
 int run_server(StringView session, StringView server_init,
                StringView client_init, Optional<BufferCoord> init_coord,
-               ServerFlags flags, UIType ui_type,
+               ServerFlags flags, UIType ui_type, StringView shared_strings,
                ConstArrayView<StringView> files)
 {
     static bool terminate = false;
@@ -551,9 +668,23 @@ int run_server(StringView session, StringView server_init,
     }
 
     EventManager        event_manager;
-    Server              server{session.empty() ? to_string(getpid()) : session.str()};
+
+    // in template mode the session socket serves spawn requests, the
+    // actual server is only created in the forked children
+    std::unique_ptr<Server> server;
+    if (not (flags & ServerFlags::Template))
+        server = std::make_unique<Server>(session.empty() ? to_string(getpid()) : session.str());
 
     StringRegistry      string_registry;
+    if (not shared_strings.empty()) try
+    {
+        string_registry.attach_arena(shared_strings);
+    }
+    catch (runtime_error& error) // sessions remain usable with private storage
+    {
+        write_stderr(format("error while attaching shared string arena: {}\n",
+                            error.what()));
+    }
     GlobalScope         global_scope;
     ShellManager        shell_manager;
     CommandManager      command_manager;
@@ -563,6 +694,7 @@ int run_server(StringView session, StringView server_init,
     FaceRegistry        face_registry;
     ClientManager       client_manager;
     BufferManager       buffer_manager;
+    FileWatcher         file_watcher;
 
     register_options();
     register_env_vars();
@@ -602,6 +734,26 @@ int run_server(StringView session, StringView server_init,
                                      "    {}", error.what()));
     }
 
+    bool template_spawned = false;
+    if (flags & ServerFlags::Template)
+    {
+        // the parent sits here serving spawn requests until terminated;
+        // only forked children return with a connection, to be
+        // acknowledged once their own session socket is bound
+        String spawned_session;
+        const int ack_fd = accept_spawn_requests(session, spawned_session);
+        if (ack_fd == -1)
+            return 0;
+
+        server = std::make_unique<Server>(std::move(spawned_session));
+        const char ack = 0;
+        ::write(ack_fd, &ack, 1);
+        close(ack_fd);
+
+        template_spawned = true;
+        flags |= ServerFlags::Daemon;
+    }
+
     {
         Context empty_context{Context::EmptyContextFlag{}};
         global_scope.hooks().run_hook("KakBegin", "", empty_context);
@@ -650,14 +802,26 @@ int run_server(StringView session, StringView server_init,
                 local_client->info_show("Welcome to Kakoune", startup_info, {}, InfoStyle::Prompt);
         }
 
+        static const TypedOptionId<int> timer_resolution_id{"timer_resolution"};
         while (not terminate and (not client_manager.empty() or (flags & ServerFlags::Daemon)))
         {
             client_manager.redraw_clients();
+            event_manager.set_timer_coalescing(std::chrono::milliseconds{
+                global_scope.options().get(timer_resolution_id)});
             event_manager.handle_next_events(EventMode::Normal);
             client_manager.process_pending_inputs();
             client_manager.clear_client_trash();
             client_manager.clear_window_trash();
             buffer_manager.clear_buffer_trash();
+            check_memory_pressure(global_scope);
+
+            // template spawned sessions only outlive their clients, but
+            // must wait for the first one to connect; use the created
+            // count as a client may come and go within a single batch
+            // of events
+            if (template_spawned and client_manager.empty() and
+                client_manager.created_count() != 0)
+                break;
 
             if (sighup_raised)
             {
@@ -677,8 +841,8 @@ int run_server(StringView session, StringView server_init,
 
                 if (fork_server_to_background())
                 {
-                    String session = server.session();
-                    server.close_session(false);
+                    String session = server->session();
+                    server->close_session(false);
                     throw convert_to_client_mode{ std::move(session), std::move(buffer_name), std::move(selections) };
                 }
             }
@@ -694,7 +858,29 @@ int run_server(StringView session, StringView server_init,
     return local_client_exit;
 }
 
-int run_filter(StringView keystr, StringView commands, ConstArrayView<StringView> files, bool quiet, StringView suffix_backup)
+int run_benchmarks()
+{
+    // benchmarks over the real types need the same globals a filter
+    // session does (buffers reach for their options, faces, hooks...)
+    StringRegistry  string_registry;
+    GlobalScope     global_scope;
+    EventManager    event_manager;
+    ShellManager    shell_manager;
+    CommandManager  command_manager;
+    RegisterManager register_manager;
+    ClientManager   client_manager;
+    BufferManager   buffer_manager;
+
+    register_options();
+    register_env_vars();
+    register_registers();
+    register_commands();
+
+    Benchmark::run_all_benchmarks();
+    return 0;
+}
+
+int run_filter(StringView keystr, StringView commands, ConstArrayView<StringView> files, bool quiet, StringView suffix_backup, size_t jobs)
 {
     StringRegistry  string_registry;
     GlobalScope     global_scope;
@@ -738,7 +924,7 @@ int run_filter(StringView keystr, StringView commands, ConstArrayView<StringView
             }
         };
 
-        for (auto& file : files)
+        auto process_file = [&](StringView file)
         {
             Buffer* buffer = open_file_buffer(file);
             if (not suffix_backup.empty())
@@ -746,6 +932,67 @@ int run_filter(StringView keystr, StringView commands, ConstArrayView<StringView
             apply_to_buffer(*buffer);
             write_buffer_to_file(*buffer, buffer->name());
             buffer_manager.delete_buffer(*buffer);
+        };
+
+        jobs = clamp<size_t>(jobs, 1, std::max<size_t>(files.size(), 1));
+        if (jobs == 1)
+        {
+            for (auto& file : files)
+                process_file(file);
+        }
+        else
+        {
+            // files are independent but the managers above are process
+            // wide singletons, so workers are forked rather than
+            // threaded, each handling a contiguous slice of the file
+            // list. Workers write their errors to a dedicated pipe that
+            // is drained in worker order, keeping the report in file
+            // order.
+            const size_t per_worker = (files.size() + jobs - 1) / jobs;
+            // rounding up can leave the last slices empty, do not fork
+            // workers for them
+            const size_t num_workers = (files.size() + per_worker - 1) / per_worker;
+            Vector<int> error_fds;
+            Vector<pid_t> pids;
+            for (size_t worker = 0; worker < num_workers; ++worker)
+            {
+                int pipe_fds[2];
+                if (::pipe(pipe_fds) < 0)
+                    throw runtime_error("unable to create error pipe");
+
+                const pid_t pid = fork();
+                if (pid == 0)
+                {
+                    close(pipe_fds[0]);
+                    dup2(pipe_fds[1], 2);
+                    close(pipe_fds[1]);
+                    try
+                    {
+                        for (auto& file : files.subrange(worker * per_worker, per_worker))
+                            process_file(file);
+                    }
+                    catch (runtime_error& err)
+                    {
+                        write_stderr(format("error: {}\n", err.what()));
+                    }
+                    buffer_manager.clear_buffer_trash();
+                    exit(0);
+                }
+                close(pipe_fds[1]);
+                error_fds.push_back(pipe_fds[0]);
+                pids.push_back(pid);
+            }
+            for (size_t worker = 0; worker < num_workers; ++worker)
+            {
+                write_stderr(read_fd(error_fds[worker]));
+                close(error_fds[worker]);
+
+                int status = 0;
+                waitpid(pids[worker], &status, 0);
+                if (not WIFEXITED(status) or WEXITSTATUS(status) != 0)
+                    write_stderr(format("error: filter worker for '{}'... terminated abnormally\n",
+                                        files[worker * per_worker]));
+            }
         }
         if (not isatty(0))
         {
@@ -841,10 +1088,14 @@ int main(int argc, char* argv[])
                    { "f", { true,  "act as a filter, executing given keys on given files" } },
                    { "i", { true, "backup the files on which a filter is applied using the given suffix" } },
                    { "q", { false, "in filter mode, be quiet about errors applying keys" } },
+                   { "j", { true,  "in filter mode, process files with the given number of parallel jobs" } },
+                   { "t", { true,  "with -d, serve as a session template; else spawn a session from the given template and connect to it" } },
                    { "ui", { true, "set the type of user interface to use (ncurses, dummy, or json)" } },
                    { "l", { false, "list existing sessions" } },
                    { "clear", { false, "clear dead sessions" } },
                    { "ro", { false, "readonly mode" } },
+                   { "bench", { false, "run the microbenchmarks and quit" } },
+                   { "shared-strings", { true, "attach the given shared string arena file; sessions attaching the same file share interned string storage" } },
                    { "help", { false, "display a help message and quit" } } }
     };
 
@@ -907,6 +1158,9 @@ int main(int argc, char* argv[])
             return run_pipe(*session);
         }
 
+        if (parser.get_switch("bench"))
+            return run_benchmarks();
+
         auto client_init = parser.get_switch("e").value_or(StringView{});
         auto server_init = parser.get_switch("E").value_or(StringView{});
         const UIType ui_type = parse_ui_type(parser.get_switch("ui").value_or("ncurses"));
@@ -919,13 +1173,26 @@ int main(int argc, char* argv[])
                 return -1;
             }
 
+            size_t jobs = 1;
+            if (auto j = parser.get_switch("j"))
+            {
+                auto val = str_to_int_ifp(*j);
+                if (not val or *val < 1)
+                {
+                    write_stderr("error: -j requires a positive number of jobs\n");
+                    return -1;
+                }
+                jobs = (size_t)*val;
+            }
+
             Vector<StringView> files;
             for (size_t i = 0; i < parser.positional_count(); ++i)
                 files.emplace_back(parser[i]);
 
             return run_filter(*keys, client_init, files,
                               (bool)parser.get_switch("q"),
-                              parser.get_switch("i").value_or(StringView{}));
+                              parser.get_switch("i").value_or(StringView{}),
+                              jobs);
         }
 
         Vector<StringView> files;
@@ -957,7 +1224,7 @@ int main(int argc, char* argv[])
 
         if (auto server_session = parser.get_switch("c"))
         {
-            for (auto opt : { "n", "s", "d", "E", "ro" })
+            for (auto opt : { "n", "s", "d", "E", "ro", "t" })
             {
                 if (parser.get_switch(opt))
                 {
@@ -971,16 +1238,57 @@ int main(int argc, char* argv[])
 
             return run_client(*server_session, new_files + client_init, init_coord, ui_type);
         }
+        else if (parser.get_switch("t") and not parser.get_switch("d"))
+        {
+            for (auto opt : { "s", "E", "ro" })
+            {
+                if (parser.get_switch(opt))
+                {
+                    write_stderr(format("error: -{} is incompatible with -t\n", opt));
+                    return -1;
+                }
+            }
+
+            String session;
+            try
+            {
+                session = spawn_from_template(*parser.get_switch("t"));
+            }
+            catch (disconnected& e)
+            {
+                write_stderr(format("error: could not reach template session '{}': {}\n",
+                                    *parser.get_switch("t"), e.what()));
+                return -1;
+            }
+
+            String new_files;
+            for (auto name : files)
+                new_files += format("edit '{}';", escape(real_path(name), "'", '\\'));
+
+            return run_client(session, new_files + client_init, init_coord, ui_type);
+        }
         else
         {
             StringView session = parser.get_switch("s").value_or(StringView{});
+            auto tmpl = parser.get_switch("t");
+            if (tmpl)
+            {
+                if (not session.empty())
+                {
+                    write_stderr("error: -s is incompatible with -d -t\n");
+                    return -1;
+                }
+                session = *tmpl;
+            }
             try
             {
                 auto flags = (parser.get_switch("n") ? ServerFlags::IgnoreKakrc : ServerFlags::None) |
                              (parser.get_switch("d") ? ServerFlags::Daemon : ServerFlags::None) |
+                             (tmpl ? ServerFlags::Template : ServerFlags::None) |
                              (parser.get_switch("ro") ? ServerFlags::ReadOnly : ServerFlags::None) |
                              (argc == 1 and isatty(0) ? ServerFlags::StartupInfo : ServerFlags::None);
-                return run_server(session, server_init, client_init, init_coord, flags, ui_type, files);
+                return run_server(session, server_init, client_init, init_coord, flags, ui_type,
+                                  parser.get_switch("shared-strings").value_or(StringView{}), files);
             }
             catch (convert_to_client_mode& convert)
             {
@@ -3,6 +3,78 @@
 namespace Kakoune
 {
 
-size_t domain_allocated_bytes[(size_t)MemoryDomain::Count] = {};
+std::atomic<size_t> domain_allocated_bytes[(size_t)MemoryDomain::Count] = {};
+std::atomic<size_t> domain_peak_bytes[(size_t)MemoryDomain::Count] = {};
+std::atomic<size_t> domain_allocation_count[(size_t)MemoryDomain::Count] = {};
+std::atomic<size_t> domain_size_histogram[(size_t)MemoryDomain::Count][memory_histogram_buckets] = {};
+
+namespace
+{
+
+constexpr size_t pool_granularity = 16;
+constexpr size_t pool_max_size = 256;
+constexpr size_t pool_slab_size = 4096;
+
+struct Pool
+{
+    void* free_list = nullptr;
+    char* cursor = nullptr;
+    char* end = nullptr;
+};
+
+// constant initialized so allocations from static constructors are safe,
+// and trivially destructible so ones from static destructors are too
+Pool pools[(size_t)MemoryDomain::Count][pool_max_size / pool_granularity];
+
+// the rare concurrent allocations from worker threads only need
+// correctness, not throughput; a spinlock keeps the fast path short
+std::atomic_flag pool_lock = ATOMIC_FLAG_INIT;
+
+struct PoolLockGuard
+{
+    PoolLockGuard() { while (pool_lock.test_and_set(std::memory_order_acquire)) {} }
+    ~PoolLockGuard() { pool_lock.clear(std::memory_order_release); }
+};
+
+}
+
+void* pool_allocate(MemoryDomain domain, size_t size)
+{
+    if (size == 0 or size > pool_max_size)
+        return ::operator new(size);
+
+    const size_t size_class = (size - 1) / pool_granularity;
+    PoolLockGuard lock;
+    Pool& pool = pools[(size_t)domain][size_class];
+    if (pool.free_list != nullptr)
+    {
+        void* node = pool.free_list;
+        pool.free_list = *reinterpret_cast<void**>(node);
+        return node;
+    }
+    const size_t node_size = (size_class + 1) * pool_granularity;
+    if (pool.cursor + node_size > pool.end)
+    {
+        // slabs are never returned to the system, freed nodes recycle
+        // through the free list; the sub node_size tail is abandoned
+        pool.cursor = reinterpret_cast<char*>(::operator new(pool_slab_size));
+        pool.end = pool.cursor + pool_slab_size;
+    }
+    void* node = pool.cursor;
+    pool.cursor += node_size;
+    return node;
+}
+
+void pool_deallocate(MemoryDomain domain, void* ptr, size_t size)
+{
+    if (size == 0 or size > pool_max_size)
+        return ::operator delete(ptr);
+
+    const size_t size_class = (size - 1) / pool_granularity;
+    PoolLockGuard lock;
+    Pool& pool = pools[(size_t)domain][size_class];
+    *reinterpret_cast<void**>(ptr) = pool.free_list;
+    pool.free_list = ptr;
+}
 
 }
@@ -1,6 +1,7 @@
 #ifndef memory_hh_INCLUDED
 #define memory_hh_INCLUDED
 
+#include <atomic>
 #include <cstddef>
 #include <new>
 #include <utility>
@@ -31,11 +32,14 @@ enum class MemoryDomain
     Registers,
     Client,
     WordDB,
+    TrigramIndex,
+    BracketIndex,
     Selections,
     History,
     Remote,
     Events,
     Completion,
+    Regex,
     Count
 };
 
@@ -55,6 +59,8 @@ inline const char* domain_name(MemoryDomain domain)
         case MemoryDomain::Commands: return "Commands";
         case MemoryDomain::Hooks: return "Hooks";
         case MemoryDomain::WordDB: return "WordDB";
+        case MemoryDomain::TrigramIndex: return "TrigramIndex";
+        case MemoryDomain::BracketIndex: return "BracketIndex";
         case MemoryDomain::Aliases: return "Aliases";
         case MemoryDomain::EnvVars: return "EnvVars";
         case MemoryDomain::Faces: return "Faces";
@@ -66,25 +72,76 @@ inline const char* domain_name(MemoryDomain domain)
         case MemoryDomain::Remote: return "Remote";
         case MemoryDomain::Events: return "Events";
         case MemoryDomain::Completion: return "Completion";
+        case MemoryDomain::Regex: return "Regex";
         case MemoryDomain::Count: break;
     }
     kak_assert(false);
     return "";
 }
 
-extern size_t domain_allocated_bytes[(size_t)MemoryDomain::Count];
+// relaxed atomics so that worker threads may allocate as well, the
+// counters are only statistics and need no ordering guarantees.
+extern std::atomic<size_t> domain_allocated_bytes[(size_t)MemoryDomain::Count];
+extern std::atomic<size_t> domain_peak_bytes[(size_t)MemoryDomain::Count];
+extern std::atomic<size_t> domain_allocation_count[(size_t)MemoryDomain::Count];
+
+// allocation size histogram, bucket n counts allocations of up to
+// 16 * 4^n bytes, the last one whatever exceeds the previous
+constexpr int memory_histogram_buckets = 8;
+extern std::atomic<size_t> domain_size_histogram[(size_t)MemoryDomain::Count][memory_histogram_buckets];
+
+inline int memory_histogram_bucket(size_t size)
+{
+    int bucket = 0;
+    for (size_t limit = 16; bucket < memory_histogram_buckets - 1 and size > limit; limit *= 4)
+        ++bucket;
+    return bucket;
+}
 
 inline void on_alloc(MemoryDomain domain, size_t size)
 {
-    domain_allocated_bytes[(int)domain] += size;
+    const size_t total = domain_allocated_bytes[(int)domain].fetch_add(size, std::memory_order_relaxed) + size;
+    auto& peak = domain_peak_bytes[(int)domain];
+    size_t prev = peak.load(std::memory_order_relaxed);
+    while (prev < total and
+           not peak.compare_exchange_weak(prev, total, std::memory_order_relaxed))
+    {}
+    domain_allocation_count[(int)domain].fetch_add(1, std::memory_order_relaxed);
+    domain_size_histogram[(int)domain][memory_histogram_bucket(size)].fetch_add(1, std::memory_order_relaxed);
 }
 
 inline void on_dealloc(MemoryDomain domain, size_t size)
 {
-    kak_assert(domain_allocated_bytes[(int)domain] >= size);
-    domain_allocated_bytes[(int)domain] -= size;
+    kak_assert(domain_allocated_bytes[(int)domain].load(std::memory_order_relaxed) >= size);
+    domain_allocated_bytes[(int)domain].fetch_sub(size, std::memory_order_relaxed);
 }
 
+inline size_t total_allocation_count()
+{
+    size_t count = 0;
+    for (size_t domain = 0; domain < (size_t)MemoryDomain::Count; ++domain)
+        count += domain_allocation_count[domain].load(std::memory_order_relaxed);
+    return count;
+}
+
+// Counts the allocations performed through the domain allocators while
+// it is alive; paired with kak_assert this turns the allocation budget
+// of a hot path (down to none at all) into a test failure instead of a
+// silent regression.
+struct AllocationCounter
+{
+    size_t count() const { return total_allocation_count() - m_start; }
+private:
+    size_t m_start = total_allocation_count();
+};
+
+// Small allocations are served from per domain, per size class slab
+// pools; same sized nodes pack tightly and recycle through a free list
+// instead of paying malloc metadata and fragmentation for every node.
+// Large allocations forward to operator new.
+void* pool_allocate(MemoryDomain domain, size_t size);
+void pool_deallocate(MemoryDomain domain, void* ptr, size_t size);
+
 template<typename T, MemoryDomain domain>
 struct Allocator
 {
@@ -101,14 +158,14 @@ struct Allocator
     {
         size_t size = sizeof(T) * n;
         on_alloc(domain, size);
-        return reinterpret_cast<T*>(::operator new(size));
+        return reinterpret_cast<T*>(pool_allocate(domain, size));
     }
 
     void deallocate(T* ptr, size_t n)
     {
         size_t size = sizeof(T) * n;
         on_dealloc(domain, size);
-        ::operator delete(ptr);
+        pool_deallocate(domain, ptr, size);
     }
 };
 
@@ -137,7 +194,7 @@ struct UseMemoryDomain
     static void* operator new(size_t size)
     {
         on_alloc(Domain, size);
-        return ::operator new(size);
+        return pool_allocate(Domain, size);
     }
 
     static void* operator new(size_t size, void* ptr)
@@ -148,7 +205,7 @@ struct UseMemoryDomain
     static void operator delete(void* ptr, size_t size)
     {
         on_dealloc(Domain, size);
-        ::operator delete(ptr);
+        pool_deallocate(Domain, ptr, size);
     }
 };
 
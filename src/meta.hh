@@ -1,6 +1,7 @@
 #ifndef meta_hh_INCLUDED
 #define meta_hh_INCLUDED
 
+#include <cstddef>
 #include <utility>
 
 namespace Kakoune
@@ -64,14 +64,6 @@ static constexpr StringView assistant_dilbert[] =
       R"(      @     )",
       R"(            )"};
 
-static void set_attribute(WINDOW* window, int attribute, bool on)
-{
-    if (on)
-        wattron(window, attribute);
-    else
-        wattroff(window, attribute);
-}
-
 template<typename T> T sq(T x) { return x * x; }
 
 constexpr struct { unsigned char r, g, b; } builtin_colors[] = {
@@ -175,6 +167,9 @@ int NCursesUI::get_color(Color color)
                 closestCol = i;
             }
         }
+        // remember the approximation; toggling ncurses_change_colors
+        // resets m_colors so it cannot go stale
+        m_colors[color] = closestCol;
         return closestCol;
     }
 }
@@ -193,30 +188,36 @@ int NCursesUI::get_color_pair(const Face& face)
     }
 }
 
-void NCursesUI::set_face(NCursesWin* window, Face face, const Face& default_face)
+int NCursesUI::get_attributes(const Face& face)
 {
-    if (m_active_pair != -1)
-        wattroff(window, COLOR_PAIR(m_active_pair));
+    auto it = m_attributes.find(face);
+    if (it != m_attributes.end())
+        return it->value;
 
+    int attrs = face.fg != Color::Default or face.bg != Color::Default ?
+                    COLOR_PAIR(get_color_pair(face)) : 0;
+    if (face.attributes & Attribute::Underline) attrs |= A_UNDERLINE;
+    if (face.attributes & Attribute::Reverse)   attrs |= A_REVERSE;
+    if (face.attributes & Attribute::Blink)     attrs |= A_BLINK;
+    if (face.attributes & Attribute::Bold)      attrs |= A_BOLD;
+    if (face.attributes & Attribute::Dim)       attrs |= A_DIM;
+    #if defined(A_ITALIC)
+    if (face.attributes & Attribute::Italic)    attrs |= A_ITALIC;
+    #endif
+    m_attributes[face] = attrs;
+    return attrs;
+}
+
+void NCursesUI::set_face(NCursesWin* window, Face face, const Face& default_face)
+{
     if (face.fg == Color::Default)
         face.fg = default_face.fg;
     if (face.bg == Color::Default)
         face.bg = default_face.bg;
 
-    if (face.fg != Color::Default or face.bg != Color::Default)
-    {
-        m_active_pair = get_color_pair(face);
-        wattron(window, COLOR_PAIR(m_active_pair));
-    }
-
-    set_attribute(window, A_UNDERLINE, face.attributes & Attribute::Underline);
-    set_attribute(window, A_REVERSE, face.attributes & Attribute::Reverse);
-    set_attribute(window, A_BLINK, face.attributes & Attribute::Blink);
-    set_attribute(window, A_BOLD, face.attributes & Attribute::Bold);
-    set_attribute(window, A_DIM, face.attributes & Attribute::Dim);
-    #if defined(A_ITALIC)
-    set_attribute(window, A_ITALIC, face.attributes & Attribute::Italic);
-    #endif
+    // the whole attribute word for a face is computed once and cached,
+    // the per atom work is a single lookup and wattrset call
+    wattrset(window, get_attributes(face));
 }
 
 static sig_atomic_t resize_pending = 0;
@@ -246,13 +247,20 @@ NCursesUI::NCursesUI()
         if (not m_on_key)
             return;
 
-        while (auto key = get_next_key())
+        if (m_raw_input)
+            read_raw_input();
+        else while (auto key = get_next_key())
             m_on_key(*key);
       }},
       m_assistant(assistant_clippy),
       m_colors{default_colors},
       m_cursor{CursorMode::Buffer, {}}
 {
+    // make sure a frame always leaves in as few writes as possible, curses
+    // flushes at doupdate but goes through stdout buffering; partial writes
+    // show as tearing on slow connections
+    setvbuf(stdout, nullptr, _IOFBF, 65536);
+
     initscr();
     raw();
     noecho();
@@ -288,8 +296,13 @@ NCursesUI::~NCursesUI()
 void NCursesUI::Window::create(const DisplayCoord& p, const DisplayCoord& s)
 {
     pos = p;
+    if (win and size == s) // keep the existing pad, callers redraw it fully
+        return;
+    if (win)
+        wresize(win, (int)s.line, (int)s.column);
+    else
+        win = (NCursesWin*)newpad((int)s.line, (int)s.column);
     size = s;
-    win = (NCursesWin*)newpad((int)size.line, (int)size.column);
 }
 
 void NCursesUI::Window::destroy()
@@ -378,6 +391,24 @@ void NCursesUI::draw_line(NCursesWin* window, const DisplayLine& line,
 
 static const DisplayLine empty_line = String(" ");
 
+static bool same_display(const DisplayLine& lhs, const DisplayLine& rhs)
+{
+    return std::equal(lhs.begin(), lhs.end(), rhs.begin(), rhs.end(),
+                      [](const DisplayAtom& l, const DisplayAtom& r) {
+                          return l.face == r.face and l.content() == r.content();
+                      });
+}
+
+// the buffer referenced by range atoms can change between two draws,
+// so keep a copy of what was displayed instead
+static DisplayLine drawn_line(const DisplayLine& line)
+{
+    DisplayLine res;
+    for (auto& atom : line)
+        res.push_back({atom.content().str(), atom.face});
+    return res;
+}
+
 void NCursesUI::draw(const DisplayBuffer& display_buffer,
                      const Face& default_face,
                      const Face& padding_face)
@@ -386,13 +417,58 @@ void NCursesUI::draw(const DisplayBuffer& display_buffer,
 
     check_resize();
 
-    LineCount line_index = m_status_on_top ? 1 : 0;
-    for (const DisplayLine& line : display_buffer.lines())
+    if (default_face != m_drawn_default_face)
+    {
+        m_drawn_lines.clear();
+        m_drawn_first_line = -1;
+        m_drawn_default_face = default_face;
+    }
+    auto& lines = display_buffer.lines();
+    m_drawn_lines.resize(lines.size());
+
+    const int offset = m_status_on_top ? 1 : 0;
+    const LineCount first_line = lines.empty() ? -1 : lines[0].range().begin.line;
+
+    // When the content moved vertically, scroll the drawn lines to their
+    // new row so that only the newly exposed ones need a repaint. The
+    // shift is just an estimate (wrapped lines skew it), a wrong value
+    // only means more rows failing the comparison below.
+    const int shift = (int)(first_line - m_drawn_first_line);
+    if (m_drawn_first_line >= 0 and first_line >= 0 and shift != 0 and
+        std::abs(shift) < (int)m_drawn_lines.size())
+    {
+        scrollok(m_window, true);
+        wsetscrreg(m_window, offset, offset + (int)m_drawn_lines.size() - 1);
+        if (wscrl(m_window, shift) == OK)
+        {
+            if (shift > 0)
+            {
+                std::move(m_drawn_lines.begin() + shift, m_drawn_lines.end(),
+                          m_drawn_lines.begin());
+                std::fill(m_drawn_lines.end() - shift, m_drawn_lines.end(),
+                          DisplayLine{});
+            }
+            else
+            {
+                std::move_backward(m_drawn_lines.begin(), m_drawn_lines.end() + shift,
+                                   m_drawn_lines.end());
+                std::fill(m_drawn_lines.begin(), m_drawn_lines.begin() - shift,
+                          DisplayLine{});
+            }
+        }
+        scrollok(m_window, false);
+    }
+    m_drawn_first_line = first_line;
+
+    LineCount line_index = offset;
+    for (size_t i = 0; i < lines.size(); ++i, ++line_index)
     {
+        if (same_display(lines[i], m_drawn_lines[i]))
+            continue;
         wmove(m_window, (int)line_index, 0);
         wclrtoeol(m_window);
-        draw_line(m_window, line, 0, m_dimensions.column, default_face);
-        ++line_index;
+        draw_line(m_window, lines[i], 0, m_dimensions.column, default_face);
+        m_drawn_lines[i] = drawn_line(lines[i]);
     }
 
     wbkgdset(m_window, COLOR_PAIR(get_color_pair(padding_face)));
@@ -408,6 +484,42 @@ void NCursesUI::draw(const DisplayBuffer& display_buffer,
     m_dirty = true;
 }
 
+void NCursesUI::draw_partial(ConstArrayView<DisplayLine> lines,
+                             LineCount first_row,
+                             const Face& default_face)
+{
+    wbkgdset(m_window, COLOR_PAIR(get_color_pair(default_face)));
+
+    check_resize();
+
+    if (default_face != m_drawn_default_face)
+    {
+        m_drawn_lines.clear();
+        m_drawn_first_line = -1;
+        m_drawn_default_face = default_face;
+    }
+    if ((int)m_drawn_lines.size() < (int)first_row + (int)lines.size())
+        m_drawn_lines.resize((int)first_row + (int)lines.size());
+
+    // record the rows as drawn so that the following full frame skips
+    // them; when the viewport scrolled in between they just fail the
+    // comparison and get repainted
+    const int offset = m_status_on_top ? 1 : 0;
+    LineCount line_index = first_row + offset;
+    for (size_t i = 0; i < lines.size(); ++i, ++line_index)
+    {
+        auto& drawn = m_drawn_lines[(int)first_row + i];
+        if (same_display(lines[i], drawn))
+            continue;
+        wmove(m_window, (int)line_index, 0);
+        wclrtoeol(m_window);
+        draw_line(m_window, lines[i], 0, m_dimensions.column, default_face);
+        drawn = drawn_line(lines[i]);
+    }
+
+    m_dirty = true;
+}
+
 void NCursesUI::draw_status(const DisplayLine& status_line,
                             const DisplayLine& mode_line,
                             const Face& default_face)
@@ -456,8 +568,13 @@ void NCursesUI::draw_status(const DisplayLine& status_line,
         for (auto c : suffix)
             *buf_it++ = c;
 
-        fputs(buf, stdout);
-        fflush(stdout);
+        // do not spend a write on a title that did not change
+        if (m_last_title != buf)
+        {
+            m_last_title = buf;
+            fputs(buf, stdout);
+            fflush(stdout);
+        }
     }
 
     m_dirty = true;
@@ -475,38 +592,48 @@ void NCursesUI::check_resize(bool force)
     winsize ws;
     if (ioctl(fd, TIOCGWINSZ, (void*)&ws) == 0)
     {
-        const bool info = (bool)m_info;
-        const bool menu = (bool)m_menu;
-        if (m_window) delwin(m_window);
-        if (info) m_info.destroy();
-        if (menu) m_menu.destroy();
+        const bool width_changed = m_dimensions.column != ws.ws_col;
 
         resize_term(ws.ws_row, ws.ws_col);
 
-        m_window = (NCursesWin*)newpad(ws.ws_row, ws.ws_col);
-        intrflush(m_window, false);
-        keypad(m_window, true);
-        meta(m_window, true);
+        if (m_window)
+            wresize(m_window, ws.ws_row, ws.ws_col);
+        else
+        {
+            m_window = (NCursesWin*)newpad(ws.ws_row, ws.ws_col);
+            intrflush(m_window, false);
+            keypad(m_window, true);
+            meta(m_window, true);
+        }
+
+        if (width_changed)
+        {   // the kept rows were trimmed for the previous width
+            m_drawn_lines.clear();
+            m_drawn_first_line = -1;
+        }
+        else if ((int)m_drawn_lines.size() > ws.ws_row - 1)
+            m_drawn_lines.resize(ws.ws_row - 1);
 
         m_dimensions = DisplayCoord{ws.ws_row-1, ws.ws_col};
 
         if (char* csr = tigetstr((char*)"csr"))
             putp(tparm(csr, 0, ws.ws_row));
 
-        if (menu)
+        // re-anchor menu and info against the new dimensions; their pads
+        // are kept and resized by the show call
+        if (m_menu)
         {
             auto items = std::move(m_menu.items);
             menu_show(items, m_menu.anchor, m_menu.fg, m_menu.bg, m_menu.style);
         }
-        if (info)
+        if (m_info)
             info_show(m_info.title, m_info.content, m_info.anchor, m_info.face, m_info.style);
     }
     else
         kak_assert(false);
 
     ungetch(KEY_RESIZE);
-    clearok(curscr, true);
-    werase(curscr);
+    clearok(curscr, true); // the terminal content is unknown after a resize
 }
 
 void NCursesUI::on_sighup()
@@ -642,6 +769,230 @@ Optional<Key> NCursesUI::get_next_key()
     return parse_key(c);
 }
 
+bool NCursesUI::parse_raw_key(const char*& pos, const char* end, Optional<Key>& key)
+{
+    kak_assert(pos != end);
+    const char* p = pos;
+    const unsigned char c = *p++;
+
+    auto done = [&](Optional<Key> k) {
+        pos = p;
+        key = std::move(k);
+        return true;
+    };
+
+    if (c == 27)
+    {
+        if (p == end)
+            return false;
+
+        if (*p == 27) // only a pressed escape produces two in a row
+            return done({Key::Escape});
+
+        if (*p == '[') // CSI
+        {
+            ++p;
+            bool sgr_mouse = false;
+            if (p != end and *p == '<')
+            {
+                sgr_mouse = true;
+                ++p;
+            }
+            else if (p != end and (*p == '?' or *p == '>'))
+                ++p;
+
+            int params[4] = {};
+            int count = 0;
+            while (p != end and *p >= 0x30 and *p <= 0x3f)
+            {
+                if (*p == ';')
+                    ++count;
+                else if (count < 4 and *p >= '0' and *p <= '9')
+                    params[count] = params[count] * 10 + *p - '0';
+                ++p;
+            }
+            while (p != end and *p >= 0x20 and *p <= 0x2f)
+                ++p;
+            if (p == end)
+                return false;
+            const char final_byte = *p++;
+
+            auto with_mods = [&](Key k) -> Optional<Key> {
+                const int mods = params[1] > 0 ? params[1] - 1 : 0;
+                if (mods & 2)
+                    k.modifiers |= Key::Modifiers::Alt;
+                if (mods & 4)
+                    k.modifiers |= Key::Modifiers::Control;
+                return k;
+            };
+
+            auto mouse_key = [&](int b, int x, int y, bool release) -> Optional<Key> {
+                Key::Modifiers mod{};
+                if (b & 8)
+                    mod |= Key::Modifiers::Alt;
+                if (b & 16)
+                    mod |= Key::Modifiers::Control;
+                const int code = b & ~(4 | 8 | 16);
+                const int button = code & 3;
+                if (code & 64)
+                    mod |= (code & 1) ? Key::Modifiers::MouseWheelDown
+                                      : Key::Modifiers::MouseWheelUp;
+                else if (code & 32)
+                    mod |= Key::Modifiers::MousePos;
+                else if (release)
+                    mod |= button == 1 or button == 2 ? Key::Modifiers::MousePos
+                                                      : Key::Modifiers::MouseRelease;
+                else
+                    mod |= button == 0 ? Key::Modifiers::MousePress
+                                       : Key::Modifiers::MousePos;
+                return Key{ mod, encode_coord({ y - 1 - (m_status_on_top ? 1 : 0), x - 1 }) };
+            };
+
+            switch (final_byte)
+            {
+            case 'A': return done(with_mods({Key::Up}));
+            case 'B': return done(with_mods({Key::Down}));
+            case 'C': return done(with_mods({Key::Right}));
+            case 'D': return done(with_mods({Key::Left}));
+            case 'F': return done(with_mods({Key::End}));
+            case 'H': return done(with_mods({Key::Home}));
+            case 'I': return done({Key::FocusIn});
+            case 'O': return done({Key::FocusOut});
+            case 'Z': return done({Key::BackTab});
+            case 'P': case 'Q': case 'R': case 'S':
+                return done(with_mods({Key::F1 + (final_byte - 'P')}));
+            case '~':
+                switch (params[0])
+                {
+                case 1: case 7: return done(with_mods({Key::Home}));
+                case 3: return done(with_mods({Key::Delete}));
+                case 4: case 8: return done(with_mods({Key::End}));
+                case 5: return done(with_mods({Key::PageUp}));
+                case 6: return done(with_mods({Key::PageDown}));
+                case 11: case 12: case 13: case 14: case 15:
+                    return done(with_mods({Key::F1 + params[0] - 11}));
+                case 17: case 18: case 19: case 20: case 21:
+                    return done(with_mods({Key::F6 + params[0] - 17}));
+                case 23: case 24:
+                    return done(with_mods({Key::F11 + params[0] - 23}));
+                }
+                return done({});
+            case 'M': case 'm':
+                if (sgr_mouse)
+                    return done(mouse_key(params[0], params[1], params[2],
+                                          final_byte == 'm'));
+                if (final_byte == 'M') // X10 encoding, three raw bytes follow
+                {
+                    if (end - p < 3)
+                        return false;
+                    const int b = (unsigned char)p[0] - 32;
+                    const int x = (unsigned char)p[1] - 32;
+                    const int y = (unsigned char)p[2] - 32;
+                    p += 3;
+                    return done(mouse_key(b, x, y, (b & 3) == 3));
+                }
+                return done({});
+            }
+            return done({}); // unhandled sequence, drop it
+        }
+
+        if (*p == 'O') // SS3
+        {
+            if (++p == end)
+                return false;
+            const char ss3 = *p++;
+            switch (ss3)
+            {
+            case 'A': return done({Key::Up});
+            case 'B': return done({Key::Down});
+            case 'C': return done({Key::Right});
+            case 'D': return done({Key::Left});
+            case 'F': return done({Key::End});
+            case 'H': return done({Key::Home});
+            case 'P': case 'Q': case 'R': case 'S':
+                return done({Key::F1 + (ss3 - 'P')});
+            }
+            return done({});
+        }
+
+        // the escape prefixes the key that follows
+        Optional<Key> inner;
+        if (not parse_raw_key(p, end, inner))
+            return false;
+        return done(inner ? Optional<Key>{alt(*inner)} : Optional<Key>{});
+    }
+
+    if (c == 127 or c == control('h'))
+        return done({Key::Backspace});
+
+    if (c > 0 and c < 27)
+    {
+        if (c == control('m') or c == control('j'))
+            return done({Key::Return});
+        if (c == control('i'))
+            return done({Key::Tab});
+        if (c == control('z'))
+        {
+            raise(SIGTSTP);
+            return done({});
+        }
+        return done(ctrl(Codepoint(c) - 1 + 'a'));
+    }
+    if (c < 32)
+        return done({});
+
+    const char* start = p - 1;
+    const ByteCount len = utf8::codepoint_size(*start);
+    if (end - start < (int)len)
+        return false;
+    p = start + (int)len;
+    return done(Key{utf8::codepoint(start, end)});
+}
+
+void NCursesUI::read_raw_input()
+{
+    if (not m_window)
+        return;
+
+    const bool was_resized = resize_pending;
+    check_resize();
+    if (was_resized)
+        m_on_key(resize(m_dimensions));
+
+    char buffer[4096];
+    const ssize_t size = read(0, buffer, sizeof(buffer));
+    if (size <= 0)
+        return;
+
+    // a single read soaks up a whole auto-repeat or mouse drag burst,
+    // every key it holds gets delivered in this event loop iteration
+    String input = m_input_buffer + StringView{buffer, buffer + size};
+    m_input_buffer = String{};
+
+    const char* p = input.begin();
+    const char* end = input.end();
+    while (p != end)
+    {
+        Optional<Key> key;
+        if (not parse_raw_key(p, end, key))
+        {
+            // a trailing lone escape once the burst is drained is a
+            // pressed escape key; a longer tail is a sequence cut at
+            // the read boundary, keep it around for the next chunk
+            if (end - p == 1 and *p == 27 and size < (ssize_t)sizeof(buffer))
+            {
+                ++p;
+                m_on_key({Key::Escape});
+            }
+            break;
+        }
+        if (key)
+            m_on_key(*key);
+    }
+    // the key callbacks may have re-entered us and queued more input
+    m_input_buffer = String{StringView{p, end}} + m_input_buffer;
+}
+
 template<typename T>
 T div_round_up(T a, T b)
 {
@@ -700,7 +1051,10 @@ void NCursesUI::menu_show(ConstArrayView<DisplayLine> items,
                           DisplayCoord anchor, Face fg, Face bg,
                           MenuStyle style)
 {
-    menu_hide();
+    // keep the current pad alive so Window::create can reuse it when the
+    // menu geometry is stable, as it is while a completion list refines;
+    // remember the old area to repaint whatever the new menu uncovers.
+    const Rect old_rect = m_menu;
 
     m_menu.fg = fg;
     m_menu.bg = bg;
@@ -715,7 +1069,10 @@ void NCursesUI::menu_show(ConstArrayView<DisplayLine> items,
     DisplayCoord maxsize = m_dimensions;
     maxsize.column -= anchor.column;
     if (maxsize.column <= 2)
+    {
+        menu_hide();
         return;
+    }
 
     const int item_count = items.size();
     m_menu.items.clear(); // make sure it is empty
@@ -748,6 +1105,9 @@ void NCursesUI::menu_show(ConstArrayView<DisplayLine> items,
 
     auto width = is_prompt ? maxsize.column : min(longest+1, maxsize.column);
     m_menu.create({line, anchor.column}, {height, width});
+    if (old_rect.size != DisplayCoord{} and
+        (m_menu.pos != old_rect.pos or m_menu.size != old_rect.size))
+        mark_dirty(old_rect);
     draw_menu();
 
     if (m_info)
@@ -895,7 +1255,10 @@ Vector<String> make_info_box(StringView title, StringView message, ColumnCount m
 void NCursesUI::info_show(StringView title, StringView content,
                           DisplayCoord anchor, Face face, InfoStyle style)
 {
-    info_hide();
+    // as for the menu, retain the pad across calls; docstring infos are
+    // re-shown on every keystroke, usually at the exact same place, and
+    // hiding first would make them flicker.
+    const Rect old_rect = m_info;
 
     m_info.title = title.str();
     m_info.content = content.str();
@@ -924,7 +1287,10 @@ void NCursesUI::info_show(StringView title, StringView content,
 
         const ColumnCount max_width = m_dimensions.column - col;
         if (max_width < 4)
+        {
+            info_hide();
             return;
+        }
 
         for (auto& line : wrap_lines(m_info.content, max_width))
             info_box.push_back(line.str());
@@ -947,11 +1313,18 @@ void NCursesUI::info_show(StringView title, StringView content,
 
     // The info box does not fit
     if (pos < rect.pos or pos + size > rect.pos + rect.size)
+    {
+        info_hide();
         return;
+    }
 
     m_info.create(pos, size);
+    if (old_rect.size != DisplayCoord{} and
+        (pos != old_rect.pos or size != old_rect.size))
+        mark_dirty(old_rect);
 
     wbkgd(m_info.win, COLOR_PAIR(get_color_pair(face)));
+    werase(m_info.win); // the pad may be reused, clear leftover content
     for (size_t line = 0; line < info_box.size(); ++line)
     {
         wmove(m_info.win, line, 0);
@@ -969,9 +1342,9 @@ void NCursesUI::info_hide()
     m_dirty = true;
 }
 
-void NCursesUI::mark_dirty(const Window& win)
+void NCursesUI::mark_dirty(const Rect& rect)
 {
-    wredrawln(m_window, (int)win.pos.line, (int)win.size.line);
+    wredrawln(m_window, (int)rect.pos.line, (int)rect.size.line);
 }
 
 void NCursesUI::set_on_key(OnKeyCallback callback)
@@ -1003,16 +1376,35 @@ void NCursesUI::enable_mouse(bool enabled)
         fputs("\033[?1002h", stdout);
         // force enable report focus events
         fputs("\033[?1004h", stdout);
+        // the in-process parser prefers unambiguous SGR encoded events
+        if (m_raw_input)
+            fputs("\033[?1006h", stdout);
     }
     else
     {
         mousemask(0, nullptr);
+        if (m_raw_input)
+            fputs("\033[?1006l", stdout);
         fputs("\033[?1004l", stdout);
         fputs("\033[?1002l", stdout);
     }
     fflush(stdout);
 }
 
+void NCursesUI::set_raw_input(bool enabled)
+{
+    if (enabled == m_raw_input)
+        return;
+
+    m_raw_input = enabled;
+    m_input_buffer = String{};
+    if (m_mouse_enabled)
+    {
+        fputs(enabled ? "\033[?1006h" : "\033[?1006l", stdout);
+        fflush(stdout);
+    }
+}
+
 void NCursesUI::set_ui_options(const Options& options)
 {
     {
@@ -1029,8 +1421,14 @@ void NCursesUI::set_ui_options(const Options& options)
 
     {
         auto it = options.find("ncurses_status_on_top"_sv);
-        m_status_on_top = it != options.end() and
+        const bool status_on_top = it != options.end() and
             (it->value == "yes" or it->value == "true");
+        if (status_on_top != m_status_on_top)
+        {
+            m_status_on_top = status_on_top;
+            m_drawn_lines.clear(); // every line moved
+            m_drawn_first_line = -1;
+        }
     }
 
     {
@@ -1052,7 +1450,7 @@ void NCursesUI::set_ui_options(const Options& options)
             m_colors = default_colors;
             m_next_color = 16;
             m_next_pair = 1;
-            m_active_pair = -1;
+            m_attributes.clear();
         }
         m_change_colors = value;
     }
@@ -1071,6 +1469,12 @@ void NCursesUI::set_ui_options(const Options& options)
         m_wheel_down_button = wheel_down_it != options.end() ?
             str_to_int_ifp(wheel_down_it->value).value_or(5) : 5;
     }
+
+    {
+        auto it = options.find("ncurses_raw_input"_sv);
+        set_raw_input(it != options.end() and
+                      (it->value == "yes" or it->value == "true"));
+    }
 }
 
 }
@@ -28,6 +28,10 @@ public:
               const Face& default_face,
               const Face& padding_face) override;
 
+    void draw_partial(ConstArrayView<DisplayLine> lines,
+                      LineCount first_row,
+                      const Face& default_face) override;
+
     void draw_status(const DisplayLine& status_line,
                      const DisplayLine& mode_line,
                      const Face& default_face) override;
@@ -68,12 +72,15 @@ private:
 
     int get_color(Color color);
     int get_color_pair(const Face& face);
+    int get_attributes(const Face& face);
     void set_face(NCursesWin* window, Face face, const Face& default_face);
     void draw_line(NCursesWin* window, const DisplayLine& line,
                    ColumnCount col_index, ColumnCount max_column,
                    const Face& default_face);
 
     Optional<Key> get_next_key();
+    void read_raw_input();
+    bool parse_raw_key(const char*& pos, const char* end, Optional<Key>& key);
 
     NCursesWin* m_window = nullptr;
 
@@ -82,9 +89,9 @@ private:
     using ColorPair = std::pair<Color, Color>;
     HashMap<Color, int, MemoryDomain::Faces> m_colors;
     HashMap<ColorPair, int, MemoryDomain::Faces> m_colorpairs;
+    HashMap<Face, int, MemoryDomain::Faces> m_attributes;
     int m_next_color = 16;
     int m_next_pair = 1;
-    int m_active_pair = -1;
 
     struct Window : Rect
     {
@@ -97,7 +104,7 @@ private:
         NCursesWin* win = nullptr;
     };
 
-    void mark_dirty(const Window& win);
+    void mark_dirty(const Rect& rect);
 
     struct Menu : Window
     {
@@ -135,15 +142,28 @@ private:
     ConstArrayView<StringView> m_assistant;
 
     void enable_mouse(bool enabled);
+    void set_raw_input(bool enabled);
 
     bool m_mouse_enabled = false;
     int m_wheel_up_button = 4;
     int m_wheel_down_button = 5;
 
+    // raw input mode bypasses curses and reads the tty in large chunks,
+    // parsing escape sequences in process
+    bool m_raw_input = false;
+    String m_input_buffer;
+
     bool m_set_title = true;
     bool m_change_colors = true;
 
     bool m_dirty = false;
+
+    // lines as they were last drawn into the window, used to repaint
+    // only the ones that changed
+    Vector<DisplayLine, MemoryDomain::Display> m_drawn_lines;
+    Face m_drawn_default_face;
+    LineCount m_drawn_first_line = -1;
+    String m_last_title;
 };
 
 }
@@ -163,7 +163,7 @@ String build_autoinfo_for_mapping(Context& context, KeymapMode mode,
 
     String res;
     for (auto& desc : descs)
-        res += format("{}:{}{}\n",
+        format_to(res, "{}:{}{}\n",
                       desc.first,
                       String{' ', max_len - desc.first.column_length() + 1},
                       desc.second);
@@ -714,7 +714,17 @@ void regex_prompt(Context& context, String prompt, T func)
                 if (event == PromptEvent::Validate)
                     context.push_jump();
 
-                func(str.empty() ? Regex{} : Regex{str}, event, context);
+                if (event == PromptEvent::Change)
+                {
+                    // bound the time an incremental search may take so that
+                    // typing stays responsive in huge buffers, the next
+                    // keystroke will trigger a fresh attempt anyway; on
+                    // expiry the runtime_error is swallowed below.
+                    ScopedRegexTimeBudget budget{std::chrono::milliseconds{100}};
+                    func(str.empty() ? Regex{} : Regex{str}, event, context);
+                }
+                else
+                    func(str.empty() ? Regex{} : Regex{str}, event, context);
             }
             catch (regex_error& err)
             {
@@ -1386,8 +1396,21 @@ void replay_macro(Context& context, NormalParams params)
     running_macros[idx] = true;
     auto stop = on_scope_end([&]{ running_macros[idx] = false; });
 
-    auto keys = parse_keys(reg_val[0]);
+    // macros live as text in their register, which set-register can
+    // change behind our back; keep the parsed keys per slot and only
+    // re-parse when the text differs, so a macro replayed repeatedly
+    // costs a comparison instead of a full parse
+    struct MacroCache { String text; KeyList keys; };
+    static MacroCache macro_caches[27];
+    auto& cache = macro_caches[idx];
+    if (cache.text != reg_val[0])
+    {
+        cache.keys = parse_keys(reg_val[0]);
+        cache.text = reg_val[0];
+    }
+    const auto& keys = cache.keys;
     ScopedEdition edition(context);
+    ScopedSetBool replaying(context.input_handler().replaying());
     do
     {
         for (auto& key : keys)
@@ -1422,11 +1445,13 @@ void align(Context& context, NormalParams)
     auto& buffer = context.buffer();
     const ColumnCount tabstop = context.options()["tabstop"].get<int>();
 
-    Vector<Vector<const Selection*>> columns;
+    Vector<Vector<size_t>> columns;
+    Vector<size_t> sel_column(selections.size());
     LineCount last_line = -1;
     size_t column = 0;
-    for (auto& sel : selections)
+    for (size_t index = 0; index < selections.size(); ++index)
     {
+        auto& sel = selections[index];
         auto line = sel.cursor().line;
         if (sel.anchor().line != line)
             throw runtime_error("align cannot work with multi line selections");
@@ -1434,37 +1459,67 @@ void align(Context& context, NormalParams)
         column = (line == last_line) ? column + 1 : 0;
         if (column >= columns.size())
             columns.resize(column+1);
-        columns[column].push_back(&sel);
+        columns[column].push_back(index);
+        sel_column[index] = column;
         last_line = line;
     }
 
+    // the paddings computed for earlier columns shift the content of later
+    // ones, so display columns are computed against the buffer as it will be
+    // once the paddings decided so far are inserted
+    struct Pad { ByteCount pos; ColumnCount width; };
+    Vector<Pad> pads(selections.size(), Pad{0, 0});
+    auto padded_column = [&](size_t index, BufferCoord coord) {
+        // selections on a line are contiguous, in column order; all
+        // earlier ones on this line already have their padding decided
+        ConstArrayView<Pad> line_pads{pads.data() + index - sel_column[index],
+                                      sel_column[index]};
+        auto line = buffer[coord.line];
+        ColumnCount col = 0;
+        auto pad = line_pads.begin();
+        for (auto it = line.begin();
+             it != line.end() and coord.column > (int)(it - line.begin()); )
+        {
+            while (pad != line_pads.end() and pad->pos == (int)(it - line.begin()))
+                col += (pad++)->width;
+            if (*it == '\t')
+            {
+                col = (col / tabstop + 1) * tabstop;
+                ++it;
+            }
+            else
+                col += codepoint_width(utf8::read_codepoint(it, line.end()));
+        }
+        return col;
+    };
+
     const bool use_tabs = context.options()["aligntab"].get<bool>();
+    Vector<String> padstrs(selections.size(), String{});
     for (auto& col : columns)
     {
         ColumnCount maxcol = 0;
-        for (auto& sel : col)
-            maxcol = std::max(get_column(buffer, tabstop, sel->cursor()), maxcol);
-        for (auto& sel : col)
+        for (size_t index : col)
+            maxcol = std::max(padded_column(index, selections[index].cursor()), maxcol);
+        for (size_t index : col)
         {
-            auto insert_coord = sel->min();
-            ColumnCount lastcol = get_column(buffer, tabstop, sel->cursor());
-            ColumnCount inscount = maxcol - lastcol;
-            String padstr;
+            auto& sel = selections[index];
+            const auto insert_coord = sel.min();
+            const ColumnCount inscount = maxcol - padded_column(index, sel.cursor());
             if (not use_tabs)
-                padstr = String{ ' ', inscount };
+                padstrs[index] = String{ ' ', inscount };
             else
             {
-                ColumnCount inscol = get_column(buffer, tabstop, insert_coord);
+                ColumnCount inscol = padded_column(index, insert_coord);
                 ColumnCount targetcol = inscol + inscount;
                 ColumnCount tabcol = inscol - (inscol % tabstop);
                 CharCount tabs = (int)((targetcol - tabcol) / tabstop);
                 CharCount spaces = (int)(targetcol - (tabs ? (tabcol + (int)tabs * tabstop) : inscol));
-                padstr = String{ '\t', tabs } + String{ ' ', spaces };
+                padstrs[index] = String{ '\t', tabs } + String{ ' ', spaces };
             }
-            buffer.insert(insert_coord, padstr);
+            pads[index] = Pad{ insert_coord.column, inscount };
         }
-        selections.update();
     }
+    selections.insert(padstrs, InsertMode::Insert);
 }
 
 void copy_indent(Context& context, NormalParams params)
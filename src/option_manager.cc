@@ -6,9 +6,9 @@
 namespace Kakoune
 {
 
-OptionDesc::OptionDesc(String name, String docstring, OptionFlags flags)
+OptionDesc::OptionDesc(String name, String docstring, OptionFlags flags, int id)
     : m_name(std::move(name)), m_docstring(std::move(docstring)),
-    m_flags(flags) {}
+    m_flags(flags), m_id(id) {}
 
 Option::Option(const OptionDesc& desc, OptionManager& manager)
     : m_manager(manager), m_desc(desc) {}
@@ -46,6 +46,8 @@ struct option_not_found : public runtime_error
         : runtime_error("option not found: " + name) {}
 };
 
+size_t OptionManager::ms_structure_epoch = 0;
+
 Option& OptionManager::get_local_option(StringView name)
 {
     auto it = m_options.find(name);
@@ -54,6 +56,9 @@ Option& OptionManager::get_local_option(StringView name)
     else if (m_parent)
     {
         auto* clone = (*m_parent)[name].clone(*this);
+        index_option(*clone);
+        // the local copy shadows whatever the name resolved to so far
+        ++ms_structure_epoch;
         return *m_options.insert({clone->name(), std::unique_ptr<Option>{clone}});
     }
     else
@@ -63,13 +68,27 @@ Option& OptionManager::get_local_option(StringView name)
 
 Option& OptionManager::operator[](StringView name)
 {
+    if (m_lookup_epoch != ms_structure_epoch)
+    {
+        m_lookup_cache.clear();
+        m_lookup_epoch = ms_structure_epoch;
+    }
+    auto cached = m_lookup_cache.find(name);
+    if (cached != m_lookup_cache.end())
+        return *cached->value;
+
+    Option* option;
     auto it = m_options.find(name);
     if (it != m_options.end())
-        return *it->value;
+        option = it->value.get();
     else if (m_parent)
-        return (*m_parent)[name];
+        option = &(*m_parent)[name];
     else
         throw option_not_found(name);
+
+    // key the cache on the option name storage, which outlives the cache
+    m_lookup_cache.insert({option->name(), option});
+    return *option;
 }
 
 const Option& OptionManager::operator[](StringView name) const
@@ -77,12 +96,45 @@ const Option& OptionManager::operator[](StringView name) const
     return const_cast<OptionManager&>(*this)[name];
 }
 
+Option& OptionManager::operator[](const OptionId& id)
+{
+    // intern on first use; once the name is resolved to its dense id
+    // the lookup is a plain array load per scope
+    if (id.m_id < 0)
+        id.m_id = (*this)[id.m_name].id();
+    for (auto* manager = this; manager; manager = manager->m_parent)
+    {
+        if (id.m_id < (int)manager->m_by_id.size())
+        {
+            if (Option* option = manager->m_by_id[id.m_id])
+                return *option;
+        }
+    }
+    throw option_not_found(id.m_name);
+}
+
+const Option& OptionManager::operator[](const OptionId& id) const
+{
+    return const_cast<OptionManager&>(*this)[id];
+}
+
+void OptionManager::index_option(Option& option)
+{
+    const int id = option.id();
+    if (id >= (int)m_by_id.size())
+        m_by_id.resize(id + 1, nullptr);
+    m_by_id[id] = &option;
+}
+
 void OptionManager::unset_option(StringView name)
 {
     kak_assert(m_parent); // cannot unset option on global manager
-    if (m_options.contains(name))
+    auto it = m_options.find(name);
+    if (it != m_options.end())
     {
+        m_by_id[it->value->id()] = nullptr;
         m_options.erase(name);
+        ++ms_structure_epoch;
         on_option_changed((*m_parent)[name]);
     }
 }
@@ -30,17 +30,48 @@ constexpr bool with_bit_ops(Meta::Type<OptionFlags>) { return true; }
 class OptionDesc
 {
 public:
-    OptionDesc(String name, String docstring, OptionFlags flags);
+    OptionDesc(String name, String docstring, OptionFlags flags, int id);
 
     const String& name() const { return m_name; }
     const String& docstring() const { return m_docstring; }
 
     OptionFlags flags() const { return m_flags; }
+    int id() const { return m_id; }
 
 private:
     String m_name;
     String m_docstring;
     OptionFlags  m_flags;
+    int m_id;
+};
+
+// Interned option name; declared options are assigned dense ids in
+// declaration order, which the scope managers mirror in plain arrays.
+// Hot paths keep a static OptionId around so that lookups cost an
+// array load per scope instead of hashing the name in every scope.
+class OptionId
+{
+public:
+    explicit OptionId(StringView name) : m_name{name} {}
+
+private:
+    friend class OptionManager;
+    StringView m_name;
+    mutable int m_id = -1;
+};
+
+// OptionId that also fixes the option type; the dynamic type is
+// validated on first access and trusted afterwards, so steady state
+// reads are an array load and a direct dereference with no dynamic_cast
+template<typename T>
+class TypedOptionId : public OptionId
+{
+public:
+    using OptionId::OptionId;
+
+private:
+    friend class OptionManager;
+    mutable bool m_type_checked = false;
 };
 
 class Option : public UseMemoryDomain<MemoryDomain::Options>
@@ -53,9 +84,10 @@ public:
     template<typename T> void set(const T& val, bool notify=true);
     template<typename T> bool is_of_type() const;
 
-    virtual String get_as_string() const = 0;
+    virtual const String& get_as_string() const = 0;
     virtual void   set_from_string(StringView str) = 0;
     virtual void   add_from_string(StringView str) = 0;
+    virtual void   remove_from_string(StringView str) = 0;
     virtual void   update(const Context& context) = 0;
 
     virtual Option* clone(OptionManager& manager) const = 0;
@@ -64,6 +96,7 @@ public:
     const String& name() const { return m_desc.name(); }
     const String& docstring() const { return m_desc.docstring(); }
     OptionFlags flags() const { return m_desc.flags(); }
+    int id() const { return m_desc.id(); }
 
 protected:
     Option(const OptionDesc& desc, OptionManager& manager);
@@ -86,6 +119,9 @@ public:
 
     Option& operator[] (StringView name);
     const Option& operator[] (StringView name) const;
+    Option& operator[] (const OptionId& id);
+    const Option& operator[] (const OptionId& id) const;
+    template<typename T> const T& get(const TypedOptionId<T>& id) const;
     Option& get_local_option(StringView name);
 
     void unset_option(StringView name);
@@ -104,7 +140,18 @@ private:
     friend class Scope;
     friend class OptionsRegistry;
 
+    void index_option(Option& option);
+
     HashMap<StringView, std::unique_ptr<Option>, MemoryDomain::Options> m_options;
+    // options present in this scope, indexed by their dense id
+    Vector<Option*, MemoryDomain::Options> m_by_id;
+    // flat name -> resolved option cache so steady state lookups do a
+    // single hash lookup instead of walking the scope chain; what a name
+    // resolves to only changes when some scope gains or loses a local
+    // option, so a process wide epoch invalidates every cache at once
+    mutable HashMap<StringView, Option*, MemoryDomain::Options> m_lookup_cache;
+    mutable size_t m_lookup_epoch = 0;
+    static size_t ms_structure_epoch;
     OptionManager* m_parent;
 
     mutable Vector<OptionManagerWatcher*, MemoryDomain::Options> m_watchers;
@@ -123,16 +170,28 @@ public:
         if (m_value != value)
         {
             m_value = std::move(value);
+            m_serialized_valid = false;
             if (notify)
                 manager().on_option_changed(*this);
         }
     }
     const T& get() const { return m_value; }
-    T& get_mutable() { return m_value; }
+    T& get_mutable()
+    {
+        m_serialized_valid = false;
+        return m_value;
+    }
 
-    String get_as_string() const override
+    const String& get_as_string() const override
     {
-        return option_to_string(m_value);
+        // serializing a big list option for every expansion gets costly,
+        // keep the result around until the value changes
+        if (not m_serialized_valid)
+        {
+            m_serialized = option_to_string(m_value);
+            m_serialized_valid = true;
+        }
+        return m_serialized;
     }
     void set_from_string(StringView str) override
     {
@@ -143,15 +202,29 @@ public:
     void add_from_string(StringView str) override
     {
         if (option_add(m_value, str))
+        {
+            m_serialized_valid = false;
             m_manager.on_option_changed(*this);
+        }
+    }
+    void remove_from_string(StringView str) override
+    {
+        if (option_remove(m_value, str))
+        {
+            m_serialized_valid = false;
+            m_manager.on_option_changed(*this);
+        }
     }
     void update(const Context& context) override
     {
         option_update(m_value, context);
+        m_serialized_valid = false;
     }
 private:
     virtual void validate(const T& value) const {}
     T m_value;
+    mutable String m_serialized;
+    mutable bool m_serialized_valid = false;
 };
 
 template<typename T, void (*validator)(const T&)>
@@ -193,6 +266,20 @@ template<typename T> bool Option::is_of_type() const
     return dynamic_cast<const TypedOption<T>*>(this) != nullptr;
 }
 
+template<typename T>
+const T& OptionManager::get(const TypedOptionId<T>& id) const
+{
+    const Option& option = (*this)[id];
+    if (not id.m_type_checked)
+    {
+        // every scope holds clones of the same declaration, so checking
+        // the first resolved option covers them all
+        option.get<T>(); // throws if the declared type does not match
+        id.m_type_checked = true;
+    }
+    return static_cast<const TypedOption<T>&>(option).get();
+}
+
 class OptionsRegistry
 {
 public:
@@ -222,9 +309,11 @@ public:
         }
         String doc =  docstring.empty() ? format("[{}]", option_type_name(Meta::Type<T>{}))
                                         : format("[{}] - {}", option_type_name(Meta::Type<T>{}), docstring);
-        m_descs.emplace_back(new OptionDesc{name.str(), std::move(doc), flags});
-        return *opts.insert({m_descs.back()->name(),
-                             std::make_unique<TypedCheckedOption<T, validator>>(m_global_manager, *m_descs.back(), value)});
+        m_descs.emplace_back(new OptionDesc{name.str(), std::move(doc), flags, (int)m_descs.size()});
+        auto& option = *opts.insert({m_descs.back()->name(),
+                                     std::make_unique<TypedCheckedOption<T, validator>>(m_global_manager, *m_descs.back(), value)});
+        m_global_manager.index_option(option);
+        return option;
     }
 
     const OptionDesc* option_desc(StringView name) const
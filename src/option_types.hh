@@ -98,6 +98,24 @@ bool option_add(Vector<T, domain>& opt, StringView str)
     return not vec.empty();
 }
 
+template<typename T, MemoryDomain domain>
+bool option_remove(Vector<T, domain>& opt, StringView str)
+{
+    Vector<T, domain> to_remove;
+    option_from_string(str, to_remove);
+    bool changed = false;
+    for (auto& elem : to_remove)
+    {
+        auto it = find(opt, elem);
+        if (it != opt.end())
+        {
+            opt.erase(it);
+            changed = true;
+        }
+    }
+    return changed;
+}
+
 template<typename T, MemoryDomain D>
 String option_type_name(Meta::Type<Vector<T, D>>)
 {
@@ -138,6 +156,24 @@ bool option_add(HashMap<Key, Value, domain>& opt, StringView str)
     return changed;
 }
 
+template<typename Key, typename Value, MemoryDomain domain>
+bool option_remove(HashMap<Key, Value, domain>& opt, StringView str)
+{
+    bool changed = false;
+    for (auto& elem : split(str, list_separator, '\\'))
+    {
+        // ignore the value if the caller passed a full key=value entry
+        Key key;
+        option_from_string(split(elem, '=', '\\')[0], key);
+        if (opt.find(key) != opt.end())
+        {
+            opt.remove(key);
+            changed = true;
+        }
+    }
+    return changed;
+}
+
 template<typename Key, typename Value, MemoryDomain domain>
 void option_from_string(StringView str, HashMap<Key, Value, domain>& opt)
 {
@@ -229,6 +265,11 @@ inline bool option_add(WorstMatch, StringView)
     throw runtime_error("no add operation supported for this option type");
 }
 
+inline bool option_remove(WorstMatch, StringView)
+{
+    throw runtime_error("no remove operation supported for this option type");
+}
+
 inline void option_update(WorstMatch, const Context&)
 {
     throw runtime_error("no update operation supported for this option type");
@@ -331,6 +372,12 @@ inline bool option_add(PrefixedList<P, T>& opt, StringView str)
     return option_add(opt.list, str);
 }
 
+template<typename P, typename T>
+inline bool option_remove(PrefixedList<P, T>& opt, StringView str)
+{
+    return option_remove(opt.list, str);
+}
+
 }
 
 #endif // option_types_hh_INCLUDED
@@ -21,7 +21,9 @@ ParametersParser::ParametersParser(ParameterList params,
       m_desc(desc)
 {
     bool only_pos = desc.flags & ParameterDesc::Flags::SwitchesAsPositional;
-    Vector<bool> switch_seen(desc.switches.size(), false);
+    m_switch_args.resize(desc.switches.size());
+    for (auto& arg : m_switch_args)
+        arg = -1;
     for (size_t i = 0; i < params.size(); ++i)
     {
         if (not only_pos and params[i] == "--")
@@ -33,12 +35,12 @@ ParametersParser::ParametersParser(ParameterList params,
                 throw unknown_option(params[i]);
 
             auto switch_index = it - m_desc.switches.begin();
-            if (switch_seen[switch_index])
+            if (m_switch_args[switch_index] != -1)
                 throw runtime_error{format("switch '-{}' specified more than once", it->key)};
-            switch_seen[switch_index] = true;
 
             if (it->value.takes_arg and ++i == params.size())
                throw missing_option_value(it->key);
+            m_switch_args[switch_index] = (int)i;
         }
         else // positional
         {
@@ -56,16 +58,10 @@ Optional<StringView> ParametersParser::get_switch(StringView name) const
 {
     auto it = m_desc.switches.find(name);
     kak_assert(it != m_desc.switches.end());
-    for (size_t i = 0; i < m_params.size(); ++i)
-    {
-        const auto& param = m_params[i];
-        if (param[0_byte] == '-' and param.substr(1_byte) == name)
-            return it->value.takes_arg ? m_params[i+1] : StringView{};
-
-        if (param == "--")
-            break;
-    }
-    return {};
+    const int arg = m_switch_args[it - m_desc.switches.begin()];
+    if (arg == -1)
+        return {};
+    return it->value.takes_arg ? StringView{m_params[arg]} : StringView{};
 }
 
 }
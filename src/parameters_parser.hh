@@ -3,6 +3,7 @@
 
 #include "exception.hh"
 #include "hash_map.hh"
+#include "inline_vector.hh"
 #include "meta.hh"
 #include "array_view.hh"
 #include "optional.hh"
@@ -120,7 +121,13 @@ struct ParametersParser
 
 private:
     ParameterList m_params;
-    Vector<size_t, MemoryDomain::Commands> m_positional_indices;
+    // a parser is constructed per command execution, most commands take
+    // few enough positionals to not need an allocation
+    InlineVector<size_t, 8, MemoryDomain::Commands> m_positional_indices;
+    // per switch, the index of its value parameter (of the switch itself
+    // for boolean switches), -1 when not given; resolved once during
+    // parsing so get_switch does not rescan the parameter list
+    InlineVector<int, 8, MemoryDomain::Commands> m_switch_args;
     const ParameterDesc& m_desc;
 };
 
@@ -0,0 +1,199 @@
+#include "project_search.hh"
+
+#include "event_manager.hh"
+#include "exception.hh"
+#include "file.hh"
+#include "ranges.hh"
+#include "regex.hh"
+#include "string_utils.hh"
+#include "utils.hh"
+#include "vector.hh"
+
+#include <algorithm>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace Kakoune
+{
+
+namespace
+{
+
+using FileList = Vector<String>;
+
+// Depth first walk gathering the regular files under dir; hidden entries
+// are skipped and symlinks are not followed, so cyclic trees terminate.
+// This intentionally does not go through read_directory, whose cache is
+// not meant to be touched from another thread.
+void list_tree(const String& dir, FileList& files)
+{
+    DIR* d = opendir(dir.c_str());
+    if (not d)
+        return;
+    auto close_dir = on_scope_end([d]{ closedir(d); });
+    while (dirent* entry = readdir(d))
+    {
+        if (entry->d_name[0] == '.')
+            continue;
+        String path = format("{}/{}", dir, entry->d_name);
+        struct stat st;
+        if (lstat(path.c_str(), &st) != 0)
+            continue;
+        if (S_ISDIR(st.st_mode))
+            list_tree(path, files);
+        else if (S_ISREG(st.st_mode))
+            files.push_back(std::move(path));
+    }
+}
+
+// Match regex against each line of a memory mapped file, appending one
+// "file:line:column:text" record per matching line. Files whose first
+// block contains a null byte are considered binary and skipped, as are
+// unreadable ones.
+void scan_file(const Regex& regex, const String& path, String& results)
+{
+    try
+    {
+        MappedFile file{path};
+        if (file.st.st_size == 0)
+            return;
+        const char* const end = file.data + file.st.st_size;
+        if (memchr(file.data, 0, std::min<size_t>(file.st.st_size, 8192)))
+            return;
+
+        MatchResults<const char*> res;
+        int line = 1;
+        for (const char* pos = file.data; pos < end; ++line)
+        {
+            const char* eol = std::find(pos, end, '\n');
+            if (regex_search(pos, eol, res, regex))
+                results += format("{}:{}:{}:{}\n", path, line,
+                                  (int)(res[0].first - pos) + 1,
+                                  StringView{pos, eol});
+            pos = eol + 1;
+        }
+    }
+    catch (runtime_error&)
+    {
+        // unreadable file, or an error the fallback regex engine raised
+        // on this content; skip the file
+    }
+}
+
+// An in flight project search. The compiled regex is shared with the
+// process wide regex cache through a RefPtr whose refcount is not
+// atomic, so the regex is owned here, on the main thread, and destroyed
+// there once the worker is done; the worker only reads through it.
+struct ProjectSearch : UseMemoryDomain<MemoryDomain::Regex>
+{
+    Regex regex;
+    size_t id;
+    std::thread thread;
+
+    ~ProjectSearch() { if (thread.joinable()) thread.join(); }
+};
+
+Vector<std::unique_ptr<ProjectSearch>, MemoryDomain::Regex>& pending_searches()
+{
+    static Vector<std::unique_ptr<ProjectSearch>, MemoryDomain::Regex> searches;
+    return searches;
+}
+
+}
+
+int spawn_project_search(String pattern, String root)
+{
+    auto search = std::make_unique<ProjectSearch>();
+    // compile here so the caller gets regex errors synchronously
+    search->regex = Regex{pattern};
+    static size_t next_id = 0;
+    search->id = ++next_id;
+
+    int pipefd[2];
+    if (pipe(pipefd) != 0)
+        throw runtime_error("unable to create pipe");
+    fcntl(pipefd[0], F_SETFD, FD_CLOEXEC);
+    fcntl(pipefd[1], F_SETFD, FD_CLOEXEC);
+    fcntl(pipefd[0], F_SETFL, O_NONBLOCK);
+
+    ProjectSearch* ptr = search.get();
+    search->thread = std::thread{[ptr, root=std::move(root), fd=pipefd[1]] {
+        auto done = on_scope_end([ptr, fd] {
+            close(fd);
+            // hand the entry back to the main thread which joins us and
+            // destroys the regex there
+            EventManager::instance().post([id = ptr->id] {
+                auto& searches = pending_searches();
+                auto it = find_if(searches, [id](auto& search) { return search->id == id; });
+                if (it == searches.end())
+                    return;
+                (*it)->thread.join();
+                searches.erase(it);
+            });
+        });
+        const Regex& regex = ptr->regex;
+
+        // a failed write means the fifo buffer went away; SIGPIPE is
+        // ignored so this surfaces as an error and stops the search
+        auto write_all = [fd](StringView data) {
+            while (not data.empty())
+            {
+                const ssize_t res = ::write(fd, data.data(), (size_t)(int)data.length());
+                if (res <= 0)
+                    return false;
+                data = data.substr(ByteCount{(int)res});
+            }
+            return true;
+        };
+
+        FileList files;
+        list_tree(root, files);
+
+        // scan batches of files concurrently as find_all_matches does for
+        // buffer ranges (only our own engine is known to support matching
+        // from several threads), but emit records between batches so that
+        // results stream out in file order while the scan proceeds
+        const size_t max_threads = std::thread::hardware_concurrency();
+        const size_t num_threads = (regex.impl() and max_threads > 1) ?
+            std::min(max_threads, (size_t)16) : 1;
+
+        const size_t batch_size = num_threads * 32;
+        for (size_t batch = 0; batch < files.size(); batch += batch_size)
+        {
+            const size_t batch_end = std::min(batch + batch_size, files.size());
+            std::vector<String> results(batch_end - batch);
+            if (num_threads == 1)
+            {
+                for (size_t i = batch; i < batch_end; ++i)
+                    scan_file(regex, files[i], results[i - batch]);
+            }
+            else
+            {
+                std::vector<std::thread> threads;
+                for (size_t t = 0; t < num_threads; ++t)
+                    threads.emplace_back([&, t]{
+                        for (size_t i = batch + t; i < batch_end; i += num_threads)
+                            scan_file(regex, files[i], results[i - batch]);
+                    });
+                for (auto& thread : threads)
+                    thread.join();
+            }
+
+            for (auto& result : results)
+                if (not result.empty() and not write_all(result))
+                    return;
+        }
+    }};
+    pending_searches().push_back(std::move(search));
+
+    return pipefd[0];
+}
+
+}
@@ -0,0 +1,19 @@
+#ifndef project_search_hh_INCLUDED
+#define project_search_hh_INCLUDED
+
+#include "string.hh"
+
+namespace Kakoune
+{
+
+// Search the regular files under root for pattern on a background
+// thread, streaming grep style "file:line:column:text" records to the
+// returned file descriptor. The descriptor is non blocking and ready to
+// be handed to create_fifo_buffer, so results show up incrementally as
+// they are found. The pattern is compiled on the calling thread first,
+// so an invalid one throws before any work is spawned.
+int spawn_project_search(String pattern, String root);
+
+}
+
+#endif // project_search_hh_INCLUDED
@@ -1,7 +1,10 @@
 #include "ranked_match.hh"
 
 #include "flags.hh"
+#include "string_utils.hh"
 #include "unit_tests.hh"
+#include "benchmark.hh"
+#include "vector.hh"
 #include "utf8_iterator.hh"
 #include "optional.hh"
 
@@ -12,20 +15,9 @@ namespace Kakoune
 
 UsedLetters used_letters(StringView str)
 {
-    UsedLetters res = 0;
+    UsedLetters res;
     for (auto c : str)
-    {
-        if (c >= 'a' and c <= 'z')
-            res |= 1uLL << (c - 'a');
-        else if (c >= 'A' and c <= 'Z')
-            res |= 1uLL << (c - 'A' + 26);
-        else if (c == '_')
-            res |= 1uLL << 53;
-        else if (c == '-')
-            res |= 1uLL << 54;
-        else
-            res |= 1uLL << 63;
-    }
+        add_used_letter(res, c);
     return res;
 }
 
@@ -71,6 +63,13 @@ static int count_word_boundaries_match(StringView candidate, StringView query)
 
 static bool smartcase_eq(Codepoint candidate, Codepoint query)
 {
+    if (candidate < 128 and query < 128) // bypass the locale for ascii
+    {
+        if (query >= 'a' and query <= 'z')
+            return query == (candidate >= 'A' and candidate <= 'Z' ?
+                             candidate + 32 : candidate);
+        return query == candidate;
+    }
     return query == (iswlower((wchar_t)query) ? to_lower(candidate) : candidate);
 }
 
@@ -237,6 +236,31 @@ UnitTest test_ranked_match{[] {
 UnitTest test_used_letters{[]()
 {
     kak_assert(used_letters("abcd") == to_lower(used_letters("abcdABCD")));
+    kak_assert(matches(used_letters("foo12"), used_letters("foo123_bar")));
+    kak_assert(not matches(used_letters("foo3"), used_letters("foo12")));
+    kak_assert(not matches(used_letters("f,b"), used_letters("f.b")));
+}};
+
+
+Benchmark bench_ranked_match{"ranked match over candidates", []()
+{
+    Vector<String> candidates;
+    Vector<UsedLetters> letters;
+    for (int i = 0; i < 100000; ++i)
+    {
+        candidates.push_back(format("some_candidate_function_name_{}", i));
+        letters.push_back(used_letters(candidates.back()));
+    }
+    const StringView query = "scfn42";
+    const UsedLetters query_letters = used_letters(query);
+    size_t matched = 0;
+    for (int i = 0; i < (int)candidates.size(); ++i)
+    {
+        if (RankedMatch match{candidates[i], letters[i], query, query_letters})
+            ++matched;
+    }
+    volatile size_t sink = matched;
+    (void)sink;
 }};
 
 }
@@ -7,14 +7,67 @@
 namespace Kakoune
 {
 
-using UsedLetters = uint64_t;
+// 128 bit bitmap of the letters used in a string, allowing candidates
+// that cannot possibly match a query to be discarded without walking
+// their characters. The low word holds a bit per ascii letter, digit,
+// '_' and '-'; the high word buckets the remaining ascii bytes and the
+// non-ascii utf8 bytes.
+struct UsedLetters
+{
+    uint64_t low = 0;
+    uint64_t high = 0;
+
+    constexpr UsedLetters operator&(UsedLetters other) const
+    {
+        return { low & other.low, high & other.high };
+    }
+
+    UsedLetters& operator|=(UsedLetters other)
+    {
+        low |= other.low;
+        high |= other.high;
+        return *this;
+    }
+
+    constexpr bool operator==(UsedLetters other) const
+    {
+        return low == other.low and high == other.high;
+    }
+
+    constexpr bool operator!=(UsedLetters other) const
+    {
+        return not (*this == other);
+    }
+};
+
+// fold one utf8 code unit into the bitmap; callers scanning text
+// themselves use this to keep the bucketing consistent everywhere
+inline void add_used_letter(UsedLetters& letters, char c)
+{
+    if (c >= 'a' and c <= 'z')
+        letters.low |= 1uLL << (c - 'a');
+    else if (c >= 'A' and c <= 'Z')
+        letters.low |= 1uLL << (c - 'A' + 26);
+    else if (c >= '0' and c <= '9')
+        letters.low |= 1uLL << (c - '0' + 52);
+    else if (c == '_')
+        letters.low |= 1uLL << 62;
+    else if (c == '-')
+        letters.low |= 1uLL << 63;
+    else if ((unsigned char)c < 0x80) // remaining ascii, bucketed by low bits
+        letters.high |= 1uLL << ((unsigned char)c & 31);
+    else // utf8 code units, bucketed by their low bits
+        letters.high |= 1uLL << (32 + ((unsigned char)c & 31));
+}
+
 UsedLetters used_letters(StringView str);
 
-constexpr UsedLetters upper_mask = 0xFFFFFFC000000;
+constexpr UsedLetters upper_mask = { 0xFFFFFFC000000, 0 };
 
 inline UsedLetters to_lower(UsedLetters letters)
 {
-    return ((letters & upper_mask) >> 26) | (letters & (~upper_mask));
+    return { ((letters.low & upper_mask.low) >> 26) | (letters.low & ~upper_mask.low),
+             letters.high };
 }
 
 struct RankedMatch
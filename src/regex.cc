@@ -1,15 +1,88 @@
 #include "regex.hh"
 
 #include "exception.hh"
+#include "benchmark.hh"
+#include "ranges.hh"
+
+#include <algorithm>
 
 namespace Kakoune
 {
 
 using Utf8It = RegexUtf8It<const char*>;
 
-Regex::Regex(StringView re, flag_type flags) try
-    : RegexBase{Utf8It{re.begin(), re}, Utf8It{re.end(), re}, flags}, m_str{re.str()}
-{} catch (std::runtime_error& err) { throw regex_error(err.what()); }
+namespace
+{
+
+// Process wide cache of compiled regexes: dynamic highlighters and
+// option driven patterns (modelinefmt, search highlighting...) rebuild
+// Regex objects from the same strings again and again, often once per
+// keystroke, and compilation costs milliseconds where copying boosts
+// internally refcounted representation and the RefPtr'd program is
+// nearly free. Entries are kept in least recently used order.
+class RegexCache
+{
+public:
+    const Regex* find(StringView re, Regex::flag_type flags)
+    {
+        auto it = find_if(m_entries, [&](const Entry& entry) {
+            return entry.flags == flags and entry.regex.str() == re;
+        });
+        if (it == m_entries.end())
+            return nullptr;
+        std::rotate(it, it + 1, m_entries.end()); // most recently used last
+        return &m_entries.back().regex;
+    }
+
+    void add(Regex regex, Regex::flag_type flags)
+    {
+        constexpr size_t max_entries = 128;
+        if (m_entries.size() == max_entries)
+            m_entries.erase(m_entries.begin());
+        m_entries.push_back({std::move(regex), flags});
+    }
+
+private:
+    struct Entry
+    {
+        Regex regex;
+        Regex::flag_type flags;
+    };
+    Vector<Entry, MemoryDomain::Regex> m_entries;
+};
+
+RegexCache& regex_cache()
+{
+    static RegexCache cache;
+    return cache;
+}
+
+}
+
+Regex::Regex(StringView re, flag_type flags)
+{
+    if (const Regex* cached = regex_cache().find(re, flags))
+    {
+        *this = *cached;
+        return;
+    }
+
+    try
+    {
+        assign(Utf8It{re.begin(), re}, Utf8It{re.end(), re}, flags);
+    }
+    catch (std::runtime_error& err) { throw regex_error(err.what()); }
+
+    m_str = re.str();
+    // the boost regex compilation stays authoritative for syntax errors
+    // and for mark_count, the internal engine only kicks in when it
+    // supports every feature the expression uses.
+    constexpr flag_type supported = ECMAScript | icase | optimize;
+    if ((flags & ~supported) == 0)
+        m_impl = try_compile_regex(re, flags & icase);
+
+    regex_cache().add(*this, flags);
+}
 
 String option_to_string(const Regex& re)
 {
@@ -21,4 +94,19 @@ void option_from_string(StringView str, Regex& re)
     re = Regex{str};
 }
 
+
+Benchmark bench_regex{"regex search over sample source", []()
+{
+    String source;
+    for (int i = 0; i < 2000; ++i)
+        source += "int some_function_name(const Type& arg) { return arg.member + 0x1f; } // a comment\n";
+    const Regex regex{R"(\b(?:int|const|return)\b|0x[0-9a-fA-F]+)"};
+    size_t count = 0;
+    for (auto it = RegexIterator<const char*>{source.begin(), source.end(), regex},
+              end = RegexIterator<const char*>{}; it != end; ++it)
+        ++count;
+    volatile size_t sink = count;
+    (void)sink;
+}};
+
 }
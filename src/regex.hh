@@ -4,6 +4,7 @@
 #include "string.hh"
 #include "string_utils.hh"
 #include "exception.hh"
+#include "regex_impl.hh"
 #include "utf8_iterator.hh"
 
 #include <boost/regex.hpp>
@@ -20,7 +21,13 @@ struct regex_error : runtime_error
 
 using RegexBase = boost::basic_regex<wchar_t, boost::c_regex_traits<wchar_t>>;
 
-// Regex that keeps track of its string representation
+// Regex that keeps track of its string representation and, when the
+// expression only uses features the internal engine supports, of a
+// compiled program for ThreadedRegexVM. Matching then runs directly over
+// the utf-8 text instead of going through boost and its wchar_t
+// conversion, and in linear time; boost remains as a fallback for the
+// features the internal engine does not implement (lookarounds,
+// backreferences, posix classes...).
 class Regex : public RegexBase
 {
 public:
@@ -33,65 +40,60 @@ public:
 
     const String& str() const { return m_str; }
 
+    const CompiledRegex* impl() const { return m_impl.get(); }
+
     static constexpr const char* option_type_name = "regex";
 
 private:
     String m_str;
+    RefPtr<CompiledRegex> m_impl;
 };
 
 template<typename It>
 using RegexUtf8It = utf8::iterator<It, wchar_t, ssize_t>;
 
-template<typename It>
-using RegexIteratorBase = boost::regex_iterator<RegexUtf8It<It>, wchar_t,
-                                                boost::c_regex_traits<wchar_t>>;
-
 namespace RegexConstant = boost::regex_constants;
 
 template<typename Iterator>
-struct MatchResults : boost::match_results<RegexUtf8It<Iterator>>
+struct MatchResults
 {
-    using ParentType = boost::match_results<RegexUtf8It<Iterator>>;
     struct SubMatch : std::pair<Iterator, Iterator>
     {
         SubMatch() = default;
-        SubMatch(const boost::sub_match<RegexUtf8It<Iterator>>& m)
-            : std::pair<Iterator, Iterator>{m.first.base(), m.second.base()},
-              matched{m.matched}
+        SubMatch(Iterator begin, Iterator end, bool matched)
+            : std::pair<Iterator, Iterator>{begin, end}, matched{matched}
         {}
 
         bool matched = false;
     };
 
-    struct iterator : boost::match_results<RegexUtf8It<Iterator>>::iterator
-    {
-        using ParentType = typename boost::match_results<RegexUtf8It<Iterator>>::iterator;
-        iterator(const ParentType& it) : ParentType(it) {}
+    using ContainerType = Vector<SubMatch, MemoryDomain::Regex>;
 
-        SubMatch operator*() const { return {ParentType::operator*()}; }
-    };
+    MatchResults() = default;
+    MatchResults(ContainerType values) : m_values{std::move(values)} {}
 
-    iterator begin() const { return {ParentType::begin()}; }
-    iterator cbegin() const { return {ParentType::cbegin()}; }
-    iterator end() const { return {ParentType::end()}; }
-    iterator cend() const { return {ParentType::cend()}; }
+    typename ContainerType::const_iterator begin() const { return m_values.begin(); }
+    typename ContainerType::const_iterator cbegin() const { return m_values.cbegin(); }
+    typename ContainerType::const_iterator end() const { return m_values.end(); }
+    typename ContainerType::const_iterator cend() const { return m_values.cend(); }
 
-    SubMatch operator[](size_t s) const { return {ParentType::operator[](s)}; }
-};
+    size_t size() const { return m_values.size(); }
+    bool empty() const { return m_values.empty(); }
 
-template<typename Iterator>
-struct RegexIterator : RegexIteratorBase<Iterator>
-{
-    using Utf8It = RegexUtf8It<Iterator>;
-    using ValueType = MatchResults<Iterator>;
+    const SubMatch& operator[](size_t i) const
+    {
+        static const SubMatch empty_match{};
+        return i < m_values.size() ? m_values[i] : empty_match;
+    }
 
-    RegexIterator() = default;
-    RegexIterator(Iterator begin, Iterator end, const Regex& re,
-                  RegexConstant::match_flag_type flags = RegexConstant::match_default)
-        : RegexIteratorBase<Iterator>{Utf8It{begin, begin, end}, Utf8It{end, begin, end}, re, flags} {}
+    void swap(MatchResults& other) { m_values.swap(other.m_values); }
 
-    const ValueType& operator*() const { return *reinterpret_cast<const ValueType*>(&RegexIteratorBase<Iterator>::operator*()); }
-    const ValueType* operator->() const { return reinterpret_cast<const ValueType*>(RegexIteratorBase<Iterator>::operator->()); }
+    // underlying storage, exposed so capture extraction code can refill
+    // results in place and reuse the capacity across matches
+    ContainerType& container() { return m_values; }
+
+private:
+    ContainerType m_values;
 };
 
 inline RegexConstant::match_flag_type match_flags(bool bol, bool eol, bool bow, bool eow)
@@ -102,9 +104,48 @@ inline RegexConstant::match_flag_type match_flags(bool bol, bool eol, bool bow,
            (eow ? RegexConstant::match_default : RegexConstant::match_not_eow);
 }
 
+namespace RegexDetails
+{
+
+// unmatched submatches are represented as an empty range at the subject
+// end, which keeps them safe to dereference in generic capture handling
+// code. The results are refilled in place so repeated extraction into
+// the same object does not allocate once the capacity is established.
+template<typename It>
+void from_vm_saves(const Vector<It, MemoryDomain::Regex>& saves, const It& end,
+                   MatchResults<It>& res)
+{
+    auto& values = res.container();
+    values.clear();
+    values.reserve(saves.size() / 2);
+    for (size_t i = 0; i + 1 < saves.size(); i += 2)
+        values.push_back({saves[i], saves[i+1],
+                          saves[i] != end or saves[i+1] != end});
+}
+
+template<typename It>
+void from_boost_results(const boost::match_results<RegexUtf8It<It>>& boost_res, const It& end,
+                        MatchResults<It>& res)
+{
+    auto& values = res.container();
+    values.clear();
+    values.reserve(boost_res.size());
+    for (auto& sub : boost_res)
+        values.push_back({sub.matched ? sub.first.base() : end,
+                          sub.matched ? sub.second.base() : end,
+                          sub.matched});
+}
+
+}
+
 template<typename It>
 bool regex_match(It begin, It end, const Regex& re)
 {
+    if (auto* impl = re.impl())
+    {
+        ThreadedRegexVM<It> vm{*impl};
+        return vm.exec(begin, end, true, true, true, true, true);
+    }
     try
     {
         return boost::regex_match<RegexUtf8It<It>>({begin, begin, end}, {end, begin, end}, re);
@@ -118,9 +159,21 @@ bool regex_match(It begin, It end, const Regex& re)
 template<typename It>
 bool regex_match(It begin, It end, MatchResults<It>& res, const Regex& re)
 {
+    if (auto* impl = re.impl())
+    {
+        ThreadedRegexVM<It> vm{*impl};
+        if (not vm.exec(begin, end, true, true, true, true, true))
+            return false;
+        RegexDetails::from_vm_saves(vm.captures, end, res);
+        return true;
+    }
     try
     {
-        return boost::regex_match<RegexUtf8It<It>>({begin, begin, end}, {end, begin, end}, res, re);
+        boost::match_results<RegexUtf8It<It>> boost_res;
+        if (not boost::regex_match<RegexUtf8It<It>>({begin, begin, end}, {end, begin, end}, boost_res, re))
+            return false;
+        RegexDetails::from_boost_results(boost_res, end, res);
+        return true;
     }
     catch (std::runtime_error& err)
     {
@@ -132,6 +185,15 @@ template<typename It>
 bool regex_search(It begin, It end, const Regex& re,
                   RegexConstant::match_flag_type flags = RegexConstant::match_default)
 {
+    if (auto* impl = re.impl())
+    {
+        ThreadedRegexVM<It> vm{*impl};
+        return vm.exec(begin, end, false,
+                       not (flags & RegexConstant::match_not_bol),
+                       not (flags & RegexConstant::match_not_eol),
+                       not (flags & RegexConstant::match_not_bow),
+                       not (flags & RegexConstant::match_not_eow));
+    }
     try
     {
         return boost::regex_search<RegexUtf8It<It>>({begin, begin, end}, {end, begin, end}, re, flags);
@@ -146,9 +208,25 @@ template<typename It>
 bool regex_search(It begin, It end, MatchResults<It>& res, const Regex& re,
                   RegexConstant::match_flag_type flags = RegexConstant::match_default)
 {
+    if (auto* impl = re.impl())
+    {
+        ThreadedRegexVM<It> vm{*impl};
+        if (not vm.exec(begin, end, false,
+                        not (flags & RegexConstant::match_not_bol),
+                        not (flags & RegexConstant::match_not_eol),
+                        not (flags & RegexConstant::match_not_bow),
+                        not (flags & RegexConstant::match_not_eow)))
+            return false;
+        RegexDetails::from_vm_saves(vm.captures, end, res);
+        return true;
+    }
     try
     {
-        return boost::regex_search<RegexUtf8It<It>>({begin, begin, end}, {end, begin, end}, res, re, flags);
+        boost::match_results<RegexUtf8It<It>> boost_res;
+        if (not boost::regex_search<RegexUtf8It<It>>({begin, begin, end}, {end, begin, end}, boost_res, re, flags))
+            return false;
+        RegexDetails::from_boost_results(boost_res, end, res);
+        return true;
     }
     catch (std::runtime_error& err)
     {
@@ -156,6 +234,102 @@ bool regex_search(It begin, It end, MatchResults<It>& res, const Regex& re,
     }
 }
 
+template<typename Iterator>
+struct RegexIterator
+{
+    using ValueType = MatchResults<Iterator>;
+
+    RegexIterator() = default;
+    RegexIterator(Iterator begin, Iterator end, const Regex& re,
+                  RegexConstant::match_flag_type flags = RegexConstant::match_default)
+        : m_regex{&re}, m_next_pos{begin}, m_begin{begin}, m_end{end}, m_flags{flags}
+    {
+        // the boost iterator tracks the original subject start, which buffer
+        // limit assertions and lookbehinds depend on, so fallback regexes
+        // cannot be iterated with repeated regex_search calls.
+        if (not re.impl())
+            m_boost_it = BoostIt{{begin, begin, end}, {end, begin, end}, re, flags};
+        next();
+    }
+
+    const ValueType& operator*() const { kak_assert(m_regex); return m_results; }
+    const ValueType* operator->() const { kak_assert(m_regex); return &m_results; }
+
+    RegexIterator& operator++() { next(); return *this; }
+
+    friend bool operator==(const RegexIterator& lhs, const RegexIterator& rhs)
+    {
+        if (not lhs.m_regex or not rhs.m_regex)
+            return lhs.m_regex == rhs.m_regex;
+        return lhs.m_next_pos == rhs.m_next_pos;
+    }
+
+    friend bool operator!=(const RegexIterator& lhs, const RegexIterator& rhs)
+    {
+        return not (lhs == rhs);
+    }
+
+private:
+    void next()
+    {
+        kak_assert(m_regex);
+        if (not m_regex->impl())
+        {
+            if (m_boost_it == BoostIt{})
+                m_regex = nullptr;
+            else
+            {
+                RegexDetails::from_boost_results(*m_boost_it, m_end, m_results);
+                m_next_pos = m_results[0].second;
+                ++m_boost_it;
+            }
+            return;
+        }
+        if (m_stop)
+        {
+            m_regex = nullptr;
+            return;
+        }
+
+        auto flags = m_flags;
+        if (m_next_pos != m_begin) // the initial flags only describe m_begin
+        {
+            const Codepoint prev = utf8::codepoint(utf8::previous(m_next_pos, m_begin), m_end);
+            flags &= ~(RegexConstant::match_not_bol | RegexConstant::match_not_bow);
+            if (prev != '\n')
+                flags |= RegexConstant::match_not_bol;
+            if (is_word(prev))
+                flags |= RegexConstant::match_not_bow;
+        }
+
+        if (not regex_search(m_next_pos, m_end, m_results, *m_regex, flags))
+            m_regex = nullptr;
+        else
+        {
+            m_next_pos = m_results[0].second;
+            if (m_results[0].first == m_results[0].second) // empty match
+            {
+                if (m_next_pos == m_end)
+                    m_stop = true; // this was the last match
+                else
+                    m_next_pos = utf8::next(m_next_pos, m_end);
+            }
+        }
+    }
+
+    using BoostIt = boost::regex_iterator<RegexUtf8It<Iterator>, wchar_t,
+                                          boost::c_regex_traits<wchar_t>>;
+
+    const Regex* m_regex = nullptr;
+    BoostIt m_boost_it;
+    MatchResults<Iterator> m_results;
+    Iterator m_next_pos{};
+    Iterator m_begin{};
+    Iterator m_end{};
+    RegexConstant::match_flag_type m_flags = RegexConstant::match_default;
+    bool m_stop = false;
+};
+
 String option_to_string(const Regex& re);
 void option_from_string(StringView str, Regex& re);
 
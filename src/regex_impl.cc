@@ -0,0 +1,652 @@
+#include "regex_impl.hh"
+
+#include "exception.hh"
+#include "optional.hh"
+#include "string.hh"
+#include "unit_tests.hh"
+
+#include <iterator>
+#include <memory>
+
+namespace Kakoune
+{
+
+namespace
+{
+
+// Thrown when the regex uses a feature the internal engine does not
+// implement (or syntax it does not want to diagnose itself), compilation
+// then falls back on the boost based implementation.
+struct regex_unsupported {};
+
+struct Quantifier
+{
+    enum Type { One, Optional, RepeatZeroOrMore, RepeatOneOrMore, RepeatMinMax };
+    Type type = One;
+    bool greedy = true;
+    int min = 0, max = 0; // for RepeatMinMax, max == -1 means unbounded
+};
+
+struct AstNode : UseMemoryDomain<MemoryDomain::Regex>
+{
+    enum Op
+    {
+        Literal,
+        AnyChar,
+        Class,
+        Sequence,
+        Alternation,
+        CaptureGroup,
+        Group,
+        LineStart,
+        LineEnd,
+        WordBoundary,
+        NotWordBoundary,
+    };
+
+    Op op;
+    Codepoint value = 0; // literal codepoint, class index or capture index
+    Quantifier quantifier;
+    Vector<std::unique_ptr<AstNode>, MemoryDomain::Regex> children;
+};
+
+using AstNodePtr = std::unique_ptr<AstNode>;
+
+AstNodePtr make_node(AstNode::Op op, Codepoint value = 0)
+{
+    AstNodePtr node{new AstNode{}};
+    node->op = op;
+    node->value = value;
+    return node;
+}
+
+bool is_assertion(AstNode::Op op)
+{
+    return op == AstNode::LineStart or op == AstNode::LineEnd or
+           op == AstNode::WordBoundary or op == AstNode::NotWordBoundary;
+}
+
+struct RegexParser
+{
+    RegexParser(StringView re, bool ignore_case)
+        : m_pos{re.begin()}, m_end{re.end()}, m_ignore_case{ignore_case} {}
+
+    AstNodePtr parse()
+    {
+        auto node = disjunction();
+        if (not eof()) // unbalanced ')'
+            throw regex_unsupported{};
+        return node;
+    }
+
+    Vector<CompiledRegex::CharacterClass, MemoryDomain::Regex> classes;
+    uint32_t capture_count = 1;
+
+private:
+    bool eof() const { return m_pos == m_end; }
+    Codepoint peek() const { return utf8::codepoint(m_pos, m_end); }
+    Codepoint read() { return utf8::read_codepoint(m_pos, m_end); }
+
+    bool accept(Codepoint cp)
+    {
+        if (eof() or peek() != cp)
+            return false;
+        read();
+        return true;
+    }
+
+    AstNodePtr disjunction()
+    {
+        auto node = alternative();
+        if (eof() or peek() != '|')
+            return node;
+
+        auto alt = make_node(AstNode::Alternation);
+        alt->children.push_back(std::move(node));
+        while (accept('|'))
+            alt->children.push_back(alternative());
+        return alt;
+    }
+
+    AstNodePtr alternative()
+    {
+        auto node = make_node(AstNode::Sequence);
+        while (not eof() and peek() != '|' and peek() != ')')
+            node->children.push_back(term());
+        return node;
+    }
+
+    AstNodePtr term()
+    {
+        auto node = atom();
+        quantifier(node->quantifier);
+        if (is_assertion(node->op) and node->quantifier.type != Quantifier::One)
+            throw regex_unsupported{};
+        return node;
+    }
+
+    AstNodePtr atom()
+    {
+        const Codepoint cp = read();
+        switch (cp)
+        {
+        case '^': return make_node(AstNode::LineStart);
+        case '$': return make_node(AstNode::LineEnd);
+        case '.': return make_node(AstNode::AnyChar);
+        case '(':
+        {
+            AstNodePtr node;
+            if (accept('?'))
+            {
+                if (not accept(':')) // lookarounds, named groups, options...
+                    throw regex_unsupported{};
+                node = make_node(AstNode::Group);
+            }
+            else
+                node = make_node(AstNode::CaptureGroup, capture_count++);
+
+            node->children.push_back(disjunction());
+            if (not accept(')'))
+                throw regex_unsupported{};
+            return node;
+        }
+        case '\\': return escaped_atom();
+        case '[': return character_class();
+        case '*': case '+': case '?': case '{': case ')':
+            throw regex_unsupported{}; // invalid, let boost diagnose
+        default: return literal(cp);
+        }
+    }
+
+    AstNodePtr literal(Codepoint cp)
+    {
+        return make_node(AstNode::Literal, m_ignore_case ? to_lower(cp) : cp);
+    }
+
+    AstNodePtr escaped_atom()
+    {
+        if (eof())
+            throw regex_unsupported{};
+        const Codepoint cp = read();
+        switch (cp)
+        {
+        case 'b': return make_node(AstNode::WordBoundary);
+        case 'B': return make_node(AstNode::NotWordBoundary);
+        case 'n': return literal('\n');
+        case 't': return literal('\t');
+        case 'r': return literal('\r');
+        case 'f': return literal('\f');
+        case 'v': return literal('\v');
+        case '0': return literal('\0');
+        case 'd': case 'w': case 's': case 'h':
+        case 'D': case 'W': case 'S': case 'H':
+        {
+            CompiledRegex::CharacterClass cclass;
+            cclass.ctypes = ctype(cp);
+            cclass.negative = is_upper(cp);
+            return class_node(std::move(cclass));
+        }
+        default:
+            // backreferences, \x, \u, \Q, \A... along with the boost
+            // specific assertions for buffer limits and word limits
+            if (is_word(cp) or cp == '`' or cp == '\'' or cp == '<' or cp == '>')
+                throw regex_unsupported{};
+            return literal(cp);
+        }
+    }
+
+    CompiledRegex::CharacterType ctype(Codepoint cp) const
+    {
+        switch (to_lower(cp))
+        {
+        case 'd': return CompiledRegex::CharacterType::Digit;
+        case 'w': return CompiledRegex::CharacterType::Word;
+        case 's': return CompiledRegex::CharacterType::Whitespace;
+        case 'h': return CompiledRegex::CharacterType::HorizontalWhitespace;
+        }
+        kak_assert(false);
+        return CompiledRegex::CharacterType::None;
+    }
+
+    AstNodePtr class_node(CompiledRegex::CharacterClass cclass)
+    {
+        auto node = make_node(AstNode::Class, classes.size());
+        classes.push_back(std::move(cclass));
+        return node;
+    }
+
+    AstNodePtr character_class()
+    {
+        CompiledRegex::CharacterClass cclass;
+        cclass.ignore_case = m_ignore_case;
+        cclass.negative = accept('^');
+        if (accept(']')) // as first element, ']' is a literal
+            cclass.ranges.push_back({']', ']'});
+
+        while (not accept(']'))
+        {
+            if (eof()) // unbalanced '[', let boost diagnose
+                throw regex_unsupported{};
+
+            Codepoint cp = read();
+            if (cp == '[' and not eof() and
+                (peek() == ':' or peek() == '=' or peek() == '.'))
+                throw regex_unsupported{}; // posix named classes
+            if (cp == '\\')
+            {
+                if (eof())
+                    throw regex_unsupported{};
+                cp = read();
+                switch (cp)
+                {
+                case 'd': case 'w': case 's': case 'h':
+                    cclass.ctypes |= ctype(cp);
+                    continue;
+                case 'n': cp = '\n'; break;
+                case 't': cp = '\t'; break;
+                case 'r': cp = '\r'; break;
+                case 'f': cp = '\f'; break;
+                case 'v': cp = '\v'; break;
+                case '0': cp = '\0'; break;
+                default:
+                    if (is_word(cp)) // negated types, \x...
+                        throw regex_unsupported{};
+                    break;
+                }
+            }
+
+            CompiledRegex::CharacterClass::Range range{cp, cp};
+            if (not eof() and peek() == '-')
+            {
+                read();
+                if (eof())
+                    throw regex_unsupported{};
+                if (peek() == ']') // trailing '-' is a literal
+                {
+                    cclass.ranges.push_back(range);
+                    range = {'-', '-'};
+                }
+                else
+                {
+                    range.max = read();
+                    if (range.max == '\\' or range.min > range.max)
+                        throw regex_unsupported{};
+                }
+            }
+            cclass.ranges.push_back(range);
+        }
+        return class_node(std::move(cclass));
+    }
+
+    void quantifier(Quantifier& quant)
+    {
+        if (eof())
+            return;
+        switch (peek())
+        {
+        case '*': read(); quant.type = Quantifier::RepeatZeroOrMore; break;
+        case '+': read(); quant.type = Quantifier::RepeatOneOrMore; break;
+        case '?': read(); quant.type = Quantifier::Optional; break;
+        case '{':
+        {
+            read();
+            quant.type = Quantifier::RepeatMinMax;
+            quant.min = read_int();
+            quant.max = quant.min;
+            if (accept(','))
+                quant.max = (not eof() and peek() == '}') ? -1 : read_int();
+            if (not accept('}') or quant.min > max_repeat or quant.max > max_repeat
+                or (quant.max != -1 and quant.min > quant.max))
+                throw regex_unsupported{};
+            break;
+        }
+        default: return;
+        }
+        quant.greedy = not accept('?');
+    }
+
+    int read_int()
+    {
+        if (eof() or peek() < '0' or peek() > '9')
+            throw regex_unsupported{};
+        int res = 0;
+        while (not eof() and peek() >= '0' and peek() <= '9')
+            res = res * 10 + (int)(read() - '0');
+        return res;
+    }
+
+    // bounded repetition is compiled by duplicating the atom program,
+    // keep that (and hence the program size) reasonable
+    static constexpr int max_repeat = 100;
+
+    const char* m_pos;
+    const char* m_end;
+    const bool m_ignore_case;
+};
+
+struct RegexCompiler
+{
+    RegexCompiler(CompiledRegex& program, bool ignore_case)
+        : m_program{program}, m_ignore_case{ignore_case} {}
+
+    uint32_t emit(CompiledRegex::Op op, uint32_t param = 0)
+    {
+        if (m_program.instructions.size() >= max_instructions)
+            throw regex_unsupported{};
+        m_program.instructions.push_back({op, param});
+        return m_program.instructions.size() - 1;
+    }
+
+    uint32_t next_inst() const { return m_program.instructions.size(); }
+
+    void compile_node(const AstNode& node)
+    {
+        auto& quant = node.quantifier;
+        const bool greedy = quant.greedy;
+        // for a greedy quantifier the branch entering the atom has priority
+        // over the one skipping it, and conversely for a lazy one.
+        const auto skip_split = greedy ? CompiledRegex::Split_PrioritizeParent
+                                       : CompiledRegex::Split_PrioritizeChild;
+        const auto loop_split = greedy ? CompiledRegex::Split_PrioritizeChild
+                                       : CompiledRegex::Split_PrioritizeParent;
+        switch (quant.type)
+        {
+        case Quantifier::One:
+            compile_node_inner(node);
+            break;
+        case Quantifier::Optional:
+        {
+            auto split = emit(skip_split);
+            compile_node_inner(node);
+            m_program.instructions[split].param = next_inst();
+            break;
+        }
+        case Quantifier::RepeatZeroOrMore:
+        {
+            auto begin = next_inst();
+            auto split = emit(skip_split);
+            compile_node_inner(node);
+            emit(CompiledRegex::Jump, begin);
+            m_program.instructions[split].param = next_inst();
+            break;
+        }
+        case Quantifier::RepeatOneOrMore:
+        {
+            auto begin = next_inst();
+            compile_node_inner(node);
+            emit(loop_split, begin);
+            break;
+        }
+        case Quantifier::RepeatMinMax:
+        {
+            for (int i = 0; i < quant.min; ++i)
+                compile_node_inner(node);
+            if (quant.max == -1)
+            {
+                auto begin = next_inst();
+                auto split = emit(skip_split);
+                compile_node_inner(node);
+                emit(CompiledRegex::Jump, begin);
+                m_program.instructions[split].param = next_inst();
+            }
+            else
+            {
+                Vector<uint32_t, MemoryDomain::Regex> splits;
+                for (int i = quant.min; i < quant.max; ++i)
+                {
+                    splits.push_back(emit(skip_split));
+                    compile_node_inner(node);
+                }
+                for (auto split : splits)
+                    m_program.instructions[split].param = next_inst();
+            }
+            break;
+        }
+        }
+    }
+
+private:
+    void compile_node_inner(const AstNode& node)
+    {
+        switch (node.op)
+        {
+        case AstNode::Literal:
+            emit(m_ignore_case ? CompiledRegex::LiteralIgnoreCase
+                               : CompiledRegex::Literal, node.value);
+            break;
+        case AstNode::AnyChar:
+            emit(CompiledRegex::AnyChar);
+            break;
+        case AstNode::Class:
+            emit(CompiledRegex::Class, node.value);
+            break;
+        case AstNode::Sequence:
+            for (auto& child : node.children)
+                compile_node(*child);
+            break;
+        case AstNode::Alternation:
+        {
+            Vector<uint32_t, MemoryDomain::Regex> jumps;
+            const auto count = node.children.size();
+            for (size_t i = 0; i < count; ++i)
+            {
+                uint32_t split = 0;
+                if (i + 1 < count)
+                    split = emit(CompiledRegex::Split_PrioritizeParent);
+                compile_node(*node.children[i]);
+                if (i + 1 < count)
+                {
+                    jumps.push_back(emit(CompiledRegex::Jump));
+                    m_program.instructions[split].param = next_inst();
+                }
+            }
+            for (auto jump : jumps)
+                m_program.instructions[jump].param = next_inst();
+            break;
+        }
+        case AstNode::CaptureGroup:
+            emit(CompiledRegex::Save, 2 * node.value);
+            compile_node(*node.children[0]);
+            emit(CompiledRegex::Save, 2 * node.value + 1);
+            break;
+        case AstNode::Group:
+            compile_node(*node.children[0]);
+            break;
+        case AstNode::LineStart:
+            emit(CompiledRegex::LineStart);
+            break;
+        case AstNode::LineEnd:
+            emit(CompiledRegex::LineEnd);
+            break;
+        case AstNode::WordBoundary:
+            emit(CompiledRegex::WordBoundary);
+            break;
+        case AstNode::NotWordBoundary:
+            emit(CompiledRegex::NotWordBoundary);
+            break;
+        }
+    }
+
+    static constexpr size_t max_instructions = 2048;
+
+    CompiledRegex& m_program;
+    const bool m_ignore_case;
+};
+
+// Gather the literal every match has to begin with. Saves and zero-width
+// assertions do not contribute bytes and get skipped, the first split,
+// class or any-char instruction ends the literal run. The prefix is only
+// a filter for candidate positions, which the program then validates in
+// full, so an interleaved assertion does not need to be checked here.
+void extract_prefix(CompiledRegex& program)
+{
+    for (auto& inst : program.instructions)
+    {
+        if (inst.op == CompiledRegex::Literal)
+            utf8::dump(std::back_inserter(program.prefix), inst.param);
+        else if (inst.op != CompiledRegex::Save and
+                 inst.op != CompiledRegex::LineStart and
+                 inst.op != CompiledRegex::LineEnd and
+                 inst.op != CompiledRegex::WordBoundary and
+                 inst.op != CompiledRegex::NotWordBoundary)
+            break;
+    }
+}
+
+}
+
+bool can_match_eol(const CompiledRegex& program)
+{
+    for (auto& inst : program.instructions)
+    {
+        if (((inst.op == CompiledRegex::Literal or
+              inst.op == CompiledRegex::LiteralIgnoreCase) and inst.param == '\n') or
+            inst.op == CompiledRegex::AnyChar or
+            (inst.op == CompiledRegex::Class and
+             character_class_matches(program.classes[inst.param], '\n')))
+            return true;
+    }
+    return false;
+}
+
+static TimePoint g_regex_deadline = TimePoint::max();
+
+ScopedRegexTimeBudget::ScopedRegexTimeBudget(Clock::duration budget)
+    : m_previous_deadline{g_regex_deadline}
+{
+    g_regex_deadline = Clock::now() + budget;
+}
+
+ScopedRegexTimeBudget::~ScopedRegexTimeBudget()
+{
+    g_regex_deadline = m_previous_deadline;
+}
+
+void check_regex_deadline()
+{
+    if (Clock::now() > g_regex_deadline)
+        throw runtime_error{"regex matching timed out"};
+}
+
+RefPtr<CompiledRegex> try_compile_regex(StringView re, bool ignore_case)
+{
+    try
+    {
+        RegexParser parser{re, ignore_case};
+        auto ast = parser.parse();
+
+        RefPtr<CompiledRegex> program{new CompiledRegex};
+        program->classes = std::move(parser.classes);
+        program->save_count = parser.capture_count * 2;
+
+        RegexCompiler compiler{*program, ignore_case};
+        compiler.emit(CompiledRegex::Save, 0);
+        compiler.compile_node(*ast);
+        compiler.emit(CompiledRegex::Save, 1);
+        compiler.emit(CompiledRegex::Match);
+        extract_prefix(*program);
+        return program;
+    }
+    catch (regex_unsupported&)
+    {
+        return {};
+    }
+}
+
+bool is_ctype(CompiledRegex::CharacterType ctypes, Codepoint cp)
+{
+    using CT = CompiledRegex::CharacterType;
+    return ((ctypes & CT::Digit) and cp >= '0' and cp <= '9') or
+           ((ctypes & CT::Word) and is_word(cp)) or
+           ((ctypes & CT::Whitespace) and (is_blank(cp) or cp == '\r' or
+                                           cp == '\f' or cp == '\v')) or
+           ((ctypes & CT::HorizontalWhitespace) and is_horizontal_blank(cp));
+}
+
+bool character_class_matches(const CompiledRegex::CharacterClass& cclass, Codepoint cp)
+{
+    auto matches = [&cclass](Codepoint cp) {
+        for (auto& range : cclass.ranges)
+        {
+            if (cp >= range.min and cp <= range.max)
+                return true;
+        }
+        return is_ctype(cclass.ctypes, cp);
+    };
+    const bool found = matches(cp) or
+        (cclass.ignore_case and (matches(to_lower(cp)) or matches(to_upper(cp))));
+    return found != cclass.negative;
+}
+
+UnitTest test_regex_impl{[]{
+    auto compile = [](StringView re, bool ignore_case = false) {
+        auto program = try_compile_regex(re, ignore_case);
+        kak_assert(program);
+        return program;
+    };
+    auto matches = [](const CompiledRegex& program, StringView subject) {
+        ThreadedRegexVM<const char*> vm{program};
+        return vm.exec(subject.begin(), subject.end(), true, true, true, true, true);
+    };
+    auto find = [](const CompiledRegex& program, StringView subject) -> Optional<StringView> {
+        ThreadedRegexVM<const char*> vm{program};
+        if (not vm.exec(subject.begin(), subject.end(), false, true, true, true, true))
+            return {};
+        return StringView{vm.captures[0], vm.captures[1]};
+    };
+
+    kak_assert(matches(*compile("foo"), "foo"));
+    kak_assert(not matches(*compile("foo"), "foobar"));
+    kak_assert(*find(*compile("foo"), "qux foo bar") == "foo");
+    kak_assert(not find(*compile("foo"), "qux baz bar"));
+
+    kak_assert(*find(*compile("foo|bar"), "qux bar") == "bar");
+    kak_assert(*find(*compile("a+b?c{2,3}"), "xaaabccz") == "aaabcc");
+    kak_assert(*find(*compile("a+"), "baaa") == "aaa");
+    kak_assert(*find(*compile("a+?"), "baaa") == "a");
+    kak_assert(*find(*compile("a{2,}"), "baaaa") == "aaaa");
+    kak_assert(not find(*compile("a{3}"), "baa"));
+    kak_assert(*find(*compile("a*"), "bcd") == "");
+
+    kak_assert(*find(*compile("[b-d]+"), "abcde") == "bcd");
+    kak_assert(*find(*compile("[^\\d ]+"), "0 foo 1") == "foo");
+    kak_assert(*find(*compile("\\w+\\h\\d"), "== foo 42") == "foo 4");
+    kak_assert(*find(*compile("[-a\\]]+"), "b]a-c") == "]a-");
+
+    kak_assert(matches(*compile("^foo$"), "foo"));
+    kak_assert(*find(*compile("^bar$"), "foo\nbar\nbaz") == "bar");
+    kak_assert(*find(*compile("\\bfoo\\b.*"), "barfoo foo qux") == "foo qux");
+    kak_assert(*find(*compile("\\B.."), "ab cd") == "b ");
+
+    kak_assert(matches(*compile("héhé"), "héhé"));
+    kak_assert(*find(*compile("[é-ê]+"), "aéêb") == "éê");
+    kak_assert(matches(*compile("FoO", true), "fOo"));
+    kak_assert(*find(*compile("[A-Z]+", true), "12ab") == "ab");
+
+    {
+        auto program = compile("(\\w+)@(?:\\w+)\\.(\\w+)?");
+        ThreadedRegexVM<const char*> vm{*program};
+        StringView subject = "mail: user@host.org";
+        kak_assert(vm.exec(subject.begin(), subject.end(), false, true, true, true, true));
+        kak_assert(StringView(vm.captures[2], vm.captures[3]) == "user");
+        kak_assert(StringView(vm.captures[4], vm.captures[5]) == "org");
+    }
+
+    auto prefix = [&](StringView re) {
+        auto program = compile(re);
+        return String{program->prefix.data(), program->prefix.data() + program->prefix.size()};
+    };
+    kak_assert(prefix("foo\\w+") == "foo");
+    kak_assert(prefix("^(TODO|FIXME)") == "");
+    kak_assert(prefix("^éé\\b\\d*") == "éé");
+    kak_assert(prefix("a?bc") == "");
+    kak_assert(*find(*compile("^TODO\\h\\S+"), "x\nTODO fix\n") == "TODO fix");
+
+    // not supported, should fall back on boost
+    kak_assert(not try_compile_regex("(?=foo)", false));
+    kak_assert(not try_compile_regex("(a)\\1", false));
+    kak_assert(not try_compile_regex("[[:alpha:]]", false));
+    kak_assert(not try_compile_regex("foo)", false));
+}};
+
+}
@@ -0,0 +1,323 @@
+#ifndef regex_impl_hh_INCLUDED
+#define regex_impl_hh_INCLUDED
+
+#include "clock.hh"
+#include "flags.hh"
+#include "ref_ptr.hh"
+#include "unicode.hh"
+#include "utf8.hh"
+#include "vector.hh"
+
+#include <algorithm>
+#include <cstring>
+
+namespace Kakoune
+{
+
+class StringView;
+
+// Program for the internal regex engine, executed by ThreadedRegexVM.
+// Instructions either consume a codepoint (Literal, AnyChar, Class),
+// assert something about the current position (LineStart, WordBoundary, ...)
+// or direct the control flow (Jump, Split, Save).
+struct CompiledRegex : RefCountable, UseMemoryDomain<MemoryDomain::Regex>
+{
+    enum Op : char
+    {
+        Match,
+        Literal,
+        LiteralIgnoreCase,
+        AnyChar,
+        Class,
+        Jump,                    // unconditional jump to param
+        Split_PrioritizeParent,  // try next instruction first, param second
+        Split_PrioritizeChild,   // try param first, next instruction second
+        Save,                    // save current position in slot param
+        LineStart,
+        LineEnd,
+        WordBoundary,
+        NotWordBoundary,
+    };
+
+    struct Instruction
+    {
+        Op op;
+        uint32_t param;
+    };
+
+    enum class CharacterType : int
+    {
+        None                 = 0,
+        Word                 = 1 << 0,
+        Whitespace           = 1 << 1,
+        Digit                = 1 << 2,
+        HorizontalWhitespace = 1 << 3,
+    };
+    friend constexpr bool with_bit_ops(Meta::Type<CharacterType>) { return true; }
+
+    struct CharacterClass
+    {
+        struct Range { Codepoint min, max; };
+
+        Vector<Range, MemoryDomain::Regex> ranges;
+        CharacterType ctypes = CharacterType::None;
+        bool negative = false;
+        bool ignore_case = false;
+    };
+
+    Vector<Instruction, MemoryDomain::Regex> instructions;
+    Vector<CharacterClass, MemoryDomain::Regex> classes;
+    uint32_t save_count = 2;
+
+    // utf-8 bytes of the literal every match has to start with (after
+    // eventual zero-width assertions), empty if there is no such literal.
+    // Searching uses it to skip ahead with a substring scan instead of
+    // starting a match attempt at every position.
+    Vector<char, MemoryDomain::Regex> prefix;
+};
+
+// Compile the given regex for ThreadedRegexVM, returns a null pointer if it
+// uses features the internal engine does not support, in which case the
+// caller is expected to fall back on the boost based implementation.
+RefPtr<CompiledRegex> try_compile_regex(StringView re, bool ignore_case);
+
+bool is_ctype(CompiledRegex::CharacterType ctypes, Codepoint cp);
+bool character_class_matches(const CompiledRegex::CharacterClass& cclass, Codepoint cp);
+
+// when no instruction can consume an end of line, every match lies within
+// a single line, which allows splitting a scan at line boundaries.
+bool can_match_eol(const CompiledRegex& program);
+
+// Bound the time the VM spends matching while the budget object is alive,
+// so that interactive searches stay responsive on huge buffers: once the
+// deadline passes, matching calls throw a runtime_error that interactive
+// callers are expected to swallow. The boost fallback cannot be
+// interrupted midway and is not affected.
+struct ScopedRegexTimeBudget
+{
+    ScopedRegexTimeBudget(Clock::duration budget);
+    ~ScopedRegexTimeBudget();
+
+private:
+    TimePoint m_previous_deadline;
+};
+
+void check_regex_deadline();
+
+// find the next occurrence of the program literal prefix, as utf-8 is self
+// synchronizing a byte level scan can only stop at codepoint boundaries.
+template<typename Iterator>
+Iterator find_prefix(const CompiledRegex& program, Iterator pos, Iterator end)
+{
+    return std::search(pos, end, program.prefix.begin(), program.prefix.end());
+}
+
+inline const char* find_prefix(const CompiledRegex& program, const char* pos, const char* end)
+{
+    // contiguous memory gets the vectorized libc scan
+    if (auto* res = memmem(pos, end - pos, program.prefix.data(), program.prefix.size()))
+        return static_cast<const char*>(res);
+    return end;
+}
+
+// Pike VM over utf-8 text: all pending alternatives advance in lock step,
+// one codepoint at a time, so matching time stays linear in the subject
+// size where a backtracking engine can blow up on alternation heavy
+// regexes. Thread priority order preserves the leftmost/greedy semantics
+// of a backtracking implementation.
+template<typename Iterator>
+struct ThreadedRegexVM
+{
+    ThreadedRegexVM(const CompiledRegex& program)
+        : m_program{program} {}
+
+    // positions of the submatch begin/end pairs after a successful exec
+    using Saves = Vector<Iterator, MemoryDomain::Regex>;
+    Saves captures;
+
+    bool exec(Iterator begin, Iterator end, bool match /* whole subject */,
+              bool bol, bool eol, bool bow, bool eow)
+    {
+        m_begin = begin;
+        m_end = end;
+        m_bol = bol;
+        m_eol = eol;
+        m_bow = bow;
+        m_eow = eow;
+
+        const auto inst_count = m_program.instructions.size();
+        Vector<Thread, MemoryDomain::Regex> current, next;
+        bool found_match = false;
+
+        Iterator pos = begin;
+        m_seen.assign(inst_count, false);
+        add_thread(current, 0, Saves(m_program.save_count, end), pos);
+
+        while (true)
+        {
+            Iterator next_pos = pos;
+            const Codepoint cp = pos == end ? -1
+                : utf8::read_codepoint(next_pos, end);
+
+            m_seen.assign(inst_count, false);
+            for (auto& thread : current)
+            {
+                const auto& inst = m_program.instructions[thread.inst];
+                switch (inst.op)
+                {
+                case CompiledRegex::Literal:
+                    if ((Codepoint)inst.param == cp)
+                        add_thread(next, thread.inst + 1, std::move(thread.saves), next_pos);
+                    break;
+                case CompiledRegex::LiteralIgnoreCase:
+                    if (cp != -1 and (Codepoint)inst.param == to_lower(cp))
+                        add_thread(next, thread.inst + 1, std::move(thread.saves), next_pos);
+                    break;
+                case CompiledRegex::AnyChar:
+                    if (cp != -1) // as in boost, '.' does match end of lines
+                        add_thread(next, thread.inst + 1, std::move(thread.saves), next_pos);
+                    break;
+                case CompiledRegex::Class:
+                    if (cp != -1 and character_class_matches(m_program.classes[inst.param], cp))
+                        add_thread(next, thread.inst + 1, std::move(thread.saves), next_pos);
+                    break;
+                case CompiledRegex::Match:
+                    if (match and pos != end)
+                        break;
+                    captures = std::move(thread.saves);
+                    found_match = true;
+                    break;
+                default: // jumps, splits and asserts are resolved by add_thread
+                    kak_assert(false);
+                    break;
+                }
+                if (found_match and inst.op == CompiledRegex::Match)
+                    break; // cut lower priority threads
+            }
+            current.clear();
+            std::swap(current, next);
+
+            if (pos == end)
+                break;
+            pos = next_pos;
+
+            if ((++m_ticks & 1023) == 0)
+                check_regex_deadline();
+
+            // as long as no match was found, a new attempt starting at the
+            // current position gets appended with the lowest priority, which
+            // keeps the first match the leftmost one.
+            if (not match and not found_match)
+            {
+                // without any thread alive the next match can only begin at
+                // the next occurrence of the literal prefix, skip ahead to it
+                // instead of attempting a match at every position.
+                if (current.empty() and not m_program.prefix.empty())
+                {
+                    pos = find_prefix(m_program, pos, end);
+                    if (pos == end)
+                        break;
+                    m_seen.assign(inst_count, false); // marks refer to the old position
+                }
+                add_thread(current, 0, Saves(m_program.save_count, end), pos);
+            }
+            else if (current.empty()) // no pending attempt anymore
+                break;
+        }
+        return found_match;
+    }
+
+private:
+    struct Thread
+    {
+        uint32_t inst;
+        Saves saves;
+    };
+
+    // add a thread for the given instruction, following jumps, splits,
+    // saves and asserts eagerly so that thread lists only ever contain
+    // instructions consuming a codepoint (or Match).
+    void add_thread(Vector<Thread, MemoryDomain::Regex>& list, uint32_t inst,
+                    Saves saves, const Iterator& pos)
+    {
+        if (m_seen[inst])
+            return;
+        m_seen[inst] = true;
+
+        const auto& i = m_program.instructions[inst];
+        switch (i.op)
+        {
+        case CompiledRegex::Jump:
+            add_thread(list, i.param, std::move(saves), pos);
+            break;
+        case CompiledRegex::Split_PrioritizeParent:
+            add_thread(list, inst + 1, saves, pos);
+            add_thread(list, i.param, std::move(saves), pos);
+            break;
+        case CompiledRegex::Split_PrioritizeChild:
+            add_thread(list, i.param, saves, pos);
+            add_thread(list, inst + 1, std::move(saves), pos);
+            break;
+        case CompiledRegex::Save:
+            saves[i.param] = pos;
+            add_thread(list, inst + 1, std::move(saves), pos);
+            break;
+        case CompiledRegex::LineStart:
+            if (is_line_start(pos))
+                add_thread(list, inst + 1, std::move(saves), pos);
+            break;
+        case CompiledRegex::LineEnd:
+            if (is_line_end(pos))
+                add_thread(list, inst + 1, std::move(saves), pos);
+            break;
+        case CompiledRegex::WordBoundary:
+            if (is_word_boundary(pos))
+                add_thread(list, inst + 1, std::move(saves), pos);
+            break;
+        case CompiledRegex::NotWordBoundary:
+            if (not is_word_boundary(pos))
+                add_thread(list, inst + 1, std::move(saves), pos);
+            break;
+        default:
+            list.push_back({inst, std::move(saves)});
+            break;
+        }
+    }
+
+    bool is_line_start(const Iterator& pos) const
+    {
+        if (pos == m_begin)
+            return m_bol;
+        return *utf8::previous(pos, m_begin) == '\n';
+    }
+
+    bool is_line_end(const Iterator& pos) const
+    {
+        if (pos == m_end)
+            return m_eol;
+        return *pos == '\n';
+    }
+
+    bool is_word_boundary(const Iterator& pos) const
+    {
+        const bool prev_word = pos == m_begin ?
+            not m_bow : is_word(utf8::codepoint(utf8::previous(pos, m_begin), m_end));
+        const bool next_word = pos == m_end ?
+            not m_eow : is_word(utf8::codepoint(pos, m_end));
+        return prev_word != next_word;
+    }
+
+    const CompiledRegex& m_program;
+    Vector<bool, MemoryDomain::Regex> m_seen;
+    uint32_t m_ticks = 0;
+    Iterator m_begin{};
+    Iterator m_end{};
+    bool m_bol = true;
+    bool m_eol = true;
+    bool m_bow = true;
+    bool m_eow = true;
+};
+
+}
+
+#endif // regex_impl_hh_INCLUDED
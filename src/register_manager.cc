@@ -2,11 +2,100 @@
 
 #include "assert.hh"
 #include "hash_map.hh"
+#include "option_manager.hh"
+#include "scope.hh"
 #include "string_utils.hh"
 
 namespace Kakoune
 {
 
+Vector<HistoryRegister*, MemoryDomain::Registers> HistoryRegister::ms_instances;
+size_t HistoryRegister::ms_history_bytes = 0;
+size_t HistoryRegister::ms_use_counter = 0;
+
+HistoryRegister::HistoryRegister()
+{
+    ms_instances.push_back(this);
+}
+
+HistoryRegister::~HistoryRegister()
+{
+    for (auto& content : m_history)
+        ms_history_bytes -= content_bytes(content);
+    unordered_erase(ms_instances, this);
+}
+
+void HistoryRegister::set(Context& context, ConstArrayView<String> values)
+{
+    m_last_use = ++ms_use_counter;
+    if (not m_content.empty())
+    {
+        ms_history_bytes += content_bytes(m_content);
+        m_history.push_back(std::move(m_content));
+    }
+    StaticRegister::set(context, values);
+    trim_histories();
+}
+
+ConstArrayView<String> HistoryRegister::get(const Context& context)
+{
+    m_last_use = ++ms_use_counter;
+    return StaticRegister::get(context);
+}
+
+bool HistoryRegister::restore(Context&)
+{
+    if (m_history.empty())
+        return false;
+    ms_history_bytes -= content_bytes(m_history.back());
+    m_content = std::move(m_history.back());
+    m_history.pop_back();
+    m_last_use = ++ms_use_counter;
+    return true;
+}
+
+void HistoryRegister::drop_oldest()
+{
+    ms_history_bytes -= content_bytes(m_history.front());
+    m_history.erase(m_history.begin());
+}
+
+size_t HistoryRegister::content_bytes(ConstArrayView<String> content)
+{
+    size_t bytes = 0;
+    for (auto& str : content)
+        bytes += (size_t)(int)str.length();
+    return bytes;
+}
+
+void HistoryRegister::trim_histories()
+{
+    static const TypedOptionId<int> depth_id{"register_history_depth"};
+    static const TypedOptionId<int> size_id{"register_history_size"};
+    auto& options = GlobalScope::instance().options();
+    const size_t depth = (size_t)std::max(0, options.get(depth_id));
+    const size_t byte_budget = (size_t)std::max(0, options.get(size_id));
+
+    for (auto* reg : ms_instances)
+    {
+        while (reg->m_history.size() > depth)
+            reg->drop_oldest();
+    }
+    while (ms_history_bytes > byte_budget)
+    {
+        HistoryRegister* lru = nullptr;
+        for (auto* reg : ms_instances)
+        {
+            if (not reg->m_history.empty() and
+                (not lru or reg->m_last_use < lru->m_last_use))
+                lru = reg;
+        }
+        if (not lru)
+            break;
+        lru->drop_oldest();
+    }
+}
+
 Register& RegisterManager::operator[](StringView reg) const
 {
     if (reg.length() == 1)
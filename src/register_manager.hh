@@ -20,6 +20,10 @@ public:
 
     virtual void set(Context& context, ConstArrayView<String> values) = 0;
     virtual ConstArrayView<String> get(const Context& context) = 0;
+
+    // discard the current value and bring back the one the last set
+    // replaced, if the register keeps a history of its values
+    virtual bool restore(Context& context) { return false; }
 };
 
 // static value register, which can be modified
@@ -43,6 +47,36 @@ protected:
     Vector<String, MemoryDomain::Registers> m_content;
 };
 
+// assignable register that keeps a bounded history of its previous
+// values, so a clobbered yank can be recovered with restore-register.
+// The history depth is capped per register and the memory all register
+// histories may use is capped globally, the least recently used
+// registers giving their oldest values up first.
+class HistoryRegister : public StaticRegister
+{
+public:
+    HistoryRegister();
+    ~HistoryRegister() override;
+
+    void set(Context& context, ConstArrayView<String> values) override;
+    ConstArrayView<String> get(const Context& context) override;
+    bool restore(Context& context) override;
+
+private:
+    using Content = Vector<String, MemoryDomain::Registers>;
+
+    void drop_oldest();
+    static void trim_histories();
+    static size_t content_bytes(ConstArrayView<String> content);
+
+    Vector<Content, MemoryDomain::Registers> m_history;
+    size_t m_last_use = 0;
+
+    static Vector<HistoryRegister*, MemoryDomain::Registers> ms_instances;
+    static size_t ms_history_bytes;
+    static size_t ms_use_counter;
+};
+
 // Dynamic value register, use it's RegisterRetriever
 // to get it's value when needed.
 template<typename Getter, typename Setter>
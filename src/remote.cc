@@ -1,5 +1,6 @@
 #include "remote.hh"
 
+#include "benchmark.hh"
 #include "buffer_manager.hh"
 #include "buffer_utils.hh"
 #include "client_manager.hh"
@@ -9,10 +10,15 @@
 #include "file.hh"
 #include "hash_map.hh"
 #include "optional.hh"
+#include "unit_tests.hh"
 #include "user_interface.hh"
 
+#include <atomic>
+
 #include <sys/types.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/un.h>
 #include <sys/wait.h>
 #include <unistd.h>
@@ -29,19 +35,141 @@ enum class MessageType : uint8_t
     Connect,
     Command,
     MenuShow,
+    MenuFilter,
     MenuSelect,
     MenuHide,
     InfoShow,
     InfoHide,
     Draw,
+    DrawPartial,
     DrawStatus,
     SetCursor,
     Refresh,
     SetOptions,
     Exit,
     Key,
+    SharedMemoryFrame,
+    Compressed,
 };
 
+// Draw messages are large and highly repetitive (atom faces, indentation,
+// recurring words); when the socket is likely forwarded over a thin link
+// each message is wrapped into a Compressed envelope. The codec is a
+// small self-contained LZ77 with an LZ4-style token layout: sequences of
+// literals followed by a 16bit backreference, lengths extended by 255
+// bytes, the decompressed size stored up front.
+static RemoteBuffer compress_block(const char* data, uint32_t size)
+{
+    RemoteBuffer out;
+    out.reserve(size / 2 + 16);
+    out.insert(out.end(), (const char*)&size, (const char*)&size + sizeof(uint32_t));
+
+    constexpr uint32_t min_match = 4;
+    constexpr int table_bits = 12;
+    int table[1 << table_bits];
+    std::fill(std::begin(table), std::end(table), -1);
+
+    auto load32 = [&](uint32_t pos) {
+        uint32_t res;
+        memcpy(&res, data + pos, sizeof(uint32_t));
+        return res;
+    };
+    auto hash = [](uint32_t val) { return (val * 2654435761u) >> (32 - table_bits); };
+    auto emit_length = [&](uint32_t len) {
+        while (len >= 255) { out.push_back((char)255); len -= 255; }
+        out.push_back((char)len);
+    };
+    auto emit_sequence = [&](uint32_t anchor, uint32_t literals,
+                             uint32_t match_len, uint32_t offset) {
+        const uint32_t encoded = match_len == 0 ? 0 : match_len - min_match;
+        out.push_back((char)((std::min(literals, 15u) << 4) | std::min(encoded, 15u)));
+        if (literals >= 15)
+            emit_length(literals - 15);
+        out.insert(out.end(), data + anchor, data + anchor + literals);
+        if (match_len != 0)
+        {
+            out.push_back((char)(offset & 0xff));
+            out.push_back((char)(offset >> 8));
+            if (encoded >= 15)
+                emit_length(encoded - 15);
+        }
+    };
+
+    uint32_t pos = 0, anchor = 0;
+    while (pos + min_match <= size)
+    {
+        const uint32_t h = hash(load32(pos));
+        const int candidate = table[h];
+        table[h] = (int)pos;
+        if (candidate < 0 or pos - (uint32_t)candidate > 65535 or
+            load32((uint32_t)candidate) != load32(pos))
+        {
+            ++pos;
+            continue;
+        }
+
+        uint32_t len = min_match;
+        while (pos + len < size and data[candidate + len] == data[pos + len])
+            ++len;
+        emit_sequence(anchor, pos - anchor, len, pos - (uint32_t)candidate);
+        pos += len;
+        anchor = pos;
+    }
+    emit_sequence(anchor, size - anchor, 0, 0);
+    return out;
+}
+
+static RemoteBuffer decompress_block(const char* data, uint32_t size)
+{
+    if (size < sizeof(uint32_t))
+        throw disconnected{"corrupted compressed message"};
+    uint32_t out_size;
+    memcpy(&out_size, data, sizeof(uint32_t));
+
+    RemoteBuffer out;
+    out.reserve(out_size);
+    uint32_t pos = sizeof(uint32_t);
+    auto read_length = [&](uint32_t base) {
+        uint32_t len = base;
+        if (base == 15)
+        {
+            uint8_t byte;
+            do {
+                if (pos >= size)
+                    throw disconnected{"corrupted compressed message"};
+                byte = (uint8_t)data[pos++];
+                len += byte;
+            } while (byte == 255);
+        }
+        return len;
+    };
+
+    while (pos < size)
+    {
+        const uint8_t token = (uint8_t)data[pos++];
+        const uint32_t literals = read_length(token >> 4);
+        if (pos + literals > size)
+            throw disconnected{"corrupted compressed message"};
+        out.insert(out.end(), data + pos, data + pos + literals);
+        pos += literals;
+        if (pos >= size) // final sequence has no match
+            break;
+
+        if (pos + 2 > size)
+            throw disconnected{"corrupted compressed message"};
+        const uint32_t offset = (uint8_t)data[pos] | ((uint32_t)(uint8_t)data[pos+1] << 8);
+        pos += 2;
+        const uint32_t match_len = read_length(token & 15) + 4;
+        if (offset == 0 or offset > out.size())
+            throw disconnected{"corrupted compressed message"};
+        for (uint32_t i = 0; i < match_len; ++i) // may overlap, copy per byte
+            out.push_back(out[out.size() - offset]);
+    }
+    if (out.size() != out_size)
+        throw disconnected{"corrupted compressed message"};
+    return out;
+}
+
 class MsgWriter
 {
 public:
@@ -94,6 +222,12 @@ public:
         write(ConstArrayView<T>(vec));
     }
 
+    template<typename T, size_t N, MemoryDomain domain>
+    void write(const InlineVector<T, N, domain>& vec)
+    {
+        write(ConstArrayView<T>(vec));
+    }
+
     template<typename Key, typename Val, MemoryDomain domain>
     void write(const HashMap<Key, Val, domain>& map)
     {
@@ -163,6 +297,16 @@ public:
         }
         else
             read_from_socket(sock, size() - m_write_pos);
+
+        // a compressed envelope holds exactly one message, unwrap it so
+        // callers never see the envelope
+        if (ready() and type() == MessageType::Compressed)
+        {
+            m_stream = decompress_block(m_stream.data() + header_size,
+                                        (uint32_t)m_stream.size() - header_size);
+            m_write_pos = (uint32_t)m_stream.size();
+            m_read_pos = header_size;
+        }
     }
 
     bool ready() const
@@ -247,11 +391,20 @@ public:
         m_read_pos = header_size;
     }
 
+    void fill(RemoteBuffer content)
+    {
+        m_stream = std::move(content);
+        m_write_pos = (uint32_t)m_stream.size();
+        m_read_pos = header_size;
+    }
+
 private:
     void read_from_socket(int sock, size_t size)
     {
         kak_assert(m_write_pos + size <= m_stream.size());
         int res = ::read(sock, m_stream.data() + m_write_pos, size);
+        if (res == -1 and (errno == EAGAIN or errno == EWOULDBLOCK))
+            return;
         if (res <= 0)
             throw disconnected{format("socket read failed: {}", strerror(errno))};
         m_write_pos += res;
@@ -301,7 +454,12 @@ DisplayAtom MsgReader::read<DisplayAtom>()
 template<>
 DisplayLine MsgReader::read<DisplayLine>()
 {
-    return DisplayLine(read_vector<DisplayAtom>());
+    uint32_t size = read<uint32_t>();
+    AtomList atoms;
+    atoms.reserve(size);
+    while (size--)
+        atoms.push_back(read<DisplayAtom>());
+    return DisplayLine(std::move(atoms));
 }
 
 template<>
@@ -313,10 +471,84 @@ DisplayBuffer MsgReader::read<DisplayBuffer>()
 }
 
 
+// When the user interface runs on the same machine as the server, draw
+// frames go through a shared memory ring created by the client and mapped
+// by the server on connect; the socket then only carries a small frame
+// notification instead of every atom string, face and coordinate.
+struct ShmRing
+{
+    static constexpr uint32_t capacity = 1024 * 1024;
+
+    std::atomic<uint32_t> read_pos;
+    std::atomic<uint32_t> write_pos;
+    char data[capacity];
+
+    // Positions run freely and are reduced modulo capacity on access,
+    // which distinguishes a full ring from an empty one.
+    bool push(const RemoteBuffer& content)
+    {
+        const uint32_t read = read_pos.load(std::memory_order_acquire);
+        uint32_t write = write_pos.load(std::memory_order_relaxed);
+        const uint32_t size = (uint32_t)content.size();
+        if (capacity - (write - read) < size + sizeof(uint32_t))
+            return false;
+
+        auto put = [&, this](const char* bytes, uint32_t count) {
+            while (count > 0)
+            {
+                const uint32_t pos = write % capacity;
+                const uint32_t contiguous = std::min(count, capacity - pos);
+                memcpy(data + pos, bytes, contiguous);
+                bytes += contiguous;
+                write += contiguous;
+                count -= contiguous;
+            }
+        };
+        put((const char*)&size, sizeof(uint32_t));
+        put(content.data(), size);
+        write_pos.store(write, std::memory_order_release);
+        return true;
+    }
+
+    RemoteBuffer pop()
+    {
+        uint32_t read = read_pos.load(std::memory_order_relaxed);
+        const uint32_t write = write_pos.load(std::memory_order_acquire);
+
+        auto get = [&, this](char* bytes, uint32_t count) {
+            if (write - read < count)
+                throw disconnected{"truncated shared memory frame"};
+            while (count > 0)
+            {
+                const uint32_t pos = read % capacity;
+                const uint32_t contiguous = std::min(count, capacity - pos);
+                memcpy(bytes, data + pos, contiguous);
+                bytes += contiguous;
+                read += contiguous;
+                count -= contiguous;
+            }
+        };
+        uint32_t size;
+        get((char*)&size, sizeof(uint32_t));
+        RemoteBuffer res;
+        res.resize(size);
+        get(res.data(), size);
+        read_pos.store(read, std::memory_order_release);
+        return res;
+    }
+};
+
+static ShmRing* map_shm_ring(int fd)
+{
+    void* mem = mmap(nullptr, sizeof(ShmRing), PROT_READ | PROT_WRITE,
+                     MAP_SHARED, fd, 0);
+    return mem == MAP_FAILED ? nullptr : static_cast<ShmRing*>(mem);
+}
+
 class RemoteUI : public UserInterface
 {
 public:
-    RemoteUI(int socket, DisplayCoord dimensions);
+    RemoteUI(int socket, DisplayCoord dimensions, Optional<String> shm_name);
     ~RemoteUI() override;
 
     void menu_show(ConstArrayView<DisplayLine> choices,
@@ -334,6 +566,10 @@ public:
               const Face& default_face,
               const Face& padding_face) override;
 
+    void draw_partial(ConstArrayView<DisplayLine> lines,
+                      LineCount first_row,
+                      const Face& default_face) override;
+
     void draw_status(const DisplayLine& status_line,
                      const DisplayLine& mode_line,
                      const Face& default_face) override;
@@ -360,30 +596,61 @@ private:
     DisplayCoord  m_dimensions;
     OnKeyCallback m_on_key;
     RemoteBuffer  m_send_buffer;
+    ShmRing*      m_shm = nullptr;
+    bool          m_compress = false;
+    RemoteBuffer  m_scratch;
+    Optional<uint32_t> m_queued_draw_pos;
+    uint32_t      m_queued_draw_size = 0;
+    Vector<DisplayLine> m_menu_choices; // last full menu transmitted
+    HashMap<String, int, MemoryDomain::Remote> m_menu_index;
+
+    template<typename WriteBody>
+    void send_message(MessageType type, WriteBody&& write_body);
+    void enqueue_message(const RemoteBuffer& msg, bool supersedable);
+    void queue_draw_frame(const RemoteBuffer& frame);
 
     SafePtr<Client> m_client;
 };
 
 static bool send_data(int fd, RemoteBuffer& buffer)
 {
-    while (not buffer.empty() and fd_writable(fd))
+    // Flush as much of the accumulated messages as the socket accepts in
+    // one write per iteration, and compact the buffer only once at the
+    // end instead of shifting the remaining bytes after every write.
+    size_t sent = 0;
+    while (sent < buffer.size() and fd_writable(fd))
     {
-      int res = ::write(fd, buffer.data(), buffer.size());
+      int res = ::write(fd, buffer.data() + sent, buffer.size() - sent);
+      if (res == -1 and (errno == EAGAIN or errno == EWOULDBLOCK))
+          break;
       if (res <= 0)
           throw disconnected{format("socket write failed: {}", strerror(errno))};
-      buffer.erase(buffer.begin(), buffer.begin() + res);
+      sent += res;
     }
+    buffer.erase(buffer.begin(), buffer.begin() + sent);
     return buffer.empty();
 }
 
-RemoteUI::RemoteUI(int socket, DisplayCoord dimensions)
+RemoteUI::RemoteUI(int socket, DisplayCoord dimensions, Optional<String> shm_name)
     : m_socket_watcher(socket,  FdEvents::Read | FdEvents::Write,
                        [this](FDWatcher& watcher, FdEvents events, EventMode mode) {
           const int sock = watcher.fd();
           try
           {
-              if (events & FdEvents::Write and send_data(sock, m_send_buffer))
-                  m_socket_watcher.events() &= ~FdEvents::Write;
+              if (events & FdEvents::Write)
+              {
+                  const size_t previous = m_send_buffer.size();
+                  if (send_data(sock, m_send_buffer))
+                      m_socket_watcher.events() &= ~FdEvents::Write;
+                  const size_t flushed = previous - m_send_buffer.size();
+                  if (flushed != 0 and m_queued_draw_pos)
+                  {
+                      if (*m_queued_draw_pos < flushed) // frame is (partially) on the wire
+                          m_queued_draw_pos.reset();
+                      else
+                          *m_queued_draw_pos -= flushed;
+                  }
+              }
 
               while (events & FdEvents::Read and fd_readable(sock))
               {
@@ -413,6 +680,26 @@ RemoteUI::RemoteUI(int socket, DisplayCoord dimensions)
       }),
       m_dimensions(dimensions)
 {
+    // never block the server event loop on a client that cannot keep up
+    fcntl(socket, F_SETFL, fcntl(socket, F_GETFL, 0) | O_NONBLOCK);
+
+    if (shm_name)
+    {
+        const int fd = shm_open(shm_name->c_str(), O_RDWR, 0600);
+        if (fd != -1)
+        {
+            auto close_fd = on_scope_end([fd]{ close(fd); });
+            m_shm = map_shm_ring(fd);
+            // both sides hold a mapping now, the name is not needed anymore
+            shm_unlink(shm_name->c_str());
+        }
+        if (not m_shm)
+            write_to_debug_buffer(format("unable to map shared memory region '{}': {}",
+                                         *shm_name, strerror(errno)));
+    }
+    // no shared memory means the socket is probably forwarded over a thin
+    // link, trade some cpu for bandwidth
+    m_compress = not m_shm;
     write_to_debug_buffer(format("remote client connected: {}", m_socket_watcher.fd()));
 }
 
@@ -427,104 +714,252 @@ RemoteUI::~RemoteUI()
     {
     }
 
+    if (m_shm)
+        munmap(m_shm, sizeof(ShmRing));
+
     write_to_debug_buffer(format("remote client disconnected: {}", m_socket_watcher.fd()));
     m_socket_watcher.close_fd();
 }
 
+template<typename WriteBody>
+void RemoteUI::send_message(MessageType type, WriteBody&& write_body)
+{
+    m_scratch.clear();
+    {
+        MsgWriter msg{m_scratch, type};
+        write_body(msg);
+    }
+    enqueue_message(m_scratch, type == MessageType::Draw);
+}
+
+void RemoteUI::enqueue_message(const RemoteBuffer& msg, bool supersedable)
+{
+    const RemoteBuffer* bytes = &msg;
+    RemoteBuffer envelope;
+    if (m_compress)
+    {
+        auto compressed = compress_block(msg.data(), (uint32_t)msg.size());
+        if (compressed.size() < msg.size()) // only wrap when it helps
+        {
+            MsgWriter env{envelope, MessageType::Compressed};
+            env.write(compressed.data(), compressed.size());
+        }
+    }
+    if (not envelope.empty())
+        bytes = &envelope;
+
+    if (supersedable)
+        queue_draw_frame(*bytes);
+    else
+        m_send_buffer.insert(m_send_buffer.end(), bytes->begin(), bytes->end());
+    m_socket_watcher.events() |= FdEvents::Write;
+}
+
+static String menu_item_text(const DisplayLine& line)
+{
+    String res;
+    for (auto& atom : line.atoms())
+        res += atom.content();
+    return res;
+}
+
 void RemoteUI::menu_show(ConstArrayView<DisplayLine> choices,
                          DisplayCoord anchor, Face fg, Face bg,
                          MenuStyle style)
 {
-    MsgWriter msg{m_send_buffer, MessageType::MenuShow};
-    msg.write(choices);
-    msg.write(anchor);
-    msg.write(fg);
-    msg.write(bg);
-    msg.write(style);
-    m_socket_watcher.events() |= FdEvents::Write;
+    // refiltering a menu while the user types keeps a subset of the
+    // choices already on the client; send indices into the last full
+    // list transmitted instead of retransmitting every choice
+    auto same_line = [](const DisplayLine& lhs, const DisplayLine& rhs) {
+        return lhs.atoms().size() == rhs.atoms().size() and
+               std::equal(lhs.atoms().begin(), lhs.atoms().end(), rhs.atoms().begin(),
+                          [](const DisplayAtom& a, const DisplayAtom& b) {
+                              return a.content() == b.content() and a.face == b.face;
+                          });
+    };
+
+    if (not m_menu_choices.empty())
+    {
+        Vector<int> indices;
+        indices.reserve(choices.size());
+        for (auto& choice : choices)
+        {
+            auto it = m_menu_index.find(menu_item_text(choice));
+            if (it == m_menu_index.end() or
+                not same_line(m_menu_choices[it->value], choice))
+                break;
+            indices.push_back(it->value);
+        }
+        if (indices.size() == choices.size())
+        {
+            send_message(MessageType::MenuFilter, [&](MsgWriter& msg) {
+                msg.write(ConstArrayView<int>(indices));
+                msg.write(anchor);
+                msg.write(fg);
+                msg.write(bg);
+                msg.write(style);
+            });
+            return;
+        }
+    }
+
+    m_menu_choices = Vector<DisplayLine>{choices.begin(), choices.end()};
+    m_menu_index.clear();
+    for (int i = 0; i < (int)m_menu_choices.size(); ++i)
+        m_menu_index.insert({menu_item_text(m_menu_choices[i]), i});
+
+    send_message(MessageType::MenuShow, [&](MsgWriter& msg) {
+        msg.write(choices);
+        msg.write(anchor);
+        msg.write(fg);
+        msg.write(bg);
+        msg.write(style);
+    });
 }
 
 void RemoteUI::menu_select(int selected)
 {
-    MsgWriter msg{m_send_buffer, MessageType::MenuSelect};
-    msg.write(selected);
-    m_socket_watcher.events() |= FdEvents::Write;
+    send_message(MessageType::MenuSelect, [&](MsgWriter& msg) {
+        msg.write(selected);
+    });
 }
 
 void RemoteUI::menu_hide()
 {
-    MsgWriter msg{m_send_buffer, MessageType::MenuHide};
-    m_socket_watcher.events() |= FdEvents::Write;
+    send_message(MessageType::MenuHide, [](MsgWriter&) {});
 }
 
 void RemoteUI::info_show(StringView title, StringView content,
                          DisplayCoord anchor, Face face,
                          InfoStyle style)
 {
-    MsgWriter msg{m_send_buffer, MessageType::InfoShow};
-    msg.write(title);
-    msg.write(content);
-    msg.write(anchor);
-    msg.write(face);
-    msg.write(style);
-    m_socket_watcher.events() |= FdEvents::Write;
+    send_message(MessageType::InfoShow, [&](MsgWriter& msg) {
+        msg.write(title);
+        msg.write(content);
+        msg.write(anchor);
+        msg.write(face);
+        msg.write(style);
+    });
 }
 
 void RemoteUI::info_hide()
 {
-    MsgWriter msg{m_send_buffer, MessageType::InfoHide};
-    m_socket_watcher.events() |= FdEvents::Write;
+    send_message(MessageType::InfoHide, [](MsgWriter&) {});
+}
+
+// Clients attached to the same buffer with matching viewports, dimensions
+// and faces produce byte-identical frames; remember the last serialized
+// one so that a broadcast to n clients serializes once and reuses the
+// bytes for every client whose frame coincides.
+static const RemoteBuffer& serialized_draw_frame(const DisplayBuffer& display_buffer,
+                                                 const Face& default_face,
+                                                 const Face& padding_face)
+{
+    static size_t cached_key = 0;
+    static RemoteBuffer cached_frame;
+
+    size_t key = hash_values(default_face, padding_face);
+    for (auto& line : display_buffer.lines())
+    {
+        for (auto& atom : line.atoms())
+            key = combine_hash(key, hash_values(atom.content(), atom.face));
+        key = combine_hash(key, 0x1f); // do not conflate line splits
+    }
+
+    if (key != cached_key or cached_frame.empty())
+    {
+        cached_frame.clear();
+        MsgWriter msg{cached_frame, MessageType::Draw};
+        msg.write(display_buffer);
+        msg.write(default_face);
+        msg.write(padding_face);
+        cached_key = key;
+    }
+    return cached_frame;
+}
+
+// A draw frame still queued when the next one arrives is superseded by
+// it; dropping it bounds the send buffer of a client that cannot keep
+// up with the session, so one slow consumer never stalls the others.
+void RemoteUI::queue_draw_frame(const RemoteBuffer& frame)
+{
+    if (m_queued_draw_pos)
+    {
+        m_send_buffer.erase(m_send_buffer.begin() + *m_queued_draw_pos,
+                            m_send_buffer.begin() + *m_queued_draw_pos + m_queued_draw_size);
+        m_queued_draw_pos.reset();
+    }
+    m_queued_draw_pos = (uint32_t)m_send_buffer.size();
+    m_queued_draw_size = (uint32_t)frame.size();
+    m_send_buffer.insert(m_send_buffer.end(), frame.begin(), frame.end());
 }
 
 void RemoteUI::draw(const DisplayBuffer& display_buffer,
                     const Face& default_face,
                     const Face& padding_face)
 {
-    MsgWriter msg{m_send_buffer, MessageType::Draw};
-    msg.write(display_buffer);
-    msg.write(default_face);
-    msg.write(padding_face);
-    m_socket_watcher.events() |= FdEvents::Write;
+    const RemoteBuffer& frame = serialized_draw_frame(display_buffer,
+                                                      default_face, padding_face);
+    if (m_shm and m_shm->push(frame))
+    {
+        MsgWriter msg{m_send_buffer, MessageType::SharedMemoryFrame};
+        m_socket_watcher.events() |= FdEvents::Write;
+    }
+    else // no shared memory, or the ring is full: use the socket
+        enqueue_message(frame, true);
+}
+
+// partial frames are small and precede the full frame they announce, so
+// unlike draw frames they are never superseded in the send queue
+void RemoteUI::draw_partial(ConstArrayView<DisplayLine> lines,
+                            LineCount first_row,
+                            const Face& default_face)
+{
+    send_message(MessageType::DrawPartial, [&](MsgWriter& msg) {
+        msg.write(lines);
+        msg.write(first_row);
+        msg.write(default_face);
+    });
 }
 
 void RemoteUI::draw_status(const DisplayLine& status_line,
                            const DisplayLine& mode_line,
                            const Face& default_face)
 {
-    MsgWriter msg{m_send_buffer, MessageType::DrawStatus};
-    msg.write(status_line);
-    msg.write(mode_line);
-    msg.write(default_face);
-    m_socket_watcher.events() |= FdEvents::Write;
+    send_message(MessageType::DrawStatus, [&](MsgWriter& msg) {
+        msg.write(status_line);
+        msg.write(mode_line);
+        msg.write(default_face);
+    });
 }
 
 void RemoteUI::set_cursor(CursorMode mode, DisplayCoord coord)
 {
-    MsgWriter msg{m_send_buffer, MessageType::SetCursor};
-    msg.write(mode);
-    msg.write(coord);
-    m_socket_watcher.events() |= FdEvents::Write;
+    send_message(MessageType::SetCursor, [&](MsgWriter& msg) {
+        msg.write(mode);
+        msg.write(coord);
+    });
 }
 
 void RemoteUI::refresh(bool force)
 {
-    MsgWriter msg{m_send_buffer, MessageType::Refresh};
-    msg.write(force);
-    m_socket_watcher.events() |= FdEvents::Write;
+    send_message(MessageType::Refresh, [&](MsgWriter& msg) {
+        msg.write(force);
+    });
 }
 
 void RemoteUI::set_ui_options(const Options& options)
 {
-    MsgWriter msg{m_send_buffer, MessageType::SetOptions};
-    msg.write(options);
-    m_socket_watcher.events() |= FdEvents::Write;
+    send_message(MessageType::SetOptions, [&](MsgWriter& msg) {
+        msg.write(options);
+    });
 }
 
 void RemoteUI::exit(int status)
 {
-    MsgWriter msg{m_send_buffer, MessageType::Exit};
-    msg.write(status);
-    m_socket_watcher.events() |= FdEvents::Write;
+    send_message(MessageType::Exit, [&](MsgWriter& msg) {
+        msg.write(status);
+    });
 }
 
 static sockaddr_un session_addr(StringView session)
@@ -557,6 +992,92 @@ bool check_session(StringView session)
     return connect(sock, (sockaddr*)&addr, sizeof(addr.sun_path)) != -1;
 }
 
+static volatile sig_atomic_t spawn_requests_terminated = 0;
+
+int accept_spawn_requests(StringView session, String& spawned_session)
+{
+    int listen_sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    fcntl(listen_sock, F_SETFD, FD_CLOEXEC);
+    sockaddr_un addr = session_addr(session);
+
+    // set sticky bit on the shared kakoune directory
+    make_directory(format("{}/kakoune", tmpdir()), 01777);
+    make_directory(split_path(addr.sun_path).first, 0711);
+
+    // Do not give any access to the socket to other users by default
+    auto old_mask = umask(0077);
+    auto restore_mask = on_scope_end([old_mask]() { umask(old_mask); });
+
+    if (bind(listen_sock, (sockaddr*) &addr, sizeof(sockaddr_un)) == -1)
+        throw runtime_error(format("unable to bind listen socket '{}': {}",
+                                   addr.sun_path, strerror(errno)));
+
+    if (listen(listen_sock, 4) == -1)
+        throw runtime_error(format("unable to listen on socket '{}': {}",
+                                   addr.sun_path, strerror(errno)));
+
+    // accept must be interruptible by SIGTERM here, so install a non
+    // restarting handler rather than going through set_signal_handler
+    struct sigaction action{}, old_action{};
+    action.sa_handler = [](int) { spawn_requests_terminated = 1; };
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGTERM, &action, &old_action);
+
+    while (not spawn_requests_terminated)
+    {
+        sockaddr_un client_addr;
+        socklen_t client_addr_len = sizeof(sockaddr_un);
+        int sock = accept(listen_sock, (sockaddr*) &client_addr,
+                          &client_addr_len);
+        if (sock == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            throw runtime_error(format("accept failed: {}", strerror(errno)));
+        }
+        fcntl(sock, F_SETFD, FD_CLOEXEC);
+
+        String name;
+        char c;
+        while (read(sock, &c, 1) == 1 and c != '\n')
+            name += c;
+
+        if (name.empty() or find(name, '/') != name.end() or
+            fork() != 0)
+        {
+            close(sock);
+            while (waitpid(-1, nullptr, WNOHANG) > 0) {}
+        }
+        else
+        {
+            close(listen_sock);
+            sigaction(SIGTERM, &old_action, nullptr);
+            spawned_session = std::move(name);
+            return sock;
+        }
+    }
+    close(listen_sock);
+    unlink(addr.sun_path);
+    return -1;
+}
+
+String spawn_from_template(StringView session)
+{
+    const int sock = connect_to(session);
+    auto close_sock = on_scope_end([sock]{ close(sock); });
+
+    String name = to_string(getpid());
+    const String request = name + "\n";
+    if (::write(sock, request.data(), (size_t)(int)request.length()) !=
+        (ssize_t)(int)request.length())
+        throw disconnected(format("unable to send spawn request to session {}", session));
+
+    char ack;
+    if (read(sock, &ack, 1) != 1)
+        throw disconnected(format("template session {} did not answer the spawn request", session));
+    return name;
+}
+
 RemoteClient::RemoteClient(StringView session, std::unique_ptr<UserInterface>&& ui,
                            int pid, const EnvVarMap& env_vars, StringView init_command,
                            Optional<BufferCoord> init_coord)
@@ -564,6 +1085,29 @@ RemoteClient::RemoteClient(StringView session, std::unique_ptr<UserInterface>&&
 {
     int sock = connect_to(session);
 
+    // The server always runs on this machine, offer it a shared memory
+    // ring so that draw frames do not have to go through the socket.
+    Optional<String> shm_name;
+    {
+        auto name = format("/kakoune-{}", getpid());
+        const int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+        if (fd != -1)
+        {
+            auto close_fd = on_scope_end([fd]{ close(fd); });
+            if (ftruncate(fd, sizeof(ShmRing)) != -1)
+                m_shm = map_shm_ring(fd);
+            if (m_shm)
+            {
+                m_shm->read_pos.store(0, std::memory_order_relaxed);
+                m_shm->write_pos.store(0, std::memory_order_relaxed);
+                m_shm_name = std::move(name);
+                shm_name = m_shm_name;
+            }
+            else
+                shm_unlink(name.c_str());
+        }
+    }
+
     {
         MsgWriter msg{m_send_buffer, MessageType::Connect};
         msg.write(pid);
@@ -571,6 +1115,7 @@ RemoteClient::RemoteClient(StringView session, std::unique_ptr<UserInterface>&&
         msg.write(init_coord);
         msg.write(m_ui->dimensions());
         msg.write(env_vars);
+        msg.write(shm_name);
     }
 
     m_ui->set_on_key([this](Key key){
@@ -581,7 +1126,8 @@ RemoteClient::RemoteClient(StringView session, std::unique_ptr<UserInterface>&&
 
     MsgReader reader;
     m_socket_watcher.reset(new FDWatcher{sock, FdEvents::Read | FdEvents::Write,
-                           [this, reader](FDWatcher& watcher, FdEvents events, EventMode) mutable {
+                           [this, reader, menu_choices = Vector<DisplayLine>{}]
+                           (FDWatcher& watcher, FdEvents events, EventMode) mutable {
         const int sock = watcher.fd();
         if (events & FdEvents::Write and send_data(sock, m_send_buffer))
             m_socket_watcher->events() &= ~FdEvents::Write;
@@ -599,11 +1145,30 @@ RemoteClient::RemoteClient(StringView session, std::unique_ptr<UserInterface>&&
             {
             case MessageType::MenuShow:
             {
-                auto choices = reader.read_vector<DisplayLine>();
+                menu_choices = reader.read_vector<DisplayLine>();
                 auto anchor = reader.read<DisplayCoord>();
                 auto fg = reader.read<Face>();
                 auto bg = reader.read<Face>();
                 auto style = reader.read<MenuStyle>();
+                m_ui->menu_show(menu_choices, anchor, fg, bg, style);
+                break;
+            }
+            case MessageType::MenuFilter:
+            {
+                // subset of the last full menu, as indices into it
+                auto indices = reader.read_vector<int>();
+                auto anchor = reader.read<DisplayCoord>();
+                auto fg = reader.read<Face>();
+                auto bg = reader.read<Face>();
+                auto style = reader.read<MenuStyle>();
+                Vector<DisplayLine> choices;
+                choices.reserve(indices.size());
+                for (int idx : indices)
+                {
+                    if (idx < 0 or (size_t)idx >= menu_choices.size())
+                        throw disconnected{"invalid menu filter index"};
+                    choices.push_back(menu_choices[idx]);
+                }
                 m_ui->menu_show(choices, anchor, fg, bg, style);
                 break;
             }
@@ -634,6 +1199,14 @@ RemoteClient::RemoteClient(StringView session, std::unique_ptr<UserInterface>&&
                 m_ui->draw(display_buffer, default_face, padding_face);
                 break;
             }
+            case MessageType::DrawPartial:
+            {
+                auto lines = reader.read_vector<DisplayLine>();
+                auto first_row = reader.read<LineCount>();
+                auto default_face = reader.read<Face>();
+                m_ui->draw_partial(lines, first_row, default_face);
+                break;
+            }
             case MessageType::DrawStatus:
             {
                 auto status_line = reader.read<DisplayLine>();
@@ -649,6 +1222,19 @@ RemoteClient::RemoteClient(StringView session, std::unique_ptr<UserInterface>&&
                 m_ui->set_cursor(mode, coord);
                 break;
             }
+            case MessageType::SharedMemoryFrame:
+            {
+                if (not m_shm)
+                    throw disconnected{"unexpected shared memory frame"};
+                MsgReader frame_reader;
+                frame_reader.fill(m_shm->pop());
+                kak_assert(frame_reader.type() == MessageType::Draw);
+                auto display_buffer = frame_reader.read<DisplayBuffer>();
+                auto default_face = frame_reader.read<Face>();
+                auto padding_face = frame_reader.read<Face>();
+                m_ui->draw(display_buffer, default_face, padding_face);
+                break;
+            }
             case MessageType::Refresh:
                 m_ui->refresh(reader.read<bool>());
                 break;
@@ -667,6 +1253,15 @@ RemoteClient::RemoteClient(StringView session, std::unique_ptr<UserInterface>&&
     }});
 }
 
+RemoteClient::~RemoteClient()
+{
+    if (m_shm)
+    {
+        munmap(m_shm, sizeof(ShmRing));
+        shm_unlink(m_shm_name.c_str()); // noop if the server unlinked it
+    }
+}
+
 void send_command(StringView session, StringView command)
 {
     int sock = connect_to(session);
@@ -680,12 +1275,13 @@ void send_command(StringView session, StringView command)
 }
 
 
-// A client accepter handle a connection until it closes or a nul byte is
-// recieved. Everything recieved before is considered to be a command.
+// A client accepter handles a connection until it is handed to a new
+// Client (Connect message) or closed by the peer.
 //
-// * When a nul byte is recieved, the socket is handed to a new Client along
-//   with the command.
-// * When the connection is closed, the command is run in an empty context.
+// Command messages each carry a whole command block that is parsed and
+// run in one go; a tool may stream any number of them over a single
+// connection, so pushing thousands of commands costs one connection
+// and one wakeup per block instead of one per line.
 class Server::Accepter
 {
 public:
@@ -703,59 +1299,71 @@ private:
         const int sock = m_socket_watcher.fd();
         try
         {
-            while (not m_reader.ready() and fd_readable(sock))
-                m_reader.read_available(sock);
+            // a single wakeup may deliver several command blocks
+            while (handle_message(sock))
+            {}
+        }
+        catch (const disconnected& err)
+        {
+            write_to_debug_buffer(format("accepting connection failed: {}", err.what()));
+            close(sock);
+            Server::instance().remove_accepter(this);
+        }
+    }
 
-            if (not m_reader.ready())
-                return;
+    // handle one message if a full one is available, returns true if
+    // more may follow on this connection
+    bool handle_message(int sock)
+    {
+        while (not m_reader.ready() and fd_readable(sock))
+            m_reader.read_available(sock);
 
-            switch (m_reader.type())
-            {
-            case MessageType::Connect:
+        if (not m_reader.ready())
+            return false;
+
+        switch (m_reader.type())
+        {
+        case MessageType::Connect:
+        {
+            auto pid = m_reader.read<int>();
+            auto init_cmds = m_reader.read<String>();
+            auto init_coord = m_reader.read_optional<BufferCoord>();
+            auto dimensions = m_reader.read<DisplayCoord>();
+            auto env_vars = m_reader.read_hash_map<String, String, MemoryDomain::EnvVars>();
+            auto shm_name = m_reader.read_optional<String>();
+            auto* ui = new RemoteUI{sock, dimensions, std::move(shm_name)};
+            if (auto* client = ClientManager::instance().create_client(
+                                   std::unique_ptr<UserInterface>(ui), pid,
+                                   std::move(env_vars), init_cmds, init_coord,
+                                   [ui](int status) { ui->exit(status); }))
+                ui->set_client(client);
+
+            Server::instance().remove_accepter(this);
+            return false;
+        }
+        case MessageType::Command:
+        {
+            auto command = m_reader.read<String>();
+            m_reader.reset();
+            if (not command.empty()) try
             {
-                auto pid = m_reader.read<int>();
-                auto init_cmds = m_reader.read<String>();
-                auto init_coord = m_reader.read_optional<BufferCoord>();
-                auto dimensions = m_reader.read<DisplayCoord>();
-                auto env_vars = m_reader.read_hash_map<String, String, MemoryDomain::EnvVars>();
-                auto* ui = new RemoteUI{sock, dimensions};
-                if (auto* client = ClientManager::instance().create_client(
-                                       std::unique_ptr<UserInterface>(ui), pid,
-                                       std::move(env_vars), init_cmds, init_coord,
-                                       [ui](int status) { ui->exit(status); }))
-                    ui->set_client(client);
-
-                Server::instance().remove_accepter(this);
-                break;
+                Context context{Context::EmptyContextFlag{}};
+                CommandManager::instance().execute(command, context);
             }
-            case MessageType::Command:
+            catch (const runtime_error& e)
             {
-                auto command = m_reader.read<String>();
-                if (not command.empty()) try
-                {
-                    Context context{Context::EmptyContextFlag{}};
-                    CommandManager::instance().execute(command, context);
-                }
-                catch (const runtime_error& e)
-                {
-                    write_to_debug_buffer(format("error running command '{}': {}",
-                                                 command, e.what()));
-                }
-                close(sock);
-                Server::instance().remove_accepter(this);
-                break;
-            }
-            default:
-                write_to_debug_buffer("Invalid introduction message received");
-                close(sock);
-                Server::instance().remove_accepter(this);
+                write_to_debug_buffer(format("error running command '{}': {}",
+                                             command, e.what()));
             }
+            // the accepter stays around to serve further blocks
+            // until the peer closes the connection
+            return true;
         }
-        catch (const disconnected& err)
-        {
-            write_to_debug_buffer(format("accepting connection failed: {}", err.what()));
+        default:
+            write_to_debug_buffer("Invalid introduction message received");
             close(sock);
             Server::instance().remove_accepter(this);
+            return false;
         }
     }
 
@@ -839,4 +1447,48 @@ void Server::remove_accepter(Accepter* accepter)
     m_accepters.erase(it);
 }
 
+UnitTest test_compressed_messages{[]()
+{
+    auto roundtrip = [](StringView data) {
+        auto compressed = compress_block(data.data(), (uint32_t)(int)data.length());
+        auto out = decompress_block(compressed.data(), (uint32_t)compressed.size());
+        kak_assert(StringView{out.data(), out.data() + out.size()} == data);
+    };
+    roundtrip("");
+    roundtrip("a");
+    roundtrip("abcd");
+    roundtrip("aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa");
+    roundtrip("the quick brown fox jumps over the lazy dog, "
+              "the quick brown fox jumps over the lazy dog");
+
+    String lines;
+    for (int i = 0; i < 1000; ++i)
+        lines += format("    line {} with some repetitive content\n", i);
+    auto compressed = compress_block(lines.data(), (uint32_t)(int)lines.length());
+    kak_assert((int)compressed.size() < (int)lines.length());
+    roundtrip(lines);
+}};
+
+
+Benchmark bench_msg_writer{"remote display line serialization", []()
+{
+    Vector<DisplayLine> lines;
+    for (int i = 0; i < 100; ++i)
+    {
+        DisplayLine line;
+        for (int j = 0; j < 10; ++j)
+            line.push_back(DisplayAtom{format("atom {} of line {}", j, i)});
+        lines.push_back(std::move(line));
+    }
+    RemoteBuffer buffer;
+    for (int i = 0; i < 1000; ++i)
+    {
+        {
+            MsgWriter msg{buffer, MessageType::MenuShow};
+            msg.write(ConstArrayView<DisplayLine>(lines));
+        }
+        buffer.clear();
+    }
+}};
+
 }
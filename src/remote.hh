@@ -25,6 +25,8 @@ struct BufferCoord;
 
 using RemoteBuffer = Vector<char, MemoryDomain::Remote>;
 
+struct ShmRing;
+
 // A remote client handle communication between a client running on the server
 // and a user interface running on the local process.
 class RemoteClient
@@ -33,12 +35,15 @@ public:
     RemoteClient(StringView session, std::unique_ptr<UserInterface>&& ui,
                  int pid, const EnvVarMap& env_vars, StringView init_command,
                  Optional<BufferCoord> init_coord);
+    ~RemoteClient();
 
     const Optional<int>& exit_status() const { return m_exit_status; }
 private:
     std::unique_ptr<UserInterface> m_ui;
     std::unique_ptr<FDWatcher>     m_socket_watcher;
     RemoteBuffer                   m_send_buffer;
+    ShmRing*                       m_shm = nullptr;
+    String                         m_shm_name;
     Optional<int>                  m_exit_status;
 };
 
@@ -64,6 +69,19 @@ private:
 
 bool check_session(StringView session);
 
+// Template sessions: a resident pre-initialized server accepts spawn
+// requests on its session socket instead of the remote protocol and
+// forks a ready to serve child per request.
+
+// serves spawn requests until SIGTERM; returns only in forked children,
+// handing back the connection on which the child must acknowledge once
+// its own session socket is bound, or -1 on termination
+int accept_spawn_requests(StringView session, String& spawned_session);
+
+// asks the given template session to fork a new session, waits for it
+// to be ready and returns its name
+String spawn_from_template(StringView session);
+
 }
 
 #endif // remote_hh_INCLUDED
@@ -6,6 +6,7 @@
 #include "assert.hh"
 #include "ref_ptr.hh"
 
+#include <atomic>
 #include <type_traits>
 #include <utility>
 
@@ -51,7 +52,9 @@ private:
 
     mutable Vector<Callstack> m_callstacks;
     #endif
-    mutable int m_count = 0;
+    // relaxed atomic so that worker threads may hold SafePtrs (such as
+    // BufferIterators) to an object shared with the main thread.
+    mutable std::atomic<int> m_count{0};
 #endif
 };
 
@@ -60,7 +63,7 @@ struct SafeCountablePolicy
 #ifdef KAK_DEBUG
     static void inc_ref(const SafeCountable* sc, void* ptr) noexcept
     {
-        ++sc->m_count;
+        sc->m_count.fetch_add(1, std::memory_order_relaxed);
         #ifdef SAFE_PTR_TRACK_CALLSTACKS
         sc->m_callstacks.emplace_back(ptr);
         #endif
@@ -68,8 +71,8 @@ struct SafeCountablePolicy
 
     static void dec_ref(const SafeCountable* sc, void* ptr) noexcept
     {
-        --sc->m_count;
-        kak_assert(sc->m_count >= 0);
+        const int previous = sc->m_count.fetch_sub(1, std::memory_order_relaxed);
+        kak_assert(previous > 0);
         #ifdef SAFE_PTR_TRACK_CALLSTACKS
         auto it = std::find_if(sc->m_callstacks.begin(), sc->m_callstacks.end(),
                                [=](const SafeCountable::Callstack& cs) { return cs.ptr == ptr; });
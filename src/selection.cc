@@ -2,13 +2,26 @@
 
 #include "buffer_utils.hh"
 #include "changes.hh"
+#include "event_manager.hh"
+#include "file.hh"
+#include "ranges.hh"
 #include "utf8.hh"
+#include "utils.hh"
+
+#include <chrono>
+#include <memory>
+#include <thread>
+
+#include <fcntl.h>
+#include <pwd.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 namespace Kakoune
 {
 
 SelectionList::SelectionList(Buffer& buffer, Selection s, size_t timestamp)
-    : m_buffer(&buffer), m_selections({ std::move(s) }), m_timestamp(timestamp)
+    : m_storage(new Storage{{ std::move(s) }}), m_buffer(&buffer), m_timestamp(timestamp)
 {
     check_invariant();
 }
@@ -17,7 +30,7 @@ SelectionList::SelectionList(Buffer& buffer, Selection s)
     : SelectionList(buffer, std::move(s), buffer.timestamp()) {}
 
 SelectionList::SelectionList(Buffer& buffer, Vector<Selection> s, size_t timestamp)
-    : m_buffer(&buffer), m_selections(std::move(s)), m_timestamp(timestamp)
+    : m_storage(new Storage{std::move(s)}), m_buffer(&buffer), m_timestamp(timestamp)
 {
     kak_assert(size() > 0);
     m_main = size() - 1;
@@ -27,16 +40,24 @@ SelectionList::SelectionList(Buffer& buffer, Vector<Selection> s, size_t timesta
 SelectionList::SelectionList(Buffer& buffer, Vector<Selection> s)
     : SelectionList(buffer, std::move(s), buffer.timestamp()) {}
 
+Vector<Selection>& SelectionList::detach()
+{
+    if (m_storage->refcount > 1)
+        m_storage = RefPtr<Storage>{new Storage{m_storage->selections}};
+    return m_storage->selections;
+}
+
 void SelectionList::remove(size_t index)
 {
-    m_selections.erase(begin() + index);
-    if (index < m_main or m_main == m_selections.size())
+    auto& sels = detach();
+    sels.erase(sels.begin() + index);
+    if (index < m_main or m_main == sels.size())
         --m_main;
 }
 void SelectionList::set(Vector<Selection> list, size_t main)
 {
     kak_assert(main < list.size());
-    m_selections = std::move(list);
+    m_storage = RefPtr<Storage>{new Storage{std::move(list)}};
     m_main = main;
     sort_and_merge_overlapping();
     update_timestamp();
@@ -224,11 +245,11 @@ void update_selections(Vector<Selection>& selections, size_t& main, Buffer& buff
             update_backward({ change_it, backward_end }, selections);
             change_it = backward_end;
         }
+        // the coordinate updates are monotonic so the batches only need
+        // the list to stay sorted, merging overlaps can wait until all
+        // of them are applied instead of re-scanning per batch
         kak_assert(std::is_sorted(selections.begin(), selections.end(),
                                   compare_selections));
-        selections.erase(
-            merge_overlapping(selections.begin(), selections.end(),
-                              main, overlaps), selections.end());
     }
     for (auto& sel : selections)
         clamp(sel, buffer);
@@ -239,7 +260,8 @@ void update_selections(Vector<Selection>& selections, size_t& main, Buffer& buff
 
 void SelectionList::update()
 {
-    update_selections(m_selections, m_main, *m_buffer, m_timestamp);
+    if (m_timestamp != m_buffer->timestamp())
+        update_selections(detach(), m_main, *m_buffer, m_timestamp);
     check_invariant();
     m_timestamp = m_buffer->timestamp();
 }
@@ -259,7 +281,7 @@ void SelectionList::check_invariant() const
 
     const auto end_coord = buffer.end_coord();
     BufferCoord last_min{0,0};
-    for (auto& sel : m_selections)
+    for (auto& sel : m_storage->selections)
     {
         auto& min = sel.min();
         kak_assert(min >= last_min);
@@ -281,16 +303,26 @@ void SelectionList::sort()
     if (size() == 1)
         return;
 
-    const auto& main = this->main();
+    // selections are very often already in buffer order (regex matching
+    // and line splitting generate them sorted); a linear check is much
+    // cheaper than re-sorting a six figures selection count, an already
+    // sorted list keeps its main index as is, and shared storage stays
+    // shared
+    auto& sorted_check = m_storage->selections;
+    if (std::is_sorted(sorted_check.begin(), sorted_check.end(), compare_selections))
+        return;
+
+    auto& sels = detach();
+    const auto& main = sels[m_main];
     const auto main_begin = main.min();
-    m_main = std::count_if(begin(), end(), [&](const Selection& sel) {
+    m_main = std::count_if(sels.begin(), sels.end(), [&](const Selection& sel) {
                                auto begin = sel.min();
                                if (begin == main_begin)
                                    return &sel < &main;
                                else
                                    return begin < main_begin;
                            });
-    std::stable_sort(begin(), end(), compare_selections);
+    std::stable_sort(sels.begin(), sels.end(), compare_selections);
 }
 
 void SelectionList::merge_overlapping()
@@ -298,8 +330,9 @@ void SelectionList::merge_overlapping()
     if (size() == 1)
         return;
 
-    m_selections.erase(Kakoune::merge_overlapping(begin(), end(),
-                                                  m_main, overlaps), end());
+    auto& sels = detach();
+    sels.erase(Kakoune::merge_overlapping(sels.begin(), sels.end(),
+                                          m_main, overlaps), sels.end());
 }
 
 void SelectionList::merge_consecutive()
@@ -310,8 +343,9 @@ void SelectionList::merge_consecutive()
     auto touches = [this](const Selection& lhs, const Selection& rhs) {
         return m_buffer->char_next(lhs.max()) >= rhs.min();
     };
-    m_selections.erase(Kakoune::merge_overlapping(begin(), end(),
-                                                  m_main, touches), end());
+    auto& sels = detach();
+    sels.erase(Kakoune::merge_overlapping(sels.begin(), sels.end(),
+                                          m_main, touches), sels.end());
 }
 
 void SelectionList::sort_and_merge_overlapping()
@@ -331,7 +365,7 @@ static inline void _avoid_eol(const Buffer& buffer, BufferCoord& coord)
 void SelectionList::avoid_eol()
 {
     update();
-    for (auto& sel : m_selections)
+    for (auto& sel : detach())
     {
         _avoid_eol(buffer(), sel.anchor());
         _avoid_eol(buffer(), sel.cursor());
@@ -383,18 +417,26 @@ void SelectionList::insert(ConstArrayView<String> strings, InsertMode mode,
         return;
 
     update();
+    auto& sels = detach();
 
     Vector<BufferCoord> insert_pos;
     if (mode != InsertMode::Replace)
     {
-        for (auto& sel : m_selections)
+        for (auto& sel : sels)
             insert_pos.push_back(get_insert_pos(*m_buffer, sel, mode));
     }
 
+    // intern the contents once upfront, so that applying the same string to
+    // every selection does not hash it again per selection
+    Vector<StringDataPtr> interned;
+    interned.reserve(strings.size());
+    for (auto& str : strings)
+        interned.push_back(str.empty() ? StringDataPtr{} : intern(str));
+
     ForwardChangesTracker changes_tracker;
-    for (size_t index = 0; index < m_selections.size(); ++index)
+    for (size_t index = 0; index < sels.size(); ++index)
     {
-        auto& sel = m_selections[index];
+        auto& sel = sels[index];
 
         sel.anchor() = changes_tracker.get_new_coord_tolerant(sel.anchor());
         sel.cursor() = changes_tracker.get_new_coord_tolerant(sel.cursor());
@@ -402,10 +444,12 @@ void SelectionList::insert(ConstArrayView<String> strings, InsertMode mode,
                    m_buffer->is_valid(sel.cursor()));
 
         const String& str = strings[std::min(index, strings.size()-1)];
+        const StringDataPtr& content = interned[std::min(index, interned.size()-1)];
 
         const auto pos = (mode == InsertMode::Replace) ?
-            replace(*m_buffer, sel, str)
-          : m_buffer->insert(changes_tracker.get_new_coord(insert_pos[index]), str);
+            (content ? replace(*m_buffer, sel, content) : replace(*m_buffer, sel, str))
+          : (content ? m_buffer->insert(changes_tracker.get_new_coord(insert_pos[index]), content)
+                     : changes_tracker.get_new_coord(insert_pos[index]));
 
         size_t old_timestamp = m_timestamp;
         changes_tracker.update(*m_buffer, m_timestamp);
@@ -438,7 +482,7 @@ void SelectionList::insert(ConstArrayView<String> strings, InsertMode mode,
     // We might just have been deleting text if strings were empty,
     // in which case we could have some selections pushed out of the buffer
     if (mode == InsertMode::Replace)
-        fix_overflowing_selections(m_selections, *m_buffer);
+        fix_overflowing_selections(sels, *m_buffer);
 
     check_invariant();
     m_buffer->check_invariant();
@@ -449,8 +493,9 @@ void SelectionList::erase()
     update();
     merge_overlapping();
 
+    auto& sels = detach();
     ForwardChangesTracker changes_tracker;
-    for (auto& sel : m_selections)
+    for (auto& sel : sels)
     {
         sel.anchor() = changes_tracker.get_new_coord(sel.anchor());
         kak_assert(m_buffer->is_valid(sel.anchor()));
@@ -462,7 +507,7 @@ void SelectionList::erase()
         changes_tracker.update(*m_buffer, m_timestamp);
     }
 
-    fix_overflowing_selections(m_selections, *m_buffer);
+    fix_overflowing_selections(sels, *m_buffer);
     m_buffer->check_invariant();
 }
 
@@ -479,6 +524,140 @@ String selection_list_to_string(const SelectionList& selections)
     return join(selections | transform(selection_to_string), ':', false);
 }
 
+namespace
+{
+
+// An in flight selections fifo expansion. The snapshot references the
+// immutable line storage; it is built and destroyed on the main thread
+// as StringData refcounts are not atomic, the writer thread only ever
+// reads through it.
+struct SelectionsFifo : UseMemoryDomain<MemoryDomain::Selections>
+{
+    struct Range { BufferCoord begin, end; };
+
+    Vector<StringDataPtr> lines;
+    Vector<Range> ranges;
+    String path;
+    size_t id;
+    std::thread thread;
+
+    ~SelectionsFifo() { if (thread.joinable()) thread.join(); }
+};
+
+Vector<std::unique_ptr<SelectionsFifo>, MemoryDomain::Selections>& pending_selections_fifos()
+{
+    static Vector<std::unique_ptr<SelectionsFifo>, MemoryDomain::Selections> fifos;
+    return fifos;
+}
+
+}
+
+String create_selections_fifo(const SelectionList& selections)
+{
+    auto fifo = std::make_unique<SelectionsFifo>();
+
+    // reference the immutable line storage instead of copying contents,
+    // the writer thread then never touches the buffer itself
+    auto& buffer = selections.buffer();
+    fifo->lines.reserve((int)buffer.line_count());
+    for (auto line = 0_line; line < buffer.line_count(); ++line)
+        fifo->lines.push_back(buffer.line_storage(line));
+    fifo->ranges.reserve(selections.size());
+    for (auto& sel : selections)
+        fifo->ranges.push_back({sel.min(), buffer.char_next(sel.max())});
+
+    static size_t next_id = 0;
+    fifo->id = ++next_id;
+    fifo->path = format("{}/kakoune/{}/selections-fifo-{}-{}", tmpdir(),
+                        getpwuid(geteuid())->pw_name, getpid(), fifo->id);
+    if (mkfifo(fifo->path.c_str(), 0600) != 0)
+        throw runtime_error(format("unable to create fifo '{}'", fifo->path));
+
+    SelectionsFifo* ptr = fifo.get();
+    fifo->thread = std::thread{[ptr] {
+        auto done = on_scope_end([ptr] {
+            // hand the entry back to the main thread which joins us and
+            // destroys the snapshot there
+            EventManager::instance().post([id = ptr->id] {
+                auto& fifos = pending_selections_fifos();
+                auto it = find_if(fifos, [id](auto& fifo) { return fifo->id == id; });
+                if (it == fifos.end())
+                    return;
+                (*it)->thread.join();
+                unlink((*it)->path.c_str());
+                fifos.erase(it);
+            });
+        });
+
+        // the consuming script might never open the fifo; poll with a
+        // deadline instead of blocking in open while holding a snapshot
+        // of the whole buffer
+        int fd = -1;
+        for (int i = 0; i < 500; ++i) // up to 10 seconds
+        {
+            fd = open(ptr->path.c_str(), O_WRONLY | O_NONBLOCK);
+            if (fd >= 0 or errno != ENXIO)
+                break;
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        }
+        if (fd < 0)
+            return;
+        fcntl(fd, F_SETFL, 0); // a reader is there, write blocking from now on
+        auto close_fd = on_scope_end([fd]{ close(fd); });
+
+        const auto& snapshot = *ptr;
+        String chunk;
+        constexpr ByteCount max_chunk = 65536;
+        auto flush = [&] {
+            StringView data = chunk;
+            while (not data.empty())
+            {
+                const ssize_t res = ::write(fd, data.data(), (size_t)(int)data.length());
+                if (res <= 0) // the reader went away
+                    return false;
+                data = data.substr(ByteCount{(int)res});
+            }
+            chunk.clear();
+            return true;
+        };
+        auto emit = [&](StringView str, bool esc) {
+            for (auto c : str)
+            {
+                if (esc and (c == ':' or c == '\\'))
+                    chunk += '\\';
+                chunk += c;
+                if (chunk.length() >= max_chunk and not flush())
+                    return false;
+            }
+            return true;
+        };
+
+        for (size_t i = 0; i < snapshot.ranges.size(); ++i)
+        {
+            if (i != 0 and not emit(":", false))
+                return;
+            const auto& range = snapshot.ranges[i];
+            // an end at the buffer end is one line past the last one
+            const auto last_line = std::min(range.end.line,
+                                            LineCount{(int)snapshot.lines.size() - 1});
+            for (auto line = range.begin.line; line <= last_line; ++line)
+            {
+                StringView content = snapshot.lines[(int)line]->strview();
+                const ByteCount b = line == range.begin.line ? range.begin.column : 0;
+                const ByteCount e = line == range.end.line ?
+                    std::min(range.end.column, content.length()) : content.length();
+                if (b < e and not emit(content.substr(b, e - b), true))
+                    return;
+            }
+        }
+        flush();
+    }};
+
+    String path = ptr->path;
+    pending_selections_fifos().push_back(std::move(fifo));
+    return path;
+}
+
 Selection selection_from_string(StringView desc)
 {
     auto comma = find(desc, ',');
@@ -2,11 +2,13 @@
 #define selection_hh_INCLUDED
 
 #include "buffer.hh"
+#include "inline_vector.hh"
+#include "ref_ptr.hh"
 
 namespace Kakoune
 {
 
-using CaptureList = Vector<String, MemoryDomain::Selections>;
+using CaptureList = InlineVector<String, 2, MemoryDomain::Selections>;
 
 // A selection is a Selection, associated with a CaptureList
 struct Selection
@@ -98,11 +100,11 @@ struct SelectionList
 
     void avoid_eol();
 
-    void push_back(const Selection& sel) { m_selections.push_back(sel); }
-    void push_back(Selection&& sel) { m_selections.push_back(std::move(sel)); }
+    void push_back(const Selection& sel) { detach().push_back(sel); }
+    void push_back(Selection&& sel) { detach().push_back(std::move(sel)); }
 
-    Selection& operator[](size_t i) { return m_selections[i]; }
-    const Selection& operator[](size_t i) const { return m_selections[i]; }
+    Selection& operator[](size_t i) { return detach()[i]; }
+    const Selection& operator[](size_t i) const { return m_storage->selections[i]; }
 
     void set(Vector<Selection> list, size_t main);
     SelectionList& operator=(Vector<Selection> list)
@@ -113,18 +115,23 @@ struct SelectionList
     }
 
     using iterator = Vector<Selection>::iterator;
-    iterator begin() { return m_selections.begin(); }
-    iterator end() { return m_selections.end(); }
+    iterator begin() { return detach().begin(); }
+    iterator end() { return detach().end(); }
 
     using const_iterator = Vector<Selection>::const_iterator;
-    const_iterator begin() const { return m_selections.begin(); }
-    const_iterator end() const { return m_selections.end(); }
+    const_iterator begin() const { return m_storage->selections.begin(); }
+    const_iterator end() const { return m_storage->selections.end(); }
 
     void remove(size_t index);
 
-    size_t size() const { return m_selections.size(); }
+    size_t size() const { return m_storage->selections.size(); }
 
-    bool operator==(const SelectionList& other) const { return m_buffer == other.m_buffer and m_selections == other.m_selections; }
+    bool operator==(const SelectionList& other) const
+    {
+        return m_buffer == other.m_buffer and
+               (m_storage == other.m_storage or
+                m_storage->selections == other.m_storage->selections);
+    }
     bool operator!=(const SelectionList& other) const { return not ((*this) == other); }
 
     void sort();
@@ -142,8 +149,22 @@ struct SelectionList
     void erase();
 
 private:
+    // the selection vector lives in shared storage so copying a list
+    // (jump list entries, selection snapshots) only bumps a reference
+    // count no matter how many selections it holds; mutation detaches a
+    // unique copy first
+    struct Storage : RefCountable, UseMemoryDomain<MemoryDomain::Selections>
+    {
+        Storage() = default;
+        Storage(Vector<Selection> s) : selections{std::move(s)} {}
+
+        Vector<Selection> selections;
+    };
+
+    Vector<Selection>& detach();
+
     size_t m_main = 0;
-    Vector<Selection> m_selections;
+    RefPtr<Storage> m_storage;
 
     SafePtr<Buffer> m_buffer;
     size_t m_timestamp;
@@ -153,6 +174,13 @@ Vector<Selection> compute_modified_ranges(Buffer& buffer, size_t timestamp);
 
 String selection_to_string(const Selection& selection);
 String selection_list_to_string(const SelectionList& selection);
+
+// Create a named fifo streaming the selections content in kak_selections
+// format (colon separated, colons escaped) from a background thread as
+// the consumer reads, and return its path. The thread works on a
+// snapshot of the underlying line storage, so peak memory stays flat no
+// matter how big the content is and later buffer edits are no concern.
+String create_selections_fifo(const SelectionList& selections);
 Selection selection_from_string(StringView desc);
 SelectionList selection_list_from_string(Buffer& buffer, StringView desc);
 
@@ -1,20 +1,27 @@
 #include "selectors.hh"
 
+#include "bracket_index.hh"
 #include "buffer_utils.hh"
 #include "context.hh"
 #include "flags.hh"
 #include "optional.hh"
 #include "regex.hh"
 #include "string.hh"
+#include "trigram_index.hh"
 #include "unicode.hh"
 #include "unit_tests.hh"
 #include "utf8_iterator.hh"
 
 #include <algorithm>
+#include <exception>
+#include <thread>
 
 namespace Kakoune
 {
 
+static const TypedOptionId<int> tabstop_id{"tabstop"};
+static const TypedOptionId<Vector<Codepoint, MemoryDomain::Options>> extra_word_chars_id{"extra_word_chars"};
+
 using Utf8Iterator = utf8::iterator<BufferIterator>;
 
 namespace
@@ -38,7 +45,54 @@ Selection utf8_range(const Utf8Iterator& first, const Utf8Iterator& last)
 
 ConstArrayView<Codepoint> get_extra_word_chars(const Context& context)
 {
-    return context.options()["extra_word_chars"].get<Vector<Codepoint, MemoryDomain::Options>>();
+    return context.options().get(extra_word_chars_id);
+}
+
+// classifies ASCII through a table built once per extra_word_chars
+// value, so the word motion loops only branch through iswalnum for non
+// ASCII codepoints
+template<WordType word_type>
+struct CharClassifier
+{
+    explicit CharClassifier(ConstArrayView<Codepoint> extra_word_chars)
+        : m_extra_word_chars{extra_word_chars.begin(), extra_word_chars.end()}
+    {
+        for (Codepoint c = 0; c < 128; ++c)
+            m_ascii[c] = Kakoune::categorize<word_type>(c, m_extra_word_chars);
+    }
+
+    CharCategories categorize(Codepoint c) const noexcept
+    {
+        return c < 128 ? m_ascii[c]
+                       : Kakoune::categorize<word_type>(c, m_extra_word_chars);
+    }
+
+    bool is_word(Codepoint c) const noexcept
+    { return categorize(c) == CharCategories::Word; }
+
+    bool is_punctuation(Codepoint c) const noexcept
+    { return categorize(c) == CharCategories::Punctuation; }
+
+    bool built_from(ConstArrayView<Codepoint> extra_word_chars) const noexcept
+    {
+        return m_extra_word_chars.size() == extra_word_chars.size() and
+               std::equal(extra_word_chars.begin(), extra_word_chars.end(),
+                          m_extra_word_chars.begin());
+    }
+
+private:
+    Vector<Codepoint, MemoryDomain::Options> m_extra_word_chars;
+    CharCategories m_ascii[128];
+};
+
+template<WordType word_type>
+const CharClassifier<word_type>& get_char_classifier(const Context& context)
+{
+    static Optional<CharClassifier<word_type>> cache;
+    auto extra_word_chars = get_extra_word_chars(context);
+    if (not cache or not cache->built_from(extra_word_chars))
+        cache = CharClassifier<word_type>{extra_word_chars};
+    return *cache;
 }
 
 }
@@ -47,13 +101,12 @@ template<WordType word_type>
 Optional<Selection>
 select_to_next_word(const Context& context, const Selection& selection)
 {
-    auto extra_word_chars = get_extra_word_chars(context);
+    auto& classify = get_char_classifier<word_type>(context);
     auto& buffer = context.buffer();
     Utf8Iterator begin{buffer.iterator_at(selection.cursor()), buffer};
     if (begin+1 == buffer.end())
         return {};
-    if (categorize<word_type>(*begin, extra_word_chars) !=
-        categorize<word_type>(*(begin+1), extra_word_chars))
+    if (classify.categorize(*begin) != classify.categorize(*(begin+1)))
         ++begin;
 
     if (not skip_while(begin, buffer.end(),
@@ -61,7 +114,8 @@ select_to_next_word(const Context& context, const Selection& selection)
         return {};
     Utf8Iterator end = begin+1;
 
-    auto is_word = [&](Codepoint c) { return Kakoune::is_word<word_type>(c, extra_word_chars); };
+    auto is_word = [&](Codepoint c) { return classify.is_word(c); };
+    auto is_punctuation = [&](Codepoint c) { return classify.is_punctuation(c); };
 
     if (is_word(*begin))
         skip_while(end, buffer.end(), is_word);
@@ -79,13 +133,12 @@ template<WordType word_type>
 Optional<Selection>
 select_to_next_word_end(const Context& context, const Selection& selection)
 {
-    auto extra_word_chars = get_extra_word_chars(context);
+    auto& classify = get_char_classifier<word_type>(context);
     auto& buffer = context.buffer();
     Utf8Iterator begin{buffer.iterator_at(selection.cursor()), buffer};
     if (begin+1 == buffer.end())
         return {};
-    if (categorize<word_type>(*begin, extra_word_chars) !=
-        categorize<word_type>(*(begin+1), extra_word_chars))
+    if (classify.categorize(*begin) != classify.categorize(*(begin+1)))
         ++begin;
 
     if (not skip_while(begin, buffer.end(),
@@ -94,7 +147,8 @@ select_to_next_word_end(const Context& context, const Selection& selection)
     Utf8Iterator end = begin;
     skip_while(end, buffer.end(), is_horizontal_blank);
 
-    auto is_word = [&](Codepoint c) { return Kakoune::is_word<word_type>(c, extra_word_chars); };
+    auto is_word = [&](Codepoint c) { return classify.is_word(c); };
+    auto is_punctuation = [&](Codepoint c) { return classify.is_punctuation(c); };
 
     if (is_word(*end))
         skip_while(end, buffer.end(), is_word);
@@ -110,19 +164,19 @@ template<WordType word_type>
 Optional<Selection>
 select_to_previous_word(const Context& context, const Selection& selection)
 {
-    auto extra_word_chars = get_extra_word_chars(context);
+    auto& classify = get_char_classifier<word_type>(context);
     auto& buffer = context.buffer();
     Utf8Iterator begin{buffer.iterator_at(selection.cursor()), buffer};
     if (begin == buffer.begin())
         return {};
-    if (categorize<word_type>(*begin, extra_word_chars) !=
-        categorize<word_type>(*(begin-1), extra_word_chars))
+    if (classify.categorize(*begin) != classify.categorize(*(begin-1)))
         --begin;
 
     skip_while_reverse(begin, buffer.begin(), [](Codepoint c){ return is_eol(c); });
     Utf8Iterator end = begin;
 
-    auto is_word = [&](Codepoint c) { return Kakoune::is_word<word_type>(c, extra_word_chars); };
+    auto is_word = [&](Codepoint c) { return classify.is_word(c); };
+    auto is_punctuation = [&](Codepoint c) { return classify.is_punctuation(c); };
 
     bool with_end = skip_while_reverse(end, buffer.begin(), is_horizontal_blank);
     if (is_word(*end))
@@ -140,10 +194,10 @@ Optional<Selection>
 select_word(const Context& context, const Selection& selection,
             int count, ObjectFlags flags)
 {
-    auto extra_word_chars = get_extra_word_chars(context);
+    auto& classify = get_char_classifier<word_type>(context);
     auto& buffer = context.buffer();
 
-    auto is_word = [&](Codepoint c) { return Kakoune::is_word<word_type>(c, extra_word_chars); };
+    auto is_word = [&](Codepoint c) { return classify.is_word(c); };
 
     Utf8Iterator first{buffer.iterator_at(selection.cursor()), buffer};
     if (not is_word(*first))
@@ -173,17 +227,12 @@ Optional<Selection>
 select_line(const Context& context, const Selection& selection)
 {
     auto& buffer = context.buffer();
-    Utf8Iterator first{buffer.iterator_at(selection.cursor()), buffer};
-    if (*first == '\n' and first + 1 != buffer.end())
-        ++first;
-
-    while (first != buffer.begin() and *(first - 1) != '\n')
-        --first;
-
-    Utf8Iterator last = first;
-    while (last + 1 != buffer.end() and *last != '\n')
-        ++last;
-    return target_eol(utf8_range(first, last));
+    BufferCoord pos = selection.cursor();
+    // when the cursor is on the line end, select the next line
+    if (pos == buffer.line_end_coord(pos.line) and
+        pos.line + 1 < buffer.line_count())
+        ++pos.line;
+    return target_eol({{pos.line, 0}, buffer.line_end_coord(pos.line)});
 }
 
 template<bool only_move>
@@ -227,7 +276,8 @@ Optional<Selection>
 select_matching(const Context& context, const Selection& selection)
 {
     auto& buffer = context.buffer();
-    ConstArrayView<Codepoint> matching_pairs = { '(', ')', '{', '}', '[', ']', '<', '>' };
+    static constexpr Codepoint pairs[] = { '(', ')', '{', '}', '[', ']', '<', '>' };
+    ConstArrayView<Codepoint> matching_pairs{pairs};
     Utf8Iterator it{buffer.iterator_at(selection.cursor()), buffer};
     auto match = matching_pairs.end();
     while (not is_eol(*it))
@@ -240,37 +290,21 @@ select_matching(const Context& context, const Selection& selection)
     if (match == matching_pairs.end())
         return {};
 
-    Utf8Iterator begin = it;
+    const auto begin = it.base().coord();
+    auto& index = BracketIndex::get(buffer);
+    index.update();
 
     if (((match - matching_pairs.begin()) % 2) == 0)
     {
-        int level = 0;
-        const Codepoint opening = *match;
-        const Codepoint closing = *(match+1);
-        while (it != buffer.end())
-        {
-            if (*it == opening)
-                ++level;
-            else if (*it == closing and --level == 0)
-                return utf8_range(begin, it);
-            ++it;
-        }
+        if (auto res = index.find_closing(begin, (char)*match,
+                                          (char)*(match+1), 0))
+            return Selection{begin, *res};
     }
     else
     {
-        int level = 0;
-        const Codepoint opening = *(match-1);
-        const Codepoint closing = *match;
-        while (true)
-        {
-            if (*it == closing)
-                ++level;
-            else if (*it == opening and --level == 0)
-                return utf8_range(begin, it);
-            if (it == buffer.begin())
-                break;
-            --it;
-        }
+        if (auto res = index.find_opening(begin, (char)*(match-1),
+                                          (char)*match, 0))
+            return Selection{begin, *res};
     }
     return {};
 }
@@ -370,6 +404,47 @@ find_surrounding(const Container& container, Iterator pos,
                             opening, closing, flags, init_level);
 }
 
+// index backed variant of find_surrounding for single byte bracket
+// pairs, working on coordinates instead of iterators
+static Optional<std::pair<BufferCoord, BufferCoord>>
+find_surrounding_indexed(const Buffer& buffer, BufferCoord pos,
+                         char opening, char closing,
+                         ObjectFlags flags, int init_level)
+{
+    auto& index = BracketIndex::get(buffer);
+    index.update();
+    const bool to_begin = flags & ObjectFlags::ToBegin;
+    const bool to_end   = flags & ObjectFlags::ToEnd;
+
+    auto first = pos;
+    if (to_begin and buffer.byte_at(pos) != opening)
+    {
+        auto res = index.find_opening(pos, opening, closing, init_level);
+        if (not res)
+            return {};
+        first = *res;
+    }
+
+    auto last = pos;
+    if (to_end)
+    {
+        auto res = index.find_closing(pos, opening, closing, init_level);
+        if (not res)
+            return {};
+        last = *res;
+    }
+
+    if (flags & ObjectFlags::Inner)
+    {
+        if (to_begin and first != last)
+            first = buffer.char_next(first);
+        if (to_end and first != last)
+            last = buffer.char_prev(last);
+    }
+    return to_end ? std::pair<BufferCoord, BufferCoord>{first, last}
+                  : std::pair<BufferCoord, BufferCoord>{last, first};
+}
+
 Optional<Selection>
 select_surrounding(const Context& context, const Selection& selection,
                    StringView opening, StringView closing, int level,
@@ -378,33 +453,46 @@ select_surrounding(const Context& context, const Selection& selection,
     auto& buffer = context.buffer();
     const bool nestable = opening != closing;
     auto pos = selection.cursor();
-    if (not nestable or flags & ObjectFlags::Inner)
+
+    const bool indexed = nestable and
+                         opening.length() == 1 and closing.length() == 1 and
+                         BracketIndex::is_indexed(opening[0]) and
+                         BracketIndex::is_indexed(closing[0]);
+    auto find = [&](int level) -> Optional<Selection>
     {
+        if (indexed)
+        {
+            if (auto res = find_surrounding_indexed(buffer, pos, opening[0],
+                                                    closing[0], flags, level))
+                return Selection{res->first, res->second};
+            return {};
+        }
         if (auto res = find_surrounding(buffer, buffer.iterator_at(pos),
                                         opening, closing, flags, level))
             return utf8_range(res->first, res->second);
         return {};
-    }
+    };
+
+    if (not nestable or flags & ObjectFlags::Inner)
+        return find(level);
 
     auto c = buffer.byte_at(pos);
     if ((flags == ObjectFlags::ToBegin and c == opening) or
         (flags == ObjectFlags::ToEnd and c == closing))
         ++level;
 
-    auto res = find_surrounding(buffer, buffer.iterator_at(pos),
-                                opening, closing, flags, level);
+    auto res = find(level);
     if (not res)
         return {};
 
-    Selection sel = utf8_range(res->first, res->second);
+    Selection sel = *res;
 
     if (flags != (ObjectFlags::ToBegin | ObjectFlags::ToEnd) or
         sel.min() != selection.min() or sel.max() != selection.max())
         return sel;
 
-    if (auto res_parent = find_surrounding(buffer, buffer.iterator_at(pos),
-                                           opening, closing, flags, level+1))
-        return utf8_range(res_parent->first, res_parent->second);
+    if (auto res_parent = find(level+1))
+        return *res_parent;
     return {};
 }
 
@@ -672,7 +760,7 @@ select_indent(const Context& context, const Selection& selection,
     const bool to_end   = flags & ObjectFlags::ToEnd;
 
     auto& buffer = context.buffer();
-    int tabstop = context.options()["tabstop"].get<int>();
+    int tabstop = context.options().get(tabstop_id);
     auto pos = selection.cursor();
     LineCount line = pos.line;
     auto indent = get_indent(buffer[line], tabstop);
@@ -810,7 +898,7 @@ select_lines(const Context& context, const Selection& selection)
     BufferCoord& to_line_end = anchor <= cursor ? cursor : anchor;
 
     to_line_start.column = 0;
-    to_line_end.column = buffer[to_line_end.line].length()-1;
+    to_line_end = buffer.line_end_coord(to_line_end.line);
 
     return target_eol({anchor, cursor});
 }
@@ -826,13 +914,12 @@ trim_partial_lines(const Context& context, const Selection& selection)
 
     if (to_line_start.column != 0)
         to_line_start = to_line_start.line+1;
-    if (to_line_end.column != buffer[to_line_end.line].length()-1)
+    if (to_line_end != buffer.line_end_coord(to_line_end.line))
     {
         if (to_line_end.line == 0)
             return {};
 
-        auto prev_line = to_line_end.line-1;
-        to_line_end = BufferCoord{ prev_line, buffer[prev_line].length()-1 };
+        to_line_end = buffer.line_end_coord(to_line_end.line-1);
     }
 
     if (to_line_start > to_line_end)
@@ -867,6 +954,69 @@ static bool find_next(const Buffer& buffer, const BufferIterator& pos,
                         match_flags(buffer, buffer.begin(), buffer.end()));
 }
 
+// The trigram index applies when the regex engine guarantees matches
+// stay within a single line and begin with a long enough literal; small
+// buffers stay on the plain scan, an index would not pay for itself
+// before the buffer changes again.
+static const TrigramIndex* applicable_trigram_index(const Buffer& buffer, const Regex& regex)
+{
+    constexpr ByteCount min_indexed_size = 1024 * 1024;
+    auto* impl = regex.impl();
+    if (not impl or can_match_eol(*impl) or
+        (int)impl->prefix.size() < TrigramIndex::min_literal_length or
+        buffer.distance({0, 0}, buffer.end_coord()) < min_indexed_size)
+        return nullptr;
+    auto& index = TrigramIndex::get(buffer);
+    index.update();
+    return &index;
+}
+
+// Scan the candidate lines at or after pos one by one; the index
+// guarantees every match lies within one of them, and the per line
+// subjects see the same boundary context a whole buffer scan would.
+static bool find_next_in_lines(const Buffer& buffer, const BufferIterator& pos,
+                               MatchResults<BufferIterator>& matches, const Regex& ex,
+                               const TrigramIndex::LineList& lines)
+{
+    auto it = std::lower_bound(lines.begin(), lines.end(), pos.coord().line);
+    for (; it != lines.end(); ++it)
+    {
+        auto begin = *it == pos.coord().line ? pos : buffer.iterator_at({*it, 0});
+        auto end = *it + 1 < buffer.line_count() ? buffer.iterator_at({*it + 1, 0})
+                                                 : buffer.end();
+        if (begin != end and
+            regex_search(begin, end, matches, ex, match_flags(buffer, begin, end)))
+            return true;
+    }
+    return false;
+}
+
+static bool find_prev_in_lines(const Buffer& buffer, const BufferIterator& pos,
+                               MatchResults<BufferIterator>& matches, const Regex& ex,
+                               const TrigramIndex::LineList& lines)
+{
+    auto it = std::upper_bound(lines.begin(), lines.end(), pos.coord().line);
+    while (it != lines.begin())
+    {
+        const LineCount line = *--it;
+        auto begin = buffer.iterator_at({line, 0});
+        auto end = line == pos.coord().line ? pos
+                 : (line + 1 < buffer.line_count() ? buffer.iterator_at({line + 1, 0})
+                                                   : buffer.end());
+        MatchResults<BufferIterator> m;
+        while (begin != end and
+               regex_search(begin, end, m, ex, match_flags(buffer, begin, end)))
+        {
+            begin = utf8::next(m[0].first, end);
+            if (matches.empty() or m[0].second > matches[0].second)
+                matches.swap(m);
+        }
+        if (not matches.empty())
+            return true;
+    }
+    return false;
+}
+
 static bool find_prev(const Buffer& buffer, const BufferIterator& pos,
                       MatchResults<BufferIterator>& matches,
                       const Regex& ex, bool& wrapped)
@@ -900,9 +1050,35 @@ Selection find_next_match(const Context& context, const Selection& sel, const Re
     MatchResults<BufferIterator> matches;
     auto pos = buffer.iterator_at(direction == Backward ? sel.min() : sel.max());
     wrapped = false;
-    const bool found = (direction == Forward) ?
-        find_next(buffer, utf8::next(pos, buffer.end()), matches, regex, wrapped)
-      : find_prev(buffer, pos, matches, regex, wrapped);
+    bool found = false;
+    if (const TrigramIndex* index = applicable_trigram_index(buffer, regex))
+    {
+        auto& prefix = regex.impl()->prefix;
+        const auto candidates = index->candidate_lines({prefix.data(), prefix.data() + prefix.size()});
+        if (direction == Forward)
+        {
+            found = find_next_in_lines(buffer, utf8::next(pos, buffer.end()),
+                                       matches, regex, candidates);
+            if (not found)
+            {
+                wrapped = true;
+                found = find_next_in_lines(buffer, buffer.begin(), matches, regex, candidates);
+            }
+        }
+        else
+        {
+            found = find_prev_in_lines(buffer, pos, matches, regex, candidates);
+            if (not found)
+            {
+                wrapped = true;
+                found = find_prev_in_lines(buffer, buffer.end(), matches, regex, candidates);
+            }
+        }
+    }
+    else
+        found = (direction == Forward) ?
+            find_next(buffer, utf8::next(pos, buffer.end()), matches, regex, wrapped)
+          : find_prev(buffer, pos, matches, regex, wrapped);
 
     if (not found or matches[0].first == buffer.end())
         throw runtime_error(format("'{}': no matches found", regex.str()));
@@ -923,6 +1099,105 @@ template Selection find_next_match<Backward>(const Context&, const Selection&, c
 
 using RegexIt = RegexIterator<BufferIterator>;
 
+// A submatch flattened to buffer coordinates; find_all_matches appends
+// mark_count()+1 of these per match into a single buffer, so gathering
+// thousands of matches does not allocate per hit.
+struct FlatSubMatch
+{
+    BufferCoord begin, end;
+    bool matched;
+};
+using FlatMatchList = Vector<FlatSubMatch, MemoryDomain::Selections>;
+
+// Gather all matches in [begin, end), in order. Buffer content is
+// immutable during the scan, so when the range is big enough and no match
+// can contain an end of line, chunks split at line starts are scanned
+// concurrently; every match then lies entirely inside one chunk and the
+// merged lists follow the sequential semantics exactly.
+static FlatMatchList
+find_all_matches(const Buffer& buffer, const BufferIterator& begin,
+                 const BufferIterator& end, const Regex& regex)
+{
+    const size_t stride = regex.mark_count() + 1;
+    auto scan_range = [&regex, stride](const BufferIterator& b, const BufferIterator& e,
+                                       RegexConstant::match_flag_type flags, FlatMatchList& res) {
+        for (RegexIt it{b, e, regex, flags}, it_end; it != it_end; ++it)
+        {
+            for (size_t i = 0; i < stride; ++i)
+            {
+                const auto& sub = (*it)[i];
+                res.push_back({sub.first.coord(), sub.second.coord(), sub.matched});
+            }
+        }
+    };
+
+    constexpr ByteCount parallel_threshold = 8 * 1024 * 1024;
+    const size_t max_threads = std::thread::hardware_concurrency();
+    if (buffer.distance(begin.coord(), end.coord()) < parallel_threshold or
+        max_threads <= 1 or not regex.impl() or can_match_eol(*regex.impl()))
+    {
+        FlatMatchList res;
+        scan_range(begin, end, match_flags(buffer, begin, end), res);
+        return res;
+    }
+
+    const size_t num_chunks = std::min(max_threads, (size_t)16);
+    const LineCount first_line = begin.coord().line;
+    const size_t line_count = (size_t)(int)(end.coord().line + 1 - first_line);
+    Vector<BufferIterator> bounds{begin};
+    for (size_t i = 1; i < num_chunks; ++i)
+    {
+        const BufferCoord coord{first_line + (int)(i * line_count / num_chunks), 0};
+        if (coord > bounds.back().coord() and coord < end.coord())
+            bounds.push_back(buffer.iterator_at(coord));
+    }
+    bounds.push_back(end);
+
+    // chunk boundaries sit at line starts, so the assertion context a
+    // sequential scan would see at them can be recomputed exactly from
+    // the surrounding buffer content.
+    const size_t chunk_count = bounds.size() - 1;
+    std::vector<FlatMatchList> partial(chunk_count);
+    std::vector<std::exception_ptr> errors(chunk_count);
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < chunk_count; ++i)
+    {
+        const bool last = (i + 1 == chunk_count);
+        const auto& b = bounds[i];
+        const auto& e = bounds[i+1];
+        const auto flags = match_flags(
+            i == 0 ? is_bol(b.coord()) : true,
+            last ? is_eol(buffer, e.coord()) : *e == '\n',
+            i == 0 ? is_bow(buffer, b.coord()) : true,
+            last ? is_eow(buffer, e.coord())
+                 : not is_word(utf8::codepoint(e, buffer.end())));
+        threads.emplace_back([=, &partial, &errors]{
+            try { scan_range(b, e, flags, partial[i]); }
+            catch (...) { errors[i] = std::current_exception(); }
+        });
+    }
+    for (auto& thread : threads)
+        thread.join();
+    for (auto& error : errors)
+        if (error)
+            std::rethrow_exception(error);
+
+    FlatMatchList res;
+    for (size_t i = 0; i < chunk_count; ++i)
+    {
+        auto& list = partial[i];
+        for (size_t m = 0; m < list.size(); m += stride)
+        {
+            // an empty match at the chunk end belongs to the next chunk,
+            // which found it as well
+            if (i + 1 != chunk_count and list[m].begin == bounds[i+1].coord())
+                continue;
+            res.insert(res.end(), &list[m], &list[m] + stride);
+        }
+    }
+    return res;
+}
+
 void select_all_matches(SelectionList& selections, const Regex& regex, int capture)
 {
     const int mark_count = (int)regex.mark_count();
@@ -935,22 +1210,22 @@ void select_all_matches(SelectionList& selections, const Regex& regex, int captu
     {
         auto sel_beg = buffer.iterator_at(sel.min());
         auto sel_end = utf8::next(buffer.iterator_at(sel.max()), buffer.end());
-        RegexIt re_it(sel_beg, sel_end, regex,
-                      match_flags(buffer, sel_beg, sel_end));
-        RegexIt re_end;
 
-        for (; re_it != re_end; ++re_it)
+        const size_t stride = mark_count + 1;
+        auto matches = find_all_matches(buffer, sel_beg, sel_end, regex);
+        for (size_t m = 0; m < matches.size(); m += stride)
         {
-            auto begin = (*re_it)[capture].first;
-            if (begin == sel_end)
+            const auto& sub = matches[m + capture];
+            if (not sub.matched or sub.begin == sel_end.coord())
                 continue;
-            auto end = (*re_it)[capture].second;
+            auto begin = buffer.iterator_at(sub.begin);
+            auto end = buffer.iterator_at(sub.end);
 
             CaptureList captures;
             captures.reserve(mark_count);
-            for (const auto& match : *re_it)
-                captures.push_back(buffer.string(match.first.coord(),
-                                                 match.second.coord()));
+            for (size_t i = 0; i < stride; ++i)
+                captures.push_back(buffer.string(matches[m + i].begin,
+                                                 matches[m + i].end));
 
             result.push_back(
                 keep_direction({ begin.coord(),
@@ -980,22 +1255,21 @@ void split_selections(SelectionList& selections, const Regex& regex, int capture
         auto begin = buffer.iterator_at(sel.min());
         auto sel_end = utf8::next(buffer.iterator_at(sel.max()), buffer.end());
 
-        RegexIt re_it(begin, sel_end, regex,
-                      match_flags(buffer, begin, sel_end));
-        RegexIt re_end;
-
-        for (; re_it != re_end; ++re_it)
+        const size_t stride = regex.mark_count() + 1;
+        auto matches = find_all_matches(buffer, begin, sel_end, regex);
+        for (size_t m = 0; m < matches.size(); m += stride)
         {
-            BufferIterator end = (*re_it)[capture].first;
-            if (end == buf_end)
+            const auto& sub = matches[m + capture];
+            if (not sub.matched or sub.begin == buf_end.coord())
                 continue;
+            BufferIterator end = buffer.iterator_at(sub.begin);
 
             if (end != buf_begin)
             {
                 auto sel_end = (begin == end) ? end : utf8::previous(end, begin);
                 result.push_back(keep_direction({ begin.coord(), sel_end.coord() }, sel));
             }
-            begin = (*re_it)[capture].second;
+            begin = buffer.iterator_at(sub.end);
         }
         if (begin.coord() <= sel.max())
             result.push_back(keep_direction({ begin.coord(), sel.max() }, sel));
@@ -1,11 +1,182 @@
 #include "shared_string.hh"
 #include "buffer_utils.hh"
+#include "exception.hh"
+#include "string_utils.hh"
+#include "utf8.hh"
 
 #include <cstring>
 
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 namespace Kakoune
 {
 
+struct StringArena::Header
+{
+    char magic[8];
+    uint64_t capacity;
+    // log bytes made visible to readers, stores are release so entry
+    // contents are written before the entry becomes reachable
+    std::atomic<uint64_t> committed;
+};
+
+static constexpr char arena_magic[8] = { 'k','a','k','s','t','r','a','1' };
+// the file is sparse and mapped lazily, only pages actually written
+// cost memory
+static constexpr uint64_t arena_capacity = 1024 * 1024 * 1024;
+
+// a uint32 length, the bytes, a nul, padded to keep lengths aligned
+static size_t arena_entry_size(size_t len)
+{
+    return (sizeof(uint32_t) + len + 1 + 3) & ~(size_t)3;
+}
+
+StringArena::StringArena(StringView path)
+{
+    m_fd = open(path.zstr(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (m_fd == -1)
+        throw runtime_error(format("unable to open string arena '{}' ({})",
+                                   path, strerror(errno)));
+    auto close_on_error = on_scope_end([this] {
+        if (not m_header)
+            close(m_fd);
+    });
+
+    // the creating session initializes the header under the same lock
+    // appenders take, later sessions only validate it
+    if (flock(m_fd, LOCK_EX) == -1)
+        throw runtime_error(format("unable to lock string arena '{}' ({})",
+                                   path, strerror(errno)));
+    auto unlock = on_scope_end([this] { flock(m_fd, LOCK_UN); });
+
+    struct stat st{};
+    fstat(m_fd, &st);
+    const bool fresh = st.st_size == 0;
+    const uint64_t size = fresh ? arena_capacity : (uint64_t)st.st_size;
+    if ((fresh and ftruncate(m_fd, size) == -1) or
+        size < sizeof(Header))
+        throw runtime_error(format("unable to size string arena '{}'", path));
+
+    void* mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+    if (mem == MAP_FAILED)
+        throw runtime_error(format("unable to map string arena '{}' ({})",
+                                   path, strerror(errno)));
+
+    auto* header = reinterpret_cast<Header*>(mem);
+    if (fresh)
+    {
+        memcpy(header->magic, arena_magic, sizeof(arena_magic));
+        header->capacity = size;
+        header->committed.store(0, std::memory_order_release);
+    }
+    else if (memcmp(header->magic, arena_magic, sizeof(arena_magic)) != 0 or
+             header->capacity != size)
+    {
+        munmap(mem, size);
+        throw runtime_error(format("'{}' is not a string arena", path));
+    }
+
+    m_header = header;
+    m_log = reinterpret_cast<char*>(m_header + 1);
+}
+
+StringArena::~StringArena()
+{
+    munmap(m_header, m_header->capacity);
+    close(m_fd);
+}
+
+size_t StringArena::used() const
+{
+    return m_header->committed.load(std::memory_order_relaxed);
+}
+
+size_t StringArena::capacity() const
+{
+    return m_header->capacity - sizeof(Header);
+}
+
+void StringArena::index_new_entries()
+{
+    const size_t committed = m_header->committed.load(std::memory_order_acquire);
+    while (m_indexed < committed)
+    {
+        uint32_t len;
+        memcpy(&len, m_log + m_indexed, sizeof len);
+        const char* data = m_log + m_indexed + sizeof len;
+        m_index.insert({{data, (int)len}, data});
+        m_indexed += arena_entry_size(len);
+    }
+}
+
+const char* StringArena::lookup_or_insert(StringView str)
+{
+    auto it = m_index.find(str);
+    if (it != m_index.end())
+        return it->value;
+
+    // another session may have appended it since the last look
+    index_new_entries();
+    it = m_index.find(str);
+    if (it != m_index.end())
+        return it->value;
+
+    if (flock(m_fd, LOCK_EX) == -1)
+        return nullptr;
+    auto unlock = on_scope_end([this] { flock(m_fd, LOCK_UN); });
+
+    // recheck under the lock so concurrent writers do not duplicate
+    index_new_entries();
+    it = m_index.find(str);
+    if (it != m_index.end())
+        return it->value;
+
+    const size_t committed = m_header->committed.load(std::memory_order_relaxed);
+    const size_t needed = arena_entry_size((size_t)(int)str.length());
+    if (sizeof(Header) + committed + needed > m_header->capacity)
+        return nullptr; // full, the session overflows to private storage
+
+    char* dest = m_log + committed;
+    const uint32_t len = (uint32_t)(int)str.length();
+    memcpy(dest, &len, sizeof len);
+    memcpy(dest + sizeof len, str.begin(), (size_t)str.length());
+    dest[sizeof len + (size_t)str.length()] = 0;
+    m_header->committed.store(committed + needed, std::memory_order_release);
+
+    const char* data = dest + sizeof len;
+    m_index.insert({{data, (int)len}, data});
+    m_indexed = committed + needed;
+    return data;
+}
+
+const StringData::Metrics& StringData::metrics() const
+{
+    if (not m_metrics_computed.load(std::memory_order_acquire))
+    {
+        const StringView str = strview();
+        Metrics metrics;
+        metrics.char_length = (int)utf8::distance(str.begin(), str.end());
+        metrics.column_length = (int)utf8::column_distance(str.begin(), str.end());
+        metrics.ascii = true;
+        for (auto it = str.begin(); it != str.end(); ++it)
+        {
+            const unsigned char c = *it;
+            if ((c < 0x20 or c >= 0x7f) and not (c == '\n' and it + 1 == str.end()))
+            {
+                metrics.ascii = false;
+                break;
+            }
+        }
+        m_metrics = metrics;
+        m_metrics_computed.store(true, std::memory_order_release);
+    }
+    return m_metrics;
+}
+
 StringDataPtr StringData::create(ArrayView<const StringView> strs)
 {
     const int len = accumulate(strs, 0, [](int l, StringView s) {
@@ -23,22 +194,44 @@ StringDataPtr StringData::create(ArrayView<const StringView> strs)
     return RefPtr<StringData, PtrPolicy>{res};
 }
 
+StringDataPtr StringData::create_external(StringView str, RefPtr<RefCountable> owner)
+{
+    void* ptr = StringData::operator new(sizeof(StringData) + sizeof(External));
+    auto* res = new (ptr) StringData((int)str.length());
+    res->refcount |= external_flag;
+    new (res + 1) External{str.begin(), std::move(owner)};
+    return RefPtr<StringData, PtrPolicy>{res};
+}
+
 StringDataPtr StringData::Registry::intern(StringView str)
 {
-    auto it = m_strings.find(str);
+    const size_t hash = hash_data(str.data(), (int)str.length());
+    auto it = m_strings.find(str, hash);
     if (it != m_strings.end())
         return StringDataPtr{it->value};
 
-    auto data = StringData::create(str);
+    StringDataPtr data;
+    const char* shared = m_arena ? m_arena->lookup_or_insert(str) : nullptr;
+    if (shared) // reference the arena bytes instead of a private copy
+        data = StringData::create_external({shared, str.length()},
+                                           RefPtr<RefCountable>{m_arena.get()});
+    else
+        data = StringData::create(str);
     data->refcount |= interned_flag;
-    m_strings.insert({data->strview(), data.get()});
+    data->m_hash.store(hash, std::memory_order_relaxed);
+    m_strings.insert({data->strview(), data.get()}, hash);
     return data;
 }
 
-void StringData::Registry::remove(StringView str)
+void StringData::Registry::attach_arena(StringView path)
+{
+    m_arena = RefPtr<StringArena>{new StringArena{path}};
+}
+
+void StringData::Registry::remove(StringView str, size_t hash)
 {
     kak_assert(m_strings.contains(str));
-    m_strings.unordered_remove(str);
+    m_strings.unordered_remove(str, hash);
 }
 
 void StringData::Registry::debug_stats() const
@@ -54,6 +247,9 @@ void StringData::Registry::debug_stats() const
     }
     write_to_debug_buffer(format("  data size: {}, mean: {}", total_size, (float)total_size/count));
     write_to_debug_buffer(format("  refcounts: {}, mean: {}", total_refcount, (float)total_refcount/count));
+    if (m_arena)
+        write_to_debug_buffer(format("  arena used: {} / {}", m_arena->used(),
+                                     m_arena->capacity()));
 }
 
 }
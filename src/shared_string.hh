@@ -6,26 +6,109 @@
 #include "utils.hh"
 #include "hash_map.hh"
 
+#include <atomic>
 #include <numeric>
 
 namespace Kakoune
 {
 
+// Optional cross session string arena: a shared memory mapped, append
+// only log of strings. Sessions attaching the same arena file resolve
+// intern hits to the mapped bytes instead of private copies, so the
+// identifier universe of a big project is stored once per machine
+// instead of once per session. Only the bytes are shared; refcounts
+// and the lookup index stay session private.
+class StringArena : public RefCountable
+{
+public:
+    explicit StringArena(StringView path);
+    ~StringArena() override;
+
+    StringArena(const StringArena&) = delete;
+    StringArena& operator=(const StringArena&) = delete;
+
+    // pointer to the arena copy of str, appending it if needed; null
+    // when the arena is full and the caller should fall back to
+    // session private storage
+    const char* lookup_or_insert(StringView str);
+
+    size_t used() const;
+    size_t capacity() const;
+
+private:
+    struct Header;
+
+    void index_new_entries();
+
+    int m_fd = -1;
+    Header* m_header = nullptr;
+    char* m_log = nullptr;  // entry log following the header
+    size_t m_indexed = 0;   // prefix of the log indexed so far
+    HashMap<StringView, const char*, MemoryDomain::SharedString> m_index;
+};
+
 struct StringData : UseMemoryDomain<MemoryDomain::SharedString>
 {
     uint32_t refcount;
     const int length;
 
     [[gnu::always_inline]]
-    const char* data() const { return reinterpret_cast<const char*>(this + 1); }
+    const char* data() const
+    {
+        if (refcount & external_flag)
+            return reinterpret_cast<const External*>(this + 1)->data;
+        return reinterpret_cast<const char*>(this + 1);
+    }
     [[gnu::always_inline]]
     StringView strview() const { return {data(), length}; }
 
+    // metrics rendering keeps recomputing for the same immutable lines,
+    // computed lazily once per StringData
+    struct Metrics
+    {
+        int char_length;   // codepoint count
+        int column_length; // display width
+        // only printable single column ascii (a trailing newline aside),
+        // for which columns, codepoints and byte offsets all coincide
+        bool ascii;
+    };
+    const Metrics& metrics() const;
+
+    // interned strings serve as map keys all over (string registry,
+    // word databases); the content being immutable, the hash is
+    // computed at most once. Zero doubles as the not-yet-computed
+    // marker; a string actually hashing to zero just gets rehashed.
+    size_t hash() const
+    {
+        size_t hash = m_hash.load(std::memory_order_relaxed);
+        if (hash == 0)
+        {
+            hash = hash_data(data(), length);
+            m_hash.store(hash, std::memory_order_relaxed);
+        }
+        return hash;
+    }
+
 private:
     StringData(int len) : refcount(0), length(len) {}
 
     static constexpr uint32_t interned_flag = 1 << 31;
-    static constexpr uint32_t refcount_mask = ~interned_flag;
+    static constexpr uint32_t external_flag = 1 << 30;
+    static constexpr uint32_t refcount_mask = ~(interned_flag | external_flag);
+
+    // An external StringData references bytes it does not own, and keeps
+    // alive the object owning them (such as a MappedFile).
+    struct External
+    {
+        const char* data;
+        RefPtr<RefCountable> owner;
+    };
+
+    // the content is immutable so racing threads compute the same values,
+    // the release/acquire pair just orders the stores to m_metrics
+    mutable Metrics m_metrics;
+    mutable std::atomic<bool> m_metrics_computed{false};
+    mutable std::atomic<size_t> m_hash{0};
 
     struct PtrPolicy
     {
@@ -35,8 +118,14 @@ private:
             if ((--r->refcount & refcount_mask) == 0)
             {
                 if (r->refcount & interned_flag)
-                    Registry::instance().remove(r->strview());
-                StringData::operator delete(r, sizeof(StringData) + r->length + 1);
+                    Registry::instance().remove(r->strview(), r->hash());
+                if (r->refcount & external_flag)
+                {
+                    reinterpret_cast<External*>(r + 1)->~External();
+                    StringData::operator delete(r, sizeof(StringData) + sizeof(External));
+                }
+                else
+                    StringData::operator delete(r, sizeof(StringData) + r->length + 1);
             }
         }
         static void ptr_moved(StringData*, void*, void*) noexcept {}
@@ -50,13 +139,17 @@ public:
     public:
         void debug_stats() const;
         Ptr intern(StringView str);
-        void remove(StringView str);
+        void remove(StringView str, size_t hash);
+
+        void attach_arena(StringView path);
 
     private:
         HashMap<StringView, StringData*, MemoryDomain::SharedString> m_strings;
+        RefPtr<StringArena> m_arena;
     };
 
     static Ptr create(ArrayView<const StringView> strs);
+    static Ptr create_external(StringView str, RefPtr<RefCountable> owner);
 };
 
 using StringDataPtr = StringData::Ptr;
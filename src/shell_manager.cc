@@ -8,10 +8,14 @@
 #include "face_registry.hh"
 #include "file.hh"
 #include "flags.hh"
+#include "hash.hh"
+#include "hash_map.hh"
 #include "option.hh"
 #include "regex.hh"
 
 #include <cstring>
+#include <poll.h>
+#include <sys/socket.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <unistd.h>
@@ -57,6 +61,10 @@ ShellManager::ShellManager()
         auto new_path = format("{}:{}", path, split_path(get_kak_binary_path()).first);
         setenv("PATH", new_path.c_str(), 1);
     }
+
+    // Fork the spawn server now, while our address space is still small;
+    // it will fork the shell on our behalf for the rest of the session.
+    start_spawner();
 }
 
 namespace
@@ -83,15 +91,94 @@ private:
     int m_fd[2];
 };
 
+struct PipeReader : FDWatcher
+{
+    PipeReader(Pipe& pipe, String& contents)
+        : FDWatcher(pipe.read_fd(), FdEvents::Read,
+                    [&contents, &pipe](FDWatcher& watcher, FdEvents, EventMode) {
+                        // read in big chunks directly into the target string,
+                        // filters can pipe whole buffers through here
+                        constexpr ByteCount read_size = 65536;
+                        while (fd_readable(pipe.read_fd()))
+                        {
+                            const ByteCount cur = contents.length();
+                            contents.reserve(cur + read_size); // force_size alone would not keep the content on growth
+                            contents.force_size(cur + read_size);
+                            const ssize_t size = ::read(pipe.read_fd(), contents.data() + (int)cur,
+                                                        (size_t)(int)read_size);
+                            contents.force_size(cur + (size > 0 ? ByteCount{(int)size} : 0));
+                            if (size <= 0)
+                            {
+                                pipe.close_read_fd();
+                                watcher.disable();
+                                return;
+                            }
+                        }
+                    })
+    {}
+};
+
+struct PipeWriter : FDWatcher
+{
+    PipeWriter(Pipe& pipe, StringView contents)
+        : FDWatcher(pipe.write_fd(), FdEvents::Write,
+                    [contents, &pipe](FDWatcher& watcher, FdEvents, EventMode) mutable {
+                        while (fd_writable(pipe.write_fd()))
+                        {
+#ifdef __linux__
+                            // map the pages into the pipe instead of copying
+                            // them; the content outlives the shell process
+                            // and is not mutated while it runs
+                            iovec iov{ const_cast<char*>(contents.begin()),
+                                       (size_t)contents.length() };
+                            const ssize_t size = ::vmsplice(pipe.write_fd(), &iov, 1,
+                                                            SPLICE_F_NONBLOCK);
+#else
+                            const ssize_t size = ::write(pipe.write_fd(), contents.begin(),
+                                                         (size_t)contents.length());
+#endif
+                            if (size > 0)
+                                contents = contents.substr(ByteCount{(int)size});
+                            if (size == -1 and (errno == EAGAIN or errno == EWOULDBLOCK))
+                                return;
+                            if (size < 0 or contents.empty())
+                            {
+                                pipe.close_write_fd();
+                                watcher.disable();
+                                return;
+                            }
+                        }
+                    })
+    {
+        int flags = fcntl(pipe.write_fd(), F_GETFL, 0);
+        fcntl(pipe.write_fd(), F_SETFL, flags | O_NONBLOCK);
+    }
+};
+
+// The inherited environment is fixed once ShellManager's constructor has
+// adjusted PATH, so the pointer block is built a single time and each
+// spawn only appends its kak_* suffix.
+static const Vector<const char*>& inherited_environ()
+{
+    static const Vector<const char*> envptrs = [] {
+        Vector<const char*> res;
+        for (char** envp = environ; *envp; ++envp)
+            res.push_back(*envp);
+        return res;
+    }();
+    return envptrs;
+}
+
 template<typename Func>
 pid_t spawn_shell(const char* shell, StringView cmdline,
                   ConstArrayView<String> params,
                   ConstArrayView<String> kak_env,
                   Func setup_child)
 {
+    auto& inherited = inherited_environ();
     Vector<const char*> envptrs;
-    for (char** envp = environ; *envp; ++envp)
-        envptrs.push_back(*envp);
+    envptrs.reserve(inherited.size() + kak_env.size() + 1);
+    envptrs.insert(envptrs.end(), inherited.begin(), inherited.end());
     for (auto& env : kak_env)
         envptrs.push_back(env.c_str());
     envptrs.push_back(nullptr);
@@ -118,19 +205,35 @@ Vector<String> generate_env(StringView cmdline, const Context& context, const Sh
 {
     static const Regex re(R"(\bkak_(\w+)\b)");
 
-    Vector<String> kak_env;
-    for (RegexIterator<const char*> it{cmdline.begin(), cmdline.end(), re}, end;
-         it != end; ++it)
-    {
-        StringView name{(*it)[1].first, (*it)[1].second};
+    // hooks and mappings run the same script text over and over; remember
+    // which kak_* variables each script references so that only its first
+    // run pays for the regex scan
+    static HashMap<String, Vector<String>, MemoryDomain::EnvVars> reference_cache;
 
-        auto match_name = [&](const String& s) {
-            return s.length() > name.length()  and
-                   prefix_match(s, name) and s[name.length()] == '=';
-        };
-        if (contains_that(kak_env, match_name))
-            continue;
+    auto it = reference_cache.find(cmdline);
+    if (it == reference_cache.end())
+    {
+        // scripts normally come from the finite set of hooks, mappings
+        // and commands; keep generated ones from growing the cache
+        // without bound
+        if (reference_cache.size() >= 1024)
+            reference_cache.clear();
+
+        Vector<String> names;
+        for (RegexIterator<const char*> re_it{cmdline.begin(), cmdline.end(), re}, re_end;
+             re_it != re_end; ++re_it)
+        {
+            StringView name{(*re_it)[1].first, (*re_it)[1].second};
+            if (not contains(names, name))
+                names.push_back(name.str());
+        }
+        reference_cache.insert({cmdline.str(), std::move(names)});
+        it = reference_cache.find(cmdline);
+    }
 
+    Vector<String> kak_env;
+    for (auto& name : it->value)
+    {
         auto var_it = shell_context.env_vars.find(name);
         try
         {
@@ -144,8 +247,542 @@ Vector<String> generate_env(StringView cmdline, const Context& context, const Sh
     return kak_env;
 }
 
+bool read_fully(int fd, void* data, size_t size)
+{
+    char* ptr = static_cast<char*>(data);
+    while (size > 0)
+    {
+        const ssize_t res = ::read(fd, ptr, size);
+        if (res == 0 or (res < 0 and errno != EINTR))
+            return false;
+        if (res > 0)
+        {
+            ptr += res;
+            size -= res;
+        }
+    }
+    return true;
+}
+
+bool write_fully(int fd, const void* data, size_t size)
+{
+    const char* ptr = static_cast<const char*>(data);
+    while (size > 0)
+    {
+        const ssize_t res = ::write(fd, ptr, size);
+        if (res < 0 and errno != EINTR)
+            return false;
+        if (res > 0)
+        {
+            ptr += res;
+            size -= res;
+        }
+    }
+    return true;
+}
+
+// write end of the self pipe the spawn server uses to get SIGCHLD
+// notifications out of the handler and into its poll loop
+int spawn_server_sigchld_fd = -1;
+
+// Main loop of the spawn server, a dedicated process forked at startup
+// before buffers inflate the server RSS, so that its own forks stay cheap
+// for the lifetime of the session. Jobs arrive on sock as a length
+// prefixed message carrying the command line, with the child ends of the
+// stdin/stdout/stderr pipes attached as ancillary data; exit statuses
+// are reported back on the same socket as {job, status} pairs.
+[[noreturn]] void spawn_server(int sock, const char* shell)
+{
+    // the server file descriptors (session socket, epoll instance, ...)
+    // have no business surviving in shell processes
+    int max_fd = (int)sysconf(_SC_OPEN_MAX);
+    if (max_fd <= 0 or max_fd > 4096)
+        max_fd = 4096;
+    for (int fd = 3; fd < max_fd; ++fd)
+    {
+        if (fd != sock)
+            ::close(fd);
+    }
+
+    int sigchld_pipe[2];
+    if (::pipe(sigchld_pipe) != 0)
+        _exit(-1);
+    for (int fd : sigchld_pipe)
+        fcntl(fd, F_SETFL, O_NONBLOCK);
+    spawn_server_sigchld_fd = sigchld_pipe[1];
+    set_signal_handler(SIGCHLD, [](int) {
+        char byte = 0;
+        (void)::write(spawn_server_sigchld_fd, &byte, 1);
+    });
+    // a control-c in a client sends SIGINT to the whole process group to
+    // kill spawned shells; it must not take the spawn server down as well
+    set_signal_handler(SIGINT, SIG_IGN);
+
+    struct Child { pid_t pid; uint32_t job; };
+    Vector<Child> children;
+
+    auto report = [sock](uint32_t job, uint32_t status) {
+        const uint32_t record[2] = { job, status };
+        if (not write_fully(sock, record, sizeof record))
+            _exit(0);
+    };
+
+    while (true)
+    {
+        pollfd fds[2] = { { sock, POLLIN, 0 },
+                          { sigchld_pipe[0], POLLIN, 0 } };
+        if (::poll(fds, 2, -1) < 0 and errno != EINTR)
+            _exit(-1);
+
+        char drain[32];
+        while (::read(sigchld_pipe[0], drain, sizeof drain) > 0) {}
+
+        int status = 0;
+        pid_t pid;
+        while ((pid = ::waitpid(-1, &status, WNOHANG)) > 0)
+        {
+            auto it = find_if(children, [pid](const Child& child) {
+                return child.pid == pid;
+            });
+            if (it == children.end())
+                continue;
+            const uint32_t job = it->job;
+            children.erase(it);
+            report(job, (uint32_t)status);
+        }
+
+        if (not (fds[0].revents & (POLLIN | POLLHUP)))
+            continue;
+
+        // the pipe fds ride along with the length prefix
+        uint32_t length = 0;
+        int job_fds[3] = { -1, -1, -1 };
+        {
+            iovec iov{ &length, sizeof length };
+            alignas(cmsghdr) char cmsg_buf[CMSG_SPACE(sizeof job_fds)];
+            msghdr msg{};
+            msg.msg_iov = &iov;
+            msg.msg_iovlen = 1;
+            msg.msg_control = cmsg_buf;
+            msg.msg_controllen = sizeof cmsg_buf;
+            const ssize_t res = ::recvmsg(sock, &msg, 0);
+            if (res == 0) // the server closed its end, we are done
+                _exit(0);
+            if (res < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                _exit(-1);
+            }
+            for (cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg;
+                 cmsg = CMSG_NXTHDR(&msg, cmsg))
+            {
+                if (cmsg->cmsg_level == SOL_SOCKET and
+                    cmsg->cmsg_type == SCM_RIGHTS)
+                    memcpy(job_fds, CMSG_DATA(cmsg), sizeof job_fds);
+            }
+            if (res < (ssize_t)sizeof length and
+                not read_fully(sock, (char*)&length + res, sizeof length - res))
+                _exit(0);
+        }
+
+        Vector<char> payload;
+        payload.resize(length);
+        if (not read_fully(sock, payload.data(), length))
+            _exit(0);
+
+        const char* ptr = payload.data();
+        auto read_u32 = [&ptr] {
+            uint32_t res;
+            memcpy(&res, ptr, sizeof res);
+            ptr += sizeof res;
+            return res;
+        };
+        auto read_str = [&] {
+            const uint32_t len = read_u32();
+            String res{StringView{ptr, (int)len}};
+            ptr += len;
+            return res;
+        };
+
+        const uint32_t job = read_u32();
+        const String cwd = read_str();
+        const String cmdline = read_str();
+        Vector<String> params;
+        for (uint32_t i = read_u32(); i > 0; --i)
+            params.push_back(read_str());
+        Vector<String> kak_env;
+        for (uint32_t i = read_u32(); i > 0; --i)
+            kak_env.push_back(read_str());
+
+        pid = fork();
+        if (pid == 0)
+        {
+            auto move = [](int oldfd, int newfd) { dup2(oldfd, newfd); close(oldfd); };
+            move(job_fds[0], 0);
+            move(job_fds[1], 1);
+            move(job_fds[2], 2);
+            ::close(sock);
+            ::close(sigchld_pipe[0]);
+            ::close(sigchld_pipe[1]);
+            set_signal_handler(SIGCHLD, SIG_DFL);
+            set_signal_handler(SIGINT, SIG_DFL);
+            // the server might have changed directory since we forked
+            if (not cwd.empty())
+                (void)::chdir(cwd.c_str());
+
+            auto& inherited = inherited_environ();
+            Vector<const char*> envptrs;
+            envptrs.reserve(inherited.size() + kak_env.size() + 1);
+            envptrs.insert(envptrs.end(), inherited.begin(), inherited.end());
+            for (auto& env : kak_env)
+                envptrs.push_back(env.c_str());
+            envptrs.push_back(nullptr);
+
+            Vector<const char*> execparams = { shell, "-c", cmdline.c_str() };
+            if (not params.empty())
+                execparams.push_back(shell);
+            for (auto& param : params)
+                execparams.push_back(param.c_str());
+            execparams.push_back(nullptr);
+
+            execve(shell, (char* const*)execparams.data(), (char* const*)envptrs.data());
+            _exit(-1);
+        }
+        for (int fd : job_fds)
+            ::close(fd);
+        if (pid > 0)
+            children.push_back({ pid, job });
+        else
+            report(job, (uint32_t)-1);
+    }
+}
+
 }
 
+// Server side handle to the spawn server; if anything goes wrong with it
+// eval falls back to forking the shell directly.
+struct ShellManager::Spawner
+{
+    Spawner(const String& shell)
+    {
+        int sockets[2];
+        if (::socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) != 0)
+            return;
+
+        const pid_t pid = fork();
+        if (pid < 0)
+        {
+            ::close(sockets[0]);
+            ::close(sockets[1]);
+            return;
+        }
+        if (pid == 0)
+        {
+            ::close(sockets[0]);
+            spawn_server(sockets[1], shell.c_str());
+        }
+        ::close(sockets[1]);
+        fcntl(sockets[0], F_SETFD, FD_CLOEXEC);
+        m_pid = pid;
+        m_socket = sockets[0];
+        m_env_hash = environ_hash();
+        m_watcher.reset(new FDWatcher{m_socket, FdEvents::Read,
+                                      [this](FDWatcher&, FdEvents, EventMode) {
+                                          read_statuses();
+                                      }});
+    }
+
+    ~Spawner()
+    {
+        drop(); // the spawn server exits when its socket gets closed
+        if (m_pid != -1)
+            ::waitpid(m_pid, nullptr, 0);
+    }
+
+    // the spawn server cannot see setenv calls made after it was forked;
+    // environment mutating cases have to fall back to a direct fork
+    bool usable() const
+    {
+        return m_socket != -1 and environ_hash() == m_env_hash;
+    }
+
+    uint32_t spawn(StringView cmdline, ConstArrayView<String> params,
+                   ConstArrayView<String> kak_env,
+                   int stdin_fd, int stdout_fd, int stderr_fd)
+    {
+        Vector<char> payload;
+        auto write_u32 = [&payload](uint32_t value) {
+            payload.insert(payload.end(), (const char*)&value,
+                           (const char*)&value + sizeof value);
+        };
+        auto write_str = [&](StringView str) {
+            write_u32((uint32_t)(int)str.length());
+            payload.insert(payload.end(), str.begin(), str.end());
+        };
+
+        const uint32_t job = ++m_next_job;
+        write_u32(job);
+        char cwd[1024];
+        write_str(::getcwd(cwd, sizeof cwd) ? StringView{cwd} : StringView{});
+        write_str(cmdline);
+        write_u32((uint32_t)params.size());
+        for (auto& param : params)
+            write_str(param);
+        write_u32((uint32_t)kak_env.size());
+        for (auto& env : kak_env)
+            write_str(env);
+
+        uint32_t length = (uint32_t)payload.size();
+        int job_fds[3] = { stdin_fd, stdout_fd, stderr_fd };
+        iovec iov[2] = { { &length, sizeof length },
+                         { payload.data(), payload.size() } };
+        alignas(cmsghdr) char cmsg_buf[CMSG_SPACE(sizeof job_fds)] = {};
+        msghdr msg{};
+        msg.msg_iov = iov;
+        msg.msg_iovlen = 2;
+        msg.msg_control = cmsg_buf;
+        msg.msg_controllen = sizeof cmsg_buf;
+        cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof job_fds);
+        memcpy(CMSG_DATA(cmsg), job_fds, sizeof job_fds);
+
+        ssize_t sent;
+        while ((sent = ::sendmsg(m_socket, &msg, 0)) < 0 and errno == EINTR) {}
+        if (sent < (ssize_t)sizeof length)
+        {
+            drop();
+            return 0;
+        }
+        const size_t payload_sent = (size_t)sent - sizeof length;
+        if (not write_fully(m_socket, payload.data() + payload_sent,
+                            payload.size() - payload_sent))
+        {
+            drop();
+            return 0;
+        }
+        return job;
+    }
+
+    bool finished(uint32_t job, int& status)
+    {
+        auto it = find_if(m_done, [job](const std::pair<uint32_t, int>& res) {
+            return res.first == job;
+        });
+        if (it != m_done.end())
+        {
+            status = it->second;
+            m_done.erase(it);
+            return true;
+        }
+        if (m_socket == -1) // the spawn server died with jobs in flight
+        {
+            status = -1;
+            return true;
+        }
+        return false;
+    }
+
+private:
+    static size_t environ_hash()
+    {
+        size_t res = 0;
+        for (char** envp = environ; *envp; ++envp)
+            res = combine_hash(res, hash_data(*envp, (int)strlen(*envp)));
+        return res;
+    }
+
+    void read_statuses()
+    {
+        char buffer[256];
+        while (m_socket != -1 and fd_readable(m_socket))
+        {
+            const ssize_t size = ::read(m_socket, buffer, sizeof buffer);
+            if (size <= 0)
+            {
+                drop();
+                break;
+            }
+            m_partial.insert(m_partial.end(), buffer, buffer + size);
+        }
+        while (m_partial.size() >= sizeof(uint32_t) * 2)
+        {
+            uint32_t record[2];
+            memcpy(record, m_partial.data(), sizeof record);
+            m_partial.erase(m_partial.begin(), m_partial.begin() + sizeof record);
+            m_done.push_back({ record[0], (int)record[1] });
+        }
+        // one of the statuses might belong to an async job nobody is
+        // actively waiting on
+        ShellManager::instance().schedule_async_check();
+    }
+
+    void drop()
+    {
+        if (m_watcher)
+            m_watcher->close_fd(); // closes m_socket as well
+        m_socket = -1;
+    }
+
+    pid_t m_pid = -1;
+    int m_socket = -1;
+    size_t m_env_hash = 0;
+    uint32_t m_next_job = 0;
+    std::unique_ptr<FDWatcher> m_watcher;
+    Vector<char> m_partial;
+    Vector<std::pair<uint32_t, int>> m_done;
+};
+
+void ShellManager::start_spawner()
+{
+    m_spawner.reset(new Spawner{m_shell});
+}
+
+// A shell command run without anybody waiting on it; the pipe watchers
+// accumulate its output and completion is detected from the event loop
+// in check_async_jobs.
+struct ShellManager::AsyncJob
+{
+    AsyncJob(std::function<void (String, int)> on_completion)
+        : on_completion{std::move(on_completion)} {}
+
+    static FDWatcher::Callback read_and_notify(Pipe& pipe, String& contents)
+    {
+        return [&pipe, &contents](FDWatcher& watcher, FdEvents, EventMode) {
+            char buffer[1024];
+            while (fd_readable(pipe.read_fd()))
+            {
+                const ssize_t size = ::read(pipe.read_fd(), buffer, sizeof buffer);
+                if (size <= 0)
+                {
+                    pipe.close_read_fd();
+                    watcher.disable();
+                    ShellManager::instance().schedule_async_check();
+                    return;
+                }
+                contents += StringView{buffer, buffer+size};
+            }
+        };
+    }
+
+    Pipe child_stdout;
+    Pipe child_stderr;
+    String stdout_contents;
+    String stderr_contents;
+    FDWatcher stdout_watcher{child_stdout.read_fd(), FdEvents::Read,
+                             read_and_notify(child_stdout, stdout_contents)};
+    FDWatcher stderr_watcher{child_stderr.read_fd(), FdEvents::Read,
+                             read_and_notify(child_stderr, stderr_contents)};
+    uint32_t job = 0;
+    pid_t pid = -1;
+    int status = 0;
+    bool terminated = false;
+    std::function<void (String, int)> on_completion;
+};
+
+void ShellManager::spawn_async(StringView cmdline, const Context& context,
+                               const ShellContext& shell_context,
+                               std::function<void (String output, int status)> on_completion)
+{
+    const DebugFlags debug_flags = context.options()["debug"].get<DebugFlags>();
+    if (debug_flags & DebugFlags::Shell)
+        write_to_debug_buffer(format("shell-async:\n{}\n----\n", cmdline));
+
+    auto kak_env = generate_env(cmdline, context, shell_context);
+
+    auto job = std::make_unique<AsyncJob>(std::move(on_completion));
+    if (m_spawner and m_spawner->usable())
+    {
+        const int dev_null = open("/dev/null", O_RDONLY);
+        job->job = m_spawner->spawn(cmdline, shell_context.params, kak_env, dev_null,
+                                    job->child_stdout.write_fd(),
+                                    job->child_stderr.write_fd());
+        close(dev_null);
+    }
+    if (job->job == 0)
+        job->pid = spawn_shell(m_shell.c_str(), cmdline, shell_context.params, kak_env,
+                               [&job] {
+            auto move = [](int oldfd, int newfd) { dup2(oldfd, newfd); close(oldfd); };
+            move(open("/dev/null", O_RDONLY), 0);
+
+            close(job->child_stdout.read_fd());
+            move(job->child_stdout.write_fd(), 1);
+
+            close(job->child_stderr.read_fd());
+            move(job->child_stderr.write_fd(), 2);
+        });
+    job->child_stdout.close_write_fd();
+    job->child_stderr.close_write_fd();
+
+    if (not m_async_pump)
+        m_async_pump.reset(new Timer{TimePoint::max(), [this](Timer&) {
+            check_async_jobs();
+        }, EventMode::Normal});
+
+    const bool direct_fork = job->pid != -1;
+    m_async_jobs.push_back(std::move(job));
+    // spawn server jobs get their status pushed on the socket; for a
+    // direct fork there is nothing to wake us up, so poll
+    if (direct_fork)
+        m_async_pump->set_next_date(Clock::now() + std::chrono::milliseconds{100});
+}
+
+void ShellManager::schedule_async_check()
+{
+    if (m_async_pump and not m_async_jobs.empty())
+        m_async_pump->set_next_date(Clock::now());
+}
+
+void ShellManager::check_async_jobs()
+{
+    for (size_t i = 0; i < m_async_jobs.size(); )
+    {
+        auto& job = *m_async_jobs[i];
+        if (not job.terminated)
+        {
+            if (job.job != 0)
+                job.terminated = m_spawner->finished(job.job, job.status);
+            else if (job.pid != -1)
+                job.terminated = waitpid(job.pid, &job.status, WNOHANG) != 0;
+        }
+        if (not job.terminated or job.child_stdout.read_fd() != -1 or
+            job.child_stderr.read_fd() != -1)
+        {
+            ++i;
+            continue;
+        }
+
+        auto done = std::move(m_async_jobs[i]);
+        m_async_jobs.erase(m_async_jobs.begin() + i);
+
+        if (not done->stderr_contents.empty())
+            write_to_debug_buffer(format("shell stderr: <<<\n{}>>>",
+                                         done->stderr_contents));
+        try
+        {
+            done->on_completion(std::move(done->stdout_contents),
+                                WIFEXITED(done->status) ? WEXITSTATUS(done->status) : -1);
+        }
+        catch (runtime_error& error)
+        {
+            write_to_debug_buffer(format("error in async shell callback: {}",
+                                         error.what()));
+        }
+        // the callback may have spawned or completed other jobs
+        i = 0;
+    }
+
+    // keep polling as long as a direct fork is still running
+    if (contains_that(m_async_jobs, [](const std::unique_ptr<AsyncJob>& job) {
+            return job->pid != -1 and not job->terminated;
+        }))
+        m_async_pump->set_next_date(Clock::now() + std::chrono::milliseconds{100});
+}
+
+ShellManager::~ShellManager() = default;
+
 std::pair<String, int> ShellManager::eval(
     StringView cmdline, const Context& context, StringView input,
     Flags flags, const ShellContext& shell_context)
@@ -162,24 +799,39 @@ std::pair<String, int> ShellManager::eval(
     auto spawn_time = profile ? Clock::now() : Clock::time_point{};
 
     Pipe child_stdin{not input.empty()}, child_stdout, child_stderr;
-    pid_t pid = spawn_shell(m_shell.c_str(), cmdline, shell_context.params, kak_env,
-                            [&child_stdin, &child_stdout, &child_stderr] {
-        auto move = [](int oldfd, int newfd) { dup2(oldfd, newfd); close(oldfd); };
 
-        if (child_stdin.read_fd() != -1)
-        {
-            close(child_stdin.write_fd());
-            move(child_stdin.read_fd(), 0);
-        }
-        else
-            move(open("/dev/null", O_RDONLY), 0);
+    pid_t pid = -1;
+    uint32_t job = 0;
+    if (m_spawner and m_spawner->usable())
+    {
+        int stdin_fd = child_stdin.read_fd();
+        const int dev_null = stdin_fd == -1 ? open("/dev/null", O_RDONLY) : -1;
+        if (dev_null != -1)
+            stdin_fd = dev_null;
+        job = m_spawner->spawn(cmdline, shell_context.params, kak_env, stdin_fd,
+                               child_stdout.write_fd(), child_stderr.write_fd());
+        if (dev_null != -1)
+            close(dev_null);
+    }
+    if (job == 0)
+        pid = spawn_shell(m_shell.c_str(), cmdline, shell_context.params, kak_env,
+                          [&child_stdin, &child_stdout, &child_stderr] {
+            auto move = [](int oldfd, int newfd) { dup2(oldfd, newfd); close(oldfd); };
+
+            if (child_stdin.read_fd() != -1)
+            {
+                close(child_stdin.write_fd());
+                move(child_stdin.read_fd(), 0);
+            }
+            else
+                move(open("/dev/null", O_RDONLY), 0);
 
-        close(child_stdout.read_fd());
-        move(child_stdout.write_fd(), 1);
+            close(child_stdout.read_fd());
+            move(child_stdout.write_fd(), 1);
 
-        close(child_stderr.read_fd());
-        move(child_stderr.write_fd(), 2);
-    });
+            close(child_stderr.read_fd());
+            move(child_stderr.write_fd(), 2);
+        });
 
     child_stdin.close_read_fd();
     child_stdout.close_write_fd();
@@ -187,54 +839,6 @@ std::pair<String, int> ShellManager::eval(
 
     auto wait_time = Clock::now();
 
-    struct PipeReader : FDWatcher
-    {
-        PipeReader(Pipe& pipe, String& contents)
-            : FDWatcher(pipe.read_fd(), FdEvents::Read,
-                        [&contents, &pipe](FDWatcher& watcher, FdEvents, EventMode) {
-                            char buffer[1024];
-                            while (fd_readable(pipe.read_fd()))
-                            {
-                                size_t size = ::read(pipe.read_fd(), buffer, 1024);
-                                if (size <= 0)
-                                {
-                                    pipe.close_read_fd();
-                                    watcher.disable();
-                                    return;
-                                }
-                                contents += StringView{buffer, buffer+size};
-                            }
-                        })
-        {}
-    };
-
-    struct PipeWriter : FDWatcher
-    {
-        PipeWriter(Pipe& pipe, StringView contents)
-            : FDWatcher(pipe.write_fd(), FdEvents::Write,
-                        [contents, &pipe](FDWatcher& watcher, FdEvents, EventMode) mutable {
-                            while (fd_writable(pipe.write_fd()))
-                            {
-                                ssize_t size = ::write(pipe.write_fd(), contents.begin(),
-                                                       (size_t)contents.length());
-                                if (size > 0)
-                                    contents = contents.substr(ByteCount{(int)size});
-                                if (size == -1 and (errno == EAGAIN or errno == EWOULDBLOCK))
-                                    return;
-                                if (size < 0 or contents.empty())
-                                {
-                                    pipe.close_write_fd();
-                                    watcher.disable();
-                                    return;
-                                }
-                            }
-                        })
-        {
-            int flags = fcntl(pipe.write_fd(), F_GETFL, 0);
-            fcntl(pipe.write_fd(), F_SETFL, flags | O_NONBLOCK);
-        }
-    };
-
     String stdout_contents, stderr_contents;
     PipeReader stdout_reader{child_stdout, stdout_contents};
     PipeReader stderr_reader{child_stderr, stderr_contents};
@@ -250,7 +854,8 @@ std::pair<String, int> ShellManager::eval(
 
     int status = 0;
     // check for termination now that SIGCHLD is blocked
-    bool terminated = waitpid(pid, &status, WNOHANG) != 0;
+    bool terminated = job != 0 ? m_spawner->finished(job, status)
+                               : waitpid(pid, &status, WNOHANG) != 0;
 
     using namespace std::chrono;
     static constexpr seconds wait_timeout{1};
@@ -271,7 +876,8 @@ std::pair<String, int> ShellManager::eval(
     {
         EventManager::instance().handle_next_events(EventMode::Urgent, &orig_mask);
         if (not terminated)
-            terminated = waitpid(pid, &status, WNOHANG) != 0;
+            terminated = job != 0 ? m_spawner->finished(job, status)
+                                  : waitpid(pid, &status, WNOHANG) != 0;
     }
 
     if (not stderr_contents.empty())
@@ -7,10 +7,13 @@
 #include "utils.hh"
 #include "completion.hh"
 
+#include <memory>
+
 namespace Kakoune
 {
 
 class Context;
+class Timer;
 
 using EnvVarRetriever = std::function<String (StringView name, const Context&)>;
 
@@ -24,6 +27,7 @@ class ShellManager : public Singleton<ShellManager>
 {
 public:
     ShellManager();
+    ~ShellManager();
 
     enum class Flags
     {
@@ -37,13 +41,33 @@ public:
                                 Flags flags = Flags::WaitForStdout,
                                 const ShellContext& shell_context = {});
 
+    // run cmdline without blocking the event loop; once the process has
+    // exited and its output has been drained, on_completion is called
+    // with the contents of stdout and the exit status
+    void spawn_async(StringView cmdline, const Context& context,
+                     const ShellContext& shell_context,
+                     std::function<void (String output, int status)> on_completion);
+
     void register_env_var(StringView str, bool prefix, EnvVarRetriever retriever);
     String get_val(StringView name, const Context& context) const;
 
     CandidateList complete_env_var(StringView prefix, ByteCount cursor_pos) const;
 
 private:
+    // handle to the spawn server process that forks the shell on our
+    // behalf, so that eval does not duplicate a large server address
+    // space on every %sh{} expansion
+    struct Spawner;
+    void start_spawner();
+
+    struct AsyncJob;
+    void schedule_async_check();
+    void check_async_jobs();
+
     String m_shell;
+    std::unique_ptr<Spawner> m_spawner;
+    Vector<std::unique_ptr<AsyncJob>, MemoryDomain::EnvVars> m_async_jobs;
+    std::unique_ptr<Timer> m_async_pump;
 
     struct EnvVarDesc { String str; bool prefix; EnvVarRetriever func; };
     Vector<EnvVarDesc, MemoryDomain::EnvVars> m_env_vars;
@@ -117,8 +117,10 @@ void String::Data::append(const char* str, size_t len)
 
 void String::Data::clear()
 {
-    release();
-    set_empty();
+    // keep the allocation around, reused strings would pay a release
+    // and reallocate cycle on every use otherwise
+    set_size(0);
+    data()[0] = 0;
 }
 
 void String::Data::release()
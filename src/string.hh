@@ -200,7 +200,9 @@ public:
 
     private:
         void release();
-        void set_empty() { s.size = 1; }
+        // terminate the small buffer so that c_str() is valid on a
+        // default constructed String
+        void set_empty() { s.size = 1; s.string[0] = 0; }
         void set_short(const char* data, size_t size);
     };
 
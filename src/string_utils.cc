@@ -386,6 +386,15 @@ String format(StringView fmt, ArrayView<const StringView> params)
     return res;
 }
 
+void format_to(String& out, StringView fmt, ArrayView<const StringView> params)
+{
+    ByteCount size = fmt.length();
+    for (auto& s : params) size += s.length();
+    out.reserve(out.length() + size);
+
+    format_impl(fmt, params, [&](StringView s) { out += s; });
+}
+
 UnitTest test_string{[]()
 {
     kak_assert(String("youpi ") + "matin" == "youpi matin");
@@ -110,6 +110,16 @@ StringView format_to(ArrayView<char> buffer, StringView fmt, Types&&... params)
     return format_to(buffer, fmt, ArrayView<const StringView>{detail::format_param(std::forward<Types>(params))...});
 }
 
+// append to an existing String, avoiding the temporary that
+// `out += format(...)` would build
+void format_to(String& out, StringView fmt, ArrayView<const StringView> params);
+
+template<typename... Types>
+void format_to(String& out, StringView fmt, Types&&... params)
+{
+    format_to(out, fmt, ArrayView<const StringView>{detail::format_param(std::forward<Types>(params))...});
+}
+
 }
 
 #endif // string_utils_hh_INCLUDED
@@ -0,0 +1,84 @@
+#include "trace.hh"
+
+#include "exception.hh"
+#include "string_utils.hh"
+
+#include <cstdio>
+#include <unistd.h>
+
+namespace Kakoune
+{
+
+bool tracing_enabled = false;
+
+namespace
+{
+
+FILE* trace_file = nullptr;
+TimePoint trace_begin;
+bool trace_first_event = false;
+
+String escape_json(StringView str)
+{
+    String res;
+    for (auto c : str)
+    {
+        if (c == '"' or c == '\\')
+        {
+            res += '\\';
+            res += c;
+        }
+        else if ((unsigned char)c < 0x20)
+            res += ' ';
+        else
+            res += c;
+    }
+    return res;
+}
+
+}
+
+void trace_start(StringView path)
+{
+    if (trace_file)
+        throw runtime_error("tracing is already active");
+
+    trace_file = fopen(path.zstr(), "w");
+    if (not trace_file)
+        throw runtime_error(format("unable to open '{}' for writing", path));
+
+    fputs("[\n", trace_file);
+    trace_begin = Clock::now();
+    trace_first_event = true;
+    tracing_enabled = true;
+}
+
+void trace_stop()
+{
+    if (not trace_file)
+        throw runtime_error("tracing is not active");
+
+    tracing_enabled = false;
+    fputs("\n]\n", trace_file);
+    fclose(trace_file);
+    trace_file = nullptr;
+}
+
+void trace_span(StringView category, StringView name,
+                TimePoint begin, TimePoint end)
+{
+    if (not trace_file)
+        return;
+
+    using namespace std::chrono;
+    fprintf(trace_file,
+            "%s{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":0,"
+            "\"ts\":%lld,\"dur\":%lld}",
+            trace_first_event ? "" : ",\n",
+            escape_json(name).c_str(), escape_json(category).c_str(), (int)getpid(),
+            (long long)duration_cast<microseconds>(begin - trace_begin).count(),
+            (long long)duration_cast<microseconds>(end - begin).count());
+    trace_first_event = false;
+}
+
+}
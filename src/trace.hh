@@ -0,0 +1,52 @@
+#ifndef trace_hh_INCLUDED
+#define trace_hh_INCLUDED
+
+#include "clock.hh"
+#include "string.hh"
+
+namespace Kakoune
+{
+
+// Runtime toggled chrome trace-event recording. While active, scoped
+// spans timestamp hook runs, highlighter passes, command executions and
+// redraws into a json file loadable in chrome://tracing, so that slow
+// configurations can be bisected without instrumenting anything.
+
+extern bool tracing_enabled;
+
+void trace_start(StringView path);
+void trace_stop();
+
+// emit one complete span, in the category/name columns of the viewer
+void trace_span(StringView category, StringView name,
+                TimePoint begin, TimePoint end);
+
+struct TraceScope
+{
+    TraceScope(StringView category, StringView name)
+    {
+        if (tracing_enabled)
+        {
+            m_category = category;
+            m_name = name.str();
+            m_begin = Clock::now();
+            m_active = true;
+        }
+    }
+
+    ~TraceScope()
+    {
+        if (m_active and tracing_enabled)
+            trace_span(m_category, m_name, m_begin, Clock::now());
+    }
+
+private:
+    bool m_active = false;
+    StringView m_category;
+    String m_name;
+    TimePoint m_begin;
+};
+
+}
+
+#endif // trace_hh_INCLUDED
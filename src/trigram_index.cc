@@ -0,0 +1,258 @@
+#include "trigram_index.hh"
+
+#include "line_modification.hh"
+#include "unit_tests.hh"
+#include "value.hh"
+
+#include <thread>
+
+namespace Kakoune
+{
+
+using TrigramList = Vector<uint32_t, MemoryDomain::TrigramIndex>;
+
+static uint32_t trigram_at(const char* p)
+{
+    return ((uint32_t)(unsigned char)p[0] << 16) |
+           ((uint32_t)(unsigned char)p[1] << 8) |
+            (uint32_t)(unsigned char)p[2];
+}
+
+// trigrams of the given line content, sorted and deduplicated so every
+// posting lists a line at most once
+static void line_trigrams(StringView content, TrigramList& res)
+{
+    res.clear();
+    const char* data = content.begin();
+    for (int i = 0, len = (int)content.length(); i + 2 < len; ++i)
+        res.push_back(trigram_at(data + i));
+    std::sort(res.begin(), res.end());
+    res.erase(std::unique(res.begin(), res.end()), res.end());
+}
+
+TrigramIndex::TrigramIndex(const Buffer& buffer)
+    : m_buffer{&buffer}
+{
+    rebuild();
+}
+
+TrigramIndex& TrigramIndex::get(const Buffer& buffer)
+{
+    static const ValueId id = get_free_value_id();
+    Value& value = buffer.values()[id];
+    if (not value)
+        value = Value(TrigramIndex{buffer});
+    return value.as<TrigramIndex>();
+}
+
+void TrigramIndex::rebuild()
+{
+    auto& buffer = *m_buffer;
+
+    m_postings.clear();
+    m_lines.clear();
+    m_lines.reserve((int)buffer.line_count());
+    ByteCount total_bytes = 0;
+    for (auto line = 0_line, end = buffer.line_count(); line < end; ++line)
+    {
+        m_lines.push_back(buffer.line_storage(line));
+        total_bytes += m_lines.back()->strview().length();
+    }
+
+    // per chunk posting tables, built on worker threads for big enough
+    // buffers; the workers only read the line storage owned by m_lines,
+    // and as chunks are merged in order the postings come out sorted.
+    auto scan_range = [this](size_t begin, size_t end, Postings& postings) {
+        TrigramList trigrams;
+        for (size_t i = begin; i != end; ++i)
+        {
+            line_trigrams(m_lines[i]->strview(), trigrams);
+            for (auto trigram : trigrams)
+                postings[trigram].push_back(LineCount{(int)i});
+        }
+    };
+
+    constexpr ByteCount parallel_threshold = 8 * 1024 * 1024;
+    const size_t max_threads = std::thread::hardware_concurrency();
+    if (total_bytes < parallel_threshold or max_threads <= 1)
+        scan_range(0, m_lines.size(), m_postings);
+    else
+    {
+        const size_t num_chunks = std::min(max_threads, (size_t)16);
+        const size_t per_chunk = (m_lines.size() + num_chunks - 1) / num_chunks;
+        std::vector<Postings> partial(num_chunks);
+        std::vector<std::thread> threads;
+        for (size_t i = 0; i < num_chunks; ++i)
+        {
+            const size_t begin = std::min(i * per_chunk, m_lines.size());
+            const size_t end = std::min((i+1) * per_chunk, m_lines.size());
+            threads.emplace_back([=, &partial]{ scan_range(begin, end, partial[i]); });
+        }
+        for (auto& thread : threads)
+            thread.join();
+
+        for (auto& table : partial)
+        {
+            for (auto& entry : table)
+            {
+                auto& lines = m_postings[entry.key];
+                lines.insert(lines.end(), entry.value.begin(), entry.value.end());
+            }
+        }
+    }
+    m_timestamp = buffer.timestamp();
+}
+
+void TrigramIndex::update()
+{
+    auto& buffer = *m_buffer;
+    if (buffer.timestamp() == m_timestamp)
+        return;
+
+    auto modifs = compute_line_modifications(buffer, m_timestamp);
+    m_timestamp = buffer.timestamp();
+    if (modifs.empty())
+        return;
+
+    // incrementally patching the postings does not pay off once most of
+    // the buffer changed
+    size_t touched = 0;
+    for (auto& modif : modifs)
+        touched += (size_t)(int)std::max(modif.num_removed, modif.num_added);
+    if (touched * 2 >= m_lines.size())
+        return rebuild();
+
+    // splice the line list as WordDB::update_db does, recording where
+    // every old line ends up (-1 when removed) and the trigrams the
+    // added lines bring in
+    Lines new_lines;
+    new_lines.reserve((int)buffer.line_count());
+    Vector<int, MemoryDomain::TrigramIndex> old_to_new(m_lines.size());
+    Postings added;
+    TrigramList trigrams;
+    auto collect_added = [&](LineCount new_line) {
+        line_trigrams(new_lines.back()->strview(), trigrams);
+        for (auto trigram : trigrams)
+            added[trigram].push_back(new_line);
+    };
+
+    auto old_line = 0_line;
+    for (auto& modif : modifs)
+    {
+        kak_assert(old_line <= modif.old_line);
+        while (old_line < modif.old_line)
+        {
+            old_to_new[(int)old_line] = (int)new_lines.size();
+            new_lines.push_back(std::move(m_lines[(int)old_line++]));
+        }
+        kak_assert((int)new_lines.size() == (int)modif.new_line);
+
+        while (old_line < modif.old_line + modif.num_removed)
+            old_to_new[(int)old_line++] = -1;
+
+        for (auto l = 0_line; l < modif.num_added; ++l)
+        {
+            new_lines.push_back(buffer.line_storage(modif.new_line + l));
+            collect_added(modif.new_line + l);
+        }
+    }
+    while (old_line != (int)m_lines.size())
+    {
+        old_to_new[(int)old_line] = (int)new_lines.size();
+        new_lines.push_back(std::move(m_lines[(int)old_line++]));
+    }
+    m_lines = std::move(new_lines);
+
+    // remap surviving lines and drop removed ones in place; the mapping
+    // is monotonic so postings stay sorted
+    for (auto& posting : m_postings)
+    {
+        auto& lines = posting.value;
+        auto out = lines.begin();
+        for (auto line : lines)
+        {
+            const int new_line = old_to_new[(int)line];
+            if (new_line != -1)
+                *out++ = LineCount{new_line};
+        }
+        lines.erase(out, lines.end());
+    }
+
+    // added lines occupy slots no surviving line maps to, so merging
+    // cannot introduce duplicates
+    for (auto& entry : added)
+    {
+        auto& lines = m_postings[entry.key];
+        const auto old_size = lines.size();
+        lines.insert(lines.end(), entry.value.begin(), entry.value.end());
+        std::inplace_merge(lines.begin(), lines.begin() + old_size, lines.end());
+    }
+}
+
+TrigramIndex::LineList TrigramIndex::candidate_lines(StringView literal) const
+{
+    kak_assert((int)literal.length() >= min_literal_length);
+    Vector<const LineList*, MemoryDomain::TrigramIndex> postings;
+    const char* data = literal.begin();
+    for (int i = 0, len = (int)literal.length(); i + 2 < len; ++i)
+    {
+        auto it = m_postings.find(trigram_at(data + i));
+        if (it == m_postings.end() or it->value.empty())
+            return {};
+        postings.push_back(&it->value);
+    }
+
+    // walk the shortest posting and check the line against the others
+    std::sort(postings.begin(), postings.end(),
+              [](const LineList* lhs, const LineList* rhs) {
+                  return lhs->size() < rhs->size();
+              });
+    LineList res;
+    for (auto line : *postings.front())
+    {
+        auto contains = [line](const LineList* posting) {
+            return std::binary_search(posting->begin(), posting->end(), line);
+        };
+        if (std::all_of(postings.begin() + 1, postings.end(), contains))
+            res.push_back(line);
+    }
+    return res;
+}
+
+UnitTest test_trigram_index{[]()
+{
+    auto contains = [](const TrigramIndex::LineList& lines, LineCount line) {
+        return std::binary_search(lines.begin(), lines.end(), line);
+    };
+
+    Buffer buffer("test", Buffer::Flags::None,
+                  "salut les amis\n"
+                  "what is up\n"
+                  "salutations\n"
+                  "\n"
+                  "up up and away\n"
+                  "alpha beta\n"
+                  "gamma delta\n"
+                  "epsilon zeta\n");
+    TrigramIndex index(buffer);
+
+    auto res = index.candidate_lines("salut");
+    kak_assert(res.size() == 2 and contains(res, 0_line) and contains(res, 2_line));
+    kak_assert(index.candidate_lines("salutation").size() == 1);
+    kak_assert(index.candidate_lines("goodbye").empty());
+
+    // small modifications take the incremental path
+    buffer.erase({0, 0}, {1, 0});
+    buffer.insert({3, 0}, "salute the\nnewcomers\n");
+    index.update();
+    res = index.candidate_lines("salut");
+    kak_assert(res.size() == 2 and contains(res, 1_line) and contains(res, 3_line));
+    kak_assert(index.candidate_lines("newcomer").size() == 1);
+    kak_assert(index.candidate_lines("amis").empty());
+    res = index.candidate_lines("away");
+    kak_assert(res.size() == 1 and contains(res, 5_line));
+    res = index.candidate_lines("epsilon");
+    kak_assert(res.size() == 1 and contains(res, 8_line));
+}};
+
+}
@@ -0,0 +1,59 @@
+#ifndef trigram_index_hh_INCLUDED
+#define trigram_index_hh_INCLUDED
+
+#include "buffer.hh"
+#include "shared_string.hh"
+#include "hash_map.hh"
+#include "vector.hh"
+
+namespace Kakoune
+{
+
+// Per buffer index from byte trigrams to the sorted list of lines
+// containing them. Searches whose matches have to start with a long
+// enough literal intersect that literal's trigram postings to jump
+// directly to candidate lines instead of rescanning the whole buffer,
+// which makes repeated searches over big buffers cheap. The index is
+// built lazily on first use and kept in sync incrementally from the
+// buffer change history.
+class TrigramIndex
+{
+public:
+    explicit TrigramIndex(const Buffer& buffer);
+    TrigramIndex(TrigramIndex&&) = default;
+    TrigramIndex& operator=(TrigramIndex&&) = default;
+
+    // shortest literal the index can answer for
+    static constexpr int min_literal_length = 3;
+
+    // the index of the given buffer, built on first access
+    static TrigramIndex& get(const Buffer& buffer);
+
+    // bring the index in sync with the buffer content
+    void update();
+
+    using LineList = Vector<LineCount, MemoryDomain::TrigramIndex>;
+
+    // sorted list of the lines containing every trigram of the given
+    // literal; lines not listed cannot contain it, listed lines still
+    // need an actual scan to validate a match
+    LineList candidate_lines(StringView literal) const;
+
+private:
+    using Trigram = uint32_t;
+    using Lines = Vector<StringDataPtr, MemoryDomain::TrigramIndex>;
+    using Postings = HashMap<Trigram, LineList, MemoryDomain::TrigramIndex>;
+
+    void rebuild();
+
+    SafePtr<const Buffer> m_buffer;
+    size_t m_timestamp;
+    // line storage is retained so updates can compute the trigrams of
+    // removed lines without the old buffer content
+    Lines m_lines;
+    Postings m_postings;
+};
+
+}
+
+#endif // trigram_index_hh_INCLUDED
@@ -2,17 +2,72 @@
 
 #include "assert.hh"
 #include "diff.hh"
-#include "utf8.hh"
+#include "hash_map.hh"
+#include "memory.hh"
 #include "string.hh"
+#include "string_utils.hh"
+#include "utf8.hh"
+#include "vector.hh"
 
 namespace Kakoune
 {
 
+UnitTest test_allocation_budget{[]()
+{
+    // short strings stay in place
+    {
+        AllocationCounter counter;
+        String str = "inline";
+        str += "!";
+        kak_assert(counter.count() == 0);
+    }
+
+    // a reserved vector must not reallocate while within capacity
+    {
+        Vector<int> values;
+        values.reserve(16);
+        AllocationCounter counter;
+        for (int i = 0; i < 16; ++i)
+            values.push_back(i);
+        kak_assert(counter.count() == 0);
+    }
+
+    // formatting into a fixed buffer allocates nothing
+    {
+        char buffer[64];
+        AllocationCounter counter;
+        format_to(buffer, "{}:{}", 42, "fixed");
+        kak_assert(counter.count() == 0);
+    }
+
+    // neither does looking up an existing key
+    {
+        HashMap<String, int> map;
+        map.insert({"budget", 1});
+        AllocationCounter counter;
+        kak_assert(map.find(StringView{"budget"}) != map.end());
+        kak_assert(counter.count() == 0);
+    }
+}};
+
 UnitTest test_utf8{[]()
 {
     StringView str = "maïs mélange bientôt";
     kak_assert(utf8::distance(std::begin(str), std::end(str)) == 20);
     kak_assert(utf8::codepoint(std::begin(str) + 2, std::end(str)) == 0x00EF);
+
+    // long enough to hit the word at a time ASCII paths
+    StringView ascii = "this line is plain ASCII from start to finish";
+    kak_assert(utf8::distance(std::begin(ascii), std::end(ascii)) == (int)ascii.length());
+    kak_assert(utf8::column_distance(std::begin(ascii), std::end(ascii)) == (int)ascii.length());
+    kak_assert(utf8::advance(std::begin(ascii), std::end(ascii), 17_char) == std::begin(ascii) + 17);
+    kak_assert(utf8::advance(std::begin(ascii), std::end(ascii), 17_col) == std::begin(ascii) + 17);
+
+    StringView mixed = "ASCII prefix long enough to vectorize — à suivre";
+    kak_assert(utf8::distance(std::begin(mixed), std::end(mixed)) == 48);
+    kak_assert(utf8::column_distance(std::begin(mixed), std::end(mixed)) == 48);
+    kak_assert(utf8::codepoint(utf8::advance(std::begin(mixed), std::end(mixed), 40_char),
+                               std::end(mixed)) == 0x00E0);
 }};
 
 UnitTest test_diff{[]()
@@ -3,6 +3,7 @@
 
 #include "array_view.hh"
 #include "hash_map.hh"
+#include "units.hh"
 
 #include <functional>
 
@@ -62,6 +63,13 @@ public:
                       const Face& default_face,
                       const Face& padding_face) = 0;
 
+    // update only the viewport rows starting at first_row, leaving the
+    // others untouched; lets oversized viewports paint the cursor
+    // vicinity ahead of the full frame
+    virtual void draw_partial(ConstArrayView<DisplayLine> lines,
+                              LineCount first_row,
+                              const Face& default_face) = 0;
+
     virtual void draw_status(const DisplayLine& status_line,
                              const DisplayLine& mode_line,
                              const Face& default_face) = 0;
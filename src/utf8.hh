@@ -6,6 +6,8 @@
 #include "units.hh"
 
 #include <cstddef>
+#include <cstdint>
+#include <cstring>
 
 namespace Kakoune
 {
@@ -13,6 +15,37 @@ namespace Kakoune
 namespace utf8
 {
 
+namespace detail
+{
+
+// word-at-a-time kernels used by the contiguous memory overloads below,
+// text is predominantly ASCII and decoding it byte per byte dominates
+// cursor movement and wrap layout.
+constexpr uint64_t high_bits = 0x8080808080808080ull;
+constexpr uint64_t low_bits  = 0x0101010101010101ull;
+
+inline uint64_t load_word(const char* p) noexcept
+{
+    uint64_t word;
+    std::memcpy(&word, p, sizeof word);
+    return word;
+}
+
+// true if none of the eight bytes starts a multi byte sequence
+inline bool all_ascii(uint64_t word) noexcept
+{
+    return (word & high_bits) == 0;
+}
+
+// true if all eight bytes are single column ASCII, that is ASCII minus
+// NUL whose codepoint_width is zero
+inline bool all_single_column(uint64_t word) noexcept
+{
+    return ((word | ((word - low_bits) & ~word)) & high_bits) == 0;
+}
+
+}
+
 template<typename Iterator>
 [[gnu::always_inline]]
 inline char read(Iterator& it) noexcept { char c = *it; ++it; return c; }
@@ -221,6 +254,28 @@ Iterator advance(Iterator it, const Iterator& end, ColumnCount d) noexcept
     return it;
 }
 
+// contiguous memory overloads, consume ASCII runs a word at a time
+// before falling back on the generic templates
+inline const char* advance(const char* it, const char* end, CharCount d) noexcept
+{
+    while (d >= 8 and it + 8 <= end and detail::all_ascii(detail::load_word(it)))
+    {
+        it += 8;
+        d -= 8;
+    }
+    return advance<const char*>(it, end, d);
+}
+
+inline const char* advance(const char* it, const char* end, ColumnCount d) noexcept
+{
+    while (d >= 8 and it + 8 <= end and detail::all_single_column(detail::load_word(it)))
+    {
+        it += 8;
+        d -= 8;
+    }
+    return advance<const char*>(it, end, d);
+}
+
 // returns the character count between begin and end
 template<typename Iterator>
 CharCount distance(Iterator begin, const Iterator& end) noexcept
@@ -235,6 +290,24 @@ CharCount distance(Iterator begin, const Iterator& end) noexcept
     return dist;
 }
 
+inline CharCount distance(const char* begin, const char* end) noexcept
+{
+    CharCount dist = 0;
+    while (begin != end)
+    {
+        while (begin + 8 <= end and detail::all_ascii(detail::load_word(begin)))
+        {
+            begin += 8;
+            dist += 8;
+        }
+        if (begin == end)
+            break;
+        if (is_character_start(read(begin)))
+            ++dist;
+    }
+    return dist;
+}
+
 // returns the column count between begin and end
 template<typename Iterator>
 ColumnCount column_distance(Iterator begin, const Iterator& end) noexcept
@@ -246,6 +319,23 @@ ColumnCount column_distance(Iterator begin, const Iterator& end) noexcept
     return dist;
 }
 
+inline ColumnCount column_distance(const char* begin, const char* end) noexcept
+{
+    ColumnCount dist = 0;
+    while (begin != end)
+    {
+        while (begin + 8 <= end and detail::all_single_column(detail::load_word(begin)))
+        {
+            begin += 8;
+            dist += 8;
+        }
+        if (begin == end)
+            break;
+        dist += codepoint_width(read_codepoint(begin, end));
+    }
+    return dist;
+}
+
 // returns an iterator to the first byte of the character it is into
 template<typename Iterator>
 Iterator character_start(Iterator it, const Iterator& begin) noexcept
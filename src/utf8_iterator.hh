@@ -36,7 +36,9 @@ public:
 
     iterator& operator++() noexcept
     {
-        utf8::to_next(m_it, m_end);
+        // unqualified so argument dependent lookup can pick up base
+        // iterator specific overloads (see buffer.inl.hh)
+        to_next(m_it, m_end);
         invalidate_value();
         return *this;
     }
@@ -50,7 +52,7 @@ public:
 
     iterator& operator--() noexcept
     {
-        utf8::to_previous(m_it, m_begin);
+        to_previous(m_it, m_begin);
         invalidate_value();
         return *this;
     }
@@ -16,6 +16,9 @@
 namespace Kakoune
 {
 
+static const TypedOptionId<int> tabstop_id{"tabstop"};
+static const TypedOptionId<DisplayCoord> scrolloff_id{"scrolloff"};
+
 // Implementation in highlighters.cc
 void setup_builtin_highlighters(HighlighterGroup& group);
 
@@ -23,7 +26,9 @@ Window::Window(Buffer& buffer)
     : Scope(buffer),
       m_buffer(&buffer),
       m_highlighters{HighlightPass::All},
-      m_builtin_highlighters{HighlightPass::All}
+      m_builtin_highlighters{HighlightPass::All},
+      m_prefetch_timer{TimePoint::max(),
+                       [this](Timer&) { prefetch_highlight(); }}
 {
     run_hook_in_own_context("WinCreate", buffer.name());
 
@@ -114,10 +119,12 @@ const DisplayBuffer& Window::update_display_buffer(const Context& context)
     auto start_time = profile ? Clock::now() : Clock::time_point{};
 
     DisplayBuffer::LineList& lines = m_display_buffer.lines();
-    lines.clear();
 
     if (m_dimensions == DisplayCoord{0,0})
+    {
+        lines.clear();
         return m_display_buffer;
+    }
 
     kak_assert(&buffer() == &context.buffer());
     const DisplaySetup setup = compute_display_setup(context);
@@ -125,7 +132,8 @@ const DisplayBuffer& Window::update_display_buffer(const Context& context)
     m_position = setup.window_pos;
     m_range = setup.window_range;
 
-    const int tabstop = context.options()["tabstop"].get<int>();
+    const int tabstop = context.options().get(tabstop_id);
+    size_t line_count = 0;
     for (LineCount line = 0; line < m_range.line; ++line)
     {
         LineCount buffer_line = m_position.line + line;
@@ -137,9 +145,15 @@ const DisplayBuffer& Window::update_display_buffer(const Context& context)
           : get_byte_to_column(buffer(), tabstop, {buffer_line, m_position.column + m_range.column});
 
         // The display buffer always has at least one buffer atom, which might be empty if
-        // beg_byte == end_byte
-        lines.emplace_back(AtomList{ {buffer(), {buffer_line, beg_byte}, {buffer_line, end_byte}} });
+        // beg_byte == end_byte. Lines from the previous frame are reset rather
+        // than recreated so that highlighting reuses their atom storage.
+        if (line_count < lines.size())
+            lines[line_count].reset({buffer(), {buffer_line, beg_byte}, {buffer_line, end_byte}});
+        else
+            lines.emplace_back(AtomList{ {buffer(), {buffer_line, beg_byte}, {buffer_line, end_byte}} });
+        ++line_count;
     }
+    lines.resize(line_count);
 
     m_display_buffer.compute_range();
     BufferRange range{{0,0}, buffer().end_coord()};
@@ -153,6 +167,11 @@ const DisplayBuffer& Window::update_display_buffer(const Context& context)
 
     m_last_setup = build_setup(context);
 
+    // once the session goes idle, extend the highlighter caches around the
+    // viewport so that scrolling finds them already filled.
+    m_prefetch_timer.set_next_date(Clock::now() + std::chrono::milliseconds{
+        context.options()["idle_timeout"].get<int>()});
+
     if (profile and not (buffer().flags() & Buffer::Flags::Debug))
     {
         using namespace std::chrono;
@@ -182,11 +201,11 @@ void Window::set_dimensions(DisplayCoord dimensions)
 
 DisplaySetup Window::compute_display_setup(const Context& context)
 {
-    DisplayCoord offset = options()["scrolloff"].get<DisplayCoord>();
+    DisplayCoord offset = options().get(scrolloff_id);
     offset.line = std::min(offset.line, (m_dimensions.line + 1) / 2);
     offset.column = std::min(offset.column, (m_dimensions.column + 1) / 2);
 
-    const int tabstop = context.options()["tabstop"].get<int>();
+    const int tabstop = context.options().get(tabstop_id);
     const auto& cursor = context.selections().main().cursor();
 
     // Ensure cursor line is visible
@@ -296,6 +315,39 @@ BufferCoord Window::buffer_coord(DisplayCoord coord) const
                              buffer(), coord.column);
 }
 
+void Window::prefetch_highlight()
+{
+    if (not m_client or not m_client->context().has_window() or
+        &m_client->context().window() != this or
+        &m_client->context().buffer() != &buffer())
+        return;
+
+    const Context& context = m_client->context();
+    const LineCount margin = m_dimensions.line;
+    const BufferRange display_range{
+        {std::max(0_line, m_position.line - margin), 0},
+        {std::min(buffer().line_count(), m_position.line + m_range.line + margin), 0}};
+    const BufferRange range{{0,0}, buffer().end_coord()};
+
+    HighlightTaskList tasks;
+    try
+    {
+        for (auto pass : { HighlightPass::Wrap, HighlightPass::Move, HighlightPass::Colorize })
+        {
+            m_highlighters.fetch(context, pass, display_range, range, tasks);
+            m_builtin_highlighters.fetch(context, pass, display_range, range, tasks);
+        }
+    }
+    catch (runtime_error&)
+    {
+        // tasks queued before the error must still run, highlighters rely
+        // on it to clear their pending state
+    }
+    // prefetching is best effort, the next draw will report errors if they
+    // persist
+    try { run_highlight_tasks(tasks); } catch (runtime_error&) {}
+}
+
 void Window::clear_display_buffer()
 {
     m_display_buffer = DisplayBuffer{};
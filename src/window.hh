@@ -3,6 +3,7 @@
 
 #include "client.hh"
 #include "display_buffer.hh"
+#include "event_manager.hh"
 #include "highlighter_group.hh"
 #include "option_manager.hh"
 #include "optional.hh"
@@ -56,6 +57,8 @@ private:
     void on_option_changed(const Option& option) override;
     DisplaySetup compute_display_setup(const Context& context);
 
+    void prefetch_highlight();
+
     void run_hook_in_own_context(StringView hook_name, StringView param,
                                  String client_name = "");
 
@@ -80,6 +83,8 @@ private:
     };
     Setup build_setup(const Context& context) const;
     Setup m_last_setup;
+
+    Timer m_prefetch_timer;
 };
 
 }
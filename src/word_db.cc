@@ -2,68 +2,98 @@
 
 #include "utils.hh"
 #include "line_modification.hh"
-#include "utf8_iterator.hh"
+#include "utf8.hh"
 #include "unit_tests.hh"
 
+#include <thread>
+
 namespace Kakoune
 {
 
 using WordList = Vector<StringView>;
 
-static WordList get_words(StringView content, ConstArrayView<Codepoint> extra_word_chars)
+struct WordRef
 {
-    WordList res;
-    auto is_word = [&](Codepoint c) {
-        return Kakoune::is_word(c) or contains(extra_word_chars, c);
-    };
-    for (utf8::iterator<const char*> it{content.begin(), content};
-         it != content.end(); ++it)
+    StringView word;
+    UsedLetters letters;
+};
+
+// scans lines for word boundaries; ascii bytes are classified through
+// tables built once per scanner, so the hot loop neither decodes utf8
+// nor calls iswalnum, and the used letters bitmap is accumulated in the
+// same pass. Only bytes with the high bit set take the decoding path.
+struct WordScanner
+{
+    explicit WordScanner(ConstArrayView<Codepoint> extra_word_chars)
+        : extra_word_chars{extra_word_chars}
     {
-        if (is_word(*it))
+        for (Codepoint c = 0; c < 128; ++c)
         {
-            const char* word = it.base(); 
-            while (++it != content.end() and is_word(*it))
-            {}
-            res.emplace_back(word, it.base());
+            is_ascii_word[c] = is_word(c, extra_word_chars);
+            add_used_letter(ascii_letters[c], (char)c);
         }
     }
-    return res;
-}
 
-static ConstArrayView<Codepoint> get_extra_word_chars(const Buffer& buffer)
-{
-    return buffer.options()["extra_word_chars"].get<Vector<Codepoint, MemoryDomain::Options>>();
-}
-
-void WordDB::add_words(StringView line)
-{
-    for (auto& w : get_words(line, get_extra_word_chars(*m_buffer)))
+    Vector<WordRef, MemoryDomain::WordDB> operator()(StringView content) const
     {
-        auto it = m_words.find(w);
-        if (it != m_words.end())
-            ++it->value.refcount;
-        else
+        Vector<WordRef, MemoryDomain::WordDB> res;
+        const char* word_start = nullptr;
+        UsedLetters letters;
+        auto close_word = [&](const char* word_end) {
+            if (word_start)
+                res.push_back({{word_start, word_end}, letters});
+            word_start = nullptr;
+            letters = UsedLetters{};
+        };
+        const char* const end = content.end();
+        for (const char* it = content.begin(); it != end; )
         {
-            auto word = intern(w);
-            auto view = word->strview();
-            m_words.insert({view, {std::move(word), used_letters(view), 1}});
+            const auto byte = (unsigned char)*it;
+            if (byte < 0x80)
+            {
+                if (is_ascii_word[byte])
+                {
+                    if (not word_start)
+                        word_start = it;
+                    letters |= ascii_letters[byte];
+                }
+                else
+                    close_word(it);
+                ++it;
+            }
+            else
+            {
+                const char* char_start = it;
+                const Codepoint cp = utf8::read_codepoint(it, end);
+                if (is_word(cp, extra_word_chars))
+                {
+                    if (not word_start)
+                        word_start = char_start;
+                    for (const char* p = char_start; p != it; ++p)
+                        add_used_letter(letters, *p);
+                }
+                else
+                    close_word(char_start);
+            }
         }
+        close_word(end);
+        return res;
     }
-}
 
-void WordDB::remove_words(StringView line)
+    ConstArrayView<Codepoint> extra_word_chars;
+    bool is_ascii_word[128];
+    UsedLetters ascii_letters[128];
+};
+
+static ConstArrayView<Codepoint> get_extra_word_chars(const Buffer& buffer)
 {
-    for (auto& w : get_words(line, get_extra_word_chars(*m_buffer)))
-    {
-        auto it = m_words.find(w);
-        kak_assert(it != m_words.end() and it->value.refcount > 0);
-        if (--it->value.refcount == 0)
-            m_words.unordered_remove(it->key);
-    }
+    static const TypedOptionId<Vector<Codepoint, MemoryDomain::Options>> extra_word_chars_id{"extra_word_chars"};
+    return buffer.options().get(extra_word_chars_id);
 }
 
 WordDB::WordDB(const Buffer& buffer)
-    : m_buffer{&buffer}
+    : m_buffer{&buffer},
+      m_tracked{not (buffer.flags() & Buffer::Flags::Debug)}
 {
     buffer.options().register_watcher(*this);
     rebuild_db();
@@ -72,6 +102,7 @@ WordDB::WordDB(const Buffer& buffer)
 WordDB::WordDB(WordDB&& other) noexcept
     : m_buffer{std::move(other.m_buffer)},
       m_timestamp{other.m_timestamp},
+      m_tracked{other.m_tracked},
       m_words{std::move(other.m_words)},
       m_lines{std::move(other.m_lines)}
 {
@@ -84,21 +115,102 @@ WordDB::WordDB(WordDB&& other) noexcept
 
 WordDB::~WordDB()
 {
-    if (m_buffer)
-        m_buffer->options().unregister_watcher(*this);
+    if (not m_buffer)
+        return;
+    m_buffer->options().unregister_watcher(*this);
+    if (m_tracked)
+    {
+        auto& global = GlobalWordDB::instance();
+        for (auto& word : m_words)
+            global.remove(word.value.word, m_buffer.get());
+    }
 }
 
 void WordDB::rebuild_db()
 {
     auto& buffer = *m_buffer;
 
+    ++m_generation;
+    if (m_tracked)
+    {
+        auto& global = GlobalWordDB::instance();
+        for (auto& word : m_words)
+            global.remove(word.value.word, m_buffer.get());
+    }
     m_words.clear();
     m_lines.clear();
     m_lines.reserve((int)buffer.line_count());
+    ByteCount total_bytes = 0;
     for (auto line = 0_line, end = buffer.line_count(); line < end; ++line)
     {
         m_lines.push_back(buffer.line_storage(line));
-        add_words(m_lines.back()->strview());
+        total_bytes += m_lines.back()->strview().length();
+    }
+
+    const WordScanner scan{get_extra_word_chars(buffer)};
+
+    // per shard word tables, built on worker threads for big enough
+    // buffers; the workers only read the line storage owned by m_lines
+    // and never touch refcounts, interning and the global index update
+    // stay on the main thread.
+    struct ShardInfo { int count = 0; UsedLetters letters; };
+    using ShardTable = HashMap<StringView, ShardInfo, MemoryDomain::WordDB>;
+    auto scan_range = [&scan](const StringDataPtr* begin, const StringDataPtr* end,
+                              ShardTable& table) {
+        for (auto it = begin; it != end; ++it)
+        {
+            for (auto& ref : scan((*it)->strview()))
+            {
+                auto& info = table[ref.word];
+                ++info.count;
+                info.letters = ref.letters;
+            }
+        }
+    };
+    auto merge_shard = [&](const ShardTable& table) {
+        for (auto& entry : table)
+        {
+            auto it = m_words.find(entry.key);
+            if (it != m_words.end())
+                it->value.refcount += entry.value.count;
+            else
+            {
+                auto word = intern(entry.key);
+                auto view = word->strview();
+                const size_t hash = word->hash();
+                if (m_tracked)
+                    GlobalWordDB::instance().add(word, entry.value.letters, m_buffer.get());
+                m_words.insert({view, {std::move(word), entry.value.letters,
+                                       entry.value.count}}, hash);
+            }
+        }
+    };
+
+    constexpr ByteCount parallel_threshold = 8 * 1024 * 1024;
+    const size_t max_threads = std::thread::hardware_concurrency();
+    if (total_bytes < parallel_threshold or max_threads <= 1)
+    {
+        ShardTable table;
+        scan_range(m_lines.data(), m_lines.data() + m_lines.size(), table);
+        merge_shard(table);
+    }
+    else
+    {
+        const size_t num_chunks = std::min(max_threads, (size_t)16);
+        const size_t per_chunk = (m_lines.size() + num_chunks - 1) / num_chunks;
+        std::vector<ShardTable> partial(num_chunks);
+        std::vector<std::thread> threads;
+        for (size_t i = 0; i < num_chunks; ++i)
+        {
+            const StringDataPtr* begin = m_lines.data() + std::min(i * per_chunk, m_lines.size());
+            const StringDataPtr* end = m_lines.data() + std::min((i+1) * per_chunk, m_lines.size());
+            threads.emplace_back([=, &partial]{ scan_range(begin, end, partial[i]); });
+        }
+        for (auto& thread : threads)
+            thread.join();
+
+        for (auto& table : partial)
+            merge_shard(table);
     }
     m_timestamp = buffer.timestamp();
 }
@@ -113,9 +225,25 @@ void WordDB::update_db()
     if (modifs.empty())
         return;
 
+    ++m_generation;
     Lines new_lines;
     new_lines.reserve((int)buffer.line_count());
 
+    // accumulate the net occurence change of every word over the whole
+    // modification set; bulk edits mostly re-add the words of the lines
+    // they remove, and those cancel out before ever touching m_words
+    struct Delta { int count = 0; UsedLetters letters; };
+    HashMap<StringView, Delta, MemoryDomain::WordDB> deltas;
+    const WordScanner scan{get_extra_word_chars(buffer)};
+    auto count_words = [&](StringView line, int sign) {
+        for (auto& ref : scan(line))
+        {
+            auto& delta = deltas[ref.word];
+            delta.count += sign;
+            delta.letters = ref.letters;
+        }
+    };
+
     auto old_line = 0_line;
     for (auto& modif : modifs)
     {
@@ -130,18 +258,48 @@ void WordDB::update_db()
         while (old_line < modif.old_line + modif.num_removed)
         {
             kak_assert(old_line < m_lines.size());
-            remove_words(m_lines[(int)old_line++]->strview());
+            count_words(m_lines[(int)old_line++]->strview(), -1);
         }
 
         for (auto l = 0_line; l < modif.num_added; ++l)
         {
             new_lines.push_back(buffer.line_storage(modif.new_line + l));
-            add_words(new_lines.back()->strview());
+            count_words(new_lines.back()->strview(), +1);
         }
     }
     while (old_line != (int)m_lines.size())
         new_lines.push_back(std::move(m_lines[(int)old_line++]));
 
+    // the views in deltas point either into the removed lines, still owned
+    // by m_lines at this point, or into new_lines; apply before replacing
+    for (auto& delta : deltas)
+    {
+        if (delta.value.count == 0)
+            continue;
+        auto it = m_words.find(delta.key);
+        if (it != m_words.end())
+        {
+            kak_assert(it->value.refcount + delta.value.count >= 0);
+            if ((it->value.refcount += delta.value.count) == 0)
+            {
+                const size_t hash = it->value.word->hash();
+                if (m_tracked)
+                    GlobalWordDB::instance().remove(it->value.word, m_buffer.get());
+                m_words.unordered_remove(it->key, hash);
+            }
+        }
+        else
+        {
+            kak_assert(delta.value.count > 0);
+            auto word = intern(delta.key);
+            auto view = word->strview();
+            const size_t hash = word->hash();
+            if (m_tracked)
+                GlobalWordDB::instance().add(word, delta.value.letters, m_buffer.get());
+            m_words.insert({view, {std::move(word), delta.value.letters, delta.value.count}}, hash);
+        }
+    }
+
     m_lines = std::move(new_lines);
 }
 
@@ -162,14 +320,101 @@ int WordDB::get_word_occurences(StringView word) const
 RankedMatchList WordDB::find_matching(StringView query)
 {
     update_db();
-    const UsedLetters letters = used_letters(query);
+
     RankedMatchList res;
-    for (auto&& word : m_words)
+    // an extended query can only match a subset of what the previous one
+    // did; re-rank the previous matches instead of scanning every word
+    if (m_cache_generation == m_generation and
+        prefix_match(query, m_cached_query))
+    {
+        for (auto& previous : m_cached_matches)
+        {
+            if (RankedMatch match{previous.candidate(), query})
+                res.push_back(match);
+        }
+    }
+    else
+    {
+        const UsedLetters letters = used_letters(query);
+        for (auto&& word : m_words)
+        {
+            if (RankedMatch match{word.key, word.value.letters, query, letters})
+                res.push_back(match);
+        }
+    }
+
+    m_cache_generation = m_generation;
+    m_cached_query = query.str();
+    m_cached_matches.assign(res.begin(), res.end());
+    return res;
+}
+
+GlobalWordDB& GlobalWordDB::instance()
+{
+    // function local so that the index outlives the per buffer databases
+    // feeding it, whenever they get destroyed
+    static GlobalWordDB global;
+    return global;
+}
+
+void GlobalWordDB::add(const StringDataPtr& word, UsedLetters letters, const Buffer* buffer)
+{
+    ++m_generation;
+    const size_t hash = word->hash();
+    auto it = m_words.find(word->strview(), hash);
+    if (it != m_words.end())
+        it->value.buffers.push_back(buffer);
+    else
+        m_words.insert({word->strview(), {word, letters, {buffer}}}, hash);
+}
+
+void GlobalWordDB::remove(const StringDataPtr& word, const Buffer* buffer)
+{
+    ++m_generation;
+    const size_t hash = word->hash();
+    auto it = m_words.find(word->strview(), hash);
+    kak_assert(it != m_words.end());
+    auto& buffers = it->value.buffers;
+    auto buf_it = std::find(buffers.begin(), buffers.end(), buffer);
+    kak_assert(buf_it != buffers.end());
+    buffers.erase(buf_it);
+    if (buffers.empty())
+        m_words.unordered_remove(it->key, hash);
+}
+
+Vector<GlobalWordDB::Match> GlobalWordDB::find_matching(StringView query, const Buffer* exclude)
+{
+    Vector<Match> res;
+    if (m_cache_generation == m_generation and m_cached_exclude == exclude and
+        prefix_match(query, m_cached_query))
+    {
+        for (auto& previous : m_cached_matches)
+        {
+            if (RankedMatch match{previous.match.candidate(), query})
+                res.push_back({match, previous.buffer});
+        }
+    }
+    else
     {
-        if (RankedMatch match{word.key, word.value.letters, query, letters})
-            res.push_back(match);
+        const UsedLetters letters = used_letters(query);
+        for (auto&& word : m_words)
+        {
+            // attribute the match to a buffer other than the excluded one,
+            // skipping words it is the only user of
+            auto& buffers = word.value.buffers;
+            auto it = std::find_if(buffers.begin(), buffers.end(),
+                                   [exclude](const Buffer* buf) { return buf != exclude; });
+            if (it == buffers.end())
+                continue;
+            if (RankedMatch match{word.key, word.value.letters, query, letters})
+                res.push_back({match, *it});
+        }
     }
 
+    m_cache_generation = m_generation;
+    m_cached_exclude = exclude;
+    m_cached_query = query.str();
+    m_cached_matches.assign(res.begin(), res.end());
     return res;
 }
 
@@ -207,6 +452,54 @@ UnitTest test_word_db{[]()
     res = word_db.find_matching("");
     std::sort(res.begin(), res.end(), cmp_words);
     kak_assert(eq(res, WordList{ "allo", "mutch", "retchou", "tchou" }));
+    // extending the query re-ranks the cached matches
+    res = word_db.find_matching("tch");
+    std::sort(res.begin(), res.end(), cmp_words);
+    kak_assert(eq(res, WordList{ "mutch", "retchou", "tchou" }));
+    res = word_db.find_matching("tcho");
+    std::sort(res.begin(), res.end(), cmp_words);
+    kak_assert(eq(res, WordList{ "retchou", "tchou" }));
+    // shrinking it falls back to a full scan
+    res = word_db.find_matching("ou");
+    std::sort(res.begin(), res.end(), cmp_words);
+    kak_assert(eq(res, WordList{ "retchou", "tchou" }));
+}};
+
+UnitTest test_global_word_db{[]()
+{
+    Buffer buffer1("test1", Buffer::Flags::None, "tchou mutch\n");
+    Buffer buffer2("test2", Buffer::Flags::None, "tchou kanaky\n");
+    WordDB db1(buffer1);
+    WordDB db2(buffer2);
+
+    auto& global = GlobalWordDB::instance();
+    auto found = [](const Vector<GlobalWordDB::Match>& matches,
+                    StringView word, const Buffer* buffer) {
+        for (auto& m : matches)
+        {
+            if (m.match.candidate() == word)
+                return buffer == nullptr or m.buffer == buffer;
+        }
+        return false;
+    };
+
+    auto res = global.find_matching("");
+    kak_assert(found(res, "tchou", nullptr));
+    kak_assert(found(res, "mutch", &buffer1));
+    kak_assert(found(res, "kanaky", &buffer2));
+
+    // excluding a buffer hides its private words but keeps shared ones,
+    // attributed to another user
+    res = global.find_matching("", &buffer1);
+    kak_assert(found(res, "tchou", &buffer2));
+    kak_assert(not found(res, "mutch", nullptr));
+    kak_assert(found(res, "kanaky", &buffer2));
+
+    // buffer changes are reflected after an update
+    buffer2.insert({1, 0}, "foobar\n");
+    db2.update_db();
+    res = global.find_matching("", &buffer1);
+    kak_assert(found(res, "foobar", &buffer2));
 }};
 
 }
@@ -24,10 +24,11 @@ public:
     RankedMatchList find_matching(StringView str);
 
     int get_word_occurences(StringView word) const;
-private:
+
+    // bring the database in sync with the buffer content, feeding any
+    // word changes into the global index
     void update_db();
-    void add_words(StringView line);
-    void remove_words(StringView line);
+private:
 
     void rebuild_db();
 
@@ -44,8 +45,59 @@ private:
 
     SafePtr<const Buffer> m_buffer;
     size_t m_timestamp;
+    bool m_tracked;
     WordToInfo m_words;
     Lines m_lines;
+
+    // find_matching caches its last result so that a query extended by
+    // more characters only needs to re-rank the surviving matches; any
+    // change to the word map invalidates the cache through m_generation
+    size_t m_generation = 0;
+    size_t m_cache_generation = (size_t)-1;
+    String m_cached_query;
+    RankedMatchList m_cached_matches;
+};
+
+// session wide word index aggregated incrementally from every buffer
+// WordDB; words are refcounted across buffers and share their interned
+// storage, so completing against all buffers is a single map scan
+// instead of one per buffer. Callers are responsible for bringing the
+// relevant WordDBs in sync with WordDB::update_db beforehand.
+class GlobalWordDB
+{
+public:
+    static GlobalWordDB& instance();
+
+    struct Match
+    {
+        RankedMatch match;
+        const Buffer* buffer; // one of the buffers using the word
+    };
+
+    // words used only by exclude are not reported, they are expected to
+    // be covered by that buffer's own WordDB
+    Vector<Match> find_matching(StringView query, const Buffer* exclude = nullptr);
+
+private:
+    friend class WordDB;
+    void add(const StringDataPtr& word, UsedLetters letters, const Buffer* buffer);
+    void remove(const StringDataPtr& word, const Buffer* buffer);
+
+    struct WordInfo
+    {
+        StringDataPtr word;
+        UsedLetters letters;
+        Vector<const Buffer*, MemoryDomain::WordDB> buffers;
+    };
+    HashMap<StringView, WordInfo, MemoryDomain::WordDB> m_words;
+
+    // same incremental cache as WordDB::find_matching, additionally
+    // keyed on the excluded buffer
+    size_t m_generation = 0;
+    size_t m_cache_generation = (size_t)-1;
+    const Buffer* m_cached_exclude = nullptr;
+    String m_cached_query;
+    Vector<Match> m_cached_matches;
 };
 
 }